@@ -444,6 +444,94 @@ $(TESTS): %.txt: %.cfg tools/bin/simulator
 schedsim-check: $(wildcard $(SRCDIR)/tools/schedsim/*.cfg)
 	for f in $^; do tools/bin/simulator $$f $(RUNTIME) | diff -q - `dirname $$f`/`basename $$f .cfg`.txt || exit 1; done
 
+# Host benchmarks: library and driver code built for the build machine
+# against the stand-in headers in tools/hoststubs. "make hostbench" builds
+# them all into tools/bin; each prints its results when run.
+HOST_CC ?= gcc
+HOSTBENCH_CFLAGS = -std=gnu99 -O2 -Wall -Wextra \
+	-I$(SRCDIR)/tools/hoststubs -idirafter $(SRCDIR)/include
+HOSTBENCH_LWIP_CFLAGS = $(HOSTBENCH_CFLAGS) -idirafter $(SRCDIR)/include/ipv4
+
+HOSTBENCHES = \
+	tools/bin/filterbench \
+	tools/bin/chksumbench \
+	tools/bin/nfsbench \
+	tools/bin/mempbench \
+	tools/bin/sockbench \
+	tools/bin/mmchsmodel \
+	tools/bin/bcachebench \
+	tools/bin/fatbench
+
+BFDMUX_HOST_SRCS = $(addprefix $(SRCDIR)/lib/, \
+	bfdmuxvm/vm.c bfdmuxvm/classifier.c \
+	bfdmuxtools/codegen.c bfdmuxtools/opdefs.c bfdmuxtools/tools.c)
+
+LWIP_HOST_SRCS = $(addprefix $(SRCDIR)/lib/lwip/src/, \
+	core/mem.c core/memp.c core/netif.c core/pbuf.c core/raw.c \
+	core/stats.c core/sys.c core/tcp.c core/tcp_in.c core/tcp_out.c \
+	core/udp.c core/dhcp.c core/dns.c \
+	core/ipv4/autoip.c core/ipv4/icmp.c core/ipv4/igmp.c core/ipv4/inet.c \
+	core/ipv4/inet_chksum.c core/ipv4/ip.c core/ipv4/ip_addr.c \
+	core/ipv4/ip_frag.c \
+	api/api_lib.c api/api_msg.c api/err.c api/netbuf.c api/netdb.c \
+	api/netifapi.c api/sockets.c api/tcpip.c \
+	netif/loopif.c netif/etharp.c sys_arch.c)
+
+# The FAT and MMCHS register layouts come from mackerel
+FATBENCH_DEVS = $(addprefix armv7/include/dev/, \
+	fat_bpb_dev.h fat32_ebpb_dev.h fat_direntry_dev.h)
+MMCHSMODEL_DEVS = $(addprefix armv7/include/dev/omap/, \
+	omap44xx_mmchs1_dev.h omap44xx_sysctrl_padconf_core_dev.h)
+
+hostbench: $(HOSTBENCHES)
+.PHONY: hostbench
+
+tools/bin/filterbench: $(SRCDIR)/tools/filterbench/filterbench.c \
+		$(BFDMUX_HOST_SRCS)
+	@mkdir -p $(@D)
+	$(HOST_CC) $(HOSTBENCH_CFLAGS) -I$(SRCDIR)/lib/bfdmuxtools -o $@ $^
+
+tools/bin/chksumbench: $(SRCDIR)/tools/chksumbench/chksumbench.c \
+		$(SRCDIR)/lib/lwip/src/core/ipv4/inet_chksum.c
+	@mkdir -p $(@D)
+	$(HOST_CC) $(HOSTBENCH_LWIP_CFLAGS) -o $@ $^
+
+tools/bin/nfsbench: $(SRCDIR)/tools/nfsbench/nfsbench.c \
+		$(addprefix $(SRCDIR)/lib/nfs/, \
+			nfs_file.c xdr.c nfs_xdr.c xdr_pbuf.c)
+	@mkdir -p $(@D)
+	$(HOST_CC) $(HOSTBENCH_LWIP_CFLAGS) -o $@ $^
+
+tools/bin/mempbench: $(SRCDIR)/tools/mempbench/mempbench.c \
+		$(SRCDIR)/lib/lwip/src/core/memp.c \
+		$(SRCDIR)/lib/lwip/src/core/stats.c
+	@mkdir -p $(@D)
+	$(HOST_CC) $(HOSTBENCH_LWIP_CFLAGS) -pthread -o $@ $^
+
+tools/bin/sockbench: $(SRCDIR)/tools/sockbench/sockbench.c \
+		$(LWIP_HOST_SRCS) $(SRCDIR)/lib/contmng/netbench.c
+	@mkdir -p $(@D)
+	$(HOST_CC) $(HOSTBENCH_LWIP_CFLAGS) -pthread -o $@ $^
+
+tools/bin/mmchsmodel: $(SRCDIR)/tools/mmchsmodel/mmchsmodel.c \
+		$(SRCDIR)/tools/mmchsmodel/mmchs_model.c \
+		$(SRCDIR)/usr/mmchs_driver/mmchs.c | $(MMCHSMODEL_DEVS)
+	@mkdir -p $(@D)
+	$(HOST_CC) $(HOSTBENCH_CFLAGS) -DMACKEREL_HOST_MODEL -I./armv7/include \
+		-o $@ $^
+
+tools/bin/bcachebench: $(SRCDIR)/tools/bcachebench/bcachebench.c \
+		$(SRCDIR)/usr/mmchs_driver/blockcache.c \
+		$(SRCDIR)/usr/mmchs_driver/elevator.c
+	@mkdir -p $(@D)
+	$(HOST_CC) $(HOSTBENCH_CFLAGS) -o $@ $^
+
+tools/bin/fatbench: $(SRCDIR)/tools/fatbench/fatbench.c \
+		$(addprefix $(SRCDIR)/usr/mmchs_driver/, \
+			fat.c blockcache.c elevator.c) | $(FATBENCH_DEVS)
+	@mkdir -p $(@D)
+	$(HOST_CC) $(HOSTBENCH_CFLAGS) -I./armv7/include -o $@ $^
+
 
 #######################################################################
 #
@@ -461,7 +549,10 @@ PANDABOARD_MODULES=\
 	armv7/sbin/memeater \
 	armv7/sbin/hello \
 	armv7/sbin/spawnd \
-	armv7/sbin/shell
+	armv7/sbin/shell \
+	armv7/sbin/threadbench \
+	armv7/sbin/lockbench \
+	armv7/sbin/pipebench
 
 menu.lst.pandaboard: $(SRCDIR)/hake/menu.lst.pandaboard
 	cp $< $@
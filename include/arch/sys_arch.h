@@ -21,11 +21,15 @@ typedef struct thread_wrapper *sys_thread_t;
 
 typedef struct thread_sem *sys_sem_t;
 
+/// Bounded queue of messages, the size given to sys_mbox_new()
 struct bf_sys_mbox {
-    void *msg;
-    bool empty;
+    int size;                       ///< Capacity of #msgs
+    int first;                      ///< Index of the oldest message
+    int count;                      ///< Number of queued messages
     struct thread_mutex mutex;
-    struct thread_cond changed_cond;
+    struct thread_cond not_empty;   ///< Signalled when a message is posted
+    struct thread_cond not_full;    ///< Signalled when a message is fetched
+    void *msgs[];
 };
 typedef struct bf_sys_mbox * sys_mbox_t;
 
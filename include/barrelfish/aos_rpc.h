@@ -24,6 +24,48 @@
 
 #define AOS_RPC_MSGBUF_LEN 256 
 
+/// Default reply deadline for a new channel in microseconds (0: wait forever)
+#define AOS_RPC_DEFAULT_TIMEOUT 10000000
+
+/// Bytes of serial data carried by one SERIAL_WRITE or SERIAL_READ_LINE message
+#define AOS_RPC_SERIAL_CHUNK (7 * sizeof(uintptr_t))
+
+/// Set in the length of a SERIAL_READ_LINE reply that ends the line
+#define AOS_RPC_SERIAL_EOL (1u << 31)
+
+/// Size of the frame a client shares with the file server for its data
+#define AOS_RPC_FS_BULK_SIZE (64 * 1024)
+
+/// Longest path the file server accepts, including the terminating NUL
+#define AOS_RPC_FS_PATH_MAX 1024
+
+/// Files a client can have open at the same time
+#define AOS_RPC_FS_MAX_FDS 32
+
+/// Buckets of the pid tables of init and spawnd
+#define AOS_RPC_MAX_DOMAINS 256
+
+/// Process name words per PROCESS_GET_ALL message
+#define AOS_RPC_PS_NAME_WORDS 6
+#define AOS_RPC_PS_NAME_LEN (AOS_RPC_PS_NAME_WORDS * sizeof(uintptr_t))
+
+/// Set in the remaining count of a PROCESS_GET_ALL reply that failed, the
+/// pid word carries the error then
+#define AOS_RPC_PS_FAILED ((uintptr_t)-1)
+
+/// The code word of a call carries its sequence number in the upper half,
+/// every message of the reply echoes it. 0 tags messages that are no reply.
+#define AOS_RPC_SEQ_SHIFT 16
+#define AOS_RPC_CODE_MASK ((1u << AOS_RPC_SEQ_SHIFT) - 1)
+#define AOS_RPC_TAG(code, seq) \
+    ((uint32_t)(code) | ((uint32_t)(seq) << AOS_RPC_SEQ_SHIFT))
+
+/// One process of aos_rpc_process_get_all()
+struct aos_ps_entry {
+    domainid_t pid;
+    char name[AOS_RPC_PS_NAME_LEN]; ///< Truncated, always terminated
+};
+
 enum rpc_code {
     REGISTER_CHANNEL,
     SPAWND_READY,
@@ -35,9 +77,21 @@ enum rpc_code {
     PROCESS_SPAWN,
     PROCESS_GET_NAME,
     PROCESS_GET_NO_OF_PIDS,
-    PROCESS_GET_PID,
+    PROCESS_GET_ALL,
     PROCESS_TO_FOREGROUND,
     PROCESS_TO_BACKGROUND,
+    SERIAL_WRITE,
+    SERIAL_READ_LINE,
+    FS_REGISTER,
+    FS_CONNECT,
+    FS_SHARE_FRAME,
+    FS_OPEN,
+    FS_CREATE,
+    FS_READ,
+    FS_WRITE,
+    FS_CLOSE,
+    FS_READDIR,
+    FS_DELETE,
 };
 
 enum lock_code {
@@ -49,11 +103,19 @@ enum lock_code {
   
 typedef uint32_t my_pid_t;
 
+/// Channels of struct aos_rpc that calls are made on
+enum aos_rpc_chan {
+    AOS_RPC_INIT,
+    AOS_RPC_SPAWND,
+    AOS_RPC_FS,
+    AOS_RPC_CHANS
+};
+
+struct aos_rpc_call;
+
 struct aos_rpc {
     struct lmp_chan init_lc;
     struct lmp_chan spawnd_lc;
-    struct capref return_cap; 
-    size_t ret_bits;
     char msg_buf[AOS_RPC_MSGBUF_LEN];
     size_t char_count;
     bool wait_event;
@@ -61,8 +123,35 @@ struct aos_rpc {
 
     coreid_t coreid;
 
+    delayus_t timeout; ///< Reply deadline per call in us, 0 waits forever
+    uint16_t seq[AOS_RPC_CHANS];                ///< Of the last call made
+    struct aos_rpc_call *calls[AOS_RPC_CHANS];  ///< Waiting for their reply
+
+    uint32_t serial_reply; ///< Length and EOL flag of the last line read
+
+    // file server, connected by the first file call
+    struct lmp_chan fs_lc;
+    void *fs_bulk;          ///< Frame shared with the file server
+    uintptr_t fs_ret[2];    ///< Of the last reply
+    uint16_t fs_stale;      ///< Call given up on, the server may still use
+                            ///< the frame for it
+
+    // process list being received by aos_rpc_process_get_all()
+    struct aos_ps_entry *ps_list;
+    size_t ps_len;
+    size_t ps_count;
+
 }local_rpc;
 
+/**
+ * \brief set the time to wait for each reply on the given channel
+ * \arg timeout deadline in microseconds, 0 to wait forever. Calls that miss
+ * it fail with AOS_ERR_RPC_TIMEOUT. The channel stays usable: a late reply
+ * carries the sequence number of the call that gave up on it and is dropped.
+ * Serial reads wait for input and have no deadline.
+ */
+void aos_rpc_set_timeout(struct aos_rpc *chan, delayus_t timeout);
+
 /**
  * \brief send a string over the given channel
  */
@@ -85,6 +174,23 @@ errval_t aos_rpc_serial_getchar(struct aos_rpc *chan, char *retc);
  */
 errval_t aos_rpc_serial_putchar(struct aos_rpc *chan, char c);
 
+/**
+ * \brief write a buffer to the serial port
+ * Sent AOS_RPC_SERIAL_CHUNK bytes per message without waiting for replies;
+ * the serial server translates LF to CRLF.
+ */
+errval_t aos_rpc_serial_write(struct aos_rpc *chan, const char *buf,
+                              size_t len);
+
+/**
+ * \brief read input from the serial port a line at a time
+ * \arg buf receives up to len bytes of the next line entered on the
+ * console, including the terminating newline if it fits
+ * \arg retlen the number of bytes stored in `buf'
+ */
+errval_t aos_rpc_serial_read(struct aos_rpc *chan, char *buf, size_t len,
+                             size_t *retlen);
+
 /**
  * \brief Request device memory capability from memory server.
  */
@@ -111,6 +217,24 @@ errval_t aos_rpc_process_spawn(struct aos_rpc *chan, char *name,
 errval_t aos_rpc_process_get_name(struct aos_rpc *chan, domainid_t pid,
                                   char **name);
 
+/**
+ * \brief Get the number of running processes
+ *
+ * A single round trip to the process manager.
+ */
+errval_t aos_rpc_process_get_no_of_pids(struct aos_rpc *chan,
+                                        size_t *pid_count);
+
+/**
+ * \brief Get the ids and names of all running processes
+ * \arg ps An array of \p count entries, allocated by the rpc implementation.
+ * Freeing is the caller's responsibility.
+ *
+ * One request, spawnd streams one message per process back.
+ */
+errval_t aos_rpc_process_get_all(struct aos_rpc *chan,
+                                 struct aos_ps_entry **ps, size_t *count);
+
 /**
  * \brief Get process ids of all running processes
  * \arg pids An array containing the process ids of all currently active
@@ -129,6 +253,14 @@ errval_t aos_rpc_process_get_all_pids(struct aos_rpc *chan,
  */
 errval_t aos_rpc_open(struct aos_rpc *chan, char *path, int *fd);
 
+/**
+ * \brief open a file, like aos_rpc_open(), and get its version
+ * \arg version changes whenever the file is written, deleted or created
+ * again, so data kept from an earlier open is current if it matches
+ */
+errval_t aos_rpc_open_version(struct aos_rpc *chan, char *path, int *fd,
+                              uint32_t *version);
+
 #define MAXNAMELEN 255
 struct aos_dirent {
     /// name of the directory entry
@@ -162,6 +294,17 @@ errval_t aos_rpc_readdir(struct aos_rpc *chan, char* path,
 errval_t aos_rpc_read(struct aos_rpc *chan, int fd, size_t position, size_t size,
                       void** buf, size_t *buflen);
 
+/**
+ * \brief read from an open file into a buffer of the caller
+ * Like aos_rpc_read(), but does not allocate, so it can be used by the page
+ * fault handler.
+ * \arg buf the buffer, at least `size' bytes
+ * \arg buflen the amount of bytes read, less than `size' only at the end of
+ * the file
+ */
+errval_t aos_rpc_read_into(struct aos_rpc *chan, int fd, size_t position,
+                           size_t size, void *buf, size_t *buflen);
+
 /**
  * \brief close an open file
  * \arg fd the file descriptor returned by a previous call to open
@@ -204,10 +347,33 @@ errval_t aos_setup_channel(struct lmp_chan *lc, struct capref remote_cap,
 // TODO document
 errval_t aos_retrieve_msg(struct lmp_chan *lc, struct capref *remote_cap,
                            uint32_t *rpc_code, struct lmp_recv_msg *msg);
+
+/**
+ * \brief like aos_retrieve_msg(), but split the code word
+ * \arg seq the sequence number the message is tagged with, see AOS_RPC_TAG
+ */
+errval_t aos_retrieve_tagged_msg(struct lmp_chan *lc, struct capref *remote_cap,
+                                 uint32_t *rpc_code, uint16_t *seq,
+                                 struct lmp_recv_msg *msg);
                            
 // TODO document
 errval_t aos_chan_send_string(struct lmp_chan *lc, const char *string);
 
+/**
+ * \brief send a string as part of the reply to the call tagged \p seq
+ */
+errval_t aos_chan_send_tagged_string(struct lmp_chan *lc, const char *string,
+                                     uint16_t seq);
+
+/**
+ * \brief handle a message from init on chan->init_lc
+ * For domains that receive on the channel themselves, like spawnd. Replies
+ * to calls that have given up are dropped, caps they carry are deleted.
+ * \return false if \p code is none of the replies init sends to clients
+ */
+bool aos_rpc_init_reply(struct aos_rpc *chan, uint32_t code, uint16_t seq,
+                        struct lmp_recv_msg *msg, struct capref cap);
+
 /**
  * \brief Initialize given rpc channel.
  * TODO: you may want to change the inteface of your init function
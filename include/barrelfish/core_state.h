@@ -19,6 +19,17 @@
 #include <barrelfish/paging.h>
 #include <barrelfish/waitset.h>
 
+/// Smallest block (in Header units, including the header) kept in the cache
+#define MALLOC_CACHE_MIN_UNITS  2
+/// Number of exact-size classes cached per dispatcher
+#define MALLOC_CACHE_CLASSES    16
+/// Maximum number of blocks cached per size class
+#define MALLOC_CACHE_DEPTH      64
+/// Number of blocks freed for another dispatcher before handing them back
+#define MALLOC_REMOTE_BATCH     32
+/// Cache operations after which a partial batch is handed back anyway
+#define MALLOC_REMOTE_MAX_AGE   256
+
 struct morecore_state {
     struct thread_mutex mutex;
     Header header_base;
@@ -27,6 +38,17 @@ struct morecore_state {
     struct paging_region region;
     // for "static" morecore (see lib/barrelfish/static_morecore.c)
     char *freep;
+
+    // per-dispatcher cache of small free blocks, only used while disabled
+    Header *cache[MALLOC_CACHE_CLASSES];
+    unsigned cache_count[MALLOC_CACHE_CLASSES];
+    // blocks freed here on behalf of another dispatcher, not yet returned
+    struct morecore_state *remote_owner;
+    Header *remote_batch, *remote_tail;
+    unsigned remote_count;
+    unsigned remote_age;        ///< Cache operations since the batch began
+    // blocks returned by other dispatchers, drained under the mutex
+    Header * volatile remote_free;
 };
 
 struct ram_alloc_state {
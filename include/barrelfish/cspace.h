@@ -27,6 +27,8 @@
 /* Custom CNodes */
 #define TASKCN_SLOT_PARENTEP    (TASKCN_SLOTS_USER+3)   ///< Endpoint to parent
 #define TASKCN_SLOT_SPAWNDEP    (TASKCN_SLOTS_USER+4)   ///< End Point to spawnd
+#define TASKCN_SLOT_STDIN       (TASKCN_SLOTS_USER+5)   ///< Pipe frame read as stdin
+#define TASKCN_SLOT_STDOUT      (TASKCN_SLOTS_USER+6)   ///< Pipe frame written as stdout
 
 // taskcn appears at the beginning of cspace, so the cptrs match the slot numbers
 #define CPTR_ROOTCN     TASKCN_SLOT_ROOTCN      ///< Cptr to init's root CNode
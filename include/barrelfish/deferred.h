@@ -22,7 +22,8 @@ __BEGIN_DECLS
 
 struct deferred_event {
     struct waitset_chanstate waitset_state; ///< Waitset state
-    struct deferred_event *next, *prev; ///< Next/prev in dispatcher queue
+    struct deferred_event *next, *prev; ///< Next/prev in timer wheel slot
+    struct deferred_event **slot;       ///< Timer wheel slot, NULL if not queued
     systime_t time;                     ///< System time for event
 };
 
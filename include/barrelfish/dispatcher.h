@@ -23,6 +23,19 @@
 struct lmp_chan;
 struct deferred_event;
 
+/// Timer wheel geometry: 4 levels of 64 slots, 1 tick = 1 systime unit
+#define DEFERRED_WHEEL_BITS     6
+#define DEFERRED_WHEEL_SLOTS    (1 << DEFERRED_WHEEL_BITS)
+#define DEFERRED_WHEEL_LEVELS   4
+
+/// Hierarchical timer wheel holding the deferred events of a dispatcher
+struct deferred_wheel {
+    struct deferred_event *slots[DEFERRED_WHEEL_LEVELS][DEFERRED_WHEEL_SLOTS];
+    uint64_t occupied[DEFERRED_WHEEL_LEVELS]; ///< Bitmap of non-empty slots
+    systime_t now;      ///< Last tick processed
+    size_t count;       ///< Number of queued events
+};
+
 // Architecture generic user only dispatcher struct
 struct dispatcher_generic {
     /// stack for traps and disabled pagefaults
@@ -33,9 +46,15 @@ struct dispatcher_generic {
     /// Currently-running (or last-run) thread, if any
     struct thread *current;
 
-    /// Thread run queue (all threads eligible to be run)
+    /// Thread run queue (all threads eligible to be run), by priority
     struct thread *runq;
 
+    /// Last thread of each priority band in the run queue
+    struct thread *runq_tail[THREAD_PRIORITY_LEVELS];
+
+    /// Bitmap of non-empty priority bands in the run queue
+    uint32_t runq_levels;
+
     /// Cap to this dispatcher, used for creating new endpoints
     struct capref dcb_cap;
 
@@ -50,8 +69,8 @@ struct dispatcher_generic {
     struct heap lmp_endpoint_heap;
 #endif // CONFIG_INTERCONNECT_DRIVER_LMP
 
-    /// Queue of deferred events (i.e. timers)
-    struct deferred_event *deferred_events;
+    /// Deferred events (i.e. timers)
+    struct deferred_wheel deferred_wheel;
 
     /// The core the dispatcher is running on
     coreid_t core_id;
@@ -67,6 +86,10 @@ struct dispatcher_generic {
     struct thread *cleanupthread;
     struct thread_mutex cleanupthread_lock;
 
+    /// Exited threads (TCB and stack) kept for reuse by thread_create()
+    struct thread *free_threads;
+    size_t free_threads_count;
+
     /// Last FPU-using thread
     struct thread *fpu_thread;
 
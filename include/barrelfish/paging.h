@@ -48,7 +48,14 @@ typedef int paging_flags_t;
     (VREGION_FLAGS_READ | VREGION_FLAGS_WRITE | VREGION_FLAGS_MPB)
 
 #define ENTRIES_PER_FRAME 16
+
+/// File-backed regions are paged in chunks of this size
+#define PAGING_CHUNK_SIZE (ENTRIES_PER_FRAME * BASE_PAGE_SIZE)
+/// Most chunks read ahead of sequential faults in a file-backed region
+#define PAGING_FILE_READ_AHEAD 8
         
+struct paging_region;
+
 struct node {
     lvaddr_t addr;
     long long unsigned max_size;
@@ -69,6 +76,7 @@ struct paging_state {
     // struct capref *next_frame;
     // struct capref guard_cap;
     struct aos_rpc *rpc;
+    struct paging_region *file_regions;     ///< Paged by the file pager
 };
 
 struct thread;
@@ -87,15 +95,36 @@ errval_t paging_init(void);
 /// setup paging on new thread (used for user-level threads)
 void paging_init_onthread(struct thread *t);
 
+struct paging_file;
+
 struct paging_region {
     lvaddr_t base_addr;
     lvaddr_t current_addr;
     size_t region_size;
+    struct paging_file *file;       ///< Pager state, NULL for anonymous memory
+    struct paging_region *next;     ///< In the file regions of the paging state
 };
 
 errval_t paging_region_init(struct paging_state *st,
                             struct paging_region *pr, size_t size);
 
+/**
+ * \brief Map \p size bytes of the file at \p path from \p offset on
+ *
+ * Pages are read from the file server when they are first touched. With
+ * VREGION_FLAGS_WRITE in \p flags, written pages go back to the file on
+ * paging_region_sync(), paging_region_unmap() and paging_region_destroy().
+ */
+errval_t paging_region_init_file(struct paging_state *st,
+                                 struct paging_region *pr, const char *path,
+                                 size_t offset, size_t size, int flags);
+
+/// Write the written pages of a file-backed region back to the file
+errval_t paging_region_sync(struct paging_region *pr);
+
+/// Write back and unmap a file-backed region, close its file and free it
+errval_t paging_region_destroy(struct paging_region *pr);
+
 /**
  * \brief return a pointer to a bit of the paging region `pr`.
  * This function gets used in some of the code that is responsible
@@ -107,7 +136,8 @@ errval_t paging_region_map(struct paging_region *pr, size_t req_size,
  * \brief free a bit of the paging region `pr`.
  * This function gets used in some of the code that is responsible
  * for allocating Frame (and other) capabilities.
- * We ignore unmap requests right now.
+ * Anonymous regions ignore unmap requests right now; file-backed ones write
+ * the range back and drop the chunks that lie entirely within it.
  */
 errval_t paging_region_unmap(struct paging_region *pr, lvaddr_t base, size_t bytes);
 
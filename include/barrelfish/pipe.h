@@ -0,0 +1,57 @@
+/**
+ * \file
+ * \brief Byte streams between domains in a shared frame
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef BARRELFISH_PIPE_H
+#define BARRELFISH_PIPE_H
+
+#include <barrelfish/barrelfish.h>
+
+/// Size of the frame spawnd sets up for a pipe
+#define PIPE_FRAME_SIZE     (64 * 1024)
+
+/// Keeps what one side writes off the cache line of the other
+#define PIPE_CACHE_LINE     64
+
+/**
+ * \brief Start of the pipe frame, the ring follows it
+ *
+ * A zeroed frame is an empty, open pipe. Positions are offsets into the
+ * ring, which is empty when they are equal and full when head is one byte
+ * behind tail.
+ */
+struct pipe_header {
+    volatile uint32_t head __attribute__((aligned(PIPE_CACHE_LINE)));
+    volatile uint32_t writer_closed;
+    volatile uint32_t tail __attribute__((aligned(PIPE_CACHE_LINE)));
+    volatile uint32_t reader_closed;
+};
+
+/// One end of a pipe
+struct pipe {
+    struct pipe_header *hdr;
+    uint8_t *ring;
+    uint32_t size;              ///< Of the ring
+    bool writer;
+};
+
+errval_t pipe_init(struct pipe *p, struct capref frame, bool writer);
+errval_t pipe_write(struct pipe *p, const void *buf, size_t len,
+                    size_t *written);
+errval_t pipe_read(struct pipe *p, void *buf, size_t len, size_t *ret);
+void pipe_close(struct pipe *p);
+
+void pipe_stdio_init(void);
+void pipe_stdio_close(void);
+
+#endif // BARRELFISH_PIPE_H
@@ -16,23 +16,26 @@
 #define LIBBARRELFISH_THREAD_SYNC_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <barrelfish_kpi/spinlocks_arch.h>
 
 /// A thread of execution
 struct thread;
 
 struct thread_mutex {
-    volatile int        locked;
+    volatile int        locked;     ///< 0 free, 1 held, 2 held with waiters
     struct thread       *queue;
     spinlock_t          lock;
     struct thread       *holder;
+    int                 nested;     ///< Extra acquisitions by the holder
+    int                 spins;      ///< Running average of successful spins
 };
 #ifndef __cplusplus
 #       define THREAD_MUTEX_INITIALIZER \
     { .locked = false, .queue = NULL, .lock = 0 }
 #else
 #       define THREAD_MUTEX_INITIALIZER                                \
-    { false, (struct thread *)NULL, 0, (struct thread *)NULL }
+    { false, (struct thread *)NULL, 0, (struct thread *)NULL, 0, 0 }
 #endif
 
 struct thread_cond {
@@ -60,4 +63,22 @@ struct thread_sem {
     { 0, (struct thread *)NULL, 0 }
 #endif
 
+struct thread_rwlock {
+    int                 readers;        ///< Active readers
+    bool                writer;         ///< Held by a writer
+    int                 readers_waiting;
+    int                 writers_waiting;
+    struct thread       *read_queue;
+    struct thread       *write_queue;
+    spinlock_t          lock;
+};
+#ifndef __cplusplus
+#       define THREAD_RWLOCK_INITIALIZER \
+    { .readers = 0, .writer = false, .read_queue = NULL, \
+      .write_queue = NULL, .lock = 0 }
+#else
+#       define THREAD_RWLOCK_INITIALIZER \
+    { 0, false, 0, 0, (struct thread *)NULL, (struct thread *)NULL, 0 }
+#endif
+
 #endif
@@ -29,6 +29,12 @@ typedef int (*thread_func_t)(void *);
 /// Default size of a thread's stack
 #define THREADS_DEFAULT_STACK_BYTES     (64 * 1024)
 
+/// Number of scheduling priority levels (higher value runs first)
+#define THREAD_PRIORITY_LEVELS          8
+
+/// Priority of newly-created threads
+#define THREAD_PRIORITY_DEFAULT         (THREAD_PRIORITY_LEVELS / 2)
+
 struct thread *thread_create(thread_func_t start_func, void *data);
 struct thread *thread_create_varstack(thread_func_t start_func, void *arg,
                                       size_t stacksize);
@@ -44,6 +50,8 @@ void thread_pause_and_capture_state(struct thread *thread,
                                     arch_registers_state_t **ret_regs,
                                     arch_registers_fpu_state_t **ret_fpuregs);
 void thread_resume(struct thread *thread);
+void thread_set_priority(struct thread *thread, uint8_t priority);
+uint8_t thread_get_priority(struct thread *thread);
 
 void thread_mutex_init(struct thread_mutex *mutex);
 void thread_mutex_lock(struct thread_mutex *mutex);
@@ -63,6 +71,14 @@ void thread_sem_wait(struct thread_sem *sem);
 bool thread_sem_trywait(struct thread_sem *sem);
 void thread_sem_post(struct thread_sem *sem);
 
+void thread_rwlock_init(struct thread_rwlock *rwlock);
+void thread_rwlock_read_lock(struct thread_rwlock *rwlock);
+bool thread_rwlock_read_trylock(struct thread_rwlock *rwlock);
+void thread_rwlock_read_unlock(struct thread_rwlock *rwlock);
+void thread_rwlock_write_lock(struct thread_rwlock *rwlock);
+bool thread_rwlock_write_trylock(struct thread_rwlock *rwlock);
+void thread_rwlock_write_unlock(struct thread_rwlock *rwlock);
+
 void thread_set_tls(void *);
 void *thread_get_tls(void);
 
@@ -94,6 +94,8 @@ errval_t waitset_destroy(struct waitset *ws);
 errval_t get_next_event(struct waitset *ws, struct event_closure *retclosure);
 errval_t check_for_event(struct waitset *ws, struct event_closure *retclosure);
 errval_t event_dispatch(struct waitset *ws);
+errval_t event_dispatch_many(struct waitset *ws, size_t max);
+errval_t event_dispatch_timeout(struct waitset *ws, delayus_t timeout);
 errval_t event_dispatch_non_block(struct waitset *ws);
 
 __END_DECLS
@@ -0,0 +1,77 @@
+/**
+ * \file
+ * \brief Compiled packet classifier for sets of bfdmux filters
+ *
+ */
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __CLASSIFIER_H__
+#define __CLASSIFIER_H__
+
+#ifndef DOXYGEN
+// exclude system headers from documentation
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#endif                          // DOXYGEN
+
+#define CLASSIFIER_MAX_FIELDS   8  /**< \brief Maximum number of exact-match terms in a compiled filter */
+
+/**
+ * \brief A packet field tested by a filter: big-endian integer at a fixed offset
+ */
+struct classifier_field {
+    uint16_t offset;            /**< \brief Byte offset in the packet */
+    uint8_t width;              /**< \brief Width in bytes (1, 2, 4 or 8) */
+};
+
+struct classifier_sig;
+
+/**
+ * \brief A filter in a classifier
+ *
+ * Filters that are a conjunction of equality tests between packet fields and
+ * constants are compiled into an exact-match hash table per set of tested
+ * fields ("signature"). All other filters are kept in a list and run through
+ * the interpreter.
+ */
+struct classifier_rule {
+    void *owner;                /**< \brief Returned by classifier_match() */
+    uint64_t prio;              /**< \brief On multiple matches the highest priority wins */
+    uint8_t *code;              /**< \brief Filter byte code */
+    int32_t len;                /**< \brief Length of the byte code */
+
+    struct classifier_sig *sig; /**< \brief Signature, or NULL if interpreted */
+    uint64_t values[CLASSIFIER_MAX_FIELDS]; /**< \brief Expected field values, in signature order */
+    uint32_t hash;              /**< \brief Hash of values */
+    struct classifier_rule *next; /**< \brief Next in hash bucket or interpreted list */
+};
+
+/**
+ * \brief Classifier state
+ */
+struct classifier {
+    struct classifier_sig *sigs;        /**< \brief Compiled filter tables */
+    struct classifier_rule *interpreted; /**< \brief Other filters, highest priority first */
+    size_t compiled_count;              /**< \brief Number of compiled filters */
+    size_t interpreted_count;           /**< \brief Number of interpreted filters */
+};
+
+void classifier_init(struct classifier *c);
+struct classifier_rule *classifier_add(struct classifier *c, uint8_t *code,
+                                       int32_t len, uint64_t prio,
+                                       void *owner);
+void classifier_remove(struct classifier *c, struct classifier_rule *rule);
+void *classifier_match(struct classifier *c, uint8_t *packet_data,
+                       int packet_len);
+
+#endif
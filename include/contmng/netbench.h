@@ -91,9 +91,15 @@ void netbench_print_event_stat(struct netbench_details *nbp,
         uint8_t event_type, char *event_name, int type);
 void netbench_print_all_stats(struct netbench_details *nbp);
 
+/// Moves up to #batch packets once, returns how many it moved (0 if stuck)
+typedef uint64_t (*netbench_batch_fn)(void *arg, uint32_t batch);
+void netbench_batch_sweep(char *name, netbench_batch_fn fn, void *arg,
+        uint32_t max_batch, uint64_t packets);
+
 // Utility functions
 uint64_t my_avg(uint64_t sum, uint64_t n);
 float in_seconds(uint64_t cycles);
+float netbench_pps(uint64_t packets, uint64_t cycles);
 
 __END_DECLS
 
@@ -37,6 +37,22 @@
 #include "lwip/pbuf.h"
 #include "lwip/ip_addr.h"
 
+/** Swap the bytes in an u16_t: much like htons() for little-endian */
+#ifndef SWAP_BYTES_IN_WORD
+#if LWIP_PLATFORM_BYTESWAP && (BYTE_ORDER == LITTLE_ENDIAN)
+/* little endian and PLATFORM_BYTESWAP defined */
+#define SWAP_BYTES_IN_WORD(w) LWIP_PLATFORM_HTONS(w)
+#else
+/* can't use htons on big endian (or PLATFORM_BYTESWAP not defined)... */
+#define SWAP_BYTES_IN_WORD(w) ((((w) & 0xff) << 8) | (((w) & 0xff00) >> 8))
+#endif
+#endif                          /* SWAP_BYTES_IN_WORD */
+
+/** Split an u32_t in two u16_ts and add them up */
+#ifndef FOLD_U32T
+#define FOLD_U32T(u)          (((u) >> 16) + ((u) & 0x0000ffffUL))
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -46,12 +62,66 @@ extern "C" {
     u16_t inet_chksum_pseudo(struct pbuf *p,
                              struct ip_addr *src, struct ip_addr *dest,
                              u8_t proto, u16_t proto_len);
-#if LWIP_UDPLITE
+#if LWIP_UDPLITE || LWIP_CHECKSUM_ON_COPY
     u16_t inet_chksum_pseudo_partial(struct pbuf *p,
                                      struct ip_addr *src, struct ip_addr *dest,
                                      u8_t proto, u16_t proto_len,
                                      u16_t chksum_len);
 #endif
+#if LWIP_CHECKSUM_ON_COPY
+    u16_t lwip_chksum_copy(void *dst, const void *src, u16_t len);
+#endif
+
+/**
+ * Append the checksum of a block to the checksum of the data preceding it.
+ * Both are non-inverted sums as returned by lwip_chksum_copy().
+ *
+ * @param sum checksum of the first off bytes
+ * @param next checksum of the block starting at offset off
+ * @param off length of the data summed in sum
+ * @return checksum of the concatenation
+ */
+    static INLINE u16_t lwip_chksum_append(u16_t sum, u16_t next, u16_t off)
+    {
+        u32_t acc;
+
+        if (off & 1) {
+            /* the block's words straddle our words: its bytes swap roles */
+            next = SWAP_BYTES_IN_WORD(next);
+        }
+        acc = (u32_t) sum + next;
+        return (u16_t) FOLD_U32T(acc);
+    }
+
+/**
+ * Incrementally update a header checksum for a changed 16-bit field
+ * (RFC 1624, eqn. 3), instead of summing the whole header again.
+ *
+ * @param chksum checksum as stored in the header
+ * @param from old value of the field, in network byte order
+ * @param to new value of the field, in network byte order
+ * @return checksum (as u16_t) to be saved directly in the header
+ */
+    static INLINE u16_t inet_chksum_adjust(u16_t chksum, u16_t from, u16_t to)
+    {
+        u32_t acc;
+
+        acc = (u32_t) (u16_t) ~ chksum + (u16_t) ~ from + to;
+        acc = FOLD_U32T(acc);
+        acc = FOLD_U32T(acc);
+        return (u16_t) ~ acc;
+    }
+
+/**
+ * Like inet_chksum_adjust(), for a changed 32-bit field such as an IP
+ * address or a sequence number.
+ */
+    static INLINE u16_t inet_chksum_adjust32(u16_t chksum, u32_t from, u32_t to)
+    {
+        chksum = inet_chksum_adjust(chksum, (u16_t) (from >> 16),
+                                    (u16_t) (to >> 16));
+        return inet_chksum_adjust(chksum, (u16_t) from, (u16_t) to);
+    }
 
 #ifdef __cplusplus
 }
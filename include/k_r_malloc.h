@@ -2,6 +2,7 @@
 #define _LIBC_K_R_MALLOC_H_
 
 #include <sys/cdefs.h>
+#include <stdbool.h>
 
 __BEGIN_DECLS
 
@@ -24,6 +25,21 @@ void lesscore(void);
 void __free_locked(void *ap);
 void __malloc_init(void*, void*);
 
+/* Per-dispatcher front-end, lib/barrelfish/malloc_cache.c */
+struct morecore_state;
+
+/* Allocated blocks record their owner in the free list pointer */
+static inline void __malloc_cache_set_owner(Header *p,
+                                            struct morecore_state *state)
+{
+	p->s.ptr = (Header *) state;
+}
+
+void *__malloc_cache_alloc(unsigned nunits);
+bool __malloc_cache_free(Header *bp);
+void __malloc_cache_flush_disabled(struct morecore_state *state);
+void __malloc_cache_drain_locked(struct morecore_state *state);
+
 __END_DECLS
 
 #endif /* _LIBC_K_R_MALLOC_H_ */
@@ -198,9 +198,13 @@ extern "C" {
 #define netconn_listen(conn) netconn_listen_with_backlog(conn, TCP_DEFAULT_LISTEN_BACKLOG)
     struct netconn *netconn_accept(struct netconn *conn);
     struct netbuf *netconn_recv(struct netconn *conn);
+    u16_t netconn_recv_multi(struct netconn *conn, struct netbuf **bufs,
+                             u16_t n);
     err_t netconn_sendto(struct netconn *conn,
                          struct netbuf *buf, struct ip_addr *addr, u16_t port);
     err_t netconn_send(struct netconn *conn, struct netbuf *buf);
+    u16_t netconn_send_multi(struct netconn *conn, struct netbuf *bufs,
+                             u16_t n);
     err_t netconn_write(struct netconn *conn,
                         const void *dataptr, size_t size, u8_t apiflags);
     err_t netconn_close(struct netconn *conn);
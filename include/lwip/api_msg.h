@@ -62,6 +62,12 @@ extern "C" {
         union {
     /** used for do_send */
             struct netbuf *b;
+    /** used for do_send_multi */
+            struct {
+                struct netbuf *bufs;
+                u16_t n;
+                u16_t sent;
+            } bm;
     /** used for do_newconn */
             struct {
                 u8_t proto;
@@ -148,6 +154,7 @@ extern "C" {
     void do_disconnect(struct api_msg_msg *msg);
     void do_listen(struct api_msg_msg *msg);
     void do_send(struct api_msg_msg *msg);
+    void do_send_multi(struct api_msg_msg *msg);
     void do_recv(struct api_msg_msg *msg);
     void do_write(struct api_msg_msg *msg);
     void do_getaddr(struct api_msg_msg *msg);
@@ -34,6 +34,7 @@
 #define __LWIP_MEMP_H__
 
 #include "lwip/opt.h"
+#include "lwip/err.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -88,6 +89,22 @@ extern "C" {
 #define memp_malloc(type)     mem_malloc(memp_sizes[type])
 #define memp_free(type, mem)  mem_free(mem)
 
+    static inline u16_t memp_malloc_bulk(memp_t type, void **mem, u16_t n)
+    {
+        u16_t i;
+        for (i = 0; i < n && (mem[i] = memp_malloc(type)) != NULL; i++) {
+        }
+        return i;
+    }
+
+    static inline void memp_free_bulk(memp_t type, void **mem, u16_t n)
+    {
+        u16_t i;
+        for (i = 0; i < n; i++) {
+            memp_free(type, mem[i]);
+        }
+    }
+
 #else                           /* MEMP_MEM_MALLOC */
 
 #if MEM_USE_POOLS
@@ -109,6 +126,15 @@ extern "C" {
 #endif
     void memp_free(memp_t type, void *mem);
 
+    u16_t memp_malloc_bulk(memp_t type, void **mem, u16_t n);
+    void memp_free_bulk(memp_t type, void **mem, u16_t n);
+
+    err_t memp_set_limit(memp_t type, u32_t limit);
+    u32_t memp_get_limit(memp_t type);
+    u32_t memp_avail(memp_t type);
+    void memp_set_cache(u16_t size, u16_t batch);
+    void memp_cache_flush(void);
+
 #endif                          /* MEMP_MEM_MALLOC */
 
 #ifdef __cplusplus
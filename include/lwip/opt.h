@@ -173,6 +173,43 @@
 #define MEMP_USE_CUSTOM_POOLS           0
 #endif
 
+/**
+ * MEMP_CACHE_SIZE: default number of free elements of each pool that a
+ * thread keeps for itself, so that most memp_malloc()/memp_free() calls
+ * don't touch the shared pools. Pools smaller than MEMP_CACHE_SHARE times
+ * this get proportionally smaller caches. 0 disables the thread caches.
+ * Can be changed at runtime with memp_set_cache().
+ */
+#ifndef MEMP_CACHE_SIZE
+#define MEMP_CACHE_SIZE                 32
+#endif
+
+/**
+ * MEMP_CACHE_BATCH: default number of elements moved between a thread cache
+ * and its shared pool at once.
+ */
+#ifndef MEMP_CACHE_BATCH
+#define MEMP_CACHE_BATCH                16
+#endif
+
+/**
+ * MEMP_CACHE_SHARE: a thread cache never holds more than 1/MEMP_CACHE_SHARE
+ * of the elements of a pool.
+ */
+#ifndef MEMP_CACHE_SHARE
+#define MEMP_CACHE_SHARE                8
+#endif
+
+/**
+ * MEMP_GROW_FACTOR: pools whose elements are not handed to the network
+ * driver grow with malloc() up to this many times their static size when
+ * they run dry, instead of failing allocations. 1 keeps them static.
+ * The limit can be changed at runtime with memp_set_limit().
+ */
+#ifndef MEMP_GROW_FACTOR
+#define MEMP_GROW_FACTOR                4
+#endif
+
 /**
  * Set this to 1 if you want to free PBUF_RAM pbufs (or call mem_free()) from
  * interrupt context (or another context that doesn't allow waiting for a
@@ -1239,6 +1276,16 @@
 #define SO_REUSE                        0
 #endif
 
+/**
+ * LWIP_MMSG_BATCH: Maximum number of datagrams lwip_sendmmsg() hands to the
+ * tcpip_thread in one message, and lwip_recvmmsg() takes off a socket at
+ * once. Longer vectors are split. Each one costs a struct netbuf and an
+ * address on the caller's stack.
+ */
+#ifndef LWIP_MMSG_BATCH
+#define LWIP_MMSG_BATCH                 64
+#endif
+
 /*
    ----------------------------------------
    ---------- Statistics options ----------
@@ -1564,6 +1611,15 @@
 #define CHECKSUM_CHECK_TCP              1
 #endif
 
+/**
+ * LWIP_CHECKSUM_ON_COPY==1: Calculate the checksum of TCP payload while it is
+ * copied into the segment pbufs, so that it is not read again when the
+ * segment is sent or retransmitted (only the header is summed then).
+ */
+#ifndef LWIP_CHECKSUM_ON_COPY
+#define LWIP_CHECKSUM_ON_COPY           0
+#endif
+
 /*
    ---------------------------------------
    ---------- Debugging options ----------
@@ -63,6 +63,8 @@ extern "C" {
 
 /** indicates this packet's data should be immediately passed to the application */
 #define PBUF_FLAG_PUSH 0x01U
+/** PBUF_REF whose payload is a driver receive buffer granted to us */
+#define PBUF_FLAG_RX_GRANT 0x02U
 
     struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -106,6 +108,9 @@ extern "C" {
 
     uint16_t free_pbuf_pool_count(void);
     struct pbuf *pbuf_alloc(pbuf_layer l, u16_t size, pbuf_type type);
+    u16_t pbuf_alloc_bulk(pbuf_layer l, u16_t size, pbuf_type type,
+                          struct pbuf **p, u16_t n);
+    void pbuf_free_bulk(struct pbuf **p, u16_t n);
     void pbuf_realloc(struct pbuf *p, u16_t size);
     u8_t pbuf_header(struct pbuf *p, s16_t header_size);
     void pbuf_ref(struct pbuf *p);
@@ -297,6 +297,17 @@ extern "C" {
     };
 #endif                          /* LWIP_TIMEVAL_PRIVATE */
 
+/** One message of lwip_sendmmsg() or lwip_recvmmsg(). Each message is a
+ * single contiguous buffer; there is no scatter/gather. */
+    struct lwip_mmsghdr {
+        void *msg_buf;              /* data to send, or buffer to receive into */
+        size_t msg_buflen;          /* size of msg_buf */
+        struct sockaddr *msg_name;  /* destination, or returns the source
+                                       (may be NULL) */
+        socklen_t msg_namelen;      /* size of msg_name */
+        size_t msg_len;             /* returns number of bytes transferred */
+    };
+
     void lwip_socket_init(void);
 
     int lwip_accept(int s, struct sockaddr *addr, socklen_t * addrlen);
@@ -318,6 +329,10 @@ extern "C" {
     int lwip_send(int s, const void *dataptr, size_t size, int flags);
     int lwip_sendto(int s, const void *dataptr, size_t size, int flags,
                     const struct sockaddr *to, socklen_t tolen);
+    int lwip_recvmmsg(int s, struct lwip_mmsghdr *msgvec, unsigned int vlen,
+                      int flags);
+    int lwip_sendmmsg(int s, struct lwip_mmsghdr *msgvec, unsigned int vlen,
+                      int flags);
     int lwip_socket(int domain, int type, int protocol);
     int lwip_write(int s, const void *dataptr, size_t size);
     int lwip_select(int maxfdp1, fd_set * readset, fd_set * writeset,
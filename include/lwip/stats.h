@@ -88,6 +88,8 @@ extern "C" {
         mem_size_t max;
         STAT_COUNTER err;
         STAT_COUNTER illegal;
+        STAT_COUNTER exhausted; /* Pool found empty (grown or failed). */
+        STAT_COUNTER grown;     /* Elements added to the pool at runtime. */
     };
 
     struct stats_syselem {
@@ -240,12 +242,16 @@ extern "C" {
                                         lwip_stats.memp[i].max = lwip_stats.memp[i].used; \
                                     } \
                                  } while(0)
+#define MEMP_STATS_ADD(x, i, y) lwip_stats.memp[i].x += (y)
 #define MEMP_STATS_DISPLAY(i) stats_display_memp(&lwip_stats.memp[i], i)
+    void stats_get_memp(int index, struct stats_mem *mem);
+    STAT_COUNTER stats_memp_exhausted(void);
 #else
 #define MEMP_STATS_AVAIL(x, i, y)
 #define MEMP_STATS_INC(x, i)
 #define MEMP_STATS_DEC(x, i)
 #define MEMP_STATS_INC_USED(x, i)
+#define MEMP_STATS_ADD(x, i, y)
 #define MEMP_STATS_DISPLAY(i)
 #endif
 
@@ -43,6 +43,9 @@
 #include "lwip/icmp.h"
 #include "lwip/err.h"
 
+/** Payload of enqueued segments is checksummed while it is copied */
+#define TCP_CHECKSUM_ON_COPY  (LWIP_CHECKSUM_ON_COPY && CHECKSUM_GEN_TCP)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -521,6 +524,9 @@ extern "C" {
         struct pbuf *p;         /* buffer containing data + TCP header */
         void *dataptr;          /* pointer to the TCP data in the pbuf */
         u16_t len;              /* the TCP length of this segment */
+#if TCP_CHECKSUM_ON_COPY
+        u16_t chksum;           /* non-inverted checksum of the payload */
+#endif
         u8_t flags;
 #define TF_SEG_OPTS_MSS   (u8_t)0x01U   /* Include MSS option. */
 #define TF_SEG_OPTS_TS    (u8_t)0x02U   /* Include timestamp option. */
@@ -52,6 +52,16 @@
 /// Number of TCP segments
 #define MEMP_NUM_TCP_SEG        512
 
+/// Messages queued to the tcpip thread (API calls and loopback polls)
+#define TCPIP_MBOX_SIZE         64
+
+/// Datagrams queued on a UDP or RAW socket, drained by lwip_recvmmsg()
+#define DEFAULT_UDP_RECVMBOX_SIZE       64
+#define DEFAULT_RAW_RECVMBOX_SIZE       64
+
+/// Netbufs, one for each queued datagram
+#define MEMP_NUM_NETBUF         DEFAULT_UDP_RECVMBOX_SIZE
+
 /// TCP window size
 #define TCP_WND                 11680
 
@@ -109,4 +119,13 @@
 #define CHECKSUM_CHECK_TCP              1
 #endif
 
+#ifndef LWIP_CHECKSUM_ON_COPY
+#define LWIP_CHECKSUM_ON_COPY           1
+#endif
+
+// wide accumulator checksum, vectorised where the compiler targets SIMD
+#ifndef LWIP_CHKSUM_ALGORITHM
+#define LWIP_CHKSUM_ALGORITHM           4
+#endif
+
 #endif
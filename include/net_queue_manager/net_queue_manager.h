@@ -17,6 +17,7 @@
 
 #include <barrelfish/barrelfish.h>
 #include <barrelfish/bulk_transfer.h>
+#include <barrelfish/deferred.h>
 #include <contmng/contmng.h>
 #include <contmng/netbench.h>
 #include <procon/procon.h>
@@ -32,6 +33,10 @@
 #define RECEIVE_CONNECTION 0
 #define TRANSMIT_CONNECTION 1
 
+/* Zero-copy receive: slots of the driver RX buffer pool granted to clients */
+#define RX_POOL_SLOT_SIZE   2048
+#define RX_POOL_BUFFER_ID   (~0ULL) // buffer_id of granted slots
+
 /*****************************************************************
  * common data-structures
  *****************************************************************/
@@ -43,11 +48,14 @@ struct bufdesc {
     size_t pkt_len;
 };
 
+struct classifier_rule;
+
 struct filter {
     uint64_t filter_id;
     uint64_t filter_type;
     uint8_t *data;
     int32_t len;
+    struct classifier_rule *rule; // entry in the compiled rx classifier
     bool paused;
     struct bufdesc pause_buffer[MAX_PAUSE_BUFFER];
     int pause_bufpos;
@@ -97,6 +105,8 @@ struct client_closure {
     uint64_t queueid; // The queueid to which this buffer belongs
     struct net_queue_manager_binding *app_connection; // Binding pointer to talk back
     struct cont_queue *q; // Cont management queue to report events
+    struct deferred_event notify_timer; // bounds delay of coalesced notifications
+    bool notify_timer_armed; // notify_timer is registered
 
     // For debugging and benchmarking help
     uint8_t debug_print; // To control connection level debug prints
@@ -116,6 +126,11 @@ struct client_closure {
     uint64_t dropped_pkt_count;  // # packets dropped (for no space in hw-queue)
     uint64_t pbuf_count;  // # pbufs sent
     uint64_t in_dropped_app_buf_full; // # packets dropped for lack of buffers
+
+    // Zero-copy receive
+    struct shared_pool_private *rx_pool_ret; // RX pool slots given back by app
+    uint16_t *rx_pool_held; // references held on each RX pool slot
+    uint64_t rx_granted; // # packets granted instead of copied
 }; /* holds info about how much data is transferred to NIC. */
 
 
@@ -151,6 +166,15 @@ struct buffer_descriptor *find_buffer(uint64_t buffer_id);
 
 void process_received_packet(void *pkt_data, size_t pkt_len);
 
+/* Zero-copy receive buffer pool. A driver that receives into pool slots
+ * instead of its own buffers lets matching clients map the packets directly.
+ * ethersrv_rx_pool_get() returns NIC-ready slots, and
+ * process_received_pool_buffer() replaces process_received_packet() for
+ * them and gives the slot back once no client references it anymore. */
+errval_t ethersrv_rx_pool_init(uint64_t slots);
+bool ethersrv_rx_pool_get(uint64_t *idx, void **va, lpaddr_t *pa);
+void process_received_pool_buffer(uint64_t idx, size_t len);
+
 /* for frag.c */
 bool handle_fragmented_packet(void* packet, size_t len);
 
@@ -33,6 +33,21 @@ __BEGIN_DECLS
 #define NULL_NFS_FH ((struct nfs_fh3) { /*data_len*/ 0, /*data_val*/ NULL })
 
 struct nfs_client;
+struct pbuf;
+
+/**
+ * \brief Data of a reply, left in the packet buffers it arrived in
+ *
+ * The data starts #offset bytes into #pbuf and may continue in the following
+ * pbufs of the chain. The view holds a reference on the pbufs, which must be
+ * released with nfs_data_view_free(), and should not be kept for long, as
+ * it also holds on to the network driver's receive buffers.
+ */
+struct nfs_data_view {
+    struct pbuf *pbuf;      ///< First pbuf holding data, NULL if #len is 0
+    uint16_t offset;        ///< Offset of the data within #pbuf
+    uint32_t len;           ///< Length of the data
+};
 
 /**
  * \brief Callback function for mount operation
@@ -141,6 +156,22 @@ typedef void (*nfs_access_callback_t)(void *arg, struct nfs_client *client,
 typedef void (*nfs_read_callback_t)(void *arg, struct nfs_client *client,
                                     READ3res *result);
 
+/**
+ * \brief Callback function for read operation without copying the data
+ *
+ * \param arg Opaque argument pointer, as provided to nfs_read_view()
+ * \param client NFS client instance
+ * \param result Result pointer, or NULL on error. The data field is empty.
+ * \param data The data read, or NULL on error
+ *
+ * The memory referred to by #result, if any, is now the property of the callee,
+ * and must be freed by the appropriate XDR free operations. The callee must
+ * also release #data (or a copy of it) with nfs_data_view_free().
+ */
+typedef void (*nfs_read_view_callback_t)(void *arg, struct nfs_client *client,
+                                         READ3res *result,
+                                         struct nfs_data_view *data);
+
 /**
  * \brief Callback function for write operation
  *
@@ -212,9 +243,15 @@ err_t nfs_access(struct nfs_client *client, struct nfs_fh3 fh, uint32_t access,
                  nfs_access_callback_t callback, void *cbarg);
 err_t nfs_read(struct nfs_client *client, struct nfs_fh3 fh, offset3 offset,
                count3 count, nfs_read_callback_t callback, void *cbarg);
+err_t nfs_read_view(struct nfs_client *client, struct nfs_fh3 fh,
+                    offset3 offset, count3 count,
+                    nfs_read_view_callback_t callback, void *cbarg);
 err_t nfs_write(struct nfs_client *client, struct nfs_fh3 fh, offset3 offset,
                 const void *data, count3 count, stable_how stable,
                 nfs_write_callback_t callback, void *cbarg);
+err_t nfs_write_pbuf(struct nfs_client *client, struct nfs_fh3 fh,
+                     offset3 offset, struct pbuf *data, stable_how stable,
+                     nfs_write_callback_t callback, void *cbarg);
 err_t nfs_create(struct nfs_client *client, struct nfs_fh3 dir,
                  const char *name, bool guarded, sattr3 attributes,
                  nfs_create_callback_t callback, void *cbarg);
@@ -228,6 +265,10 @@ void nfs_destroy(struct nfs_client *client);
 void nfs_copyfh(struct nfs_fh3 *dest, struct nfs_fh3 src);
 void nfs_freefh(struct nfs_fh3 fh);
 
+size_t nfs_data_view_copy(struct nfs_data_view *view, size_t offset,
+                          void *buf, size_t len);
+void nfs_data_view_free(struct nfs_data_view *view);
+
 
 errval_t nfsstat_to_errval(enum nfsstat3 s);
 errval_t mountstat_to_errval(enum mountstat3 s);
@@ -0,0 +1,78 @@
+/**
+ * \file
+ * \brief Cached NFS file access with read-ahead
+ *
+ * A layer over the NFS client (nfs.h) for reading files. Pages of files are
+ * kept in a cache shared by all files of the domain, sequential readers get
+ * a growing window of READs in flight ahead of them, and attributes are
+ * cached with close-to-open consistency: every nfs_file_open() revalidates
+ * the attributes with the server and drops the cached pages if the file has
+ * changed since they were read.
+ *
+ * Like the rest of the NFS client, this must be called with the lwIP lock
+ * held (if there is one), and callbacks run from the lwIP waitset.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef BARRELFISH_NFS_FILE_H
+#define BARRELFISH_NFS_FILE_H
+
+#include <sys/cdefs.h>
+#include <nfs/nfs.h>
+
+__BEGIN_DECLS
+
+#define NFS_FILE_PAGE_SIZE      4096    ///< Bytes per cached page and READ
+#define NFS_FILE_CACHE_PAGES    512     ///< Pages kept in the cache
+#define NFS_FILE_MIN_WINDOW     0       ///< Pages read ahead for random access
+#define NFS_FILE_MAX_WINDOW     8       ///< Pages read ahead for sequential reads
+#define NFS_FILE_ATTR_TIMEOUT   (3 * 1000 * 1000) ///< Attribute cache lifetime (us)
+
+struct nfs_file;
+
+/// Cache statistics, for benchmarks
+struct nfs_file_stats {
+    uint64_t hits;          ///< Pages found in the cache
+    uint64_t inflight_hits; ///< Pages found being read (ahead)
+    uint64_t misses;        ///< Pages read on demand
+    uint64_t readahead;     ///< Pages read ahead
+    uint64_t reads;         ///< READ calls sent
+    uint64_t evictions;     ///< Pages evicted from the cache
+    uint64_t invalidations; ///< Pages dropped because the file changed
+    uint64_t attr_hits;     ///< nfs_file_getattr() served from the cache
+    uint64_t attr_misses;   ///< GETATTR calls sent
+};
+
+typedef void (*nfs_file_open_callback_t)(void *arg, struct nfs_file *file,
+                                         errval_t err);
+
+typedef void (*nfs_file_read_callback_t)(void *arg, struct nfs_file *file,
+                                         errval_t err, size_t bytes);
+
+typedef void (*nfs_file_getattr_callback_t)(void *arg, errval_t err,
+                                            struct fattr3 *attr);
+
+errval_t nfs_file_open(struct nfs_client *client, struct nfs_fh3 fh,
+                       nfs_file_open_callback_t callback, void *cbarg);
+errval_t nfs_file_read(struct nfs_file *file, uint64_t offset, void *buf,
+                       size_t bytes, nfs_file_read_callback_t callback,
+                       void *cbarg);
+uint64_t nfs_file_size(struct nfs_file *file);
+void nfs_file_close(struct nfs_file *file);
+
+errval_t nfs_file_getattr(struct nfs_client *client, struct nfs_fh3 fh,
+                          nfs_file_getattr_callback_t callback, void *cbarg);
+void nfs_file_invalidate(struct nfs_client *client, struct nfs_fh3 fh);
+void nfs_file_get_stats(struct nfs_file_stats *stats);
+
+__END_DECLS
+
+#endif // BARRELFISH_NFS_FILE_H
@@ -30,6 +30,16 @@
 
 #define TMP_SLOTS 2
 
+// Notification coalescing defaults: tell the other side at the latest after
+// this many slot updates, or this many microseconds after the first one
+#define SP_NOTIFY_BATCH     32
+#define SP_NOTIFY_DELAY_US  1000
+
+// Consumer polling: after a notification the consumer keeps reading the pool
+// until nothing arrived for SP_POLL_IDLE_US, for at most SP_POLL_BUDGET_US
+#define SP_POLL_IDLE_US     50
+#define SP_POLL_BUDGET_US   1000
+
 
 // information inside the slot
 struct slot_data {
@@ -62,9 +72,20 @@ struct shared_pool {
     union vreg write_reg; // slot-index that producer will produce next
     union vreg read_reg;  // slot-index that Consumer will consume next
     union vreg size_reg;
+    union vreg poll_reg;  // non-zero while the consumer polls the indices
     union slot slot_list[TMP_SLOTS];
 };
 
+// Coalescing state for notifications to the other side of a pool
+struct sp_notify {
+    uint64_t    batch;      // notify once this many updates are pending
+    uint64_t    delay_us;   // ... or this long after the first pending one
+    uint64_t    pending;    // slot updates the other side was not told about
+    uint64_t    updates;    // total slot updates
+    uint64_t    sent;       // total notifications
+    uint64_t    suppressed; // slot updates seen by a polling consumer
+};
+
 struct shared_pool_private {
     struct shared_pool *sp;
     struct      capref cap;
@@ -85,6 +106,7 @@ struct shared_pool_private {
     uint64_t    c_read_id;
     uint64_t    c_write_id;
     uint64_t    c_size;
+    struct sp_notify notify;
 };
 
 
@@ -136,6 +158,14 @@ bool sp_clear_slot(struct shared_pool_private *spp, struct slot_data *d,
         uint64_t id);
 
 
+// Notification coalescing
+void sp_notify_init(struct sp_notify *n, uint64_t batch, uint64_t delay_us);
+bool sp_notify_update(struct shared_pool_private *spp, uint64_t count);
+void sp_notify_sent(struct shared_pool_private *spp);
+bool sp_notify_produced(struct shared_pool_private *spp, uint64_t count);
+uint64_t sp_consume_while_active(struct shared_pool_private *spp,
+                                 uint64_t (*consume)(void *arg), void *arg);
+
 // Helper functions
 void sp_copy_slot_data(struct slot_data *d, struct slot_data *s);
 void copy_data_into_slot(struct shared_pool_private *spp, uint64_t buf_id,
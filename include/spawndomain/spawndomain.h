@@ -55,6 +55,40 @@ struct spawninfo {
     size_t tls_init_len, tls_total_len;
 };
 
+/**
+ * \brief Reads up to \p size bytes at \p pos of an image into \p buf
+ *
+ * Fewer bytes are only returned in \p ret at the end of the image.
+ */
+typedef errval_t (*spawn_read_fn)(void *state, size_t pos, size_t size,
+                                  void *buf, size_t *ret);
+
+#define SPAWN_IMAGE_SEGMENTS    8       ///< Loadable segments of an image
+#define SPAWN_IMAGE_FRAMES      20      ///< Frames backing one segment
+
+/// A loadable segment, as its program header describes it
+struct spawn_segment {
+    genvaddr_t vaddr;
+    size_t offset;                      ///< In the image
+    size_t filesz;
+    size_t memsz;
+    uint32_t flags;                     ///< PF_R, PF_W and PF_X
+
+    /// Frames a read-only segment was loaded into. Later spawns of the
+    /// image map them instead of reading the segment again.
+    struct capref frames[SPAWN_IMAGE_FRAMES];
+    size_t nframes;
+};
+
+/// What the file loader needs to know of an image, kept across spawns
+struct spawn_image {
+    enum cpu_type cpu_type;
+    genvaddr_t entry;
+    void *arch_info;                    ///< As returned by spawn_arch_load()
+    size_t nsegments;
+    struct spawn_segment segments[SPAWN_IMAGE_SEGMENTS];
+};
+
 __BEGIN_DECLS
 errval_t spawn_get_cmdline_args(struct mem_region *module,
                                 char **retargs);
@@ -64,6 +98,14 @@ errval_t spawn_load_with_bootinfo(struct spawninfo *si, struct bootinfo *bi,
 errval_t spawn_load_with_args(struct spawninfo *si, struct mem_region *module,
                               const char *name, coreid_t coreid,
                               char *const argv[], char *const envp[]);
+errval_t spawn_read_image(spawn_read_fn read, void *state,
+                          struct spawn_image *image);
+bool spawn_image_same(struct spawn_image *a, struct spawn_image *b);
+void spawn_image_free(struct spawn_image *image);
+errval_t spawn_load_with_file(struct spawninfo *si, spawn_read_fn read,
+                              void *state, struct spawn_image *image,
+                              const char *name, coreid_t coreid,
+                              char *const argv[], char *const envp[]);
 errval_t spawn_load_image(struct spawninfo *si, lvaddr_t binary,
                           size_t binary_size, enum cpu_type type,
                           const char *name, coreid_t coreid,
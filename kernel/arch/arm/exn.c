@@ -47,7 +47,8 @@ static void dump_arm_registers(arch_registers_state_t* save_area)
 }
 
 void handle_user_page_fault(lvaddr_t                fault_address,
-                            arch_registers_state_t* save_area)
+                            arch_registers_state_t* save_area,
+                            uintptr_t               fault_status)
 {
     lvaddr_t handler;
     struct dispatcher_shared_arm *disp = get_dispatcher_shared_arm(dcb_current->disp);
@@ -102,7 +103,7 @@ void handle_user_page_fault(lvaddr_t                fault_address,
         resume_area.named.pc   = handler;
         resume_area.named.r0   = disp_gen->udisp;
         resume_area.named.r1   = fault_address;
-        resume_area.named.r2   = 0;
+        resume_area.named.r2   = fault_status;
         resume_area.named.r3   = saved_pc;
         resume_area.named.rtls = disp_gen->udisp;
         resume_area.named.r10  = disp->got_base;
@@ -148,10 +148,10 @@ handle_frame_modify_flags(
     size_t pages  = sa->arg3; // #pages to modify
     size_t flags  = sa->arg4; // new flags
 
-    paging_modify_flags(to, offset, pages, flags);
+    errval_t err = paging_modify_flags(to, offset, pages, flags);
 
     return (struct sysret) {
-        .error = SYS_ERR_OK,
+        .error = err,
         .value = 0,
     };
 }
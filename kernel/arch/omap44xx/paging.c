@@ -435,8 +435,9 @@ caps_map_l2(struct capability* dest,
     }
 
     struct cte *src_cte = cte_for_cap(src);
+    // physical address of the first entry, for paging_modify_flags()
     src_cte->mapping_info.pte_count = pte_count;
-    src_cte->mapping_info.pte = dest_lpaddr;
+    src_cte->mapping_info.pte = dest_lpaddr + slot * sizeof(union arm_l2_entry);
     src_cte->mapping_info.offset = offset;
 
     for (int i = 0; i < pte_count; i++) {
@@ -588,15 +589,26 @@ errval_t paging_modify_flags(struct capability *frame, uintptr_t offset,
     struct cte *mapping = cte_for_cap(frame);
     struct mapping_info *info = &mapping->mapping_info;
 
+    if (info->pte == 0) {
+        return SYS_ERR_VM_MAP_OFFSET;
+    }
+    // offset and pages count entries of the mapping
+    if (offset > info->pte_count || pages > info->pte_count - offset) {
+        return SYS_ERR_VM_MAP_SIZE;
+    }
+
     /* Calculate location of page table entries we need to modify */
-    lvaddr_t base = info->pte + offset;
+    union arm_l2_entry *entry =
+        (union arm_l2_entry *)local_phys_to_mem(info->pte) + offset;
 
-    for (int i = 0; i < pages; i++) {
-        union arm_l2_entry *entry =
-            (union arm_l2_entry *)base + i;
+    for (int i = 0; i < pages; i++, entry++) {
         paging_set_flags(entry, kpi_paging_flags);
     }
 
+    // taking rights away must not leave stale entries in the TLB
+    // TODO: selective TLB flush
+    cp15_invalidate_tlb();
+
     return SYS_ERR_OK;
 }
 
@@ -40,9 +40,12 @@ void exceptions_init(void);
  * Handle page fault in user-mode process.
  *
  * This function should be called in SVC mode with interrupts disabled.
+ * \p fault_status is the data fault status register for data aborts, 0
+ * for prefetch aborts; it is passed on to the dispatcher.
  */
 void handle_user_page_fault(lvaddr_t                fault_address,
-                            arch_registers_state_t* saved_context)
+                            arch_registers_state_t* saved_context,
+                            uintptr_t               fault_status)
     __attribute__((noreturn));
 
 /**
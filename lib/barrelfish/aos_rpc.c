@@ -16,6 +16,7 @@
 #include <barrelfish/paging.h>
 #include <barrelfish/barrelfish.h>
 #include <barrelfish/cspace.h>
+#include <barrelfish/deferred.h>
 
 #define FIRSTEP_BUFLEN 20u
 #define MIN(a,b) \
@@ -25,43 +26,215 @@
 
 static void clean_aos_rpc_msgbuf(struct aos_rpc *rpc);
 
+/// A call waiting for its reply, on the stack of the caller
+struct aos_rpc_call {
+    enum aos_rpc_chan chan;
+    uint16_t seq;
+    bool done;
+    errval_t err;           ///< Sent by the server
+    struct capref cap;
+    uintptr_t ret[2];
+    struct aos_rpc_call *next;
+};
+
+/// Absolute deadline for the reply to a request sent now, 0 if none
+static inline systime_t rpc_deadline(struct aos_rpc *rpc)
+{
+    return rpc->timeout == 0 ? 0 : get_system_time() + rpc->timeout;
+}
+
+/**
+ * \brief Start a call on channel \p c, it waits for the reply in rpc_wait()
+ *
+ * \return the sequence number to tag the request with
+ */
+static uint16_t rpc_begin(struct aos_rpc *rpc, enum aos_rpc_chan c,
+                          struct aos_rpc_call *call)
+{
+    // 0 tags messages that are no reply
+    if (++rpc->seq[c] == 0) {
+        rpc->seq[c]++;
+    }
+
+    call->chan = c;
+    call->seq = rpc->seq[c];
+    call->done = false;
+    call->err = SYS_ERR_OK;
+    call->cap = NULL_CAP;
+    call->ret[0] = call->ret[1] = 0;
+    call->next = rpc->calls[c];
+    rpc->calls[c] = call;
+    return call->seq;
+}
+
+static void rpc_end(struct aos_rpc *rpc, struct aos_rpc_call *call)
+{
+    struct aos_rpc_call **p = &rpc->calls[call->chan];
+    while (*p != call) {
+        p = &(*p)->next;
+    }
+    *p = call->next;
+}
+
+/**
+ * \brief Find the call a reply on channel \p c belongs to
+ *
+ * Calls made from handlers run while an outer call waits, so there can be
+ * several.
+ *
+ * \return NULL if the call gave up on its reply, or was never made
+ */
+static struct aos_rpc_call *rpc_find(struct aos_rpc *rpc, enum aos_rpc_chan c,
+                                     uint16_t seq)
+{
+    struct aos_rpc_call *call = rpc->calls[c];
+    while (call != NULL && call->seq != seq) {
+        call = call->next;
+    }
+    return call;
+}
+
+/// Complete \p call with the error the server sent
+static inline void rpc_done(struct aos_rpc_call *call, errval_t err)
+{
+    call->err = err;
+    call->done = true;
+}
+
+/// Drop a reply nobody waits for
+static void rpc_drop(struct capref cap)
+{
+    if (!capref_is_null(cap)) {
+        cap_destroy(cap);
+    }
+}
+
+/**
+ * \brief Dispatch the next event, but not past \p deadline
+ *
+ * Fails with AOS_ERR_RPC_TIMEOUT instead of blocking past the deadline, so a
+ * dead server does not hang the client forever.
+ */
+static errval_t rpc_dispatch(systime_t deadline)
+{
+    struct waitset *ws = get_default_waitset();
+
+    if (deadline == 0) {
+        return event_dispatch(ws);
+    }
+
+    systime_t now = get_system_time();
+    if (now >= deadline) {
+        return AOS_ERR_RPC_TIMEOUT;
+    }
+    errval_t err = event_dispatch_timeout(ws, deadline - now);
+    if (err_no(err) == LIB_ERR_EVENT_TIMEOUT) {
+        return err_push(err, AOS_ERR_RPC_TIMEOUT);
+    }
+    return err;
+}
+
+/**
+ * \brief Dispatch events until the reply to \p call is there
+ *
+ * A call that misses its deadline is forgotten, its reply is dropped when it
+ * arrives late, so the channel can be used for the next call right away.
+ *
+ * \return the error the server replied with
+ */
+static errval_t rpc_wait(struct aos_rpc *rpc, struct aos_rpc_call *call,
+                         systime_t deadline)
+{
+    errval_t err = SYS_ERR_OK;
+    while (!call->done && err_is_ok(err)) {
+        err = rpc_dispatch(deadline);
+    }
+    rpc_end(rpc, call);
+
+    if (!call->done) {
+        if (call->chan == AOS_RPC_FS) {
+            // see fs_connect()
+            rpc->fs_stale = call->seq;
+        }
+        return err;
+    }
+    return call->err;
+}
+
 static void spawnd_recv_handler(void *rpc_void)
 {
     struct aos_rpc *rpc = (struct aos_rpc *)rpc_void;
     struct capref remote_cap;
     struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
     uint32_t rpc_code;
+    uint16_t seq;
 
-    errval_t err = aos_retrieve_msg(&rpc->spawnd_lc, &remote_cap,
-                                    &rpc_code, &msg);
+    errval_t err = aos_retrieve_tagged_msg(&rpc->spawnd_lc, &remote_cap,
+                                           &rpc_code, &seq, &msg);
     if (err_is_fail(err)) {
         debug_printf("Could not receive msg from init: %s\n",
             err_getstring(err));
         err_print_calltrace(err);
-        local_rpc.return_cap = NULL_CAP;
         return;
     }
     
     lmp_chan_register_recv(&rpc->spawnd_lc, get_default_waitset(),
         MKCLOSURE(spawnd_recv_handler, rpc));
+
+    // spawnd sends nothing but replies
+    struct aos_rpc_call *call = rpc_find(rpc, AOS_RPC_SPAWND, seq);
+    if (call == NULL) {
+        rpc_drop(remote_cap);
+        return;
+    }
     
     switch(rpc_code){
+        case PROCESS_SPAWN:
+        {
+            call->ret[0] = msg.words[1];
+            rpc_done(call, msg.words[0]);
+            break;
+        }
+
         case PROCESS_GET_NAME:
         {
             // if this event is triggered, check the buffer for the full
             // text.
-            rpc->wait_event = false;
+            rpc_done(call, msg.words[0]);
             break;
         }
         case PROCESS_GET_NO_OF_PIDS:
         {
-            rpc->msg_buf[0] = (char) msg.words[0];
+            call->ret[0] = msg.words[1];
+            rpc_done(call, msg.words[0]);
             break;
         }
 
-        case PROCESS_GET_PID:
+        case PROCESS_GET_ALL:
         {
-            rpc->msg_buf[0] = (char) msg.words[0];
+            // remaining entries, pid, name
+            if (msg.words[0] == AOS_RPC_PS_FAILED) {
+                rpc_done(call, msg.words[1]);
+                break;
+            }
+            if (rpc->ps_list == NULL) {
+                rpc->ps_count = msg.words[0] + 1;
+                rpc->ps_len = 0;
+                rpc->ps_list = malloc(rpc->ps_count *
+                                      sizeof(struct aos_ps_entry));
+                if (rpc->ps_list == NULL) {
+                    rpc->ps_count = 0;
+                }
+            }
+            if (rpc->ps_len < rpc->ps_count) {
+                struct aos_ps_entry *e = &rpc->ps_list[rpc->ps_len++];
+                e->pid = msg.words[1];
+                memcpy(e->name, &msg.words[2], AOS_RPC_PS_NAME_LEN);
+                e->name[AOS_RPC_PS_NAME_LEN - 1] = '\0';
+            }
+            if (msg.words[0] == 0) {
+                rpc_done(call, SYS_ERR_OK);
+            }
             break;
         }
         
@@ -85,47 +258,36 @@ static void spawnd_recv_handler(void *rpc_void)
     }
 }
 
-static void init_recv_handler(void *rpc_void) 
+bool aos_rpc_init_reply(struct aos_rpc *rpc, uint32_t code, uint16_t seq,
+                        struct lmp_recv_msg *msg, struct capref cap)
 {
-    struct aos_rpc *rpc = (struct aos_rpc *)rpc_void;
-    struct capref remote_cap = NULL_CAP;
-    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
-    errval_t err = lmp_chan_recv(&rpc->init_lc, &msg, &remote_cap);
-    
-    if (err_is_fail(err)) {
-        debug_printf("Could not receive msg from init: %s\n",
-            err_getstring(err));
-        err_print_calltrace(err);
-        rpc->return_cap = NULL_CAP;
-        return;
-    }
+    struct aos_rpc_call *call = NULL;
 
-    if (msg.buf.msglen == 0){
-        debug_printf("Bad msg for init.\n");
-        rpc->return_cap = NULL_CAP;
-        return;
-    }
-    
-    uint32_t code = msg.buf.words[0];
-    switch(code) {
+    switch (code) {
         case REGISTER_CHANNEL:
+        case REQUEST_RAM_CAP:
+        case REQUEST_DEV_CAP:
+        case FS_CONNECT:
         {
-            if (capref_is_null(remote_cap)) {
-                debug_printf("Received endpoint cap was null.\n");
-                return;
+            // error, value
+            call = rpc_find(rpc, AOS_RPC_INIT, seq);
+            if (call == NULL) {
+                rpc_drop(cap);
+                return true;
             }
-
-            rpc->init_lc.remote_cap = remote_cap;
+            call->cap = cap;
+            call->ret[0] = msg->words[1];
+            rpc_done(call, msg->words[0]);
             break;
         }
         
         case SEND_TEXT:
         {
-            for(uint8_t i = 1; i < 9; i++){
-                 rpc->msg_buf[rpc->char_count] = msg.buf.words[i];
+            for(uint8_t i = 0; i < 8; i++){
+                 rpc->msg_buf[rpc->char_count] = msg->words[i];
                  rpc->char_count++;
 
-                 if (msg.buf.words[i] == '\0') {
+                 if (msg->words[i] == '\0') {
                     rpc->char_count = 0;
                     break;
                 }
@@ -133,30 +295,6 @@ static void init_recv_handler(void *rpc_void)
                                     
             break;
         }
-        
-        case REQUEST_RAM_CAP:
-        {
-            if (capref_is_null(remote_cap)) {
-                debug_printf("Remote_cap is NULL\n");
-                return;
-            }
-            
-            rpc->return_cap = remote_cap;
-            rpc->ret_bits = msg.buf.words[1];
-            break;
-        }
-
-        case REQUEST_DEV_CAP:
-        {
-            if (capref_is_null(remote_cap)) {
-                debug_printf("remote_cap is NULL\n");
-                return;
-            }
-
-            rpc->return_cap = remote_cap;
-            rpc->ret_bits = msg.buf.words[1];
-            break;
-        }
 
         case SERIAL_PUT_CHAR:
         {
@@ -166,56 +304,48 @@ static void init_recv_handler(void *rpc_void)
 
         case SERIAL_GET_CHAR:
         {
-            rpc->msg_buf[0] = msg.buf.words[1];
-            break;
-        }
-
-        case PROCESS_SPAWN:
-        {
-            // expecting a pid to be returned and success/failure
-            rpc->msg_buf[0] = (char)msg.buf.words[1];
-            if (msg.buf.words[1] == true) {
-                rpc->msg_buf[1] = (char)msg.buf.words[2];
-            }
-            
+            rpc->msg_buf[0] = msg->words[0];
             break;
         }
 
-        case PROCESS_GET_NAME:
+        case SERIAL_READ_LINE:
         {
-            // if this event is triggered, check the buffer for the full
-            // text.
+            rpc->serial_reply = msg->words[0];
+            size_t n = MIN(rpc->serial_reply & ~AOS_RPC_SERIAL_EOL,
+                           AOS_RPC_SERIAL_CHUNK);
+            memcpy(rpc->msg_buf, &msg->words[1], n);
             rpc->wait_event = false;
             break;
         }
 
-        case PROCESS_GET_NO_OF_PIDS:
+        default:
         {
-            rpc->msg_buf[0] = (char) msg.buf.words[1];
-            break;
+            return false;
         }
+    }
 
-        case PROCESS_GET_PID:
-        {
-            rpc->msg_buf[0] = (char) msg.buf.words[1];
-            break;
-        }
-        default:
-        {
-            debug_printf("Wrong rpc code!\n");
+    return true;
+}
 
-        }
+static void init_recv_handler(void *rpc_void) 
+{
+    struct aos_rpc *rpc = (struct aos_rpc *)rpc_void;
+    struct capref remote_cap = NULL_CAP;
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    uint32_t code;
+    uint16_t seq;
+
+    errval_t err = aos_retrieve_tagged_msg(&rpc->init_lc, &remote_cap, &code,
+                                           &seq, &msg);
+    if (err_is_fail(err)) {
+        debug_printf("Could not receive msg from init: %s\n",
+            err_getstring(err));
+        err_print_calltrace(err);
+        return;
     }
 
-    // Re-allocate
-    if (!capref_is_null(remote_cap)){
-        err = lmp_chan_alloc_recv_slot(&rpc->init_lc);
-        if (err_is_fail(err)){
-            debug_printf("Could not allocate receive slot: %s.\n",
-                err_getstring(err));
-            err_print_calltrace(err);
-            return;
-        }
+    if (!aos_rpc_init_reply(rpc, code, seq, &msg, remote_cap)) {
+        debug_printf("Wrong rpc code!\n");
     }
     
     // Register our receive handler
@@ -228,6 +358,11 @@ static void init_recv_handler(void *rpc_void)
     }
 }
 
+void aos_rpc_set_timeout(struct aos_rpc *chan, delayus_t timeout)
+{
+    chan->timeout = timeout;
+}
+
 errval_t aos_rpc_send_string(struct aos_rpc *rpc, const char *string)
 {
     struct lmp_chan init_lc = rpc->init_lc;
@@ -270,23 +405,28 @@ errval_t aos_rpc_get_ram_cap(struct aos_rpc *rpc, size_t req_bits,
     }
     
     // Request frame cap from init
+    struct aos_rpc_call call;
+    uint16_t seq = rpc_begin(rpc, AOS_RPC_INIT, &call);
     err = lmp_chan_send2(&rpc->init_lc, LMP_SEND_FLAGS_DEFAULT,
-                         NULL_CAP, REQUEST_RAM_CAP,
-                         req_bits); // TODO transfer error code
+                         NULL_CAP, AOS_RPC_TAG(REQUEST_RAM_CAP, seq),
+                         req_bits);
     
     if (err_is_fail(err)) {
+        rpc_end(rpc, &call);
         debug_printf("Could not send msg to init: %s.\n",
             err_getstring(err));
         err_print_calltrace(err);
         return err_push(err, LIB_ERR_LMP_CHAN_SEND);
     }
 
-    // Listen for response from init. When recv_handler returns,
-    // cap should be in rpc->return_cap
-    event_dispatch(get_default_waitset());
+    // Listen for response from init, with the cap and its size
+    err = rpc_wait(rpc, &call, rpc_deadline(rpc));
+    if (err_is_fail(err)) {
+        return err;
+    }
 
-    *dest = rpc->return_cap;
-    *ret_bits = rpc->ret_bits;
+    *dest = call.cap;
+    *ret_bits = call.ret[0];
     
     return SYS_ERR_OK;
 }
@@ -308,20 +448,25 @@ errval_t aos_rpc_get_dev_cap(struct aos_rpc *rpc, lpaddr_t paddr,
     }
 
     // Send request to init
+    struct aos_rpc_call call;
+    uint16_t seq = rpc_begin(rpc, AOS_RPC_INIT, &call);
     err = lmp_chan_send3(&rpc->init_lc, LMP_SEND_FLAGS_DEFAULT,
-                         NULL_CAP, REQUEST_DEV_CAP, paddr,
+                         NULL_CAP, AOS_RPC_TAG(REQUEST_DEV_CAP, seq), paddr,
                          length);
     
     if (err_is_fail(err)) {
+        rpc_end(rpc, &call);
         debug_printf("Could not send dev cap request to init: %s.\n",
             err_getstring(err));
         err_print_calltrace(err);
         return err_push(err, LIB_ERR_LMP_CHAN_SEND);
     }
 
-    // Listen for response from init. When recv_handler returns,
-    // cap should be in rpc->return_cap
-    event_dispatch(get_default_waitset());
+    // Listen for response from init, with the cap
+    err = rpc_wait(rpc, &call, rpc_deadline(rpc));
+    if (err_is_fail(err)) {
+        return err;
+    }
 
     /* MEMORY STUFF HAPPENS HERE */
 
@@ -346,8 +491,8 @@ errval_t aos_rpc_get_dev_cap(struct aos_rpc *rpc, lpaddr_t paddr,
     //     err_print_calltrace(err);
     // }
 
-    *retcap = rpc->return_cap;
-    *retlen = rpc->ret_bits;
+    *retcap = call.cap;
+    *retlen = call.ret[0];
     
     return SYS_ERR_OK;
 }
@@ -371,8 +516,12 @@ errval_t aos_rpc_serial_getchar(struct aos_rpc *chan, char *retc)
     }
 
     // listen for response from init. When recv_handler returns,
-    // character should be in chan->msg_buf[2]
-    event_dispatch(get_default_waitset());
+    // character should be in chan->msg_buf[2]. Input takes as long as it
+    // takes, there is no deadline.
+    err = rpc_dispatch(0);
+    if (err_is_fail(err)) {
+        return err;
+    }
     
     *retc = chan->msg_buf[0];
 
@@ -396,38 +545,101 @@ errval_t aos_rpc_serial_putchar(struct aos_rpc *chan, char c)
     return SYS_ERR_OK;
 }
 
+errval_t aos_rpc_serial_write(struct aos_rpc *chan, const char *buf,
+                              size_t len)
+{
+    while (len > 0) {
+        uintptr_t w[7] = { 0 };
+        size_t n = MIN(len, AOS_RPC_SERIAL_CHUNK);
+        memcpy(w, buf, n);
+
+        errval_t err;
+        do {
+            err = lmp_chan_send9(&chan->init_lc, LMP_SEND_FLAGS_DEFAULT,
+                                 NULL_CAP, SERIAL_WRITE, n, w[0], w[1], w[2],
+                                 w[3], w[4], w[5], w[6]);
+            if (lmp_err_is_transient(err)) {
+                // init's endpoint is full, let it drain
+                thread_yield_dispatcher(chan->init_lc.remote_cap);
+            }
+        } while (lmp_err_is_transient(err));
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_LMP_CHAN_SEND);
+        }
+
+        buf += n;
+        len -= n;
+    }
+
+    return SYS_ERR_OK;
+}
+
+errval_t aos_rpc_serial_read(struct aos_rpc *chan, char *buf, size_t len,
+                             size_t *retlen)
+{
+    size_t got = 0;
+    bool eol = false;
+
+    while (got < len && !eol) {
+        size_t want = MIN(len - got, AOS_RPC_SERIAL_CHUNK);
+        errval_t err = lmp_chan_send2(&chan->init_lc, LMP_SEND_FLAGS_DEFAULT,
+                                      NULL_CAP, SERIAL_READ_LINE, want);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_LMP_CHAN_SEND);
+        }
+
+        // init answers once a line has been entered, no deadline
+        chan->wait_event = true;
+        while (chan->wait_event) {
+            err = rpc_dispatch(0);
+            if (err_is_fail(err)) {
+                chan->wait_event = false;
+                return err;
+            }
+        }
+
+        size_t n = MIN(chan->serial_reply & ~AOS_RPC_SERIAL_EOL, want);
+        memcpy(buf + got, chan->msg_buf, n);
+        got += n;
+        eol = chan->serial_reply & AOS_RPC_SERIAL_EOL;
+    }
+
+    *retlen = got;
+    return SYS_ERR_OK;
+}
+
 errval_t aos_rpc_process_spawn(struct aos_rpc *chan, char *name,
                                coreid_t coreid, domainid_t *newpid)
 {
     // TODO (milestone 5): implement spawn new process rpc
-    struct lmp_chan spawnd_lc = chan->spawnd_lc;
     errval_t err;
 
+    struct aos_rpc_call call;
+    uint16_t seq = rpc_begin(chan, AOS_RPC_SPAWND, &call);
     err = aos_chan_send_string(&chan->spawnd_lc, name);
 
     if (err_is_fail(err)) {
+        rpc_end(chan, &call);
         DEBUG_ERR(err, "fail to send process name to init.\n");
         return err;
     }
 
-    err = lmp_chan_send2(&spawnd_lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, 
-        PROCESS_SPAWN, coreid);
+    err = lmp_chan_send2(&chan->spawnd_lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+        AOS_RPC_TAG(PROCESS_SPAWN, seq), coreid);
 
     if (err_is_fail(err)) {
+        rpc_end(chan, &call);
         DEBUG_ERR(err, "fail to send PROCESS_SPAWN event to init.\n");
         return err;
     }
 
-    event_dispatch(get_default_waitset());
-
-    if (chan->msg_buf[0] == true) {
-        *newpid = chan->msg_buf[1];
-    } else {
-        debug_printf("spawn failed.\n");
+    // spawnd replies with its error and the pid
+    err = rpc_wait(chan, &call, rpc_deadline(chan));
+    if (err_is_fail(err)) {
+        return err;
     }
 
-    clean_aos_rpc_msgbuf(chan);
-
+    *newpid = call.ret[0];
     return SYS_ERR_OK;
 }
 
@@ -438,16 +650,21 @@ errval_t aos_rpc_process_get_name(struct aos_rpc *chan, domainid_t pid,
     // id
     errval_t err;
 
+    struct aos_rpc_call call;
+    uint16_t seq = rpc_begin(chan, AOS_RPC_SPAWND, &call);
     err = lmp_chan_send2(&chan->spawnd_lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, 
-        PROCESS_GET_NAME, pid);
+        AOS_RPC_TAG(PROCESS_GET_NAME, seq), pid);
     if (err_is_fail(err)) {
+        rpc_end(chan, &call);
         DEBUG_ERR(err, "fail to send PROCESS_GET_NAME event to init.\n");
         return err;
     }
 
-    chan->wait_event = true;
-    while (chan->wait_event) {
-        event_dispatch(get_default_waitset());
+    err = rpc_wait(chan, &call, rpc_deadline(chan));
+    if (err_is_fail(err)) {
+        chan->char_count = 0;
+        clean_aos_rpc_msgbuf(chan);
+        return err;
     }
     
     memcpy(*name, chan->msg_buf, strlen((char *)chan->msg_buf));
@@ -458,89 +675,426 @@ errval_t aos_rpc_process_get_name(struct aos_rpc *chan, domainid_t pid,
 }
 
 
+errval_t aos_rpc_process_get_no_of_pids(struct aos_rpc *chan,
+                                        size_t *pid_count)
+{
+    errval_t err;
+
+    struct aos_rpc_call call;
+    uint16_t seq = rpc_begin(chan, AOS_RPC_SPAWND, &call);
+    err = lmp_chan_send1(&chan->spawnd_lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+        AOS_RPC_TAG(PROCESS_GET_NO_OF_PIDS, seq));
+    if (err_is_fail(err)) {
+        rpc_end(chan, &call);
+        DEBUG_ERR(err, "fail to send PROCESS_GET_NO_OF_PIDS event to init.\n");
+        return err;
+    }
+
+    err = rpc_wait(chan, &call, rpc_deadline(chan));
+    if (err_is_fail(err)) {
+        return err;
+    }
+    *pid_count = call.ret[0];
+    return SYS_ERR_OK;
+}
+
+errval_t aos_rpc_process_get_all(struct aos_rpc *chan,
+                                 struct aos_ps_entry **ps, size_t *count)
+{
+    errval_t err;
+
+    chan->ps_list = NULL;
+    chan->ps_len = 0;
+    chan->ps_count = 0;
+
+    struct aos_rpc_call call;
+    uint16_t seq = rpc_begin(chan, AOS_RPC_SPAWND, &call);
+    err = lmp_chan_send1(&chan->spawnd_lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+        AOS_RPC_TAG(PROCESS_GET_ALL, seq));
+    if (err_is_fail(err)) {
+        rpc_end(chan, &call);
+        return err_push(err, LIB_ERR_LMP_CHAN_SEND);
+    }
+
+    err = rpc_wait(chan, &call, rpc_deadline(chan));
+    if (err_is_fail(err)) {
+        free(chan->ps_list);
+        chan->ps_list = NULL;
+        return err;
+    }
+
+    if (chan->ps_list == NULL || chan->ps_len < chan->ps_count) {
+        // could not allocate the list, or spawnd sent fewer than announced
+        free(chan->ps_list);
+        chan->ps_list = NULL;
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    *ps = chan->ps_list;
+    *count = chan->ps_len;
+    chan->ps_list = NULL;
+    return SYS_ERR_OK;
+}
+
 errval_t aos_rpc_process_get_all_pids(struct aos_rpc *chan,
                                       domainid_t **pids, size_t *pid_count)
+{
+    struct aos_ps_entry *ps;
+    size_t count;
+
+    errval_t err = aos_rpc_process_get_all(chan, &ps, &count);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    *pids = malloc(count * sizeof(domainid_t));
+    if (*pids == NULL) {
+        free(ps);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        (*pids)[i] = ps[i].pid;
+    }
+    *pid_count = count;
+
+    free(ps);
+    return SYS_ERR_OK;
+}
+
+static void fs_recv_handler(void *rpc_void)
+{
+    struct aos_rpc *rpc = (struct aos_rpc *)rpc_void;
+    struct capref remote_cap;
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    uint32_t rpc_code;
+    uint16_t seq;
+
+    errval_t err = aos_retrieve_tagged_msg(&rpc->fs_lc, &remote_cap,
+                                           &rpc_code, &seq, &msg);
+    lmp_chan_register_recv(&rpc->fs_lc, get_default_waitset(),
+        MKCLOSURE(fs_recv_handler, rpc));
+    if (err_is_fail(err)) {
+        // nothing to tell which call it was for, its deadline ends it
+        return;
+    }
+
+    struct aos_rpc_call *call = rpc_find(rpc, AOS_RPC_FS, seq);
+    if (call == NULL) {
+        if (seq == rpc->fs_stale) {
+            rpc->fs_stale = 0;
+        }
+        rpc_drop(remote_cap);
+        return;
+    }
+
+    err = msg.words[0];
+    if (rpc_code == REGISTER_CHANNEL && err_is_ok(err)) {
+        // the server's endpoint for this client alone
+        if (capref_is_null(remote_cap)) {
+            err = AOS_ERR_FS_UNAVAILABLE;
+        } else {
+            rpc->fs_lc.remote_cap = remote_cap;
+        }
+    }
+    call->ret[0] = msg.words[1];
+    call->ret[1] = msg.words[2];
+    rpc_done(call, err);
+}
+
+/**
+ * \brief Send a request to the file server and wait for its reply
+ *
+ * \return the error of the server, results are in rpc->fs_ret
+ */
+static errval_t fs_call(struct aos_rpc *rpc, struct capref cap,
+                        uintptr_t code, uintptr_t a, uintptr_t b, uintptr_t c)
 {
     errval_t err;
 
-    err = lmp_chan_send1(&chan->spawnd_lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, 
-        PROCESS_GET_NO_OF_PIDS);
+    struct aos_rpc_call call;
+    uint16_t seq = rpc_begin(rpc, AOS_RPC_FS, &call);
+    do {
+        err = lmp_chan_send4(&rpc->fs_lc, LMP_SEND_FLAGS_DEFAULT, cap,
+                             AOS_RPC_TAG(code, seq), a, b, c);
+        if (lmp_err_is_transient(err)) {
+            thread_yield_dispatcher(rpc->fs_lc.remote_cap);
+        }
+    } while (lmp_err_is_transient(err));
+    if (err_is_fail(err)) {
+        rpc_end(rpc, &call);
+        return err_push(err, LIB_ERR_LMP_CHAN_SEND);
+    }
+
+    err = rpc_wait(rpc, &call, rpc_deadline(rpc));
+    rpc->fs_ret[0] = call.ret[0];
+    rpc->fs_ret[1] = call.ret[1];
+    return err;
+}
+
+/**
+ * \brief Connect to the file server, unless this was done before
+ *
+ * Init tells us where the server is. We get a channel of our own from it
+ * and share a frame with it that carries paths and data.
+ *
+ * A call that gave up on its reply may still have the server read or write
+ * the frame, so we wait for that reply before the frame is used again.
+ */
+static errval_t fs_connect(struct aos_rpc *rpc)
+{
+    errval_t err;
+
+    systime_t deadline = rpc_deadline(rpc);
+    while (rpc->fs_stale != 0) {
+        err = rpc_dispatch(deadline);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    if (rpc->fs_bulk != NULL) {
+        return SYS_ERR_OK;
+    }
+
+    err = lmp_chan_alloc_recv_slot(&rpc->init_lc);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_LMP_ALLOC_RECV_SLOT);
+    }
+    struct aos_rpc_call call;
+    uint16_t seq = rpc_begin(rpc, AOS_RPC_INIT, &call);
+    err = lmp_chan_send1(&rpc->init_lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+                         AOS_RPC_TAG(FS_CONNECT, seq));
+    if (err_is_fail(err)) {
+        rpc_end(rpc, &call);
+        return err_push(err, LIB_ERR_LMP_CHAN_SEND);
+    }
+
+    err = rpc_wait(rpc, &call, rpc_deadline(rpc));
     if (err_is_fail(err)) {
-        DEBUG_ERR(err, "fail to send PROCESS_GET_ALL_PIDS event to init.\n");
         return err;
     }
+    if (capref_is_null(call.cap)) {
+        return AOS_ERR_FS_UNAVAILABLE;
+    }
 
-    // 1. get pid_count
-    event_dispatch(get_default_waitset());
-    *pid_count = chan->msg_buf[0];
+    if (capref_is_null(rpc->fs_lc.local_cap)) {
+        err = aos_setup_channel(&rpc->fs_lc, call.cap,
+                                MKCLOSURE(fs_recv_handler, rpc));
+        if (err_is_fail(err)) {
+            return err;
+        }
+    } else {
+        rpc->fs_lc.remote_cap = call.cap;
+    }
 
-    // clean_aos_rpc_msgbuf(chan);
-    err = paging_alloc(get_current_paging_state(),
-                       (void**) pids,
-                       *pid_count * sizeof(domainid_t));
-    if (err_is_fail(err)){
-        // FIXME push err to stack and return
-        err_print_calltrace(err);
-        abort();
+    err = fs_call(rpc, rpc->fs_lc.local_cap, REGISTER_CHANNEL, 0, 0, 0);
+    if (err_is_fail(err)) {
+        return err;
     }
-    
-    domainid_t *pids_deref = *pids;
 
-    
-    // 2. TO BE OPTIMIZED: Right now ask for pids one at a time instead of
-    //    getting as many as possible in each msg
-    for (size_t i = 0; i < *pid_count; i++) {
-        lmp_chan_send2(&chan->spawnd_lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
-            PROCESS_GET_PID, i);
-        event_dispatch(get_default_waitset());
-        pids_deref[i] = chan->msg_buf[0];
+    struct capref frame;
+    size_t size;
+    void *bulk;
+    err = frame_alloc(&frame, AOS_RPC_FS_BULK_SIZE, &size);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
+    err = paging_map_frame(get_current_paging_state(), &bulk, size, frame,
+                           NULL, NULL);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_VSPACE_MAP);
+    }
+
+    err = fs_call(rpc, frame, FS_SHARE_FRAME, size, 0, 0);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    rpc->fs_bulk = bulk;
+    return SYS_ERR_OK;
+}
+
+/// Connect and put \p path into the shared frame
+static errval_t fs_put_path(struct aos_rpc *rpc, const char *path,
+                            size_t *len)
+{
+    errval_t err = fs_connect(rpc);
+    if (err_is_fail(err)) {
+        return err;
     }
+
+    *len = strlen(path);
+    if (*len >= AOS_RPC_FS_PATH_MAX) {
+        return FS_ERR_NOTFOUND;
+    }
+    memcpy(rpc->fs_bulk, path, *len + 1);
     return SYS_ERR_OK;
 }
 
 errval_t aos_rpc_open(struct aos_rpc *chan, char *path, int *fd)
 {
-    // TODO (milestone 7): implement file open
+    uint32_t version;
+    return aos_rpc_open_version(chan, path, fd, &version);
+}
+
+errval_t aos_rpc_open_version(struct aos_rpc *chan, char *path, int *fd,
+                              uint32_t *version)
+{
+    size_t len;
+    errval_t err = fs_put_path(chan, path, &len);
+    if (err_is_ok(err)) {
+        err = fs_call(chan, NULL_CAP, FS_OPEN, len, 0, 0);
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    *fd = chan->fs_ret[0];
+    *version = chan->fs_ret[1];
     return SYS_ERR_OK;
 }
 
 errval_t aos_rpc_readdir(struct aos_rpc *chan, char* path,
                          struct aos_dirent **dir, size_t *elem_count)
 {
-    // TODO (milestone 7): implement readdir
+    struct aos_dirent *entries = NULL;
+    size_t count = 0;
+    uintptr_t cursor = 0;
+    errval_t err;
+
+    // the server answers with as many entries as fit into the frame, and
+    // where to go on
+    do {
+        size_t len;
+        err = fs_put_path(chan, path, &len);
+        if (err_is_ok(err)) {
+            err = fs_call(chan, NULL_CAP, FS_READDIR, len, cursor, 0);
+        }
+        if (err_is_fail(err)) {
+            free(entries);
+            return err;
+        }
+
+        size_t n = chan->fs_ret[0];
+        if (n > 0) {
+            struct aos_dirent *more = realloc(entries,
+                                              (count + n) * sizeof(*entries));
+            if (more == NULL) {
+                free(entries);
+                return LIB_ERR_MALLOC_FAIL;
+            }
+            entries = more;
+            memcpy(entries + count, chan->fs_bulk, n * sizeof(*entries));
+            count += n;
+        }
+        cursor = chan->fs_ret[1];
+    } while (cursor != 0);
+
+    *dir = entries;
+    *elem_count = count;
     return SYS_ERR_OK;
 }
 
+errval_t aos_rpc_read_into(struct aos_rpc *chan, int fd, size_t position,
+                           size_t size, void *buf, size_t *buflen)
+{
+    uint8_t *data = buf;
+    size_t got = 0;
+
+    *buflen = 0;
+    errval_t err = fs_connect(chan);
+    while (err_is_ok(err) && got < size) {
+        size_t n = MIN(size - got, AOS_RPC_FS_BULK_SIZE);
+        err = fs_call(chan, NULL_CAP, FS_READ, fd, position + got, n);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        size_t ret = MIN(chan->fs_ret[0], n);
+        memcpy(data + got, chan->fs_bulk, ret);
+        got += ret;
+        if (ret < n) {
+            break;  // end of file
+        }
+    }
+
+    *buflen = got;
+    return err;
+}
+
 errval_t aos_rpc_read(struct aos_rpc *chan, int fd, size_t position, size_t size,
                       void** buf, size_t *buflen)
 {
-    // TODO (milestone 7): implement file read
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (data == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    errval_t err = aos_rpc_read_into(chan, fd, position, size, data, buflen);
+    if (err_is_fail(err)) {
+        free(data);
+        return err;
+    }
+
+    *buf = data;
     return SYS_ERR_OK;
 }
 
 errval_t aos_rpc_close(struct aos_rpc *chan, int fd)
 {
-    // TODO (milestone 7): implement file close
-    return SYS_ERR_OK;
+    errval_t err = fs_connect(chan);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    return fs_call(chan, NULL_CAP, FS_CLOSE, fd, 0, 0);
 }
 
 errval_t aos_rpc_write(struct aos_rpc *chan, int fd, size_t position, size_t *size,
                        void *buf, size_t buflen)
 {
-    // TODO (milestone 7): implement file write
-    return SYS_ERR_OK;
+    size_t done = 0;
+    errval_t err = fs_connect(chan);
+    while (err_is_ok(err) && done < buflen) {
+        size_t n = MIN(buflen - done, AOS_RPC_FS_BULK_SIZE);
+        memcpy(chan->fs_bulk, (uint8_t *)buf + done, n);
+        err = fs_call(chan, NULL_CAP, FS_WRITE, fd, position + done, n);
+        if (err_is_fail(err)) {
+            break;
+        }
+
+        done += MIN(chan->fs_ret[0], n);
+        if (chan->fs_ret[0] < n) {
+            break;
+        }
+    }
+
+    *size = done;
+    return err;
 }
 
 errval_t aos_rpc_create(struct aos_rpc *chan, char *path, int *fd)
 {
-    // TODO (milestone 7): implement file create
+    size_t len;
+    errval_t err = fs_put_path(chan, path, &len);
+    if (err_is_ok(err)) {
+        err = fs_call(chan, NULL_CAP, FS_CREATE, len, 0, 0);
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    *fd = chan->fs_ret[0];
     return SYS_ERR_OK;
 }
 
 errval_t aos_rpc_delete(struct aos_rpc *chan, char *path)
 {
-    // TODO (milestone 7): implement file delete
-    return SYS_ERR_OK;
+    size_t len;
+    errval_t err = fs_put_path(chan, path, &len);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    return fs_call(chan, NULL_CAP, FS_DELETE, len, 0, 0);
 }
 
 // 
@@ -620,7 +1174,28 @@ errval_t aos_retrieve_msg(struct lmp_chan *lc, struct capref *remote_cap,
     return SYS_ERR_OK;
 }
 
+errval_t aos_retrieve_tagged_msg(struct lmp_chan *lc, struct capref *remote_cap,
+                                 uint32_t *rpc_code, uint16_t *seq,
+                                 struct lmp_recv_msg *msg)
+{
+    errval_t err = aos_retrieve_msg(lc, remote_cap, rpc_code, msg);
+    if (err_is_fail(err) || msg->buf.msglen == 0) {
+        *seq = 0;
+        return err;
+    }
+
+    *seq = *rpc_code >> AOS_RPC_SEQ_SHIFT;
+    *rpc_code &= AOS_RPC_CODE_MASK;
+    return SYS_ERR_OK;
+}
+
 errval_t aos_chan_send_string(struct lmp_chan *lc, const char *string)
+{
+    return aos_chan_send_tagged_string(lc, string, 0);
+}
+
+errval_t aos_chan_send_tagged_string(struct lmp_chan *lc, const char *string,
+                                     uint16_t seq)
 {
     size_t slen = strlen(string) + 1; // adjust for null-character
     size_t rlen = 0;
@@ -631,8 +1206,8 @@ errval_t aos_chan_send_string(struct lmp_chan *lc, const char *string)
         size_t chunk_size = ((slen-rlen) < 8) ? (slen-rlen) : 8;
         memcpy(buf, string, chunk_size);
         err = lmp_chan_send(lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
-                            9, SEND_TEXT, buf[0], buf[1], buf[2],
-                            buf[3], buf[4], buf[5], buf[6], buf[7]);
+                            9, AOS_RPC_TAG(SEND_TEXT, seq), buf[0], buf[1],
+                            buf[2], buf[3], buf[4], buf[5], buf[6], buf[7]);
 
         if (err_is_fail(err)) {
             return err;
@@ -659,6 +1234,10 @@ errval_t aos_rpc_init(struct aos_rpc *rpc)
     waitset_init(ws);
 
     rpc->char_count = 0;
+    rpc->timeout = AOS_RPC_DEFAULT_TIMEOUT;
+    memset(rpc->seq, 0, sizeof(rpc->seq));
+    memset(rpc->calls, 0, sizeof(rpc->calls));
+    rpc->fs_stale = 0;
 
     // register in paging state
     struct paging_state *st = get_current_paging_state();
@@ -686,24 +1265,40 @@ errval_t aos_rpc_init(struct aos_rpc *rpc)
         return err;
     }
 
+    // spawnd keeps talking to init over the endpoint it was spawned with,
+    // it does not wait for the new one
+    bool spawnd = strcmp("spawnd", disp_name()) == 0;
+    struct aos_rpc_call call;
+    uint16_t seq = spawnd ? 0 : rpc_begin(rpc, AOS_RPC_INIT, &call);
+
     // Register channel at init
     err = lmp_chan_send2(&rpc->init_lc, LMP_SEND_FLAGS_DEFAULT,
-                         rpc->init_lc.local_cap, REGISTER_CHANNEL,
+                         rpc->init_lc.local_cap,
+                         AOS_RPC_TAG(REGISTER_CHANNEL, seq),
                          disp_get_domain_id());
     if (err_is_fail(err)) {
+        if (!spawnd) {
+            rpc_end(rpc, &call);
+        }
         debug_printf("Could not register by init.\n");
         err_print_calltrace(err);
         return err;
     }
     
     
-    if (strcmp("spawnd", disp_name()) == 0){
+    if (spawnd){
         debug_printf("spawnd rpc setup done.\n");
         return SYS_ERR_OK;
     }
     
     // Wait for init to send back new, dedicated endpoint
-    event_dispatch(get_default_waitset());
+    err = rpc_wait(rpc, &call, rpc_deadline(rpc));
+    if (err_is_fail(err)) {
+        debug_printf("No endpoint from init.\n");
+        err_print_calltrace(err);
+        return err;
+    }
+    rpc->init_lc.remote_cap = call.cap;
 
     // Register channel at spawnd
     err = lmp_chan_send1(&rpc->spawnd_lc, LMP_SEND_FLAGS_DEFAULT,
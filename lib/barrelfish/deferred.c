@@ -27,16 +27,145 @@
 // kludge: the kernel currently reports time in ms rather than us
 #define SYSTIME_MULTIPLIER 1000
 
+#define WHEEL_BITS      DEFERRED_WHEEL_BITS
+#define WHEEL_SLOTS     DEFERRED_WHEEL_SLOTS
+#define WHEEL_LEVELS    DEFERRED_WHEEL_LEVELS
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+
+/// Largest delay (in ticks) that fits in the wheel without being clamped
+#define WHEEL_MAX_DELTA ((systime_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+/// Tick at which an event due at the given time (in us) has to fire
+static inline systime_t expiry_tick(systime_t time)
+{
+    return (time + SYSTIME_MULTIPLIER - 1) / SYSTIME_MULTIPLIER;
+}
+
+/**
+ * \brief Insert an event into the timer wheel
+ *
+ * Events less than 64 ticks away go to level 0, indexed by their expiry
+ * tick. Events further away go to the level whose slots span their delay and
+ * are cascaded to a lower level when the wheel reaches the start of their
+ * slot. Events beyond the range of the wheel park in the farthest slot and
+ * are reinserted from their real expiry time when that slot cascades.
+ *
+ * \param wheel Timer wheel
+ * \param event Event to insert
+ * \param exp   Expiry tick, which must not be before the wheel's current tick
+ */
+static void wheel_insert(struct deferred_wheel *wheel,
+                         struct deferred_event *event, systime_t exp)
+{
+    assert(exp >= wheel->now);
+    systime_t delta = exp - wheel->now;
+    if (delta >= WHEEL_MAX_DELTA) {
+        delta = WHEEL_MAX_DELTA - 1;
+        exp = wheel->now + delta;
+    }
+
+    int level = 0;
+    while (delta >= ((systime_t)1 << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    unsigned slot = (exp >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+    struct deferred_event **head = &wheel->slots[level][slot];
+    event->prev = NULL;
+    event->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = event;
+    }
+    *head = event;
+    event->slot = head;
+    wheel->occupied[level] |= (uint64_t)1 << slot;
+    wheel->count++;
+}
+
+/// Unlink an event from its timer wheel slot
+static void wheel_remove(struct deferred_wheel *wheel,
+                         struct deferred_event *event)
+{
+    assert(event->slot != NULL);
+    if (event->prev == NULL) {
+        assert(*event->slot == event);
+        *event->slot = event->next;
+    } else {
+        event->prev->next = event->next;
+    }
+    if (event->next != NULL) {
+        event->next->prev = event->prev;
+    }
+
+    if (*event->slot == NULL) {
+        size_t idx = event->slot - &wheel->slots[0][0];
+        wheel->occupied[idx / WHEEL_SLOTS] &=
+            ~((uint64_t)1 << (idx % WHEEL_SLOTS));
+    }
+    event->slot = NULL;
+    event->next = event->prev = NULL;
+    wheel->count--;
+}
+
+/// Detach and return the whole list of events in a slot
+static struct deferred_event *wheel_take_slot(struct deferred_wheel *wheel,
+                                              int level, unsigned slot)
+{
+    struct deferred_event *list = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~((uint64_t)1 << slot);
+    for (struct deferred_event *e = list; e != NULL; e = e->next) {
+        e->slot = NULL;
+        wheel->count--;
+    }
+    return list;
+}
+
+/// Number of slots from 'from' to the next occupied slot, or -1 if none
+static inline int next_occupied(uint64_t occupied, unsigned from)
+{
+    if (occupied == 0) {
+        return -1;
+    }
+    uint64_t rotated = from == 0 ? occupied
+        : (occupied >> from) | (occupied << (WHEEL_SLOTS - from));
+    return __builtin_ctzll(rotated);
+}
+
+/**
+ * \brief Next tick at which the wheel has work to do
+ *
+ * This is either the expiry of a level 0 slot or the cascade of a higher
+ * level slot, so it is a lower bound for the next event to fire.
+ *
+ * \return Tick, or 0 if the wheel is empty
+ */
+static systime_t wheel_next_tick(struct deferred_wheel *wheel)
+{
+    systime_t next = 0;
+
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        systime_t base = ((wheel->now >> shift) + 1) << shift;
+        int d = next_occupied(wheel->occupied[level],
+                              (base >> shift) & WHEEL_MASK);
+        if (d >= 0) {
+            systime_t tick = base + ((systime_t)d << shift);
+            if (next == 0 || tick < next) {
+                next = tick;
+            }
+        }
+    }
+
+    return next;
+}
+
 static void update_wakeup_disabled(dispatcher_handle_t dh)
 {
     struct dispatcher_generic *dg = get_dispatcher_generic(dh);
     struct dispatcher_shared_generic *ds = get_dispatcher_shared_generic(dh);
 
-    if (dg->deferred_events == NULL) {
-        ds->wakeup = 0;
-    } else {
-        ds->wakeup = dg->deferred_events->time / SYSTIME_MULTIPLIER;
-    }
+    ds->wakeup = wheel_next_tick(&dg->deferred_wheel);
 }
 
 /**
@@ -54,6 +183,7 @@ void deferred_event_init(struct deferred_event *event)
     assert(event != NULL);
     waitset_chanstate_init(&event->waitset_state, CHANTYPE_DEFERRED);
     event->next = event->prev = NULL;
+    event->slot = NULL;
     event->time = 0;
 }
 
@@ -75,33 +205,22 @@ errval_t deferred_event_register(struct deferred_event *event,
     err = waitset_chan_register_disabled(ws, &event->waitset_state, closure);
     if (err_is_ok(err)) {
         struct dispatcher_generic *dg = get_dispatcher_generic(dh);
+        struct deferred_wheel *wheel = &dg->deferred_wheel;
 
         // XXX: determine absolute time for event (ignoring time since dispatch!)
         event->time = get_system_time() + delay;
 
-        // enqueue in sorted list of pending timers
-        for (struct deferred_event *e = dg->deferred_events, *p = NULL; ;
-             p = e, e = e->next) {
-            if (e == NULL || e->time > event->time) {
-                if (p == NULL) { // insert at head
-                    assert(e == dg->deferred_events);
-                    event->prev = NULL;
-                    event->next = e;
-                    if (e != NULL) {
-                        e->prev = event;
-                    }
-                    dg->deferred_events = event;
-                } else {
-                    event->next = e;
-                    event->prev = p;
-                    p->next = event;
-                    if (e != NULL) {
-                        e->prev = event;
-                    }
-                }
-                break;
-            }
+        // an idle wheel may lag behind: restart it at the current time
+        if (wheel->count == 0) {
+            wheel->now = get_dispatcher_shared_generic(dh)->systime;
+        }
+
+        // the current tick has already been processed, so fire at the next
+        systime_t exp = expiry_tick(event->time);
+        if (exp <= wheel->now) {
+            exp = wheel->now + 1;
         }
+        wheel_insert(wheel, event, exp);
     }
 
     update_wakeup_disabled(dh);
@@ -112,24 +231,19 @@ errval_t deferred_event_register(struct deferred_event *event,
 }
 
 /**
- * \brief Cancel a deferred event that has not yet fired
+ * \brief Cancel a deferred event that has not yet been dispatched
+ *
+ * Takes constant time. An event that has fired but whose closure has not
+ * run yet is withdrawn from its waitset.
  */
 errval_t deferred_event_cancel(struct deferred_event *event)
 {
     dispatcher_handle_t dh = disp_disable();
     errval_t err = waitset_chan_deregister_disabled(&event->waitset_state);
-    if (err_is_ok(err)) {
-        // remove from dispatcher queue
+    if (err_is_ok(err) && event->slot != NULL) {
+        // not yet fired: remove from the timer wheel
         struct dispatcher_generic *disp = get_dispatcher_generic(dh);
-        if (event->prev == NULL) {
-            assert(disp->deferred_events == event);
-            disp->deferred_events = event->next;
-        } else {
-            event->prev->next = event->next;
-        }
-        if (event->next != NULL) {
-            event->next->prev = event->prev;
-        }
+        wheel_remove(&disp->deferred_wheel, event);
         update_wakeup_disabled(dh);
     }
 
@@ -184,18 +298,43 @@ errval_t periodic_event_cancel(struct periodic_event *event)
 void trigger_deferred_events_disabled(dispatcher_handle_t dh, systime_t now)
 {
     struct dispatcher_generic *dg = get_dispatcher_generic(dh);
-    struct deferred_event *e;
+    struct deferred_wheel *wheel = &dg->deferred_wheel;
     errval_t err;
 
-    now *= SYSTIME_MULTIPLIER;
+    while (wheel->now < now) {
+        systime_t tick = wheel_next_tick(wheel);
+        if (tick == 0 || tick > now) {
+            // nothing due before 'now': skip the idle ticks
+            wheel->now = now;
+            break;
+        }
+        wheel->now = tick;
 
-    for (e = dg->deferred_events; e != NULL && e->time <= now; e = e->next) {
-        err = waitset_chan_trigger_disabled(&e->waitset_state, dh);
-        assert(err_is_ok(err));
-    }
-    dg->deferred_events = e;
-    if (e != NULL) {
-        e->prev = NULL;
+        // cascade higher level slots starting at this tick, farthest first
+        for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+            int shift = WHEEL_BITS * level;
+            if ((tick & (((systime_t)1 << shift) - 1)) != 0) {
+                continue;
+            }
+            struct deferred_event *e, *next;
+            e = wheel_take_slot(wheel, level, (tick >> shift) & WHEEL_MASK);
+            for (; e != NULL; e = next) {
+                next = e->next;
+                systime_t exp = expiry_tick(e->time);
+                wheel_insert(wheel, e, exp > tick ? exp : tick);
+            }
+        }
+
+        // fire everything that expires at this tick
+        struct deferred_event *e, *next;
+        e = wheel_take_slot(wheel, 0, tick & WHEEL_MASK);
+        for (; e != NULL; e = next) {
+            next = e->next;
+            e->next = e->prev = NULL;
+            err = waitset_chan_trigger_disabled(&e->waitset_state, dh);
+            assert(err_is_ok(err));
+        }
     }
+
     update_wakeup_disabled(dh);
 }
@@ -179,6 +179,12 @@ void disp_init_disabled(dispatcher_handle_t handle)
 
     disp_gen->cleanupthread = NULL;
     thread_mutex_init(&disp_gen->cleanupthread_lock);
+
+    disp_gen->runq_levels = 0;
+    disp_gen->free_threads = NULL;
+    disp_gen->free_threads_count = 0;
+
+    memset(&disp_gen->deferred_wheel, 0, sizeof(disp_gen->deferred_wheel));
 }
 
 /**
@@ -288,6 +294,11 @@ void disp_pagefault(dispatcher_handle_t handle, lvaddr_t fault_address,
     } else {
         fault_type = PAGEFLT_READ;
     }
+#elif defined(__arm__)
+    // the kernel passes the data fault status register, WnR tells writes
+    const uintptr_t ARM_DFSR_WNR = (1 << 11);
+
+    fault_type = (error & ARM_DFSR_WNR) ? PAGEFLT_WRITE : PAGEFLT_READ;
 #else
     //assert_print("Warning: don't know how to determine fault type on this arch!\n");
     fault_type = PAGEFLT_NULL;
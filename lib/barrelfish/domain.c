@@ -179,11 +179,10 @@ static void wakeup_thread_request(struct interdisp_binding *b,
     coreid_t core_id = disp_get_core_id();
     struct thread *wakeup = (struct thread *)(uintptr_t)taddr;
     dispatcher_handle_t handle = disp_disable();
-    struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
     /* assert_disabled(wakeup->disp == handle); */
     assert_disabled(wakeup->coreid == core_id);
     wakeup->disp = handle;
-    thread_enqueue(wakeup, &disp_gen->runq);
+    thread_runq_enqueue_disabled(handle, wakeup);
     disp_enable(handle);
 }
 
@@ -844,18 +843,19 @@ errval_t domain_thread_move_to(struct thread *thread, coreid_t core_id)
     struct dispatcher_shared_generic *disp =
         get_dispatcher_shared_generic(mydisp);
 
-    struct thread *next = thread->next;
-    thread_remove_from_queue(&disp_gen->runq, thread);
+    struct thread *follow = thread->next;
+    thread_runq_remove_disabled(mydisp, thread);
 
     errval_t err = domain_wakeup_on_coreid_disabled(core_id, thread, mydisp);
     if(err_is_fail(err)) {
-        thread_enqueue(thread, &disp_gen->runq);
+        thread_runq_enqueue_disabled(mydisp, thread);
         disp_enable(mydisp);
         return err;
     }
 
     // run the next thread, if any
-    if (next != thread) {
+    struct thread *next = thread_runq_next_disabled(mydisp, follow);
+    if (next != NULL) {
         disp_gen->current = next;
         disp_resume(mydisp, &next->regs);
     } else {
@@ -47,6 +47,7 @@ struct thread {
     arch_registers_state_t regs;            ///< Register state snapshot
     void                *stack;             ///< Malloced stack area
     void                *stack_top;         ///< Stack bounds
+    size_t              stack_bytes;        ///< Size of malloced stack area
     void                *exception_stack;   ///< Stack for exception handling
     void                *exception_stack_top; ///< Bounds of exception stack
     exception_handler_fn exception_handler; ///< Exception handler, or NULL
@@ -58,6 +59,7 @@ struct thread {
     struct thread_cond  exit_condition;     ///< Thread exit condition
     struct thread_mutex exit_lock;          ///< Protects exited state
     enum thread_state   state;              ///< Thread state
+    uint8_t             priority;           ///< Scheduling priority
     bool                paused;             ///< Thread is paused (not runnable)
     bool                detached;           ///< true if detached
     bool                joining;            ///< true if someone is joining
@@ -74,6 +76,14 @@ void thread_enqueue(struct thread *thread, struct thread **queue);
 struct thread *thread_dequeue(struct thread **queue);
 void thread_remove_from_queue(struct thread **queue, struct thread *thread);
 
+/* run queue manipulation, must only be called while disabled */
+void thread_runq_enqueue_disabled(dispatcher_handle_t handle,
+                                  struct thread *thread);
+void thread_runq_remove_disabled(dispatcher_handle_t handle,
+                                 struct thread *thread);
+struct thread *thread_runq_next_disabled(dispatcher_handle_t handle,
+                                         struct thread *follow);
+
 /* must only be called by dispatcher, while disabled */
 void thread_init_disabled(dispatcher_handle_t handle, bool init_domain);
 
@@ -24,6 +24,7 @@
 #include <barrelfish/nameservice_client.h>
 #include <barrelfish/paging.h>
 #include <barrelfish/aos_rpc.h>
+#include <barrelfish/pipe.h>
 #include <barrelfish_kpi/domain_params.h>
 #include <if/monitor_defs.h>
 #include <trace/trace.h>
@@ -55,6 +56,9 @@ void libc_exit(int status)
 
         // XXX: Leak all other domain allocations
     } else {
+        // the next stage of a pipeline reads until we are gone
+        pipe_stdio_close();
+
         // we will call spawnd service to clean a domain
         aos_rpc_send_string(&local_rpc, "bye");
         thread_exit();
@@ -89,21 +93,14 @@ static void libc_assert(const char *expression, const char *file,
 
 static size_t syscall_terminal_write(const char *buf, size_t len)
 {
-    size_t i;
-    for (i = 0; i < len; i++) {
-        if (buf[i] == '\n') {
-            aos_rpc_serial_putchar(&local_rpc, '\r');
-        }
-        errval_t err = aos_rpc_serial_putchar(&local_rpc, buf[i]);
-        if (err_is_fail(err)) {
-            debug_printf("userland printf fail! %s\n", err_getstring(err));
-            err_print_calltrace(err);
-            abort();
-            //break;
-        }   
+    // init's serial server expands LF to CRLF
+    errval_t err = aos_rpc_serial_write(&local_rpc, buf, len);
+    if (err_is_fail(err)) {
+        debug_printf("userland printf fail! %s\n", err_getstring(err));
+        err_print_calltrace(err);
+        abort();
     }
-    //debug_printf("characters printed: %d\n", n);
-    return i;
+    return len;
 }
 
 // static void scan_line(char *buf, size_t len) 
@@ -120,22 +117,21 @@ static size_t syscall_terminal_write(const char *buf, size_t len)
 // }
 
 
-static size_t dummy_terminal_read(char *buf, size_t len)
+static size_t terminal_read(char *buf, size_t len)
 {
-    errval_t err = aos_rpc_serial_getchar(&local_rpc, buf);
+    size_t got = 0;
+    errval_t err = aos_rpc_serial_read(&local_rpc, buf, len, &got);
     if (err_is_fail(err)) {
         debug_printf("userland scan_line fail! %s\n", err_getstring(err));
         err_print_calltrace(err);
-        //break;
     }
-    return len;
+    return got;
 }
 
 /* Set libc function pointers */
 void barrelfish_libc_glue_init(void)
 {
-    // TODO: change these to use the user-space serial driver if possible
-    _libc_terminal_read_func = dummy_terminal_read;
+    _libc_terminal_read_func = terminal_read;
     _libc_terminal_write_func = syscall_terminal_write;
     _libc_exit_func = libc_exit;
     _libc_assert_func = libc_assert;
@@ -213,6 +209,9 @@ errval_t barrelfish_init_onthread(struct spawn_domain_params *params)
         DEBUG_ERR(err, "failed to initialize aos_rpc for process\n");
         err_print_calltrace(err);
     }
+
+    // stdin and stdout of a pipeline stage go to its neighbours
+    pipe_stdio_init();
     
     // right now we don't have the nameservice & don't need the terminal
     // and domain spanning, so we return here
@@ -65,7 +65,7 @@ static void generic_interrupt_handler(void *arg)
         .handler = generic_interrupt_handler,
         .arg = arg,
     };
-    err = lmp_endpoint_register(state->idcep, get_default_waitset(), cl);
+    err = lmp_endpoint_register(state->idcep, state->ws, cl);
     assert(err_is_ok(err));
 }
 
@@ -80,6 +80,19 @@ static void generic_interrupt_handler(void *arg)
  */
 errval_t inthandler_setup_arm(interrupt_handler_fn handler, void *handler_arg,
         uint32_t irq)
+{
+    return inthandler_setup_arm_ws(get_default_waitset(), handler,
+                                   handler_arg, irq);
+}
+
+/**
+ * \brief Like inthandler_setup_arm(), but run the handler from \p ws
+ *
+ * A driver that waits for its device synchronously dispatches a waitset of
+ * its own, so no other event is handled while it waits.
+ */
+errval_t inthandler_setup_arm_ws(struct waitset *ws,
+        interrupt_handler_fn handler, void *handler_arg, uint32_t irq)
 {
     errval_t err;
 
@@ -90,6 +103,7 @@ errval_t inthandler_setup_arm(interrupt_handler_fn handler, void *handler_arg,
 
     state->handler = handler;
     state->handler_arg = handler_arg;
+    state->ws = ws;
 
     /* create endpoint to handle interrupts */
     struct capref epcap;
@@ -112,7 +126,7 @@ errval_t inthandler_setup_arm(interrupt_handler_fn handler, void *handler_arg,
         .handler = generic_interrupt_handler,
         .arg = state,
     };
-    err = lmp_endpoint_register(state->idcep, get_default_waitset(), cl);
+    err = lmp_endpoint_register(state->idcep, ws, cl);
     if (err_is_fail(err)) {
         lmp_endpoint_free(state->idcep);
         // TODO: release vector
@@ -143,6 +157,7 @@ errval_t inthandler_setup(interrupt_handler_fn handler, void *handler_arg,
 
     state->handler = handler;
     state->handler_arg = handler_arg;
+    state->ws = get_default_waitset();
 
     /* create endpoint to handle interrupts */
     struct capref epcap;
@@ -0,0 +1,158 @@
+/**
+ * \file
+ * \brief Per-dispatcher front-end of the K&R malloc
+ *
+ * Small blocks are recycled through size-class caches in the morecore state
+ * of the current dispatcher. The caches are only touched with the dispatcher
+ * disabled, so they need no lock. Every allocated block records its owning
+ * morecore state in the (otherwise unused) free list pointer of its header;
+ * blocks freed on another dispatcher of a spanned domain are collected and
+ * handed back to their owner in batches, through a lock-free list that the
+ * owner drains the next time it has to take its heap lock.
+ *
+ * Used by both copies of the allocator, newlib's oldmalloc and oldc.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <k_r_malloc.h>
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/core_state.h>
+
+/* Push the pending remote batch onto its owner's return list */
+static void remote_flush_disabled(struct morecore_state *state)
+{
+    struct morecore_state *owner = state->remote_owner;
+    Header *old;
+
+    if (owner == NULL) {
+        return;
+    }
+
+    do {
+        old = owner->remote_free;
+        state->remote_tail->s.ptr = old;
+    } while (!__sync_bool_compare_and_swap(&owner->remote_free, old,
+                           state->remote_batch));
+
+    state->remote_batch = state->remote_tail = NULL;
+    state->remote_count = 0;
+    state->remote_age = 0;
+    state->remote_owner = NULL;
+}
+
+/* Do not let a small batch wait for ever on a dispatcher that is still busy */
+static inline void remote_age_disabled(struct morecore_state *state)
+{
+    if (state->remote_owner != NULL
+        && ++state->remote_age >= MALLOC_REMOTE_MAX_AGE) {
+        remote_flush_disabled(state);
+    }
+}
+
+/**
+ * \brief Take a block of \p nunits units from the cache, NULL if there is none
+ */
+void *__malloc_cache_alloc(unsigned nunits)
+{
+    unsigned class = nunits - MALLOC_CACHE_MIN_UNITS;
+    if (class >= MALLOC_CACHE_CLASSES) {
+        return NULL;
+    }
+
+    dispatcher_handle_t handle = disp_disable();
+    struct morecore_state *state = get_morecore_state();
+    Header *p = state->cache[class];
+    if (p != NULL) {
+        state->cache[class] = p->s.ptr;
+        state->cache_count[class]--;
+        __malloc_cache_set_owner(p, state);
+    }
+    remote_age_disabled(state);
+    disp_enable(handle);
+
+    return p == NULL ? NULL : (void *) (p + 1);
+}
+
+/**
+ * \brief Free a block without taking the heap lock
+ *
+ * Either batches it for its owning dispatcher or keeps it in the local
+ * cache. Returns false if the block has to go back to the local free list.
+ */
+bool __malloc_cache_free(Header *bp)
+{
+    dispatcher_handle_t handle = disp_disable();
+    struct morecore_state *state = get_morecore_state();
+    struct morecore_state *owner = (struct morecore_state *) bp->s.ptr;
+    bool done = true;
+
+    if (owner != state) {
+        if (state->remote_owner != owner && state->remote_owner != NULL) {
+            remote_flush_disabled(state);
+        }
+        bp->s.ptr = state->remote_batch;
+        if (state->remote_batch == NULL) {
+            state->remote_tail = bp;
+        }
+        state->remote_batch = bp;
+        state->remote_owner = owner;
+        if (++state->remote_count >= MALLOC_REMOTE_BATCH) {
+            remote_flush_disabled(state);
+        }
+    } else {
+        unsigned class = bp->s.size - MALLOC_CACHE_MIN_UNITS;
+        if (class < MALLOC_CACHE_CLASSES
+            && state->cache_count[class] < MALLOC_CACHE_DEPTH) {
+            bp->s.ptr = state->cache[class];
+            state->cache[class] = bp;
+            state->cache_count[class]++;
+        } else {
+            done = false;
+        }
+        remote_age_disabled(state);
+    }
+
+    disp_enable(handle);
+    return done;
+}
+
+/**
+ * \brief Hand blocks freed here for another dispatcher back to it now
+ *
+ * Called on the slow paths of malloc and free and when the dispatcher runs
+ * out of threads to run, so that a partial batch is not held back forever.
+ */
+void __malloc_cache_flush_disabled(struct morecore_state *state)
+{
+    remote_flush_disabled(state);
+}
+
+/**
+ * \brief Flush our remote batch and return blocks other dispatchers freed
+ * for us to the free list; heap locked
+ */
+void __malloc_cache_drain_locked(struct morecore_state *state)
+{
+    dispatcher_handle_t handle = disp_disable();
+    remote_flush_disabled(state);
+    disp_enable(handle);
+
+    if (state->remote_free == NULL) {
+        return;
+    }
+
+    Header *p = __sync_lock_test_and_set(&state->remote_free, NULL);
+    while (p != NULL) {
+        Header *next = p->s.ptr;
+        __free_locked((void *) (p + 1));
+        p = next;
+    }
+}
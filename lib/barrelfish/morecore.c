@@ -17,6 +17,7 @@
 #include <barrelfish/morecore.h>
 #include <barrelfish/paging.h>
 #include <stdio.h>
+#include <string.h>
 
 typedef void *(*morecore_alloc_func_t)(size_t bytes, size_t *retbytes);
 extern morecore_alloc_func_t sys_morecore_alloc;
@@ -86,6 +87,14 @@ errval_t morecore_init(void)
 
     state->freep = mymem;
 
+    memset(state->cache, 0, sizeof(state->cache));
+    memset(state->cache_count, 0, sizeof(state->cache_count));
+    state->remote_owner = NULL;
+    state->remote_batch = state->remote_tail = NULL;
+    state->remote_count = 0;
+    state->remote_age = 0;
+    state->remote_free = NULL;
+
     sys_morecore_alloc = morecore_alloc;
     sys_morecore_free = morecore_free;
     return SYS_ERR_OK;
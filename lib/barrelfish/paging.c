@@ -506,6 +506,270 @@ errval_t paging_map_user_device(struct paging_state *st, lvaddr_t addr,
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief Allocate a frame of \p req_size bytes for the page fault handler
+ *
+ * If we're init, we do it directly, and otherwise we do it by RPC.
+ */
+static errval_t fault_frame_alloc(struct capref *frame_cap, size_t req_size)
+{
+    struct capref ram_cap = NULL_CAP;
+    size_t ret_size;
+    errval_t err;
+   
+    const char *obj = "init";
+    const char *prog = disp_name();
+    bool is_init = strlen(prog) == 4 && strncmp(obj, prog, 4) == 0;
+    if(is_init){
+        err = frame_alloc(&ram_cap, req_size, &ret_size);
+    } else {
+        size_t req_bits = log2ceil(req_size);
+        size_t ret_bits;
+        err = aos_rpc_get_ram_cap(current.rpc, req_bits, &ram_cap, &ret_bits);
+        ret_size = (1UL << ret_bits);
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (ret_size != req_size){
+        debug_printf("Tried to allocate %d bytes but could only allocate"
+                     " %d.\n", req_size, ret_size);
+        return LIB_ERR_RAM_ALLOC_WRONG_SIZE;
+    }
+    
+    // Retype RAM cap to frame cap
+    err = slot_alloc(frame_cap);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_SLOT_ALLOC);
+    }
+    
+    err = cap_retype(*frame_cap, ram_cap, ObjType_Frame, log2ceil(ret_size));
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_CAP_RETYPE);
+    }
+
+    return cap_destroy(ram_cap);
+}
+
+//
+// File-backed regions
+//
+
+enum chunk_state {
+    CHUNK_ABSENT = 0,
+    CHUNK_CLEAN,                    ///< Mapped read-only, same as the file
+    CHUNK_DIRTY,                    ///< Mapped writable, written since loaded
+};
+
+struct paging_chunk {
+    struct capref frame;
+    enum chunk_state state;
+};
+
+/**
+ * Pager of a file-backed region. It works in chunks of PAGING_CHUNK_SIZE,
+ * the unit the anonymous page fault handler maps as well. Chunks are
+ * mapped read-only until written, so that the first write faults and marks
+ * the chunk dirty.
+ */
+struct paging_file {
+    struct paging_state *st;
+    struct aos_rpc *rpc;
+    int fd;
+    size_t offset;                  ///< File offset of the region's base
+    size_t size;                    ///< Bytes of the file mapped
+    int flags;
+    uint32_t next_seq;              ///< Where a sequential reader faults next
+    uint32_t window;                ///< Chunks read ahead of it
+    uint32_t nchunks;
+    struct paging_chunk chunks[];
+};
+
+static struct paging_region *file_region_find(struct paging_state *st,
+                                              lvaddr_t vaddr)
+{
+    for (struct paging_region *pr = st->file_regions; pr != NULL;
+         pr = pr->next) {
+        if (vaddr >= pr->base_addr
+            && vaddr < pr->base_addr + pr->region_size) {
+            return pr;
+        }
+    }
+    return NULL;
+}
+
+static inline lvaddr_t chunk_addr(struct paging_region *pr, uint32_t i)
+{
+    return pr->base_addr + (lvaddr_t)i * PAGING_CHUNK_SIZE;
+}
+
+/// Bytes of the file in chunk \p i
+static inline size_t chunk_bytes(struct paging_file *pf, uint32_t i)
+{
+    return MIN(PAGING_CHUNK_SIZE, pf->size - (size_t)i * PAGING_CHUNK_SIZE);
+}
+
+static errval_t chunk_protect(struct paging_file *pf, struct paging_chunk *ch,
+                              enum chunk_state state)
+{
+    int flags = pf->flags;
+    if (state == CHUNK_CLEAN) {
+        flags &= ~VREGION_FLAGS_WRITE;
+    }
+
+    errval_t err = invoke_frame_modify_flags(ch->frame, 0, ENTRIES_PER_FRAME,
+                                             flags);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_PMAP_MODIFY_FLAGS);
+    }
+    ch->state = state;
+    return SYS_ERR_OK;
+}
+
+static errval_t chunk_drop(struct paging_region *pr, uint32_t i);
+
+/// Read chunk \p i from the file and map it clean
+static errval_t chunk_load(struct paging_region *pr, uint32_t i)
+{
+    struct paging_file *pf = pr->file;
+    struct paging_chunk *ch = &pf->chunks[i];
+    lvaddr_t addr = chunk_addr(pr, i);
+    size_t got;
+
+    errval_t err = fault_frame_alloc(&ch->frame, PAGING_CHUNK_SIZE);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // writable to fill it in
+    err = allocate_pt(pf->st, addr, ch->frame, 0, PAGING_CHUNK_SIZE,
+                      VREGION_FLAGS_READ_WRITE, true);
+    if (err_is_fail(err)) {
+        cap_destroy(ch->frame);
+        return err;
+    }
+    // nothing to write back yet, even though it is writable for now
+    ch->state = CHUNK_CLEAN;
+
+    err = aos_rpc_read_into(pf->rpc, pf->fd, pf->offset
+                            + (size_t)i * PAGING_CHUNK_SIZE, chunk_bytes(pf, i),
+                            (void *)addr, &got);
+    if (err_is_fail(err)) {
+        chunk_drop(pr, i);
+        return err;
+    }
+    // past the end of the file reads as zeroes
+    memset((uint8_t *)addr + got, 0, PAGING_CHUNK_SIZE - got);
+
+    return chunk_protect(pf, ch, CHUNK_CLEAN);
+}
+
+static errval_t chunk_write_back(struct paging_region *pr, uint32_t i)
+{
+    struct paging_file *pf = pr->file;
+    struct paging_chunk *ch = &pf->chunks[i];
+    size_t bytes = chunk_bytes(pf, i);
+    size_t done;
+
+    if (ch->state != CHUNK_DIRTY) {
+        return SYS_ERR_OK;
+    }
+
+    // clean first, writes while it goes out mark it dirty again
+    errval_t err = chunk_protect(pf, ch, CHUNK_CLEAN);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    err = aos_rpc_write(pf->rpc, pf->fd, pf->offset
+                        + (size_t)i * PAGING_CHUNK_SIZE, &done,
+                        (void *)chunk_addr(pr, i), bytes);
+    if (err_is_ok(err) && done < bytes) {
+        err = LIB_ERR_PAGING_WRITE_BACK;
+    }
+    if (err_is_fail(err)) {
+        ch->state = CHUNK_DIRTY;    // still writable, try again next time
+        return err_push(err, LIB_ERR_PAGING_WRITE_BACK);
+    }
+    return SYS_ERR_OK;
+}
+
+/// Write chunk \p i back and unmap it
+static errval_t chunk_drop(struct paging_region *pr, uint32_t i)
+{
+    struct paging_file *pf = pr->file;
+    struct paging_chunk *ch = &pf->chunks[i];
+    lvaddr_t addr = chunk_addr(pr, i);
+
+    if (ch->state == CHUNK_ABSENT) {
+        return SYS_ERR_OK;
+    }
+    errval_t err = chunk_write_back(pr, i);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    err = vnode_unmap(pf->st->l2_caps[ARM_L1_USER_OFFSET(addr)], ch->frame,
+                      ARM_L2_USER_OFFSET(addr), ENTRIES_PER_FRAME);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_VNODE_UNMAP);
+    }
+    ch->state = CHUNK_ABSENT;
+    return cap_destroy(ch->frame);
+}
+
+/**
+ * \brief Handle a fault at \p vaddr in the file-backed region \p pr
+ *
+ * A fault on the chunk after the ones read last is taken as sequential
+ * access; the read-ahead window then doubles up to PAGING_FILE_READ_AHEAD
+ * chunks, so a sequential reader faults once per window, not per chunk.
+ */
+static errval_t file_region_fault(struct paging_region *pr, lvaddr_t vaddr,
+                                  bool write)
+{
+    struct paging_file *pf = pr->file;
+    uint32_t i = (vaddr - pr->base_addr) / PAGING_CHUNK_SIZE;
+    struct paging_chunk *ch = &pf->chunks[i];
+    errval_t err;
+
+    if (write && !(pf->flags & VREGION_FLAGS_WRITE)) {
+        return LIB_ERR_PAGING_READONLY;
+    }
+
+    if (ch->state == CHUNK_ABSENT) {
+        if (i == pf->next_seq) {
+            pf->window = MIN(MAX(pf->window * 2, 1), PAGING_FILE_READ_AHEAD);
+        } else {
+            pf->window = 0;
+        }
+
+        err = chunk_load(pr, i);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        uint32_t j;
+        for (j = i + 1; j <= i + pf->window && j < pf->nchunks; j++) {
+            if (pf->chunks[j].state != CHUNK_ABSENT) {
+                continue;
+            }
+            // the fault on it will try again
+            err = chunk_load(pr, j);
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "file mapping read-ahead");
+                break;
+            }
+        }
+        pf->next_seq = j;
+    }
+
+    if (write && ch->state == CHUNK_CLEAN) {
+        return chunk_protect(pf, ch, CHUNK_DIRTY);
+    }
+    return SYS_ERR_OK;
+}
+
 void page_fault_handler(enum exception_type type, int subtype,
                         void *addr, arch_registers_state_t *regs,
                         arch_registers_fpu_state_t *fpuregs);
@@ -541,64 +805,33 @@ void page_fault_handler(enum exception_type type, int subtype,
         default:;
     }
     
+    // File-backed regions have a pager of their own
+    struct paging_region *pr = file_region_find(&current, vaddr);
+    if (pr != NULL) {
+        errval_t err = file_region_fault(pr, vaddr, subtype == PAGEFLT_WRITE);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "file mapping fault at addr 0x%08x", vaddr);
+            abort();
+        }
+        return;
+    }
+
     // Check if addr is in buddy allocation tree and throw error if not
     if (!buddy_check_addr(current.root, (lvaddr_t)addr)) {
         debug_printf("Did not find address 0x%08x!\n", (lvaddr_t)addr);
         abort();        
     }
     
-    /* Otherwise we need to allocate. If we're init, we do it directly,
-       and otherwise we do it by RPC */
-    struct capref ram_cap = NULL_CAP;
-    size_t req_size = BASE_PAGE_SIZE * ENTRIES_PER_FRAME;
-    size_t ret_size;
-    errval_t err;
-   
-    const char *obj = "init";
-    const char *prog = disp_name();
-    bool is_init = strlen(prog) == 4 && strncmp(obj, prog, 4) == 0;
-    if(is_init){
-        err = frame_alloc(&ram_cap, req_size, &ret_size);
-    } else {
-        size_t req_bits = log2ceil(req_size);
-        size_t ret_bits;
-        err = aos_rpc_get_ram_cap(current.rpc, req_bits, &ram_cap, &ret_bits);
-        ret_size = (1UL << ret_bits);
-    }
-
-    if (err != SYS_ERR_OK){
+    // Otherwise we need to allocate
+    struct capref frame_cap;
+    size_t ret_size = BASE_PAGE_SIZE * ENTRIES_PER_FRAME;
+    errval_t err = fault_frame_alloc(&frame_cap, ret_size);
+    if (err_is_fail(err)) {
         debug_printf("Could not allocate frame for addr 0x%08x: %s\n",
                      addr, err_getstring(err));
         abort();
     }
 
-    if (ret_size != req_size){
-        debug_printf("Tried to allocate %d bytes for addr 0x%08x but"
-                     " could only allocate %d.\n", req_size, addr, ret_size);
-        abort();
-    }
-    
-    struct capref frame_cap;
-    
-    // Retype RAM cap to frame cap
-    err = slot_alloc(&frame_cap);
-    if (err_is_fail(err)) {
-        err_print_calltrace(err);        
-        err_push(err, LIB_ERR_SLOT_ALLOC);
-        return;
-    }
-    
-    err = cap_retype(frame_cap, ram_cap, ObjType_Frame, log2ceil(ret_size));
-    if (err_is_fail(err)) {
-        err_push(err, LIB_ERR_CAP_RETYPE);
-        return;
-    }
-
-    err = cap_destroy(ram_cap);
-    if (err_is_fail(err)) {
-        return;
-    }
-
     // Allocate L1 and L2 entries, if needed, and insert frame cap
     allocate_pt(&current, (lvaddr_t)addr, frame_cap,
                 0, ret_size, VREGION_FLAGS_READ_WRITE, true);
@@ -622,6 +855,7 @@ errval_t paging_init_state(struct paging_state *st, lvaddr_t start_vaddr,
         st->l2_caps[i] = NULL_CAP;
     }
     
+    st->file_regions = NULL;
     st->next_node = st->all_nodes;
     st->root = create_node(st);
     st->root->max_size = (1ULL<<32); // TODO subtract stack size
@@ -683,6 +917,12 @@ void paging_init_onthread(struct thread *t)
     debug_printf("paging_init_onthread called for thread 0x%08x\n", t);
 #endif
 
+    // a recycled thread keeps the exception stack it already has
+    if (t->exception_stack != NULL) {
+        t->exception_handler = page_fault_handler;
+        return;
+    }
+
     void *buf;
     errval_t err = paging_alloc(&current, &buf, EXC_STACK_SIZE);
     if (err_is_fail(err)) {
@@ -724,6 +964,8 @@ errval_t paging_region_init(struct paging_state *st, struct paging_region *pr,
     pr->base_addr    = (lvaddr_t)base;
     pr->current_addr = pr->base_addr;
     pr->region_size  = size;
+    pr->file         = NULL;
+    pr->next         = NULL;
 
 #if PRINT_CALLS
     debug_printf("paging_region_init returned\n");
@@ -770,16 +1012,127 @@ errval_t paging_region_map(struct paging_region *pr, size_t req_size,
  * \brief free a bit of the paging region `pr`.
  * This function gets used in some of the code that is responsible
  * for allocating Frame (and other) capabilities.
- * We ignore unmap requests right now.
+ * Anonymous regions ignore unmap requests right now; file-backed ones write
+ * the range back and drop the chunks that lie entirely within it.
  */
 errval_t paging_region_unmap(struct paging_region *pr, lvaddr_t base, 
     size_t bytes)
 {
     // XXX: should free up some space in paging region, however need to track
     //      holes for non-trivial case
+    if (pr->file == NULL || bytes == 0) {
+        return SYS_ERR_OK;
+    }
+    if (base < pr->base_addr || base - pr->base_addr >= pr->region_size) {
+        return LIB_ERR_VREGION_NOT_FOUND;
+    }
+
+    lvaddr_t end = MIN(base + bytes, pr->base_addr + pr->region_size);
+    uint32_t first = (base - pr->base_addr) / PAGING_CHUNK_SIZE;
+    uint32_t last = (end - 1 - pr->base_addr) / PAGING_CHUNK_SIZE;
+    errval_t err = SYS_ERR_OK;
+
+    for (uint32_t i = first; i <= last && err_is_ok(err); i++) {
+        if (chunk_addr(pr, i) >= base
+            && chunk_addr(pr, i) + PAGING_CHUNK_SIZE <= end) {
+            err = chunk_drop(pr, i);
+        } else {
+            err = chunk_write_back(pr, i);
+        }
+    }
+    return err;
+}
+
+errval_t paging_region_init_file(struct paging_state *st,
+                                 struct paging_region *pr, const char *path,
+                                 size_t offset, size_t size, int flags)
+{
+#if PRINT_CALLS
+    debug_printf("paging_region_init_file called for %s\n", path);
+#endif
+    if (size == 0) {
+        return SYS_ERR_VM_MAP_SIZE;
+    }
+    if (st->rpc == NULL) {
+        return AOS_ERR_FS_UNAVAILABLE;
+    }
+
+    // allocated now, the fault handler must not
+    uint32_t nchunks = DIVIDE_ROUND_UP(size, PAGING_CHUNK_SIZE);
+    struct paging_file *pf = calloc(1, sizeof(*pf)
+                                    + nchunks * sizeof(struct paging_chunk));
+    if (pf == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    errval_t err = aos_rpc_open(st->rpc, (char *)path, &pf->fd);
+    if (err_is_fail(err)) {
+        free(pf);
+        return err;
+    }
+
+    err = paging_region_init(st, pr, (size_t)nchunks * PAGING_CHUNK_SIZE);
+    if (err_is_fail(err)) {
+        aos_rpc_close(st->rpc, pf->fd);
+        free(pf);
+        return err;
+    }
+
+    pf->st = st;
+    pf->rpc = st->rpc;
+    pf->offset = offset;
+    pf->size = size;
+    pf->flags = VREGION_FLAGS_READ
+                | (flags & (VREGION_FLAGS_WRITE | VREGION_FLAGS_EXECUTE));
+    pf->nchunks = nchunks;
+    pf->next_seq = 0;
+
+    pr->file = pf;
+    pr->next = st->file_regions;
+    st->file_regions = pr;
     return SYS_ERR_OK;
 }
 
+errval_t paging_region_sync(struct paging_region *pr)
+{
+    if (pr->file == NULL) {
+        return SYS_ERR_OK;
+    }
+
+    errval_t err = SYS_ERR_OK;
+    for (uint32_t i = 0; i < pr->file->nchunks && err_is_ok(err); i++) {
+        err = chunk_write_back(pr, i);
+    }
+    return err;
+}
+
+errval_t paging_region_destroy(struct paging_region *pr)
+{
+    struct paging_file *pf = pr->file;
+    if (pf == NULL) {
+        return LIB_ERR_VREGION_DESTROY;
+    }
+
+    for (uint32_t i = 0; i < pf->nchunks; i++) {
+        errval_t err = chunk_drop(pr, i);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_VREGION_DESTROY);
+        }
+    }
+
+    struct paging_region **p = &pf->st->file_regions;
+    while (*p != pr) {
+        p = &(*p)->next;
+    }
+    *p = pr->next;
+
+    errval_t err = aos_rpc_close(pf->rpc, pf->fd);
+    paging_dealloc(pf->st, (void *)pr->base_addr);
+    pr->file = NULL;
+    free(pf);
+    return err;
+}
+
 /**
  * \brief Find a bit of free virtual address space that is large enough to
  *        accomodate a buffer of size `bytes`.
@@ -0,0 +1,227 @@
+/**
+ * \file
+ * \brief Byte streams between domains in a shared frame
+ *
+ * spawnd connects the stages of a pipeline by giving the writing domain
+ * and the reading domain the same frame, in TASKCN_SLOT_STDOUT and
+ * TASKCN_SLOT_STDIN. The frame holds a single producer, single consumer
+ * ring, so the data never goes through init or the kernel. A side that
+ * has to wait yields the dispatcher to let the other one run.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/cspace.h>
+#include <barrelfish/pipe.h>
+
+STATIC_ASSERT(sizeof(struct pipe_header) <= 2 * PIPE_CACHE_LINE,
+              "pipe header does not fit its cache lines");
+
+#define RING_OFFSET     (2 * PIPE_CACHE_LINE)
+
+/**
+ * \brief Map \p frame as one end of a pipe
+ */
+errval_t pipe_init(struct pipe *p, struct capref frame, bool writer)
+{
+    struct frame_identity id;
+    void *buf;
+
+    errval_t err = invoke_frame_identify(frame, &id);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_IDENTIFY);
+    }
+
+    size_t bytes = 1UL << id.bits;
+    if (bytes <= RING_OFFSET) {
+        return LIB_ERR_INVALID_ARGS;
+    }
+
+    err = paging_map_frame_attr(get_current_paging_state(), &buf, bytes,
+                                frame, VREGION_FLAGS_READ_WRITE, NULL, NULL);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_VSPACE_MAP);
+    }
+
+    p->hdr = buf;
+    p->ring = (uint8_t *)buf + RING_OFFSET;
+    p->size = bytes - RING_OFFSET;
+    p->writer = writer;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Write all of \p buf, waiting for room in the ring
+ *
+ * Fails with LIB_ERR_PIPE_CLOSED once the reader is gone, \p written tells
+ * how much got into the ring before.
+ */
+errval_t pipe_write(struct pipe *p, const void *buf, size_t len,
+                    size_t *written)
+{
+    struct pipe_header *hdr = p->hdr;
+    const uint8_t *src = buf;
+    uint32_t head = hdr->head;
+
+    assert(p->writer);
+    *written = 0;
+    while (*written < len) {
+        if (hdr->reader_closed) {
+            return LIB_ERR_PIPE_CLOSED;
+        }
+
+        uint32_t tail = hdr->tail;
+        uint32_t room = (tail + p->size - head - 1) % p->size;
+        if (room == 0) {
+            thread_yield();
+            continue;
+        }
+
+        // up to the end of the ring, the rest goes in on the next round
+        uint32_t n = MIN(MIN(room, len - *written), p->size - head);
+        memcpy(p->ring + head, src + *written, n);
+
+        // the data has to be there before the reader sees the new head
+        __sync_synchronize();
+        head = (head + n) % p->size;
+        hdr->head = head;
+        *written += n;
+    }
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Read what is in the ring, up to \p len bytes
+ *
+ * Waits until there is something to read. \p ret is 0 at the end of the
+ * stream, when the ring is empty and the writer is gone.
+ */
+errval_t pipe_read(struct pipe *p, void *buf, size_t len, size_t *ret)
+{
+    struct pipe_header *hdr = p->hdr;
+    uint8_t *dst = buf;
+    uint32_t tail = hdr->tail;
+    uint32_t head;
+
+    assert(!p->writer);
+    *ret = 0;
+    while ((head = hdr->head) == tail) {
+        if (hdr->writer_closed) {
+            // the last write may have come in before the writer closed
+            __sync_synchronize();
+            if ((head = hdr->head) == tail) {
+                return SYS_ERR_OK;
+            }
+            break;
+        }
+        thread_yield();
+    }
+
+    // don't read the data before the head that covers it
+    __sync_synchronize();
+    while (*ret < len && tail != head) {
+        uint32_t avail = (head >= tail) ? head - tail : p->size - tail;
+        uint32_t n = MIN(avail, len - *ret);
+        memcpy(dst + *ret, p->ring + tail, n);
+        tail = (tail + n) % p->size;
+        *ret += n;
+    }
+
+    // the data has to be copied out before the writer may overwrite it
+    __sync_synchronize();
+    hdr->tail = tail;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Close this end, the other one sees the end of the stream
+ */
+void pipe_close(struct pipe *p)
+{
+    __sync_synchronize();
+    if (p->writer) {
+        p->hdr->writer_closed = 1;
+    } else {
+        p->hdr->reader_closed = 1;
+    }
+}
+
+static struct pipe stdin_pipe, stdout_pipe;
+static bool stdin_piped, stdout_piped;
+
+extern size_t (*_libc_terminal_read_func)(char *, size_t);
+extern size_t (*_libc_terminal_write_func)(const char *, size_t);
+
+static size_t pipe_terminal_write(const char *buf, size_t len)
+{
+    size_t written;
+    errval_t err = pipe_write(&stdout_pipe, buf, len, &written);
+    if (err_is_fail(err) && err != LIB_ERR_PIPE_CLOSED) {
+        DEBUG_ERR(err, "could not write to stdout pipe");
+    }
+    return written;
+}
+
+static size_t pipe_terminal_read(char *buf, size_t len)
+{
+    size_t got;
+    errval_t err = pipe_read(&stdin_pipe, buf, len, &got);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "could not read from stdin pipe");
+        return 0;
+    }
+    return got;
+}
+
+/**
+ * \brief Use the pipes spawnd gave us for stdin and stdout
+ *
+ * Either stays on the serial line if its slot is empty.
+ */
+void pipe_stdio_init(void)
+{
+    struct capref in = {
+        .cnode = cnode_task,
+        .slot = TASKCN_SLOT_STDIN,
+    };
+    struct capref out = {
+        .cnode = cnode_task,
+        .slot = TASKCN_SLOT_STDOUT,
+    };
+
+    if (err_is_ok(pipe_init(&stdin_pipe, in, false))) {
+        stdin_piped = true;
+        _libc_terminal_read_func = pipe_terminal_read;
+    }
+    if (err_is_ok(pipe_init(&stdout_pipe, out, true))) {
+        stdout_piped = true;
+        _libc_terminal_write_func = pipe_terminal_write;
+    }
+}
+
+/**
+ * \brief Let the neighbours in the pipeline see that we are gone
+ */
+void pipe_stdio_close(void)
+{
+    if (stdout_piped) {
+        fflush(stdout);
+        pipe_close(&stdout_pipe);
+        stdout_piped = false;
+    }
+    if (stdin_piped) {
+        pipe_close(&stdin_pipe);
+        stdin_piped = false;
+    }
+}
@@ -15,6 +15,7 @@
 #include <barrelfish/barrelfish.h>
 #include <barrelfish/dispatch.h>
 #include <barrelfish/dispatcher_arch.h>
+#include <barrelfish/curdispatcher_arch.h>
 #include "threads_priv.h"
 
 
@@ -138,6 +139,20 @@ void thread_cond_broadcast(struct thread_cond *cond)
     }
 }
 
+/// Upper bound on spin iterations before a contended lock blocks
+#define THREAD_MUTEX_MAX_SPINS  1000
+
+/**
+ * \brief Return the running thread without disabling the dispatcher
+ *
+ * The current thread pointer can only change while we are not running, so
+ * it is always our own thread when we read it.
+ */
+static inline struct thread *current_thread(void)
+{
+    return get_dispatcher_generic(curdispatcher())->current;
+}
+
 /**
  * \brief Initialise a mutex
  *
@@ -149,26 +164,70 @@ void thread_mutex_init(struct thread_mutex *mutex)
     mutex->holder = NULL;
     mutex->queue = NULL;
     mutex->lock = 0;
+    mutex->nested = 0;
+    mutex->spins = 0;
+}
+
+/**
+ * \brief Spin briefly on a mutex held by a thread on another dispatcher
+ *
+ * Spinning only helps if the holder can run (and release the lock) while we
+ * spin, which is only the case when it lives on another dispatcher of a
+ * spanned domain. The spin limit adapts to how long past spins took.
+ *
+ * \returns true if the mutex was acquired
+ */
+static bool thread_mutex_spin(struct thread_mutex *mutex)
+{
+    struct thread *holder = mutex->holder;
+    if (holder == NULL || holder->disp == curdispatcher()) {
+        return false;
+    }
+
+    int limit = mutex->spins * 2 + 10;
+    if (limit > THREAD_MUTEX_MAX_SPINS) {
+        limit = THREAD_MUTEX_MAX_SPINS;
+    }
+
+    for (int count = 1; count <= limit; count++) {
+        if (mutex->locked == 0
+            && __sync_bool_compare_and_swap(&mutex->locked, 0, 1)) {
+            mutex->spins += (count - mutex->spins) / 8;
+            return true;
+        }
+    }
+
+    mutex->spins += (limit - mutex->spins) / 8;
+    return false;
 }
 
 /**
  * \brief Lock a mutex
  *
  * This blocks until the given mutex is unlocked, and then atomically locks it.
+ * An uncontended mutex is acquired with a single atomic operation, without
+ * disabling the dispatcher.
  *
  * \param mutex Mutex pointer
  */
 void thread_mutex_lock(struct thread_mutex *mutex)
 {
+    if (__sync_bool_compare_and_swap(&mutex->locked, 0, 1)
+        || thread_mutex_spin(mutex)) {
+        mutex->holder = current_thread();
+        return;
+    }
+
     dispatcher_handle_t handle = disp_disable();
     struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
 
+    // Mark the mutex contended, so the holder takes the slow unlock path
     acquire_spinlock(&mutex->lock);
-    if (mutex->locked > 0) {
+    if (__sync_lock_test_and_set(&mutex->locked, 2) != 0) {
+        // Ownership (and holder) is handed to us on unlock
         thread_block_and_release_spinlock_disabled(handle, &mutex->queue,
                                                    &mutex->lock);
     } else {
-        mutex->locked = 1;
         mutex->holder = disp_gen->current;
         release_spinlock(&mutex->lock);
         disp_enable(handle);
@@ -185,21 +244,13 @@ void thread_mutex_lock(struct thread_mutex *mutex)
  */
 void thread_mutex_lock_nested(struct thread_mutex *mutex)
 {
-    dispatcher_handle_t handle = disp_disable();
-    struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
-
-    acquire_spinlock(&mutex->lock);
-    if (mutex->locked > 0
-        && mutex->holder != disp_gen->current) {
-        thread_block_and_release_spinlock_disabled(handle, &mutex->queue,
-                                                   &mutex->lock);
-    } else {
-        mutex->locked++;
-        mutex->holder = disp_gen->current;
-        release_spinlock(&mutex->lock);
-        disp_enable(handle);
+    // Only the holder itself can observe itself as the holder
+    if (mutex->locked != 0 && mutex->holder == current_thread()) {
+        mutex->nested++;
+        return;
     }
 
+    thread_mutex_lock(mutex);
 }
 
 /**
@@ -214,27 +265,11 @@ void thread_mutex_lock_nested(struct thread_mutex *mutex)
  */
 bool thread_mutex_trylock(struct thread_mutex *mutex)
 {
-    // Try first to avoid contention
-    if (mutex->locked > 0) {
-        return false;
+    if (__sync_bool_compare_and_swap(&mutex->locked, 0, 1)) {
+        mutex->holder = current_thread();
+        return true;
     }
-
-    dispatcher_handle_t handle = disp_disable();
-    struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
-    bool ret;
-
-    acquire_spinlock(&mutex->lock);
-    if (mutex->locked > 0) {
-        ret = false;
-    } else {
-        ret = true;
-        mutex->locked = 1;
-        mutex->holder = disp_gen->current;
-    }
-    release_spinlock(&mutex->lock);
-
-    disp_enable(handle);
-    return ret;
+    return false;
 }
 
 /**
@@ -252,21 +287,31 @@ struct thread *thread_mutex_unlock_disabled(dispatcher_handle_t handle,
 {
     struct thread *ft = NULL;
 
-    acquire_spinlock(&mutex->lock);
     assert_disabled(mutex->locked > 0);
+    if (mutex->nested > 0) {
+        mutex->nested--;
+        return NULL;
+    }
+
+    // No waiters: just release it
+    mutex->holder = NULL;
+    if (__sync_bool_compare_and_swap(&mutex->locked, 1, 0)) {
+        return NULL;
+    }
+
+    acquire_spinlock(&mutex->lock);
+    assert_disabled(mutex->locked == 2);
 
-    if(mutex->locked == 1) {
-        // Wakeup one waiting thread
-        if (mutex->queue != NULL) {
-            // XXX: This assumes dequeueing is off the top of the queue
-            mutex->holder = mutex->queue;
-            ft = thread_unblock_one_disabled(handle, &mutex->queue, NULL);
-        } else {
-            mutex->holder = NULL;
-            mutex->locked = 0;
+    // Wakeup one waiting thread
+    if (mutex->queue != NULL) {
+        // XXX: This assumes dequeueing is off the top of the queue
+        mutex->holder = mutex->queue;
+        ft = thread_unblock_one_disabled(handle, &mutex->queue, NULL);
+        if (mutex->queue == NULL) {
+            mutex->locked = 1;
         }
     } else {
-        mutex->locked--;
+        mutex->locked = 0;
     }
 
     release_spinlock(&mutex->lock);
@@ -276,12 +321,21 @@ struct thread *thread_mutex_unlock_disabled(dispatcher_handle_t handle,
 /**
  * \brief Unlock a mutex
  *
- * This unlocks the given mutex.
+ * This unlocks the given mutex. If nobody is waiting for it, the dispatcher
+ * is not disabled.
  *
  * \param mutex Mutex pointer
  */
 void thread_mutex_unlock(struct thread_mutex *mutex)
 {
+    assert(mutex->locked > 0);
+    if (mutex->nested == 0) {
+        mutex->holder = NULL;
+        if (__sync_bool_compare_and_swap(&mutex->locked, 1, 0)) {
+            return;
+        }
+    }
+
     dispatcher_handle_t disp = disp_disable();
     struct thread *wakeup = thread_mutex_unlock_disabled(disp, mutex);
     errval_t err = SYS_ERR_OK;
@@ -382,3 +436,200 @@ void thread_sem_post(struct thread_sem *sem)
         thread_yield();
     }
 }
+
+/**
+ * \brief Initialise a reader-writer lock
+ *
+ * \param rwlock Reader-writer lock pointer
+ */
+void thread_rwlock_init(struct thread_rwlock *rwlock)
+{
+    assert(rwlock != NULL);
+
+    rwlock->readers = 0;
+    rwlock->writer = false;
+    rwlock->readers_waiting = 0;
+    rwlock->writers_waiting = 0;
+    rwlock->read_queue = NULL;
+    rwlock->write_queue = NULL;
+    rwlock->lock = 0;
+}
+
+/**
+ * \brief Acquire a reader-writer lock for reading
+ *
+ * Readers also wait while a writer is queued, so that a steady stream of
+ * readers cannot starve writers.
+ *
+ * \param rwlock Reader-writer lock pointer
+ */
+void thread_rwlock_read_lock(struct thread_rwlock *rwlock)
+{
+    assert(rwlock != NULL);
+
+    dispatcher_handle_t disp = disp_disable();
+    acquire_spinlock(&rwlock->lock);
+
+    if (rwlock->writer || rwlock->writers_waiting > 0) {
+        // Our read count is taken for us by the waking writer
+        rwlock->readers_waiting++;
+        thread_block_and_release_spinlock_disabled(disp, &rwlock->read_queue,
+                                                   &rwlock->lock);
+    } else {
+        rwlock->readers++;
+        release_spinlock(&rwlock->lock);
+        disp_enable(disp);
+    }
+}
+
+/**
+ * \brief Try to acquire a reader-writer lock for reading
+ *
+ * \returns true if lock acquired, false otherwise
+ */
+bool thread_rwlock_read_trylock(struct thread_rwlock *rwlock)
+{
+    assert(rwlock != NULL);
+    bool ret = false;
+
+    dispatcher_handle_t disp = disp_disable();
+    acquire_spinlock(&rwlock->lock);
+
+    if (!rwlock->writer && rwlock->writers_waiting == 0) {
+        rwlock->readers++;
+        ret = true;
+    }
+
+    release_spinlock(&rwlock->lock);
+    disp_enable(disp);
+
+    return ret;
+}
+
+/**
+ * \brief Release a reader-writer lock held for reading
+ *
+ * The last reader out hands the lock to a waiting writer, if any.
+ *
+ * \param rwlock Reader-writer lock pointer
+ */
+void thread_rwlock_read_unlock(struct thread_rwlock *rwlock)
+{
+    assert(rwlock != NULL);
+
+    dispatcher_handle_t disp = disp_disable();
+    struct thread *wakeup = NULL;
+    errval_t err = SYS_ERR_OK;
+    acquire_spinlock(&rwlock->lock);
+
+    assert_disabled(rwlock->readers > 0 && !rwlock->writer);
+    rwlock->readers--;
+    if (rwlock->readers == 0 && rwlock->write_queue != NULL) {
+        rwlock->writer = true;
+        rwlock->writers_waiting--;
+        wakeup = thread_unblock_one_disabled(disp, &rwlock->write_queue, NULL);
+    }
+
+    if(wakeup != NULL) {
+        err = domain_wakeup_on_disabled(wakeup->disp, wakeup, disp);
+        assert_disabled(err_is_ok(err));
+    }
+
+    release_spinlock(&rwlock->lock);
+    disp_enable(disp);
+
+    if(err_is_fail(err)) {
+        USER_PANIC_ERR(err, "remote wakeup from rwlock read unlock");
+    }
+}
+
+/**
+ * \brief Acquire a reader-writer lock for writing
+ *
+ * \param rwlock Reader-writer lock pointer
+ */
+void thread_rwlock_write_lock(struct thread_rwlock *rwlock)
+{
+    assert(rwlock != NULL);
+
+    dispatcher_handle_t disp = disp_disable();
+    acquire_spinlock(&rwlock->lock);
+
+    if (rwlock->writer || rwlock->readers > 0) {
+        // Ownership is handed to us by the releasing reader or writer
+        rwlock->writers_waiting++;
+        thread_block_and_release_spinlock_disabled(disp, &rwlock->write_queue,
+                                                   &rwlock->lock);
+    } else {
+        rwlock->writer = true;
+        release_spinlock(&rwlock->lock);
+        disp_enable(disp);
+    }
+}
+
+/**
+ * \brief Try to acquire a reader-writer lock for writing
+ *
+ * \returns true if lock acquired, false otherwise
+ */
+bool thread_rwlock_write_trylock(struct thread_rwlock *rwlock)
+{
+    assert(rwlock != NULL);
+    bool ret = false;
+
+    dispatcher_handle_t disp = disp_disable();
+    acquire_spinlock(&rwlock->lock);
+
+    if (!rwlock->writer && rwlock->readers == 0) {
+        rwlock->writer = true;
+        ret = true;
+    }
+
+    release_spinlock(&rwlock->lock);
+    disp_enable(disp);
+
+    return ret;
+}
+
+/**
+ * \brief Release a reader-writer lock held for writing
+ *
+ * Waiting writers are preferred; otherwise all waiting readers are admitted.
+ *
+ * \param rwlock Reader-writer lock pointer
+ */
+void thread_rwlock_write_unlock(struct thread_rwlock *rwlock)
+{
+    assert(rwlock != NULL);
+
+    dispatcher_handle_t disp = disp_disable();
+    struct thread *wakeupq = NULL;
+    acquire_spinlock(&rwlock->lock);
+
+    assert_disabled(rwlock->writer && rwlock->readers == 0);
+    if (rwlock->write_queue != NULL) {
+        rwlock->writers_waiting--;
+        wakeupq = thread_unblock_one_disabled(disp, &rwlock->write_queue, NULL);
+        if (wakeupq != NULL) {
+            wakeupq->next = NULL;
+        }
+    } else {
+        rwlock->writer = false;
+        rwlock->readers += rwlock->readers_waiting;
+        rwlock->readers_waiting = 0;
+        wakeupq = thread_unblock_all_disabled(disp, &rwlock->read_queue, NULL);
+    }
+
+    release_spinlock(&rwlock->lock);
+    disp_enable(disp);
+
+    // Now, wakeup all on foreign dispatchers
+    while (wakeupq != NULL) {
+        struct thread *wakeup = wakeupq;
+        wakeupq = wakeupq->next;
+        errval_t err = domain_wakeup_on(wakeup->disp, wakeup);
+        if(err_is_fail(err)) {
+            USER_PANIC_ERR(err, "remote wakeup from rwlock write unlock");
+        }
+    }
+}
@@ -23,6 +23,8 @@
 #include <barrelfish/caddr.h>
 #include <barrelfish/curdispatcher_arch.h>
 #include <barrelfish/paging.h>
+#include <barrelfish/core_state.h>
+#include <k_r_malloc.h>
 #include <barrelfish_kpi/cpu_arch.h>
 #include <barrelfish_kpi/domain_params.h>
 #include <arch/registers.h>
@@ -42,7 +44,13 @@
 
 /// Maximum number of threads in a domain, used to size VM region for thread structures
 // there is no point having MAX_THREADS > LDT_NENTRIES on x86 (see ldt.c)
-#define MAX_THREADS 256
+#define MAX_THREADS 16384
+
+/// Number of thread structures pre-allocated before spanning a domain
+#define SPAN_PREFILL_THREADS 256
+
+/// Maximum number of exited threads cached per dispatcher for reuse
+#define THREADS_FREE_CACHE_MAX 64
 
 /// 16-byte alignment required for x86-64
 // FIXME: this should be in an arch header
@@ -202,6 +210,108 @@ void thread_remove_from_queue(struct thread **queue, struct thread *thread)
 #endif
 }
 
+/**
+ * \brief Enqueue a thread at the tail of its priority band in the run queue
+ *
+ * The run queue is a single circular list sorted by descending priority, so
+ * its head is always the first thread of the highest non-empty band. The
+ * per-band tail pointers and the bitmap of non-empty bands let us find the
+ * insertion point without walking the queue.
+ * Must only be called while disabled.
+ */
+void thread_runq_enqueue_disabled(dispatcher_handle_t handle,
+                                  struct thread *thread)
+{
+    struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
+    uint8_t prio = thread->priority;
+    assert_disabled(prio < THREAD_PRIORITY_LEVELS);
+
+    if (disp_gen->runq == NULL) {
+        disp_gen->runq_levels = 0;
+        thread_enqueue(thread, &disp_gen->runq);
+    } else {
+        struct thread *after;
+        bool new_head = false;
+        uint32_t higher = disp_gen->runq_levels & ~((2U << prio) - 1);
+
+        if (disp_gen->runq_levels & (1U << prio)) {
+            // band exists: append to it
+            after = disp_gen->runq_tail[prio];
+        } else if (higher != 0) {
+            // new band: goes after the nearest higher band
+            after = disp_gen->runq_tail[__builtin_ctz(higher)];
+        } else {
+            // new highest band: goes in front of the current head
+            after = disp_gen->runq->prev;
+            new_head = true;
+        }
+
+        thread->prev = after;
+        thread->next = after->next;
+        after->next->prev = thread;
+        after->next = thread;
+
+        if (new_head) {
+            disp_gen->runq = thread;
+        }
+    }
+
+    disp_gen->runq_tail[prio] = thread;
+    disp_gen->runq_levels |= 1U << prio;
+    check_queue(disp_gen->runq);
+}
+
+/**
+ * \brief Remove a thread from the run queue
+ *
+ * Must only be called while disabled.
+ */
+void thread_runq_remove_disabled(dispatcher_handle_t handle,
+                                 struct thread *thread)
+{
+    struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
+    uint8_t prio = thread->priority;
+    assert_disabled(disp_gen->runq_levels & (1U << prio));
+
+    if (disp_gen->runq_tail[prio] == thread) {
+        struct thread *prev = thread->prev;
+        if (prev != thread && prev->priority == prio) {
+            disp_gen->runq_tail[prio] = prev;
+        } else {
+            // last thread of its band
+            disp_gen->runq_tail[prio] = NULL;
+            disp_gen->runq_levels &= ~(1U << prio);
+        }
+    }
+
+    thread_remove_from_queue(&disp_gen->runq, thread);
+}
+
+/**
+ * \brief Pick the next thread to run, round-robin within the top band
+ *
+ * \param follow Thread that followed the previously-running thread in the
+ *               run queue (sampled before that thread was removed, if it was)
+ *
+ * \returns Thread to run, or NULL if the run queue is empty
+ */
+struct thread *thread_runq_next_disabled(dispatcher_handle_t handle,
+                                         struct thread *follow)
+{
+    struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
+    struct thread *head = disp_gen->runq;
+
+    if (head == NULL) {
+        return NULL;
+    }
+
+    // the head is always in the highest band; wrap to it at the band's end
+    if (follow != NULL && follow->priority == head->priority) {
+        return follow;
+    }
+    return head;
+}
+
 /// Refill backing storage for thread region
 static errval_t refill_thread_slabs(struct slab_alloc *slabs)
 {
@@ -245,6 +355,7 @@ static void thread_init(dispatcher_handle_t disp, struct thread *newthread)
     newthread->in_exception = false;
     newthread->used_fpu = false;
     newthread->paused = false;
+    newthread->priority = THREAD_PRIORITY_DEFAULT;
     newthread->slab = NULL;
 }
 
@@ -301,7 +412,8 @@ void thread_run_disabled(dispatcher_handle_t handle)
         warn_disabled(&stack_warned,
                       thread_check_stack_bounds(disp_gen->current, enabled_area));
 
-        struct thread *next = disp_gen->current->next;
+        struct thread *next =
+            thread_runq_next_disabled(handle, disp_gen->current->next);
         assert_disabled(next != NULL);
         if (next != disp_gen->current) {
             fpu_context_switch(disp_gen, next);
@@ -322,6 +434,8 @@ void thread_run_disabled(dispatcher_handle_t handle)
         disp_resume(handle, &disp_gen->runq->regs);
     } else {
         // kernel gave us the CPU when we have nothing to do. block!
+        // Blocks freed here for other dispatchers must not wait for us.
+        __malloc_cache_flush_disabled(get_morecore_state());
         disp->haswork = havework_disabled(handle);
         disp_gen->current = NULL;
         disp_yield_disabled(handle);
@@ -347,6 +461,20 @@ static void free_thread(struct thread *thread)
     ldt_free_segment(thread->thread_seg_selector);
 #endif
 
+    // keep default-sized threads around for the next thread_create()
+    if (thread->stack_bytes == THREADS_DEFAULT_STACK_BYTES) {
+        dispatcher_handle_t handle = disp_disable();
+        struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
+        if (disp_gen->free_threads_count < THREADS_FREE_CACHE_MAX) {
+            thread->next = disp_gen->free_threads;
+            disp_gen->free_threads = thread;
+            disp_gen->free_threads_count++;
+            disp_enable(handle);
+            return;
+        }
+        disp_enable(handle);
+    }
+
     free(thread->stack);
     if (thread->tls_dtv != NULL) {
         free(thread->tls_dtv);
@@ -371,29 +499,62 @@ static void free_thread(struct thread *thread)
 struct thread *thread_create_unrunnable(thread_func_t start_func, void *arg,
                                         size_t stacksize)
 {
+    assert((stacksize % sizeof(uintptr_t)) == 0);
+
+    // reuse a cached thread (TCB, TLS block and stack) if we can
+    struct thread *newthread = NULL;
+    if (stacksize == THREADS_DEFAULT_STACK_BYTES) {
+        dispatcher_handle_t handle = disp_disable();
+        struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
+        newthread = disp_gen->free_threads;
+        if (newthread != NULL) {
+            disp_gen->free_threads = newthread->next;
+            disp_gen->free_threads_count--;
+        }
+        disp_enable(handle);
+    }
+
+    void *space;
+    struct tls_dtv *dtv;
+    if (newthread != NULL) {
+        space = newthread->slab;
+        dtv = newthread->tls_dtv;
+    } else {
         // allocate stack
-        assert((stacksize % sizeof(uintptr_t)) == 0);
         void *stack = malloc(stacksize);
         if (stack == NULL) {
             return NULL;
         }
 
-    // allocate space for TCB + initial TLS data
-    // no mutex as it may deadlock: see comment for thread_slabs_spinlock
-    // thread_mutex_lock(&thread_slabs_mutex);
-    acquire_spinlock(&thread_slabs_spinlock);
-    void *space = slab_alloc(&thread_slabs);
-    release_spinlock(&thread_slabs_spinlock);
-    // thread_mutex_unlock(&thread_slabs_mutex);
-    if (space == NULL) {
-        free(stack);
-        return NULL;
+        // allocate space for TCB + initial TLS data
+        // no mutex as it may deadlock: see comment for thread_slabs_spinlock
+        // thread_mutex_lock(&thread_slabs_mutex);
+        acquire_spinlock(&thread_slabs_spinlock);
+        space = slab_alloc(&thread_slabs);
+        release_spinlock(&thread_slabs_spinlock);
+        // thread_mutex_unlock(&thread_slabs_mutex);
+        if (space == NULL) {
+            free(stack);
+            return NULL;
+        }
+        // split space into TLS data followed by TCB
+        // XXX: this layout is specific to the x86 ABIs! once other (saner)
+        // architectures support TLS, we'll need to break out the logic.
+        newthread = (void *)((uintptr_t)space + tls_block_total_len);
+        dtv = NULL;
+
+        // init stack
+        newthread->stack = stack;
+        newthread->stack_bytes = stacksize;
+        newthread->stack_top = (char *)stack + stacksize;
+
+        // waste space for alignment, if malloc gave us an unaligned stack
+        newthread->stack_top = (char *)newthread->stack_top
+            - (lvaddr_t)newthread->stack_top % STACK_ALIGNMENT;
+
+        newthread->exception_stack = NULL;
     }
-    // split space into TLS data followed by TCB
-    // XXX: this layout is specific to the x86 ABIs! once other (saner)
-    // architectures support TLS, we'll need to break out the logic.
     void *tls_data = space;
-    struct thread *newthread = (void *)((uintptr_t)space + tls_block_total_len);
 
     // init thread
     thread_init(curdispatcher(), newthread);
@@ -409,20 +570,15 @@ struct thread *thread_create_unrunnable(thread_func_t start_func, void *arg,
                tls_block_total_len - tls_block_init_len);
 
         // create a TLS thread vector
-        struct tls_dtv *dtv = malloc(sizeof(struct tls_dtv) + 1 * sizeof(void *));
-        assert(dtv != NULL);
+        if (dtv == NULL) {
+            dtv = malloc(sizeof(struct tls_dtv) + 1 * sizeof(void *));
+            assert(dtv != NULL);
+        }
 
         dtv->gen = 0;
         dtv->dtv[0] = tls_data;
         newthread->tls_dtv = dtv;
     }
-    // init stack
-    newthread->stack = stack;
-    newthread->stack_top = (char *)stack + stacksize;
-
-    // waste space for alignment, if malloc gave us an unaligned stack
-    newthread->stack_top = (char *)newthread->stack_top
-        - (lvaddr_t)newthread->stack_top % STACK_ALIGNMENT;
 
     paging_init_onthread(newthread);
     // init registers
@@ -449,9 +605,8 @@ struct thread *thread_create_varstack(thread_func_t start_func, void *arg,
     if (newthread) {
         // enqueue on runq
         dispatcher_handle_t handle = disp_disable();
-        struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
         newthread->disp = handle;
-        thread_enqueue(newthread, &disp_gen->runq);
+        thread_runq_enqueue_disabled(handle, newthread);
         disp_enable(handle);
     }
     return newthread;
@@ -580,18 +735,13 @@ void thread_yield(void)
         dispatcher_get_enabled_save_area(handle);
 
     struct thread *me = disp_gen->current;
-    struct thread *next = me;
     me->yield_epoch = disp_gen->timeslice;
 
-    do {
-        assert_disabled(next != NULL);
-        next = next->next;
-        if (next == me) {
-            break; // Everybody yielded this timeslice
-        }
-    } while(next->yield_epoch == disp_gen->timeslice);
-
-    if (next != me) {
+    // Threads are picked in round-robin order, so if the next one already
+    // yielded this timeslice then everybody in the band has had a turn
+    struct thread *next = thread_runq_next_disabled(handle, me->next);
+    assert_disabled(next != NULL);
+    if (next != me && next->yield_epoch != disp_gen->timeslice) {
         fpu_context_switch(disp_gen, next);
         disp_gen->current = next;
         disp_switch(handle, &me->regs, &next->regs);
@@ -645,9 +795,10 @@ static int cleanup_thread(void *arg)
     assert(ft == NULL);
 
     // run the next thread, if any
-    struct thread *next = me->next;
-    thread_remove_from_queue(&disp_gen->runq, me);
-    if (next != me) {
+    struct thread *follow = me->next;
+    thread_runq_remove_disabled(handle, me);
+    struct thread *next = thread_runq_next_disabled(handle, follow);
+    if (next != NULL) {
         disp_gen->current = next;
         disp_resume(handle, &next->regs);
     } else {
@@ -691,9 +842,10 @@ void thread_exit(void)
 #endif
 
         // run the next thread, if any
-        struct thread *next = me->next;
-        thread_remove_from_queue(&disp_gen->runq, me);
-        if (next != me) {
+        struct thread *follow = me->next;
+        thread_runq_remove_disabled(handle, me);
+        struct thread *next = thread_runq_next_disabled(handle, follow);
+        if (next != NULL) {
             fpu_context_switch(disp_gen, next);
             disp_gen->current = next;
             disp_resume(handle, &next->regs);
@@ -732,9 +884,9 @@ void thread_exit(void)
         }
 #endif
 
-        thread_remove_from_queue(&disp_gen->runq, me);
-        thread_enqueue(dg->cleanupthread, &disp_gen->runq);
+        thread_runq_remove_disabled(handle, me);
         disp_gen->cleanupthread->disp = handle;
+        thread_runq_enqueue_disabled(handle, disp_gen->cleanupthread);
         fpu_context_switch(disp_gen, dg->cleanupthread);
         disp_gen->current = dg->cleanupthread;
         disp_resume(handle, &dg->cleanupthread->regs);
@@ -763,9 +915,10 @@ void thread_exit(void)
 #endif
 
         // run the next thread, if any
-        struct thread *next = me->next;
-        thread_remove_from_queue(&disp_gen->runq, me);
-        if (next != me) {
+        struct thread *follow = me->next;
+        thread_runq_remove_disabled(handle, me);
+        struct thread *next = thread_runq_next_disabled(handle, follow);
+        if (next != NULL) {
             fpu_context_switch(disp_gen, next);
             disp_gen->current = next;
             disp_resume(handle, &next->regs);
@@ -804,13 +957,13 @@ void *thread_block_and_release_spinlock_disabled(dispatcher_handle_t handle,
         get_dispatcher_shared_generic(handle);
     struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
     struct thread *me = disp_gen->current;
-    struct thread *next = me->next;
-    assert_disabled(next != NULL);
+    struct thread *follow = me->next;
+    assert_disabled(follow != NULL);
 
     assert_disabled(me->state == THREAD_STATE_RUNNABLE);
     me->state = THREAD_STATE_BLOCKED;
 
-    thread_remove_from_queue(&disp_gen->runq, me);
+    thread_runq_remove_disabled(handle, me);
     if (queue != NULL) {
         thread_enqueue(me, queue);
     }
@@ -819,7 +972,8 @@ void *thread_block_and_release_spinlock_disabled(dispatcher_handle_t handle,
         release_spinlock(spinlock);
     }
 
-    if (next != me) {
+    struct thread *next = thread_runq_next_disabled(handle, follow);
+    if (next != NULL) {
         assert_disabled(disp_gen->runq != NULL);
         fpu_context_switch(disp_gen, next);
         disp_gen->current = next;
@@ -900,8 +1054,7 @@ struct thread *thread_unblock_one_disabled(dispatcher_handle_t handle,
     /* enqueue on run queue if it's "our" thread, and not paused */
     if (wakeup->disp == handle) {
         if (!wakeup->paused) {
-            struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
-            thread_enqueue(wakeup, &disp_gen->runq);
+            thread_runq_enqueue_disabled(handle, wakeup);
         }
         return NULL;
     } else {
@@ -1062,7 +1215,7 @@ void thread_init_disabled(dispatcher_handle_t handle, bool init_domain)
 
     // Switch to it (always on this dispatcher)
     thread->disp = handle;
-    thread_enqueue(thread, &disp_gen->runq);
+    thread_runq_enqueue_disabled(handle, thread);
     disp_gen->current = thread;
     disp->haswork = true;
     disp_resume(handle, &thread->regs);
@@ -1078,7 +1231,7 @@ void thread_init_remote(dispatcher_handle_t handle, struct thread *thread)
     struct dispatcher_shared_generic *disp =
         get_dispatcher_shared_generic(handle);
     struct dispatcher_generic *disp_gen = get_dispatcher_generic(handle);
-    thread_enqueue(thread, &disp_gen->runq);
+    thread_runq_enqueue_disabled(handle, thread);
     disp_gen->current = thread;
     disp->haswork = true;
     disp_resume(handle, &thread->regs);
@@ -1102,7 +1255,7 @@ void threads_prepare_to_span(dispatcher_handle_t newdh)
         thread_mutex_lock(&thread_slabs_mutex);
         acquire_spinlock(&thread_slabs_spinlock);
 
-        while (slab_freecount(&thread_slabs) < MAX_THREADS - 1) {
+        while (slab_freecount(&thread_slabs) < SPAN_PREFILL_THREADS - 1) {
             size_t size;
             void *buf;
             errval_t err;
@@ -1147,7 +1300,7 @@ void thread_pause_and_capture_state(struct thread *thread,
                 assert_disabled(thread->state == THREAD_STATE_RUNNABLE);
                 thread_block_disabled(dh, NULL);
             } else if (thread->state == THREAD_STATE_RUNNABLE) {
-                thread_remove_from_queue(&disp->runq, thread);
+                thread_runq_remove_disabled(dh, thread);
             }
         }
         if (ret_regs != NULL) {
@@ -1184,12 +1337,11 @@ void thread_resume(struct thread *thread)
 {
     assert(thread != NULL);
     dispatcher_handle_t dh = disp_disable();
-    struct dispatcher_generic *disp = get_dispatcher_generic(dh);
     if (thread->disp == dh) {
         if (thread->paused) {
             thread->paused = false;
             if (thread->state == THREAD_STATE_RUNNABLE) {
-                thread_enqueue(thread, &disp->runq);
+                thread_runq_enqueue_disabled(dh, thread);
             }
         }
     } else {
@@ -1198,6 +1350,39 @@ void thread_resume(struct thread *thread)
     disp_enable(dh);
 }
 
+/**
+ * \brief Change the scheduling priority of a thread
+ *
+ * Takes effect at the next scheduling decision on the thread's dispatcher.
+ */
+void thread_set_priority(struct thread *thread, uint8_t priority)
+{
+    assert(thread != NULL);
+    assert(priority < THREAD_PRIORITY_LEVELS);
+    dispatcher_handle_t dh = disp_disable();
+    if (thread->disp == dh) {
+        if (thread->state == THREAD_STATE_RUNNABLE && !thread->paused) {
+            thread_runq_remove_disabled(dh, thread);
+            thread->priority = priority;
+            thread_runq_enqueue_disabled(dh, thread);
+        } else {
+            thread->priority = priority;
+        }
+    } else {
+        USER_PANIC("NYI: remote dispatcher thread_set_priority()");
+    }
+    disp_enable(dh);
+}
+
+/**
+ * \brief Return the scheduling priority of a thread
+ */
+uint8_t thread_get_priority(struct thread *thread)
+{
+    assert(thread != NULL);
+    return thread->priority;
+}
+
 /**
  * \brief Set old-style thread-local storage pointer.
  * \param p   User's pointer
@@ -1361,7 +1546,7 @@ void thread_deliver_exception_disabled(dispatcher_handle_t handle,
 
         // TODO: actually delete the thread!
         disp_gen->current = NULL;
-        thread_remove_from_queue(&disp_gen->runq, thread);
+        thread_runq_remove_disabled(handle, thread);
         return;
     }
 
@@ -22,6 +22,7 @@
 #include <barrelfish/waitset_chan.h>
 #include <barrelfish/threads.h>
 #include <barrelfish/dispatch.h>
+#include <barrelfish/deferred.h>
 #include "threads_priv.h"
 #include "waitset_chan_priv.h"
 
@@ -180,6 +181,61 @@ static void poll_channel(struct waitset_chanstate *chan)
     }
 }
 
+/**
+ * \brief Poll every polled channel on the waitset once
+ *
+ * Polling starts at the head of the polled queue, and the head is advanced
+ * afterwards, so that successive calls give every channel a turn at being
+ * first instead of favouring the same one.
+ *
+ * Takes part in the same ownership protocol as get_next_event(): nothing is
+ * polled if another thread is already polling the waitset, and a thread
+ * blocked on the waitset is woken to carry on polling when we are done.
+ */
+static void poll_channels_once(struct waitset *ws)
+{
+    struct waitset_chanstate *chan, *next;
+    size_t count = 0;
+
+    dispatcher_handle_t handle = disp_disable();
+    if (ws->polling || ws->polled == NULL) {
+        disp_enable(handle);
+        return;
+    }
+    ws->polling = true;
+    disp_enable(handle);
+
+    // count first: triggered channels leave the queue while we walk it
+    chan = ws->polled;
+    if (chan != NULL) {
+        do {
+            count++;
+            chan = chan->next;
+        } while (chan != ws->polled);
+    }
+
+    for (chan = ws->polled; count-- > 0 && chan != NULL
+             && chan->waitset == ws && chan->state == CHAN_POLLED;
+         chan = next) {
+        next = chan->next;
+        poll_channel(chan);
+    }
+
+    handle = disp_disable();
+    if (ws->polled != NULL) {
+        ws->polled = ws->polled->next;
+    }
+    if (ws->polled != NULL && ws->waiting_threads != NULL) {
+        // hand polling over to a blocked thread, as get_next_event() does
+        struct thread *t;
+        t = thread_unblock_one_disabled(handle, &ws->waiting_threads, NULL);
+        assert(t == NULL); // shouldn't see a remote thread
+    } else {
+        ws->polling = false;
+    }
+    disp_enable(handle);
+}
+
 // pollcycles_*: arch-specific implementation for polling.
 //               Used by get_next_event().
 //
@@ -425,6 +481,59 @@ errval_t event_dispatch(struct waitset *ws)
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief Wait for (block) and dispatch a batch of events on given waitset
+ *
+ * Waits for the first event like event_dispatch(), then keeps dispatching
+ * events that are already pending, without going through the blocking and
+ * polling machinery of get_next_event() for each. Events are dequeued one at
+ * a time, right before their closure runs, so a handler that cancels or
+ * deregisters another pending event also stops it from being dispatched. A
+ * handler that re-triggers its own channel goes to the back of the queue,
+ * so one busy channel cannot starve the others.
+ *
+ * \param ws  Waitset
+ * \param max Maximum number of events to dispatch before returning
+ */
+errval_t event_dispatch_many(struct waitset *ws, size_t max)
+{
+    struct waitset_chanstate *chan;
+    struct event_closure closure;
+
+    assert(max > 0);
+
+    errval_t err = get_next_event(ws, &closure);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    for (size_t done = 0; ; ) {
+        assert(closure.handler != NULL);
+        closure.handler(closure.arg);
+        if (++done >= max) {
+            break;
+        }
+
+        dispatcher_handle_t handle = disp_disable();
+        chan = get_pending_event_disabled(ws);
+        disp_enable(handle);
+
+        if (chan == NULL && ws->polled != NULL) {
+            // give polled channels a chance before deciding we are out of work
+            poll_channels_once(ws);
+            handle = disp_disable();
+            chan = get_pending_event_disabled(ws);
+            disp_enable(handle);
+        }
+        if (chan == NULL) {
+            break;
+        }
+        closure = chan->closure;
+    }
+
+    return SYS_ERR_OK;
+}
+
 /**
  * \brief check and dispatch next event on given waitset
  *
@@ -449,6 +558,53 @@ errval_t event_dispatch_non_block(struct waitset *ws)
     return SYS_ERR_OK;
 }
 
+static void event_timeout_handler(void *arg)
+{
+    bool *expired = arg;
+    *expired = true;
+}
+
+/**
+ * \brief Wait for (block) and dispatch next event, giving up after a timeout
+ *
+ * Like event_dispatch(), but registers a deferred event on the waitset for
+ * the duration of the wait. If that fires before any other event, nothing is
+ * dispatched and LIB_ERR_EVENT_TIMEOUT is returned. The timeout is only
+ * reliable if no other thread dispatches events on the same waitset.
+ *
+ * \param ws      Waitset
+ * \param timeout Timeout in microseconds
+ */
+errval_t event_dispatch_timeout(struct waitset *ws, delayus_t timeout)
+{
+    struct deferred_event timer;
+    struct event_closure closure;
+    bool expired = false;
+    errval_t err;
+
+    deferred_event_init(&timer);
+    err = deferred_event_register(&timer, ws, timeout,
+                                  MKCLOSURE(event_timeout_handler, &expired));
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    err = get_next_event(ws, &closure);
+    if (err_is_fail(err)) {
+        deferred_event_cancel(&timer);
+        return err;
+    }
+
+    assert(closure.handler != NULL);
+    if (closure.handler == event_timeout_handler && closure.arg == &expired) {
+        return LIB_ERR_EVENT_TIMEOUT;
+    }
+
+    // the timer lives on our stack: withdraw it before running the handler
+    deferred_event_cancel(&timer);
+    closure.handler(closure.arg);
+    return SYS_ERR_OK;
+}
 
 /**
  * \privatesection
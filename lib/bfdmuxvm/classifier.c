@@ -0,0 +1,464 @@
+/**
+ * \file
+ * \brief Compiled packet classifier for sets of bfdmux filters
+ *
+ * Instead of running every filter through the byte code interpreter until one
+ * matches, filters of the form generated by the bfdmuxtools templates (a
+ * conjunction of "intN[offset] == constant" terms, such as the MAC, IPv4,
+ * protocol and port tests of a socket filter) are compiled into exact-match
+ * hash tables. All filters testing the same set of packet fields share one
+ * table, so a packet is classified with one hash lookup per distinct filter
+ * shape, independent of the number of filters. Filters that do not fit this
+ * form are still executed by the interpreter.
+ */
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <bfdmuxvm/vm.h>
+#include <bfdmuxvm/classifier.h>
+
+#define INITIAL_BUCKETS 16
+
+/**
+ * \brief Hash table of all compiled filters testing the same set of fields
+ */
+struct classifier_sig {
+    int nfields;
+    struct classifier_field fields[CLASSIFIER_MAX_FIELDS];
+    int min_len;                /**< Packets shorter than this cannot match */
+    struct classifier_rule **buckets;
+    size_t nbuckets;            /**< Power of two */
+    size_t count;
+    struct classifier_sig *next;
+};
+
+/**
+ * \brief Term of a filter while it is being compiled
+ */
+struct term {
+    struct classifier_field field;
+    uint64_t value;
+};
+
+static inline uint64_t read_imm(uint8_t * p, int width)
+{
+    switch (width) {
+    case 1:
+        return *p;
+    case 2: {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    case 4: {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    default: {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    }
+}
+
+/// Width of an immediate opcode, 0 if op is not an immediate
+static inline int imm_width(uint8_t op)
+{
+    switch (op) {
+    case OP_INT8:
+        return 1;
+    case OP_INT16:
+        return 2;
+    case OP_INT32:
+        return 4;
+    case OP_INT64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/// Width of a packet load opcode, 0 if op is not a load
+static inline int load_width(uint8_t op)
+{
+    switch (op) {
+    case OP_LOAD8:
+        return 1;
+    case OP_LOAD16:
+        return 2;
+    case OP_LOAD32:
+        return 4;
+    case OP_LOAD64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * \brief Parse an immediate operand
+ * \return Position after the operand, or -1 if it is not an immediate
+ */
+static int parse_imm(uint8_t * code, int len, int pos, uint64_t * value)
+{
+    if (pos >= len) {
+        return -1;
+    }
+    int width = imm_width(code[pos]);
+    if (width == 0 || pos + 1 + width > len) {
+        return -1;
+    }
+    *value = read_imm(code + pos + 1, width);
+    return pos + 1 + width;
+}
+
+/**
+ * \brief Parse a load from a constant packet offset
+ * \return Position after the operand, or -1 if it is not such a load
+ */
+static int parse_load(uint8_t * code, int len, int pos,
+                      struct classifier_field *field)
+{
+    if (pos >= len) {
+        return -1;
+    }
+    int width = load_width(code[pos]);
+    uint64_t offset;
+    if (width == 0) {
+        return -1;
+    }
+    pos = parse_imm(code, len, pos + 1, &offset);
+    if (pos < 0 || offset > UINT16_MAX) {
+        return -1;
+    }
+    field->offset = offset;
+    field->width = width;
+    return pos;
+}
+
+/**
+ * \brief Collect the terms of a conjunction of equality tests
+ * \return Position after the subtree, or -1 if the subtree has another form
+ */
+static int parse_conjunction(uint8_t * code, int len, int pos,
+                             struct term *terms, int *nterms)
+{
+    if (pos >= len) {
+        return -1;
+    }
+
+    uint64_t value;
+    struct classifier_field field;
+    int next;
+
+    switch (code[pos]) {
+    case OP_AND:
+        // opcode and 32 bit subtree size, then both operands
+        pos = parse_conjunction(code, len, pos + 5, terms, nterms);
+        if (pos < 0) {
+            return -1;
+        }
+        return parse_conjunction(code, len, pos, terms, nterms);
+
+    case OP_EQUAL:
+        next = parse_load(code, len, pos + 1, &field);
+        if (next >= 0) {
+            next = parse_imm(code, len, next, &value);
+        } else {
+            next = parse_imm(code, len, pos + 1, &value);
+            if (next >= 0) {
+                next = parse_load(code, len, next, &field);
+            }
+        }
+        if (next < 0) {
+            return -1;
+        }
+
+        // the same field tested twice must agree, or the filter never matches
+        for (int i = 0; i < *nterms; i++) {
+            if (terms[i].field.offset == field.offset
+                && terms[i].field.width == field.width) {
+                return terms[i].value == value ? next : -1;
+            }
+        }
+        if (*nterms == CLASSIFIER_MAX_FIELDS) {
+            return -1;
+        }
+        terms[*nterms].field = field;
+        terms[*nterms].value = value;
+        (*nterms)++;
+        return next;
+
+    default:
+        // a constant true term (e.g. "1" for a wildcard address) is a no-op
+        next = parse_imm(code, len, pos, &value);
+        if (next < 0 || value == 0) {
+            return -1;
+        }
+        return next;
+    }
+}
+
+static int term_cmp(const void *a, const void *b)
+{
+    const struct term *ta = a, *tb = b;
+    if (ta->field.offset != tb->field.offset) {
+        return ta->field.offset < tb->field.offset ? -1 : 1;
+    }
+    return (int)ta->field.width - (int)tb->field.width;
+}
+
+static inline uint32_t hash_values(uint64_t * values, int n)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < n; i++) {
+        h ^= values[i];
+        h *= 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    return (uint32_t) (h ^ (h >> 32));
+}
+
+/// Big-endian packet field, as loaded by the interpreter
+static inline uint64_t load_field(uint8_t * packet, struct classifier_field *f)
+{
+    uint8_t *p = packet + f->offset;
+    uint64_t v = 0;
+    for (int i = 0; i < f->width; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static struct classifier_sig *find_sig(struct classifier *c, struct term *terms,
+                                       int nterms)
+{
+    for (struct classifier_sig * sig = c->sigs; sig != NULL; sig = sig->next) {
+        if (sig->nfields != nterms) {
+            continue;
+        }
+        int i;
+        for (i = 0; i < nterms; i++) {
+            if (sig->fields[i].offset != terms[i].field.offset
+                || sig->fields[i].width != terms[i].field.width) {
+                break;
+            }
+        }
+        if (i == nterms) {
+            return sig;
+        }
+    }
+
+    struct classifier_sig *sig = calloc(1, sizeof(struct classifier_sig));
+    if (sig == NULL) {
+        return NULL;
+    }
+    sig->buckets = calloc(INITIAL_BUCKETS, sizeof(struct classifier_rule *));
+    if (sig->buckets == NULL) {
+        free(sig);
+        return NULL;
+    }
+    sig->nbuckets = INITIAL_BUCKETS;
+    sig->nfields = nterms;
+    for (int i = 0; i < nterms; i++) {
+        sig->fields[i] = terms[i].field;
+        if (terms[i].field.offset + terms[i].field.width > sig->min_len) {
+            sig->min_len = terms[i].field.offset + terms[i].field.width;
+        }
+    }
+    sig->next = c->sigs;
+    c->sigs = sig;
+    return sig;
+}
+
+/// Double the bucket array of a signature; keeps the old one on failure
+static void grow_sig(struct classifier_sig *sig)
+{
+    size_t nbuckets = sig->nbuckets * 2;
+    struct classifier_rule **buckets =
+        calloc(nbuckets, sizeof(struct classifier_rule *));
+    if (buckets == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < sig->nbuckets; i++) {
+        struct classifier_rule *r = sig->buckets[i], *next;
+        for (; r != NULL; r = next) {
+            next = r->next;
+            struct classifier_rule **b = &buckets[r->hash & (nbuckets - 1)];
+            r->next = *b;
+            *b = r;
+        }
+    }
+
+    free(sig->buckets);
+    sig->buckets = buckets;
+    sig->nbuckets = nbuckets;
+}
+
+static void remove_sig(struct classifier *c, struct classifier_sig *sig)
+{
+    struct classifier_sig **p = &c->sigs;
+    while (*p != sig) {
+        p = &(*p)->next;
+    }
+    *p = sig->next;
+    free(sig->buckets);
+    free(sig);
+}
+
+/**
+ * \brief Initialize an empty classifier
+ */
+void classifier_init(struct classifier *c)
+{
+    memset(c, 0, sizeof(struct classifier));
+}
+
+/**
+ * \brief Add a filter to a classifier
+ *
+ * Only the hash table of the filter's signature is updated, so adding (and
+ * removing) filters does not rebuild the rest of the classifier.
+ *
+ * @param c Classifier
+ * @param code Filter byte code; must stay valid until the filter is removed
+ * @param len Length of the byte code
+ * @param prio Priority of the filter; on multiple matches the highest wins
+ * @param owner Value returned by classifier_match() if this filter wins
+ * @return Handle for classifier_remove(), or NULL if out of memory
+ */
+struct classifier_rule *classifier_add(struct classifier *c, uint8_t * code,
+                                       int32_t len, uint64_t prio,
+                                       void *owner)
+{
+    struct classifier_rule *rule = calloc(1, sizeof(struct classifier_rule));
+    if (rule == NULL) {
+        return NULL;
+    }
+    rule->owner = owner;
+    rule->prio = prio;
+    rule->code = code;
+    rule->len = len;
+
+    struct term terms[CLASSIFIER_MAX_FIELDS];
+    int nterms = 0;
+    if (parse_conjunction(code, len, 0, terms, &nterms) == len && nterms > 0) {
+        qsort(terms, nterms, sizeof(struct term), term_cmp);
+        rule->sig = find_sig(c, terms, nterms);
+    }
+
+    if (rule->sig != NULL) {
+        struct classifier_sig *sig = rule->sig;
+        for (int i = 0; i < nterms; i++) {
+            rule->values[i] = terms[i].value;
+        }
+        rule->hash = hash_values(rule->values, nterms);
+
+        if (sig->count >= sig->nbuckets) {
+            grow_sig(sig);
+        }
+        struct classifier_rule **b = &sig->buckets[rule->hash & (sig->nbuckets - 1)];
+        rule->next = *b;
+        *b = rule;
+        sig->count++;
+        c->compiled_count++;
+    } else {
+        // keep the interpreted list sorted by decreasing priority
+        struct classifier_rule **p = &c->interpreted;
+        while (*p != NULL && (*p)->prio > prio) {
+            p = &(*p)->next;
+        }
+        rule->next = *p;
+        *p = rule;
+        c->interpreted_count++;
+    }
+
+    return rule;
+}
+
+/**
+ * \brief Remove a filter from a classifier and free its handle
+ */
+void classifier_remove(struct classifier *c, struct classifier_rule *rule)
+{
+    struct classifier_rule **p;
+    struct classifier_sig *sig = rule->sig;
+
+    if (sig != NULL) {
+        p = &sig->buckets[rule->hash & (sig->nbuckets - 1)];
+    } else {
+        p = &c->interpreted;
+    }
+    while (*p != rule) {
+        p = &(*p)->next;
+    }
+    *p = rule->next;
+
+    if (sig != NULL) {
+        c->compiled_count--;
+        if (--sig->count == 0) {
+            remove_sig(c, sig);
+        }
+    } else {
+        c->interpreted_count--;
+    }
+    free(rule);
+}
+
+/**
+ * \brief Find the highest priority filter matching a packet
+ * @param c Classifier
+ * @param packet_data Points to the packet data
+ * @param packet_len Length of packet data in bytes
+ * @return The owner of the matching filter, or NULL if none matches
+ */
+void *classifier_match(struct classifier *c, uint8_t * packet_data,
+                       int packet_len)
+{
+    struct classifier_rule *best = NULL;
+    uint64_t values[CLASSIFIER_MAX_FIELDS];
+
+    for (struct classifier_sig * sig = c->sigs; sig != NULL; sig = sig->next) {
+        if (packet_len < sig->min_len) {
+            continue;
+        }
+        for (int i = 0; i < sig->nfields; i++) {
+            values[i] = load_field(packet_data, &sig->fields[i]);
+        }
+        uint32_t hash = hash_values(values, sig->nfields);
+
+        struct classifier_rule *r = sig->buckets[hash & (sig->nbuckets - 1)];
+        for (; r != NULL; r = r->next) {
+            if (r->hash != hash || (best != NULL && r->prio <= best->prio)) {
+                continue;
+            }
+            if (memcmp(r->values, values, sig->nfields * sizeof(uint64_t)) == 0) {
+                best = r;
+            }
+        }
+    }
+
+    // only interpreted filters that would win need to be run
+    for (struct classifier_rule * r = c->interpreted; r != NULL; r = r->next) {
+        if (best != NULL && r->prio <= best->prio) {
+            break;
+        }
+        if (execute_filter(r->code, r->len, packet_data, packet_len, NULL)) {
+            best = r;
+            break;
+        }
+    }
+
+    return best == NULL ? NULL : best->owner;
+}
@@ -218,5 +218,34 @@ void netbench_print_all_stats(struct netbench_details *nbp)
     } // end for: each event
 }
 
+// Packets per second, for #packets handled in #cycles
+float netbench_pps(uint64_t packets, uint64_t cycles)
+{
+    float secs = in_seconds(cycles);
+    if (secs <= 0) {
+        return 0;
+    }
+    return packets / secs;
+}
+
+// Run #fn for batch sizes 1, 2, 4, ... max_batch and print packets/second
+void netbench_batch_sweep(char *name, netbench_batch_fn fn, void *arg,
+        uint32_t max_batch, uint64_t packets)
+{
+    for (uint32_t batch = 1; batch <= max_batch; batch *= 2) {
+        uint64_t done = 0, moved;
+        uint64_t start = rdtsc();
+        do {
+            moved = fn(arg, batch);
+            done += moved;
+        } while (moved > 0 && done < packets);
+        uint64_t cycles = rdtsc() - start;
+
+        printf("Batch %20s: SIZE[%"PRIu32"], N[%"PRIu64"], PPS[%.0"PU"]%s\n",
+              name, batch, done, netbench_pps(done, cycles),
+              done < packets ? " (stalled)" : "");
+    }
+}
+
 #endif // NETBENCH_C_
 
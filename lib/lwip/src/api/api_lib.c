@@ -354,7 +354,8 @@ struct netbuf *netconn_recv(struct netconn *conn)
     struct pbuf *p;
     u16_t len;
 
-    printf("netconn_recv called on [%p]\n", conn);
+    LWIP_DEBUGF(API_LIB_DEBUG, ("netconn_recv called on [%p]\n",
+                                (void *) conn));
     LWIP_ERROR("netconn_recv: invalid conn", (conn != NULL), return NULL;
       );
 
@@ -460,6 +461,72 @@ struct netbuf *netconn_recv(struct netconn *conn)
     return buf;
 }
 
+#if (LWIP_UDP || LWIP_RAW)
+/**
+ * Receive several netbufs from a UDP or RAW netconn. Waits for the first one
+ * like netconn_recv(), then takes those already queued without waiting.
+ *
+ * @param conn the netconn from which to receive data
+ * @param bufs returns the received netbufs
+ * @param n maximum number of netbufs to receive
+ * @return number of netbufs received, 0 on timeout or error (see conn->err)
+ */
+u16_t netconn_recv_multi(struct netconn *conn, struct netbuf **bufs, u16_t n)
+{
+    u16_t i, got = 0;
+
+    LWIP_ERROR("netconn_recv_multi: invalid conn", (conn != NULL), return 0;
+      );
+    LWIP_ERROR("netconn_recv_multi: not for TCP",
+               (conn->type != NETCONN_TCP), return 0;
+      );
+    LWIP_ERROR("netconn_recv_multi: invalid bufs", (bufs != NULL && n > 0),
+               return 0;
+      );
+
+    if (conn->recvmbox == SYS_MBOX_NULL) {
+        conn->err = ERR_CONN;
+        return 0;
+    }
+
+    if (ERR_IS_FATAL(conn->err)) {
+        return 0;
+    }
+
+    lwip_mutex_unlock();
+#if LWIP_SO_RCVTIMEO
+    if (sys_arch_mbox_fetch
+        (conn->recvmbox, (void *) &bufs[0],
+         conn->recv_timeout) == SYS_ARCH_TIMEOUT) {
+        bufs[0] = NULL;
+    }
+#else
+    sys_arch_mbox_fetch(conn->recvmbox, (void *) &bufs[0], 0);
+#endif                          /* LWIP_SO_RCVTIMEO */
+    if (bufs[0] != NULL) {
+        for (got = 1; got < n; got++) {
+            if (sys_arch_mbox_tryfetch(conn->recvmbox, (void *) &bufs[got])
+                == SYS_MBOX_EMPTY) {
+                break;
+            }
+        }
+    }
+    lwip_mutex_lock();
+
+    for (i = 0; i < got; i++) {
+        SYS_ARCH_DEC(conn->recv_avail, bufs[i]->p->tot_len);
+        /* Register event with callback */
+        API_EVENT(conn, NETCONN_EVT_RCVMINUS, bufs[i]->p->tot_len);
+    }
+
+    LWIP_DEBUGF(API_LIB_DEBUG,
+                ("netconn_recv_multi: received %" U16_F " (err %d)\n", got,
+                 conn->err));
+
+    return got;
+}
+#endif                          /* (LWIP_UDP || LWIP_RAW) */
+
 /**
  * Send data (in form of a netbuf) to a specific remote IP address and port.
  * Only to be used for UDP and RAW netconns (not TCP).
@@ -505,6 +572,35 @@ err_t netconn_send(struct netconn * conn, struct netbuf * buf)
     return conn->err;
 }
 
+/**
+ * Send several netbufs over a UDP or RAW netconn with a single call into the
+ * tcpip_thread. Sending stops at the first netbuf that fails.
+ *
+ * @param conn the UDP or RAW netconn over which to send data
+ * @param bufs array of netbufs to send, each may carry its own address
+ * @param n number of netbufs in bufs
+ * @return number of netbufs sent; if less than n, conn->err tells why
+ */
+u16_t netconn_send_multi(struct netconn * conn, struct netbuf * bufs, u16_t n)
+{
+    struct api_msg msg;
+
+    LWIP_ERROR("netconn_send_multi: invalid conn", (conn != NULL), return 0;
+      );
+    if (n == 0) {
+        return 0;
+    }
+
+    LWIP_DEBUGF(API_LIB_DEBUG,
+                ("netconn_send_multi: sending %" U16_F " netbufs\n", n));
+    msg.function = do_send_multi;
+    msg.msg.conn = conn;
+    msg.msg.msg.bm.bufs = bufs;
+    msg.msg.msg.bm.n = n;
+    TCPIP_APIMSG(&msg);
+    return msg.msg.msg.bm.sent;
+}
+
 /**
  * Send data over a TCP netconn.
  *
@@ -933,6 +933,38 @@ void do_listen(struct api_msg_msg *msg)
     TCPIP_APIMSG_ACK(msg);
 }
 
+/**
+ * Send one netbuf on the RAW or UDP pcb of a netconn, setting conn->err
+ *
+ * @param conn the netconn to send on
+ * @param b the netbuf to send
+ */
+static void send_netbuf(struct netconn *conn, struct netbuf *b)
+{
+    switch (NETCONNTYPE_GROUP(conn->type)) {
+#if LWIP_RAW
+        case NETCONN_RAW:
+            if (b->addr == NULL) {
+                conn->err = raw_send(conn->pcb.raw, b->p);
+            } else {
+                conn->err = raw_sendto(conn->pcb.raw, b->p, b->addr);
+            }
+            break;
+#endif
+#if LWIP_UDP
+        case NETCONN_UDP:
+            if (b->addr == NULL) {
+                conn->err = udp_send(conn->pcb.udp, b->p);
+            } else {
+                conn->err = udp_sendto(conn->pcb.udp, b->p, b->addr, b->port);
+            }
+            break;
+#endif                          /* LWIP_UDP */
+        default:
+            break;
+    }
+}
+
 /**
  * Send some data on a RAW or UDP pcb contained in a netconn
  * Called from netconn_send
@@ -943,33 +975,32 @@ void do_send(struct api_msg_msg *msg)
 {
     if (!ERR_IS_FATAL(msg->conn->err)) {
         if (msg->conn->pcb.tcp != NULL) {
-            switch (NETCONNTYPE_GROUP(msg->conn->type)) {
-#if LWIP_RAW
-                case NETCONN_RAW:
-                    if (msg->msg.b->addr == NULL) {
-                        msg->conn->err =
-                          raw_send(msg->conn->pcb.raw, msg->msg.b->p);
-                    } else {
-                        msg->conn->err =
-                          raw_sendto(msg->conn->pcb.raw, msg->msg.b->p,
-                                     msg->msg.b->addr);
-                    }
-                    break;
-#endif
-#if LWIP_UDP
-                case NETCONN_UDP:
-                    if (msg->msg.b->addr == NULL) {
-                        msg->conn->err =
-                          udp_send(msg->conn->pcb.udp, msg->msg.b->p);
-                    } else {
-                        msg->conn->err =
-                          udp_sendto(msg->conn->pcb.udp, msg->msg.b->p,
-                                     msg->msg.b->addr, msg->msg.b->port);
-                    }
-                    break;
-#endif                          /* LWIP_UDP */
-                default:
+            send_netbuf(msg->conn, msg->msg.b);
+        }
+    }
+    TCPIP_APIMSG_ACK(msg);
+}
+
+/**
+ * Send several netbufs on a RAW or UDP pcb contained in a netconn, stopping
+ * at the first one that fails. The number sent is returned in msg.bm.sent.
+ * Called from netconn_send_multi
+ *
+ * @param msg the api_msg_msg pointing to the connection
+ */
+void do_send_multi(struct api_msg_msg *msg)
+{
+    u16_t i;
+
+    msg->msg.bm.sent = 0;
+    if (!ERR_IS_FATAL(msg->conn->err)) {
+        if (msg->conn->pcb.tcp != NULL) {
+            for (i = 0; i < msg->msg.bm.n; i++) {
+                send_netbuf(msg->conn, &msg->msg.bm.bufs[i]);
+                if (msg->conn->err != ERR_OK) {
                     break;
+                }
+                msg->msg.bm.sent++;
             }
         }
     }
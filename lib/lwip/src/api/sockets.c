@@ -804,6 +804,259 @@ lwip_sendto(int s, const void *data, size_t size, int flags,
     return (err == ERR_OK ? short_size : -1);
 }
 
+/**
+ * lwip_recvmmsg() for TCP sockets and MSG_PEEK: one lwip_recvfrom() per
+ * message, only the first of which may wait.
+ */
+static int recvmmsg_each(int s, struct lwip_socket *sock,
+                         struct lwip_mmsghdr *msgvec, unsigned int vlen,
+                         int flags)
+{
+    unsigned int i;
+    int len = -1;
+
+    for (i = 0; i < vlen; i++) {
+        struct lwip_mmsghdr *m = &msgvec[i];
+
+        len = lwip_recvfrom(s, m->msg_buf, m->msg_buflen,
+                            (i == 0) ? flags : (flags | MSG_DONTWAIT),
+                            m->msg_name,
+                            (m->msg_name != NULL) ? &m->msg_namelen : NULL);
+        if (len < 0 || (len == 0 && netconn_type(sock->conn) == NETCONN_TCP)) {
+            break;
+        }
+        m->msg_len = len;
+    }
+    if (i == 0) {
+        return len;             /* errno set by lwip_recvfrom */
+    }
+    sock_set_errno(sock, 0);
+    return i;
+}
+
+/**
+ * Copy a received datagram into a message of lwip_recvmmsg() and free it.
+ * Like lwip_recvfrom(), a datagram longer than the buffer is truncated.
+ */
+static void recvmmsg_copy(struct lwip_mmsghdr *m, struct netbuf *buf)
+{
+    u16_t len = netbuf_len(buf);
+
+    if (len > m->msg_buflen) {
+        len = (u16_t) m->msg_buflen;
+    }
+    netbuf_copy(buf, m->msg_buf, len);
+    m->msg_len = len;
+
+    if (m->msg_name != NULL) {
+        struct sockaddr_in sin;
+
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_len = sizeof(sin);
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(netbuf_fromport(buf));
+        sin.sin_addr.s_addr = netbuf_fromaddr(buf)->addr;
+
+        if (m->msg_namelen > sizeof(sin)) {
+            m->msg_namelen = sizeof(sin);
+        }
+        MEMCPY(m->msg_name, &sin, m->msg_namelen);
+    }
+    netbuf_delete(buf);
+}
+
+/**
+ * Receive several datagrams with one call. Waits for the first one (unless
+ * the socket is non-blocking or MSG_DONTWAIT is given) and then returns all
+ * that are already queued, up to vlen, taking up to LWIP_MMSG_BATCH off the
+ * socket at a time.
+ *
+ * TCP sockets and MSG_PEEK are handled one message at a time.
+ *
+ * @param s the socket
+ * @param msgvec the messages to receive into
+ * @param vlen number of messages in msgvec
+ * @param flags MSG_DONTWAIT or MSG_PEEK
+ * @return number of messages received, or -1 on error
+ */
+int lwip_recvmmsg(int s, struct lwip_mmsghdr *msgvec, unsigned int vlen,
+                  int flags)
+{
+    struct lwip_socket *sock;
+    struct netbuf *bufs[LWIP_MMSG_BATCH];
+    unsigned int done = 0;
+    u16_t n, got, i;
+
+    LWIP_DEBUGF(SOCKETS_DEBUG,
+                ("lwip_recvmmsg(%d, %p, %u, 0x%x)\n", s, (void *) msgvec,
+                 vlen, flags));
+    sock = get_socket(s);
+    if (!sock)
+        return -1;
+
+    if (vlen == 0) {
+        sock_set_errno(sock, 0);
+        return 0;
+    }
+
+    if (netconn_type(sock->conn) == NETCONN_TCP || (flags & MSG_PEEK) ||
+        sock->lastdata != NULL) {
+        /* a peeked datagram is not returned twice */
+        return recvmmsg_each(s, sock, msgvec, (flags & MSG_PEEK) ? 1 : vlen,
+                             flags);
+    }
+
+    if (((flags & MSG_DONTWAIT) || (sock->flags & O_NONBLOCK)) &&
+        (sock->rcvevent <= 0)) {
+        LWIP_DEBUGF(SOCKETS_DEBUG,
+                    ("lwip_recvmmsg(%d): returning EWOULDBLOCK\n", s));
+        sock_set_errno(sock, EWOULDBLOCK);
+        return -1;
+    }
+
+    do {
+        n = (u16_t) LWIP_MIN(vlen - done, LWIP_MMSG_BATCH);
+        got = netconn_recv_multi(sock->conn, bufs, n);
+        for (i = 0; i < got; i++) {
+            recvmmsg_copy(&msgvec[done + i], bufs[i]);
+        }
+        done += got;
+        /* only the first batch may wait */
+    } while (got == n && done < vlen && sock->rcvevent > 0);
+
+    if (done == 0) {
+        sock_set_errno(sock,
+                       (((sock->conn->pcb.ip != NULL)
+                         && (sock->conn->err == ERR_OK))
+                        ? ETIMEDOUT : err_to_errno(sock->conn->err)));
+        return -1;
+    }
+
+    LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvmmsg(%d) = %u\n", s, done));
+    sock_set_errno(sock, 0);
+    return done;
+}
+
+/**
+ * Send several datagrams with one call, handing up to LWIP_MMSG_BATCH to the
+ * tcpip_thread at a time. Each message may have its own destination, or none
+ * on a connected socket. Sending stops at the first message that fails.
+ *
+ * TCP sockets send one message at a time with lwip_send().
+ *
+ * @param s the socket
+ * @param msgvec the messages to send
+ * @param vlen number of messages in msgvec
+ * @param flags passed to lwip_send() for TCP sockets
+ * @return number of messages sent, or -1 if the first one failed
+ */
+int lwip_sendmmsg(int s, struct lwip_mmsghdr *msgvec, unsigned int vlen,
+                  int flags)
+{
+    struct lwip_socket *sock;
+    unsigned int done = 0;
+    err_t err = ERR_OK;
+
+    LWIP_DEBUGF(SOCKETS_DEBUG,
+                ("lwip_sendmmsg(%d, %p, %u, 0x%x)\n", s, (void *) msgvec,
+                 vlen, flags));
+    sock = get_socket(s);
+    if (!sock)
+        return -1;
+
+    if (sock->conn->type == NETCONN_TCP) {
+#if LWIP_TCP
+        for (; done < vlen; done++) {
+            if (lwip_send(s, msgvec[done].msg_buf, msgvec[done].msg_buflen,
+                          flags) < 0) {
+                /* errno set by lwip_send */
+                return (done > 0) ? (int) done : -1;
+            }
+            msgvec[done].msg_len = msgvec[done].msg_buflen;
+        }
+        return done;
+#else
+        sock_set_errno(sock, err_to_errno(ERR_ARG));
+        return -1;
+#endif                          /* LWIP_TCP */
+    }
+
+#if (LWIP_UDP || LWIP_RAW)
+    {
+        struct netbuf bufs[LWIP_MMSG_BATCH];
+        struct ip_addr addrs[LWIP_MMSG_BATCH];
+        u16_t n, i, sent;
+
+        while (done < vlen && err == ERR_OK) {
+            n = (u16_t) LWIP_MIN(vlen - done, LWIP_MMSG_BATCH);
+            for (i = 0; i < n; i++) {
+                struct lwip_mmsghdr *m = &msgvec[done + i];
+                const struct sockaddr_in *to =
+                  (const struct sockaddr_in *) m->msg_name;
+
+                if (m->msg_buflen > 0xffff ||
+                    !(((to == NULL) && (m->msg_namelen == 0)) ||
+                      ((m->msg_namelen == sizeof(struct sockaddr_in)) &&
+                       (to->sin_family == AF_INET)))) {
+                    err = ERR_ARG;
+                    break;
+                }
+
+                bufs[i].p = bufs[i].ptr = NULL;
+                if (to != NULL) {
+                    addrs[i].addr = to->sin_addr.s_addr;
+                    bufs[i].addr = &addrs[i];
+                    bufs[i].port = ntohs(to->sin_port);
+                } else {
+                    bufs[i].addr = NULL;
+                    bufs[i].port = 0;
+                }
+
+                /* make the buffer point to the data that should be sent */
+#if LWIP_NETIF_TX_SINGLE_PBUF
+                if (netbuf_alloc(&bufs[i], (u16_t) m->msg_buflen) == NULL) {
+                    err = ERR_MEM;
+                } else {
+                    err = netbuf_take(&bufs[i], m->msg_buf,
+                                      (u16_t) m->msg_buflen);
+                }
+#else                           /* LWIP_NETIF_TX_SINGLE_PBUF */
+                err = netbuf_ref(&bufs[i], m->msg_buf, (u16_t) m->msg_buflen);
+#endif                          /* LWIP_NETIF_TX_SINGLE_PBUF */
+                if (err != ERR_OK) {
+                    netbuf_free(&bufs[i]);
+                    break;
+                }
+            }
+
+            /* send what we have prepared, in one go */
+            sent = netconn_send_multi(sock->conn, bufs, i);
+            if (sent < i) {
+                err = (sock->conn->err != ERR_OK) ? sock->conn->err : ERR_CONN;
+            }
+            for (n = 0; n < i; n++) {
+                if (n < sent) {
+                    msgvec[done + n].msg_len = msgvec[done + n].msg_buflen;
+                }
+                netbuf_free(&bufs[n]);
+            }
+            done += sent;
+        }
+    }
+#else
+    err = ERR_ARG;
+#endif                          /* (LWIP_UDP || LWIP_RAW) */
+
+    LWIP_DEBUGF(SOCKETS_DEBUG,
+                ("lwip_sendmmsg(%d) = %u err=%d\n", s, done, err));
+    if (done == 0 && err != ERR_OK) {
+        sock_set_errno(sock, err_to_errno(err));
+        return -1;
+    }
+    sock_set_errno(sock, 0);
+    return done;
+}
+
 int lwip_socket(int domain, int type, int protocol)
 {
     struct netconn *conn;
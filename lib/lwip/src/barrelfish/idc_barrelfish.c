@@ -17,6 +17,7 @@
 
 #include <barrelfish/barrelfish.h>
 #include <barrelfish/nameservice_client.h>
+#include <barrelfish/deferred.h>
 #include <stdio.h>
 #include <assert.h>
 #include <trace/trace.h>
@@ -102,6 +103,9 @@ static uint8_t *mac;
  */
 static bool mac_received = false;
 
+/// Set when the driver has answered get_rx_pool
+static bool rx_pool_replied = false;
+
 /**
  * \brief
  *
@@ -298,7 +302,35 @@ static void sp_process_tx_done(bool debug)
 } // end function: sp_process_tx_done
 
 
-static void do_pending_work_TX_lwip(void)
+// Bounds the delay of coalesced TX notifications
+static struct deferred_event tx_notify_timer;
+static bool tx_notify_timer_armed = false;
+
+static void send_tx_notification(struct net_queue_manager_binding *b)
+{
+    struct client_closure_NC *ccnc = (struct client_closure_NC *)b->st;
+
+    wrapper_send_sp_notification_from_app(b);
+    sp_notify_sent(ccnc->spp_ptr);
+    if (tx_notify_timer_armed) {
+        deferred_event_cancel(&tx_notify_timer);
+        tx_notify_timer_armed = false;
+    }
+}
+
+static void tx_notify_timeout(void *arg)
+{
+    struct net_queue_manager_binding *b = arg;
+    struct client_closure_NC *ccnc = (struct client_closure_NC *)b->st;
+
+    tx_notify_timer_armed = false;
+    if (ccnc->spp_ptr->notify.pending > 0) {
+        send_tx_notification(b);
+    }
+}
+
+// count: slots just produced into the TX spp
+static void do_pending_work_TX_lwip(uint64_t count)
 {
     struct net_queue_manager_binding *b = driver_connection[TRANSMIT_CONNECTION];
     struct client_closure_NC *ccnc = (struct client_closure_NC *)b->st;
@@ -310,15 +342,26 @@ static void do_pending_work_TX_lwip(void)
                     0);
 #endif // TRACE_ONLY_SUB_NNET
 
-    if (spp_send->notify_other_side != 0) {
+    // Coalesced: the driver is told right away only if it may have stopped
+    // polling the spp, otherwise after a batch of slots or a short delay,
+    // and not at all while it is polling.
+    if (sp_notify_produced(spp_send, count)) {
 #if TRACE_ONLY_SUB_NNET
         trace_event(TRACE_SUBSYS_NNET, TRACE_EVENT_NNET_TXLWINOTIF,
                     0);
 #endif // TRACE_ONLY_SUB_NNET
 
-        // It seems that there we should send a notification to other side
-        spp_send->notify_other_side = 0;
-        wrapper_send_sp_notification_from_app(b);
+        send_tx_notification(b);
+    } else if (spp_send->notify.pending > 0 && !tx_notify_timer_armed) {
+        errval_t err = deferred_event_register(&tx_notify_timer, lwip_waitset,
+                                               spp_send->notify.delay_us,
+                                               MKCLOSURE(tx_notify_timeout, b));
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "deferred_event_register, notifying right away");
+            send_tx_notification(b);
+        } else {
+            tx_notify_timer_armed = true;
+        }
     }
 
 #if TRACE_ONLY_SUB_NNET
@@ -372,7 +415,7 @@ uint64_t idc_send_packet_to_network_driver(struct pbuf * p)
 
         // send a msg to driver saying "READ Packets Quickly!"
         spp_send->notify_other_side = 0;
-        wrapper_send_sp_notification_from_app(b);
+        send_tx_notification(b);
 
 /*        printf("Not enough (%"PRIu8") space left in shared_pool %"PRIu64"\n",
                numpbufs, free_slots_count);
@@ -535,7 +578,7 @@ uint64_t idc_send_packet_to_network_driver(struct pbuf * p)
 
 //  printf("idc_send_packet_to_network_driver  is done\n");
     // FIXME: check if there are any packets to send or receive
-    do_pending_work_TX_lwip();
+    do_pending_work_TX_lwip(numpbufs);
 
     return numpbufs;
 } // end function: idc_send_packet_to_network_driver
@@ -692,6 +735,82 @@ void idc_get_mac_address(uint8_t * mac_client)
 }
 
 
+static errval_t send_get_rx_pool(struct q_entry e)
+{
+    struct net_queue_manager_binding *b = (struct net_queue_manager_binding *)
+        e.binding_ptr;
+    struct client_closure_NC *ccnc = (struct client_closure_NC *) b->st;
+
+    if (b->can_send(b)) {
+        return b->tx_vtbl.get_rx_pool(b, MKCONT(cont_queue_callback, ccnc->q),
+                                      ccnc->queueid);
+    } else {
+        LWIPBF_DEBUG("send_get_rx_pool: Flounder busy,rtry+++++\n");
+        return FLOUNDER_ERR_TX_BUSY;
+    }
+}
+
+/**
+ * \brief Ask the driver for its receive buffer pool and wait for the answer
+ *
+ * If the driver has one, received packets are granted to us in the pool's
+ * buffers from then on instead of being copied into our own pbufs.
+ */
+void idc_get_rx_pool(void)
+{
+    struct q_entry entry;
+    errval_t err;
+
+    memset(&entry, 0, sizeof(struct q_entry));
+    entry.handler = send_get_rx_pool;
+    entry.fname = "send_get_rx_pool";
+    struct net_queue_manager_binding *b = driver_connection[RECEIVE_CONNECTION];
+    entry.binding_ptr = (void *) b;
+    struct client_closure_NC *ccnc = (struct client_closure_NC *) b->st;
+    enqueue_cont_q(ccnc->q, &entry);
+
+    while (!rx_pool_replied) {
+        err = event_dispatch(lwip_waitset);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "in event_dispatch on LWIP waitset");
+        }
+    }
+}
+
+static errval_t send_rx_pool_return(struct q_entry e)
+{
+    struct net_queue_manager_binding *b = (struct net_queue_manager_binding *)
+        e.binding_ptr;
+    struct client_closure_NC *ccnc = (struct client_closure_NC *) b->st;
+
+    if (b->can_send(b)) {
+        return b->tx_vtbl.register_rx_pool_return(b,
+                          MKCONT(cont_queue_callback, ccnc->q),
+                          ccnc->queueid, e.cap, e.plist[0]);
+        // queueid, sp_cap, slot_no
+    } else {
+        LWIPBF_DEBUG("send_rx_pool_return: Flounder busy,rtry+++++\n");
+        return FLOUNDER_ERR_TX_BUSY;
+    }
+}
+
+void idc_register_rx_pool_return(struct shared_pool_private *spp)
+{
+    struct q_entry entry;
+
+    memset(&entry, 0, sizeof(struct q_entry));
+    entry.handler = send_rx_pool_return;
+    entry.fname = "send_rx_pool_return";
+    struct net_queue_manager_binding *b = driver_connection[RECEIVE_CONNECTION];
+    entry.binding_ptr = (void *) b;
+    struct client_closure_NC *ccnc = (struct client_closure_NC *) b->st;
+
+    entry.cap = spp->cap;
+    entry.plist[0] = spp->sp->size_reg.value;
+    enqueue_cont_q(ccnc->q, &entry);
+}
+
+
 static errval_t send_print_statistics_request(struct q_entry e)
 {
     struct net_queue_manager_binding *b = (struct net_queue_manager_binding *)
@@ -714,6 +833,13 @@ void idc_print_statistics(void)
 {
     LWIPBF_DEBUG("idc_print_statistics: called\n");
 
+    struct sp_notify *n = &((struct client_closure_NC *)
+            driver_connection[TRANSMIT_CONNECTION]->st)->spp_ptr->notify;
+    printf("lwip: TX notify batch %"PRIu64" delay %"PRIu64"us, %"PRIu64
+           " slots, %"PRIu64" notifications, %"PRIu64" pending, %"PRIu64
+           " seen by polling\n", n->batch, n->delay_us, n->updates, n->sent,
+           n->pending, n->suppressed);
+
     struct q_entry entry;
 
     memset(&entry, 0, sizeof(struct q_entry));
@@ -868,6 +994,21 @@ static void new_buffer_id(struct net_queue_manager_binding *st, errval_t err,
 }
 
 
+static void rx_pool(struct net_queue_manager_binding *st, errval_t err,
+                    uint64_t queueid, struct capref buf, uint64_t buffer_id,
+                    uint64_t slots, uint64_t slot_size)
+{
+    if (err_is_ok(err)) {
+        err = mem_barrelfish_map_rx_pool(buf, buffer_id, slots, slot_size);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "mapping RX pool, copying received packets");
+        }
+    } else {
+        LWIPBF_DEBUG("rx_pool: no RX pool, copying received packets\n");
+    }
+    rx_pool_replied = true;
+}
+
 static void get_mac_address_response(struct net_queue_manager_binding *st,
         uint64_t queueid, uint64_t hwaddr)
 {
@@ -960,12 +1101,25 @@ static uint32_t handle_incoming_packets(void)
      /* FIXME: enable this.  It is disabled to avoid compiliation issues with ARM
      * Problem is due to use of unint64_t to store paddr. */
 //      bulk_arch_prepare_recv((void *)paddr, pbuf_len);
-        if (lwip_rec_handler == 0) {
-            printf("packet_received: no callback installed\n");
+        // Packet granted in a driver buffer instead of copied into ours?
+        struct pbuf *granted = NULL;
+        bool is_grant = mem_barrelfish_is_rx_pool_buffer(sslot.buffer_id);
+        if (is_grant) {
+            granted = mem_barrelfish_grant_pbuf(sslot.pbuf_id, sslot.offset,
+                                                sslot.len);
+        }
+
+        if (lwip_rec_handler == 0 || (is_grant && granted == NULL)) {
+            printf("packet_received: no callback installed or no pbuf\n");
+            if (granted != NULL) {
+                pbuf_free(granted);
+            }
             // pbuf with received packet not consumed by lwip. It can be
             // reused as receive pbuf
             struct pbuf *p = mem_barrelfish_replace_pbuf(sslot.pbuf_id);
-            pbuf_free(p);
+            if (!is_grant) {
+                pbuf_free(p);
+            }
         } else {
             assert(sslot.no_pbufs == 1);
 
@@ -975,7 +1129,7 @@ static uint32_t handle_incoming_packets(void)
 #endif // TRACE_ONLY_SUB_NNET
 
             lwip_rec_handler(lwip_rec_data, sslot.pbuf_id,
-                    sslot.offset, sslot.len, sslot.len, NULL);
+                    sslot.offset, sslot.len, sslot.len, granted);
         }
         if(!sp_ghost_read_confirm(ccnc->spp_ptr)) {
             printf("handle incoming packet: error in confirming ghost read\n");
@@ -1004,6 +1158,15 @@ uint64_t perform_lwip_work(void)
 
 
 
+static uint64_t poll_lwip_work(void *arg)
+{
+    lwip_mutex_lock();
+    uint64_t count = handle_incoming_packets();
+    sp_process_tx_done(false);
+    lwip_mutex_unlock();
+    return count;
+}
+
 static void sp_notification_from_driver(struct net_queue_manager_binding *b,
        uint64_t queueid, uint64_t type, uint64_t rts)
 {
@@ -1028,11 +1191,19 @@ static void sp_notification_from_driver(struct net_queue_manager_binding *b,
         netbench_record_event_simple(nb, TX_A_SP_RN_T, ts);
     }
     lwip_mutex_unlock();
+
+    // Keep receiving while the driver keeps delivering, so that it does not
+    // need to notify us for every batch. The lock is only held while
+    // working, the application threads run in between.
+    if (b == driver_connection[RECEIVE_CONNECTION]) {
+        sp_consume_while_active(ccnc->spp_ptr, poll_lwip_work, NULL);
+    }
 } // end function: sp_notification_from_driver
 
 
 static struct net_queue_manager_rx_vtbl rx_vtbl = {
     .new_buffer_id = new_buffer_id,
+    .rx_pool = rx_pool,
     .sp_notification_from_driver = sp_notification_from_driver,
     .get_mac_address_response = get_mac_address_response,
     .benchmark_control_response = benchmark_control_response,
@@ -1131,6 +1302,7 @@ static void start_client(char *card_name, uint64_t queueid)
 void idc_connect_to_driver(char *card_name, uint64_t queueid)
 {
     conn_nr = 0;
+    deferred_event_init(&tx_notify_timer);
 
     LWIPBF_DEBUG("idc_client_init: start client\n");
     start_client(card_name, queueid);
@@ -68,6 +68,8 @@ uint64_t idc_send_packet_to_network_driver(struct pbuf *p);
 void idc_register_buffer(struct buffer_desc *buff_ptr,
         struct shared_pool_private *spp_ptr, uint8_t binding_index);
 void idc_get_mac_address(uint8_t * mac);
+void idc_get_rx_pool(void);
+void idc_register_rx_pool_return(struct shared_pool_private *spp);
 int lwip_check_sp_capacity(int direction);
 int idc_check_capacity(int direction);
 uint64_t idc_check_driver_load(void);
@@ -26,6 +26,7 @@
 #include "lwip/init.h"
 #include "lwip/def.h"
 #include "lwip/pbuf.h"
+#include "lwip/memp.h"
 #include "mem_barrelfish.h"
 #include "idc_barrelfish.h"
 #include <procon/procon.h>
@@ -45,6 +46,13 @@
 //LWIP only needs two heaps. It allocates memory and pbufs from these two heaps.
 #define MAX_NR_BUFFERS 2
 
+// Copy received packets out of their pool pbufs once fewer pool pbufs than
+// this are left, so that every receive slot can be given a buffer again
+#define RX_PBUF_RESERVE (2 * MEMP_CACHE_BATCH)
+
+// pbufs allocated at once when filling the receive slots
+#define RX_ALLOC_BATCH 64
+
 //remember the frame caps which point to the memory regions used
 //to allocate memory and pbufs in LWIP
 
@@ -54,10 +62,16 @@ static struct buffer_desc *short_buf_list[2] = {NULL, NULL};
 struct pbuf_desc {
     struct pbuf *p;
     uint64_t pbuf_id;
+    bool parked;    // p is unused, the packet was granted or copied
 };
 
 static struct pbuf_desc pbufs[RECEIVE_BUFFERS];
 
+// Driver receive buffer pool for zero-copy receive, if the driver has one
+static struct buffer_desc rx_pool;
+static uint64_t rx_pool_slot_size = 0;
+static struct shared_pool_private *rx_pool_ret = NULL; // slots given back
+
 
 static void rx_populate_sp_pbuf(struct buffer_desc *buf)
 {
@@ -72,9 +86,17 @@ static void rx_populate_sp_pbuf(struct buffer_desc *buf)
 
 //    sys_debug_set_breakpoint(&buffer_list, 1, 1);
 
+    struct pbuf *batch[RX_ALLOC_BATCH];
+    u16_t nbatch = 0, next = 0;
+
     for (i = 0; i < buf->spp_prv->c_size; i++) {
-        /* We allocate a pbuf chain of pbufs from the pool. */
-        p = pbuf_alloc(PBUF_RAW, RECEIVE_PBUF_SIZE, PBUF_POOL);
+        /* We allocate the pbufs from the pool, a batch at a time. */
+        if (next == nbatch) {
+            nbatch = pbuf_alloc_bulk(PBUF_RAW, RECEIVE_PBUF_SIZE, PBUF_POOL,
+                                     batch, RX_ALLOC_BATCH);
+            next = 0;
+        }
+        p = (next < nbatch) ? batch[next++] : NULL;
         if (p == 0) {
             printf("Error in allocating %"PRIu64"'th pbuf, no more pbufs\n",
                     i);
@@ -100,6 +122,8 @@ static void rx_populate_sp_pbuf(struct buffer_desc *buf)
         copy_data_into_slot(buf->spp_prv, buf->buffer_id, i, offset, p->len, 1,
                 (uint64_t)p, ts);
     } // end for:
+    // give back what the last batch allocated beyond the slots
+    pbuf_free_bulk(&batch[next], nbatch - next);
 //    printf("pbuf is from buff %"PRIu64" -----\n", buf->buffer_id);
 //    printf("Added %"PRIu64" no of pbufs for receiving in SP ---\n", i);
 
@@ -189,6 +213,11 @@ uint8_t *mem_barrelfish_register_buf(uint8_t binding_index, uint32_t size)
             USER_PANIC_ERR(err, "in event_dispatch on LWIP waitset");
         }
     }
+
+    if (binding_index == RX_BUFFER_ID) {
+        // receive straight from driver buffers, if the driver allows it
+        idc_get_rx_pool();
+    }
     return ((uint8_t *) buf->va);
 }
 
@@ -217,7 +246,15 @@ struct pbuf *mem_barrelfish_replace_pbuf(uint64_t idx)
     uint64_t ts = rdtsc();
 
     LWIPBF_DEBUG("mem_barrelfish_replace_pbuf %"PRIu64" ++++++++\n", idx);
-    struct pbuf *p = pbuf_alloc(PBUF_RAW, RECEIVE_PBUF_SIZE, PBUF_POOL);
+    struct pbuf *p;
+    if (pbufs[idx].parked) {
+        // the packet came in a granted buffer or was copied out of p,
+        // offer the same pbuf again
+        p = pbufs[idx].p;
+        pbufs[idx].parked = false;
+    } else {
+        p = pbuf_alloc(PBUF_RAW, RECEIVE_PBUF_SIZE, PBUF_POOL);
+    }
     LWIPBF_DEBUG("Sending pbuf %p for reuse at id %"PRIu64" ++++++++\n",
             p, idx);
 
@@ -262,3 +299,125 @@ struct pbuf *mem_barrelfish_get_pbuf(uint64_t pbuf_id)
 {
     return (pbufs[pbuf_id].p);
 }
+
+/**
+ * \brief Get the pbuf a packet was received into, to hand it up the stack
+ *
+ * Every pool pbuf handed up must be replaced by a fresh one before its slot
+ * can receive again. If the pbuf pool is nearly drained, e.g. because the
+ * application holds on to received data, the packet is copied into a heap
+ * pbuf instead and the pool pbuf stays in its slot, to be offered again by
+ * mem_barrelfish_replace_pbuf(). This way no slot is left without a buffer.
+ */
+struct pbuf *mem_barrelfish_get_rx_pbuf(uint64_t pbuf_id, uint64_t len)
+{
+    struct pbuf *p = pbufs[pbuf_id].p;
+
+    if (memp_pbuf_peek() >= RX_PBUF_RESERVE) {
+        return p;
+    }
+
+    struct pbuf *copy = pbuf_alloc(PBUF_RAW, len, PBUF_RAM);
+    if (copy == NULL) {
+        // try our luck with the pool pbuf
+        return p;
+    }
+    memcpy(copy->payload, p->payload, len);
+    pbufs[pbuf_id].parked = true;
+    return copy;
+}
+
+
+/**
+ * \brief Map the driver's receive buffer pool to receive without copies
+ *
+ * Also creates the shared pool through which granted buffers are given back
+ * and registers it with the driver, which starts granting from then on.
+ */
+errval_t mem_barrelfish_map_rx_pool(struct capref cap, uint64_t buffer_id,
+                                    uint64_t slots, uint64_t slot_size)
+{
+    errval_t err;
+    struct frame_identity f;
+
+    assert(rx_pool_ret == NULL);
+
+    err = invoke_frame_identify(cap, &f);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_IDENTIFY);
+    }
+    err = vspace_map_one_frame(&rx_pool.va, (1UL << f.bits), cap, NULL, NULL);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_VSPACE_MAP);
+    }
+    rx_pool.cap = cap;
+    rx_pool.pa = f.base;
+    rx_pool.size = slots * slot_size;
+    rx_pool.buffer_id = buffer_id;
+    rx_pool.role = RX_BUFFER_ID;
+    rx_pool_slot_size = slot_size;
+
+    // one more slot than the pool, so every buffer can be given back at once
+    rx_pool_ret = sp_create_shared_pool(slots + 1, RX_BUFFER_ID);
+    if (rx_pool_ret == NULL) {
+        return LWIP_ERR_MEM;
+    }
+
+    // granted pbufs can be sent out again (e.g. ICMP echo replies)
+    rx_pool.next = buffer_list;
+    buffer_list = &rx_pool;
+
+    idc_register_rx_pool_return(rx_pool_ret);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Wrap a packet granted in a driver receive buffer into a pbuf
+ *
+ * The application pbuf parked in the receive slot stays unused and is
+ * offered again by mem_barrelfish_replace_pbuf(). Returns NULL, and gives the
+ * buffer straight back, if no pbuf header is available.
+ */
+struct pbuf *mem_barrelfish_grant_pbuf(uint64_t pbuf_id, uint64_t offset,
+                                       uint64_t len)
+{
+    assert(rx_pool_ret != NULL);
+    assert(offset + len <= rx_pool.size);
+
+    pbufs[pbuf_id].parked = true;
+
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, 0, PBUF_REF);
+    if (p == NULL) {
+        struct slot_data d = { .pbuf_id = offset / rx_pool_slot_size };
+        if (!sp_produce_slot(rx_pool_ret, &d)) {
+            USER_PANIC("RX pool return queue full");
+        }
+        return NULL;
+    }
+    p->payload = rx_pool.va + offset;
+    p->len = len;
+    p->tot_len = len;
+    p->flags |= PBUF_FLAG_RX_GRANT;
+    return p;
+}
+
+/// Called by pbuf_free() to give a granted receive buffer back to the driver
+void mem_barrelfish_free_granted_pbuf(struct pbuf *p)
+{
+    assert(rx_pool_ret != NULL);
+    assert((uintptr_t) p->payload >= (uintptr_t) rx_pool.va);
+
+    struct slot_data d = {
+        .pbuf_id = ((uintptr_t) p->payload - (uintptr_t) rx_pool.va)
+                   / rx_pool_slot_size,
+    };
+    assert(d.pbuf_id * rx_pool_slot_size < rx_pool.size);
+    if (!sp_produce_slot(rx_pool_ret, &d)) {
+        USER_PANIC("RX pool return queue full");
+    }
+}
+
+bool mem_barrelfish_is_rx_pool_buffer(uint64_t buffer_id)
+{
+    return rx_pool_ret != NULL && buffer_id == rx_pool.buffer_id;
+}
@@ -27,5 +27,14 @@ struct buffer_desc *mem_barrelfish_get_buffer_desc(void *p);
 
 //void mem_barrelfish_pbuf_init(void);
 struct pbuf *mem_barrelfish_get_pbuf(uint64_t pbuf_id);
+struct pbuf *mem_barrelfish_get_rx_pbuf(uint64_t pbuf_id, uint64_t len);
 struct pbuf *mem_barrelfish_replace_pbuf(uint64_t idx);
+
+// zero-copy receive from the driver's buffer pool
+errval_t mem_barrelfish_map_rx_pool(struct capref cap, uint64_t buffer_id,
+                                    uint64_t slots, uint64_t slot_size);
+struct pbuf *mem_barrelfish_grant_pbuf(uint64_t pbuf_id, uint64_t offset,
+                                       uint64_t len);
+void mem_barrelfish_free_granted_pbuf(struct pbuf *p);
+bool mem_barrelfish_is_rx_pool_buffer(uint64_t buffer_id);
 #endif // MEM_BARRELFISH_H_
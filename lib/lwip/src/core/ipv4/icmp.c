@@ -103,6 +103,7 @@ void icmp_input(struct pbuf *p, struct netif *inp)
     struct icmp_echo_hdr *iecho;
     struct ip_hdr *iphdr;
     struct ip_addr tmpaddr;
+    u16_t ttl_proto;
     s16_t hlen;
 
     ICMP_STATS_INC(icmp.recv);
@@ -227,17 +228,20 @@ void icmp_input(struct pbuf *p, struct netif *inp)
             iphdr->dest.addr = tmpaddr.addr;
             ICMPH_TYPE_SET(iecho, ICMP_ER);
             /* adjust the checksum */
-            if (iecho->chksum >= htons(0xffff - (ICMP_ECHO << 8))) {
-                iecho->chksum += htons(ICMP_ECHO << 8) + 1;
-            } else {
-                iecho->chksum += htons(ICMP_ECHO << 8);
-            }
+            iecho->chksum = inet_chksum_adjust(iecho->chksum,
+                                               htons(ICMP_ECHO << 8),
+                                               htons(ICMP_ER << 8));
 
-            /* Set the correct TTL and recalculate the header checksum. */
+            /* Set the correct TTL and update the header checksum: swapping
+               the addresses leaves it unchanged */
+            ttl_proto = iphdr->_ttl_proto;
             IPH_TTL_SET(iphdr, ICMP_TTL);
-            IPH_CHKSUM_SET(iphdr, 0);
 #if CHECKSUM_GEN_IP
-            IPH_CHKSUM_SET(iphdr, inet_chksum(iphdr, IP_HLEN));
+            IPH_CHKSUM_SET(iphdr, inet_chksum_adjust(IPH_CHKSUM(iphdr),
+                                                     ttl_proto,
+                                                     iphdr->_ttl_proto));
+#else
+            IPH_CHKSUM_SET(iphdr, 0);
 #endif                          /* CHECKSUM_GEN_IP */
 
             ICMP_STATS_INC(icmp.xmit);
@@ -51,7 +51,7 @@
  * #define LWIP_CHKSUM <your_checksum_routine> 
  *
  * Or you can select from the implementations below by defining
- * LWIP_CHKSUM_ALGORITHM to 1, 2 or 3.
+ * LWIP_CHKSUM_ALGORITHM to 1, 2, 3 or 4.
  */
 
 #ifndef LWIP_CHKSUM
@@ -65,18 +65,6 @@
 #define LWIP_CHKSUM_ALGORITHM 0
 #endif
 
-/** Like the name says... */
-#if LWIP_PLATFORM_BYTESWAP && (BYTE_ORDER == LITTLE_ENDIAN)
-/* little endian and PLATFORM_BYTESWAP defined */
-#define SWAP_BYTES_IN_WORD(w) LWIP_PLATFORM_HTONS(w)
-#else
-/* can't use htons on big endian (or PLATFORM_BYTESWAP not defined)... */
-#define SWAP_BYTES_IN_WORD(w) ((w & 0xff) << 8) | ((w & 0xff00) >> 8)
-#endif
-
-/** Split an u32_t in two u16_ts and add them up */
-#define FOLD_U32T(u)          ((u >> 16) + (u & 0x0000ffffUL))
-
 #if (LWIP_CHKSUM_ALGORITHM == 1)        /* Version #1 */
 /**
  * lwip checksum
@@ -265,6 +253,230 @@ static u16_t lwip_standard_chksum(void *dataptr, int len)
 }
 #endif
 
+#if (LWIP_CHKSUM_ALGORITHM == 4)        /* Alternative version #4 */
+/*
+ * Wide accumulator version. Native order 32-bit words are added into a
+ * 64-bit accumulator and the carries are only folded back at the end: the
+ * one's complement sum of the 32-bit words folds to the sum of the 16-bit
+ * words (RFC 1071, p. 2), so no add-with-carry chain is needed.
+ *
+ * If the compiler targets NEON (ARMv7, -mfpu=neon) or SSE2 (host builds),
+ * 32 bytes are summed per iteration with unaligned vector loads, and
+ * lwip_chksum_copy() stores the loaded vectors to the destination on the
+ * way. The ARMv7 build does not use NEON yet, since the kernel neither
+ * enables nor context-switches the VFP/NEON registers.
+ */
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CHKSUM_VECTOR_BYTES 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CHKSUM_VECTOR_BYTES 32
+#endif
+
+static u16_t chksum_fold64(uint64_t sum)
+{
+    u32_t acc;
+
+    sum = (sum >> 32) + (sum & 0xffffffffULL);
+    sum = (sum >> 32) + (sum & 0xffffffffULL);
+    acc = (u32_t) sum;
+    acc = FOLD_U32T(acc);
+    acc = FOLD_U32T(acc);
+    return (u16_t) acc;
+}
+
+#ifdef CHKSUM_VECTOR_BYTES
+
+/* Native order 16-bit words out of bytes at any alignment */
+#if BYTE_ORDER == LITTLE_ENDIAN
+#define CHKSUM_LOAD16(p)        ((u16_t)((p)[0] | ((p)[1] << 8)))
+#define CHKSUM_LOAD8(p)         ((u16_t)(p)[0])
+#else
+#define CHKSUM_LOAD16(p)        ((u16_t)(((p)[0] << 8) | (p)[1]))
+#define CHKSUM_LOAD8(p)         ((u16_t)((p)[0] << 8))
+#endif
+
+/**
+ * Sum (and copy, if dst is not NULL) blocks of CHKSUM_VECTOR_BYTES bytes.
+ *
+ * @return 64-bit sum of the native order 32-bit words, not folded
+ */
+static INLINE uint64_t
+chksum_vector(const u8_t * src, u8_t * dst, int blocks)
+{
+#if defined(__ARM_NEON__)
+    uint64x2_t acc0 = vdupq_n_u64(0), acc1 = vdupq_n_u64(0);
+
+    while (blocks-- > 0) {
+        uint8x16_t a = vld1q_u8(src);
+        uint8x16_t b = vld1q_u8(src + 16);
+
+        if (dst != NULL) {
+            vst1q_u8(dst, a);
+            vst1q_u8(dst + 16, b);
+            dst += 32;
+        }
+        /* pairwise add 32-bit lanes into 64-bit lanes: never overflows */
+        acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(a));
+        acc1 = vpadalq_u32(acc1, vreinterpretq_u32_u8(b));
+        src += 32;
+    }
+    acc0 = vaddq_u64(acc0, acc1);
+    return vgetq_lane_u64(acc0, 0) + vgetq_lane_u64(acc0, 1);
+#else                           /* __SSE2__ */
+    __m128i zero = _mm_setzero_si128(), acc0 = zero, acc1 = zero;
+    uint64_t lanes[2];
+
+    while (blocks-- > 0) {
+        __m128i a = _mm_loadu_si128((const __m128i *) src);
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+
+        if (dst != NULL) {
+            _mm_storeu_si128((__m128i *) dst, a);
+            _mm_storeu_si128((__m128i *) (dst + 16), b);
+            dst += 32;
+        }
+        /* zero-extend 32-bit lanes into 64-bit lanes */
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpackhi_epi32(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpacklo_epi32(b, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+        src += 32;
+    }
+    _mm_storeu_si128((__m128i *) lanes, _mm_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1];
+#endif
+}
+
+/**
+ * Checksum len bytes at src, copying them to dst on the way if it is not
+ * NULL. Vector loads need no alignment, so words are summed relative to
+ * the start of the data and no odd-address swapping is needed.
+ */
+static INLINE u16_t chksum_wide(const u8_t * src, u8_t * dst, int len)
+{
+    int blocks = len / CHKSUM_VECTOR_BYTES;
+    uint64_t sum;
+
+    sum = chksum_vector(src, dst, blocks);
+    src += blocks * CHKSUM_VECTOR_BYTES;
+    len -= blocks * CHKSUM_VECTOR_BYTES;
+    if (dst != NULL) {
+        MEMCPY(dst + blocks * CHKSUM_VECTOR_BYTES, src, len);
+    }
+
+    /* less than one block left, starting at an even offset */
+    while (len > 1) {
+        sum += CHKSUM_LOAD16(src);
+        src += 2;
+        len -= 2;
+    }
+    if (len > 0) {
+        sum += CHKSUM_LOAD8(src);
+    }
+    return chksum_fold64(sum);
+}
+
+#else                           /* CHKSUM_VECTOR_BYTES */
+
+/**
+ * Checksum len bytes at src, copying them to dst first if it is not NULL.
+ * Aligns to 32-bit words like version #3, then sums 16 bytes per iteration.
+ */
+static INLINE u16_t chksum_wide(const u8_t * src, u8_t * dst, int len)
+{
+    const u16_t *ps;
+    const u32_t *pl;
+    uint64_t sum = 0;
+    u16_t t = 0, result;
+    int odd;
+
+    if (dst != NULL) {
+        MEMCPY(dst, src, len);
+    }
+
+    /* starts at odd byte address? */
+    odd = ((mem_ptr_t) src & 1);
+    if (odd && len > 0) {
+        ((u8_t *) & t)[1] = *src++;
+        len--;
+    }
+
+    ps = (const u16_t *) src;
+    if (((mem_ptr_t) ps & 3) && len > 1) {
+        sum += *ps++;
+        len -= 2;
+    }
+
+    pl = (const u32_t *) ps;
+    while (len > 15) {
+        sum += pl[0];
+        sum += pl[1];
+        sum += pl[2];
+        sum += pl[3];
+        pl += 4;
+        len -= 16;
+    }
+    while (len > 3) {
+        sum += *pl++;
+        len -= 4;
+    }
+
+    ps = (const u16_t *) pl;
+    if (len > 1) {
+        sum += *ps++;
+        len -= 2;
+    }
+    /* dangling tail byte remaining? */
+    if (len > 0) {
+        ((u8_t *) & t)[0] = *(const u8_t *) ps;
+    }
+    sum += t;
+
+    result = chksum_fold64(sum);
+    if (odd) {
+        result = SWAP_BYTES_IN_WORD(result);
+    }
+    return result;
+}
+
+#endif                          /* CHKSUM_VECTOR_BYTES */
+
+/**
+ * @param dataptr points to start of data to be summed at any boundary
+ * @param len length of data to be summed
+ * @return host order (!) lwip checksum (non-inverted Internet sum)
+ */
+static u16_t lwip_standard_chksum(void *dataptr, int len)
+{
+    return chksum_wide(dataptr, NULL, len);
+}
+#endif
+
+#if LWIP_CHECKSUM_ON_COPY
+/**
+ * Copy data and calculate its checksum in one pass, where the checksum
+ * algorithm allows it.
+ *
+ * @param dst destination, at any boundary
+ * @param src data to be copied and summed, at any boundary
+ * @param len length of the data
+ * @return host order (!) lwip checksum (non-inverted Internet sum) of the
+ *         data, as if it started at an even offset
+ */
+u16_t lwip_chksum_copy(void *dst, const void *src, u16_t len)
+{
+#if (LWIP_CHKSUM_ALGORITHM == 4)
+    return chksum_wide(src, dst, len);
+#else
+    MEMCPY(dst, src, len);
+    return LWIP_CHKSUM(dst, len);
+#endif
+}
+#endif                          /* LWIP_CHECKSUM_ON_COPY */
+
 /* inet_chksum_pseudo:
  *
  * Calculates the pseudo Internet checksum used by TCP and UDP for a pbuf chain.
@@ -337,8 +549,9 @@ inet_chksum_pseudo(struct pbuf * p,
  * @param proto_len length of the ip data part (used for checksum of pseudo header)
  * @return checksum (as u16_t) to be saved directly in the protocol header
  */
-/* Currently only used by UDPLITE, although this could change in the future. */
-#if LWIP_UDPLITE
+/* Used by UDPLITE, and by TCP to sum only the header of segments whose
+ * payload was checksummed on copy. */
+#if LWIP_UDPLITE || LWIP_CHECKSUM_ON_COPY
 u16_t
 inet_chksum_pseudo_partial(struct pbuf * p,
                            struct ip_addr * src, struct ip_addr * dest,
@@ -366,7 +579,7 @@ inet_chksum_pseudo_partial(struct pbuf * p,
         /*LWIP_DEBUGF(INET_DEBUG, ("inet_chksum_pseudo(): unwrapped lwip_chksum()=%"X32_F" \n", acc)); */
         /* fold the upper bit down */
         acc = FOLD_U32T(acc);
-        if (q->len % 2 != 0) {
+        if (chklen % 2 != 0) {
             swapped = 1 - swapped;
             acc = SWAP_BYTES_IN_WORD(acc);
         }
@@ -392,7 +605,7 @@ inet_chksum_pseudo_partial(struct pbuf * p,
                  acc));
     return (u16_t) ~ (acc & 0xffffUL);
 }
-#endif                          /* LWIP_UDPLITE */
+#endif                          /* LWIP_UDPLITE || LWIP_CHECKSUM_ON_COPY */
 
 /* inet_chksum:
  *
@@ -144,6 +144,7 @@ static struct netif *ip_forward(struct pbuf *p, struct ip_hdr *iphdr,
                                 struct netif *inp)
 {
     struct netif *netif;
+    u16_t ttl_proto;
 
     PERF_START;
     /* Find network interface where to forward this IP packet to. */
@@ -165,6 +166,7 @@ static struct netif *ip_forward(struct pbuf *p, struct ip_hdr *iphdr,
     }
 
     /* decrement TTL */
+    ttl_proto = iphdr->_ttl_proto;
     IPH_TTL_SET(iphdr, IPH_TTL(iphdr) - 1);
     /* send ICMP if TTL == 0 */
     if (IPH_TTL(iphdr) == 0) {
@@ -179,11 +181,8 @@ static struct netif *ip_forward(struct pbuf *p, struct ip_hdr *iphdr,
     }
 
     /* Incrementally update the IP checksum. */
-    if (IPH_CHKSUM(iphdr) >= htons(0xffff - 0x100)) {
-        IPH_CHKSUM_SET(iphdr, IPH_CHKSUM(iphdr) + htons(0x100) + 1);
-    } else {
-        IPH_CHKSUM_SET(iphdr, IPH_CHKSUM(iphdr) + htons(0x100));
-    }
+    IPH_CHKSUM_SET(iphdr, inet_chksum_adjust(IPH_CHKSUM(iphdr), ttl_proto,
+                                             iphdr->_ttl_proto));
 
     LWIP_DEBUGF(IP_DEBUG, ("ip_forward: forwarding packet to 0x%" X32_F "\n",
                            iphdr->dest.addr));
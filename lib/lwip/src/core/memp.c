@@ -55,6 +55,8 @@
 #include "lwip/ip_frag.h"
 
 #include <string.h>
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/threads.h>
 
 #if !MEMP_MEM_MALLOC            /* don't build if not configured for use in lwipopts.h */
 
@@ -107,8 +109,8 @@ struct memp {
 
 #endif                          /* MEMP_OVERFLOW_CHECK */
 
-/** This array holds the first free element of each pool.
- *  Elements form a linked list. */
+/** This array holds the first free element of each pool that is not in a
+ *  thread cache. Elements form a linked list. */
 static struct memp *memp_tab[MEMP_MAX];
 
 #else                           /* MEMP_MEM_MALLOC */
@@ -235,6 +237,23 @@ static void memp_overflow_check_all(void)
     }
 }
 
+/**
+ * Initialize the restricted areas of one memp element.
+ */
+static void memp_overflow_init_element(struct memp *p, u16_t memp_size)
+{
+    u8_t *m;
+
+#if MEMP_SANITY_REGION_BEFORE_ALIGNED > 0
+    m = (u8_t *) p + MEMP_SIZE - MEMP_SANITY_REGION_BEFORE_ALIGNED;
+    memset(m, 0xcd, MEMP_SANITY_REGION_BEFORE_ALIGNED);
+#endif
+#if MEMP_SANITY_REGION_AFTER_ALIGNED > 0
+    m = (u8_t *) p + MEMP_SIZE + memp_size;
+    memset(m, 0xcd, MEMP_SANITY_REGION_AFTER_ALIGNED);
+#endif
+}
+
 /**
  * Initialize the restricted areas of all memp elements in every pool.
  */
@@ -242,20 +261,11 @@ static void memp_overflow_init(void)
 {
     u16_t i, j;
     struct memp *p;
-    u8_t *m;
 
     p = LWIP_MEM_ALIGN(memp_memory);
     for (i = 0; i < MEMP_MAX; ++i) {
-        p = p;
         for (j = 0; j < memp_num[i]; ++j) {
-#if MEMP_SANITY_REGION_BEFORE_ALIGNED > 0
-            m = (u8_t *) p + MEMP_SIZE - MEMP_SANITY_REGION_BEFORE_ALIGNED;
-            memset(m, 0xcd, MEMP_SANITY_REGION_BEFORE_ALIGNED);
-#endif
-#if MEMP_SANITY_REGION_AFTER_ALIGNED > 0
-            m = (u8_t *) p + MEMP_SIZE + memp_sizes[i];
-            memset(m, 0xcd, MEMP_SANITY_REGION_AFTER_ALIGNED);
-#endif
+            memp_overflow_init_element(p, memp_sizes[i]);
             p =
               (struct memp *) ((u8_t *) p + MEMP_SIZE + memp_sizes[i] +
                                MEMP_SANITY_REGION_AFTER_ALIGNED);
@@ -264,7 +274,250 @@ static void memp_overflow_init(void)
 }
 #endif                          /* MEMP_OVERFLOW_CHECK */
 
-static u16_t pbuf_pool_counter = 0;
+/* Distance between two elements of a pool */
+#if MEMP_OVERFLOW_CHECK
+#define MEMP_ELEMENT_SIZE(type) \
+    (MEMP_SIZE + memp_sizes[type] + MEMP_SANITY_REGION_AFTER_ALIGNED)
+#else
+#define MEMP_ELEMENT_SIZE(type) (MEMP_SIZE + memp_sizes[type])
+#endif                          /* MEMP_OVERFLOW_CHECK */
+
+/* Elements of the pbuf pool are handed to the network driver to receive
+ * into, so they must stay in the memory registered with it by memp_init().
+ * All other pools may grow with malloc(). */
+#define MEMP_CAN_GROW(type) ((type) != MEMP_PBUF_POOL)
+
+/** Number of free elements in memp_tab, for each pool */
+static u32_t memp_tab_count[MEMP_MAX];
+/** Number of elements of each pool, static and grown */
+static u32_t memp_total[MEMP_MAX];
+/** Maximum number of elements of each pool, see memp_set_limit() */
+static u32_t memp_limit[MEMP_MAX];
+/** Memory the pools have grown by, linked through the first word */
+static void *memp_chunks = NULL;
+
+/** Protects memp_tab and the variables above. The thread caches don't
+ *  need it, so most allocations never take it. */
+static struct thread_mutex memp_lock = THREAD_MUTEX_INITIALIZER;
+
+/**
+ * Free elements a thread keeps for itself. Only the owning thread touches
+ * the lists of a cache, so memp_malloc() and memp_free() can use them
+ * without locking. Elements move between a cache and memp_tab in batches.
+ */
+struct memp_cache {
+    struct thread *thread;      /* owning thread */
+    struct memp_cache *next;    /* next cache in memp_caches */
+    struct memp *head[MEMP_MAX];        /* free elements of each pool */
+    u16_t count[MEMP_MAX];      /* length of each list */
+};
+
+/** All thread caches. Caches are only ever added, at the head. */
+static struct memp_cache *memp_caches = NULL;
+
+/** Maximum number of elements of each pool in one thread cache */
+static u16_t memp_cache_max[MEMP_MAX];
+static u16_t memp_cache_size = MEMP_CACHE_SIZE;
+static u16_t memp_cache_batch = MEMP_CACHE_BATCH;
+
+/** Recompute the per-pool cache sizes from memp_cache_size. */
+static void memp_cache_resize(void)
+{
+    u16_t i;
+
+    for (i = 0; i < MEMP_MAX; ++i) {
+        memp_cache_max[i] = LWIP_MIN(memp_cache_size,
+                                     memp_num[i] / MEMP_CACHE_SHARE);
+    }
+}
+
+/**
+ * Find the cache of the calling thread, creating it on first use.
+ *
+ * @return the cache, or NULL if it could not be allocated
+ */
+static struct memp_cache *memp_cache_self(void)
+{
+    struct thread *me = thread_self();
+    struct memp_cache *cache;
+
+    for (cache = memp_caches; cache != NULL; cache = cache->next) {
+        if (cache->thread == me) {
+            return cache;
+        }
+    }
+
+    cache = calloc(1, sizeof(struct memp_cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->thread = me;
+
+    thread_mutex_lock(&memp_lock);
+    cache->next = memp_caches;
+    /* other threads walk the list without the lock */
+    __sync_synchronize();
+    memp_caches = cache;
+    thread_mutex_unlock(&memp_lock);
+    return cache;
+}
+
+/**
+ * Add up to n malloc()ed elements to a pool, within its limit.
+ * Must be called with memp_lock held.
+ */
+static void memp_grow(memp_t type, u32_t n)
+{
+    struct memp *memp;
+    u8_t *chunk;
+    u32_t i;
+
+    if (!MEMP_CAN_GROW(type) || memp_total[type] >= memp_limit[type]) {
+        return;
+    }
+    n = LWIP_MIN(n, memp_limit[type] - memp_total[type]);
+
+    /* only freed when the pools are reset, as the elements get mixed up */
+    chunk = malloc(LWIP_MEM_ALIGN_SIZE(sizeof(void *)) + MEM_ALIGNMENT - 1
+                   + n * MEMP_ELEMENT_SIZE(type));
+    if (chunk == NULL) {
+        return;
+    }
+    *(void **) chunk = memp_chunks;
+    memp_chunks = chunk;
+    memp = LWIP_MEM_ALIGN(chunk + LWIP_MEM_ALIGN_SIZE(sizeof(void *)));
+    for (i = 0; i < n; ++i) {
+#if MEMP_OVERFLOW_CHECK
+        memp_overflow_init_element(memp, memp_sizes[type]);
+#endif                          /* MEMP_OVERFLOW_CHECK */
+        memp->next = memp_tab[type];
+        memp_tab[type] = memp;
+        memp = (struct memp *) ((u8_t *) memp + MEMP_ELEMENT_SIZE(type));
+    }
+    memp_tab_count[type] += n;
+    memp_total[type] += n;
+    MEMP_STATS_ADD(grown, type, n);
+    MEMP_STATS_ADD(avail, type, n);
+}
+
+/**
+ * Take up to 'want' free elements from a pool. If it has fewer than 'need',
+ * the pool is grown first (if it may).
+ *
+ * @param list returns the elements, linked through their next fields
+ * @return the number of elements taken
+ */
+static u16_t memp_take(memp_t type, struct memp **list, u16_t want,
+                       u16_t need)
+{
+    struct memp *memp, *head = NULL;
+    u16_t i;
+
+    thread_mutex_lock(&memp_lock);
+    if (memp_tab_count[type] < need) {
+        MEMP_STATS_INC(exhausted, type);
+        memp_grow(type, LWIP_MAX(want, memp_cache_batch)
+                  - memp_tab_count[type]);
+    }
+    for (i = 0; i < want && (memp = memp_tab[type]) != NULL; ++i) {
+        memp_tab[type] = memp->next;
+        memp->next = head;
+        head = memp;
+    }
+    memp_tab_count[type] -= i;
+    thread_mutex_unlock(&memp_lock);
+
+    *list = head;
+    return i;
+}
+
+/**
+ * Give a list of n free elements, first to last, back to a pool.
+ */
+static void memp_give(memp_t type, struct memp *first, struct memp *last,
+                      u16_t n)
+{
+    thread_mutex_lock(&memp_lock);
+    last->next = memp_tab[type];
+    memp_tab[type] = first;
+    memp_tab_count[type] += n;
+#if MEMP_SANITY_CHECK
+    LWIP_ASSERT("memp sanity", memp_sanity());
+#endif                          /* MEMP_SANITY_CHECK */
+    thread_mutex_unlock(&memp_lock);
+}
+
+/**
+ * Give all but 'keep' elements of one list of a cache back to the pool.
+ * The most recently freed elements stay, as they are most likely in the
+ * CPU cache.
+ */
+static void memp_cache_trim(struct memp_cache *cache, memp_t type, u16_t keep)
+{
+    struct memp *first, *last;
+    u16_t n = cache->count[type] - keep;
+    u16_t i;
+
+    if (cache->count[type] <= keep) {
+        return;
+    }
+    if (keep == 0) {
+        first = cache->head[type];
+        cache->head[type] = NULL;
+    } else {
+        struct memp *prev = cache->head[type];
+        for (i = 1; i < keep; ++i) {
+            prev = prev->next;
+        }
+        first = prev->next;
+        prev->next = NULL;
+    }
+    for (last = first; last->next != NULL; last = last->next) {
+    }
+    cache->count[type] = keep;
+    memp_give(type, first, last, n);
+}
+
+/**
+ * Turn a free element into the memory handed to the caller.
+ */
+static void *memp_hand_out(memp_t type, struct memp *memp, const char *file,
+                           const int line)
+{
+#if MEMP_OVERFLOW_CHECK
+    memp->next = NULL;
+    memp->file = file;
+    memp->line = line;
+#else
+    LWIP_UNUSED_ARG(file);
+    LWIP_UNUSED_ARG(line);
+#endif                          /* MEMP_OVERFLOW_CHECK */
+    MEMP_STATS_INC_USED(used, type);
+    LWIP_ASSERT("memp_malloc: memp properly aligned",
+                ((mem_ptr_t) memp % MEM_ALIGNMENT) == 0);
+    return (u8_t *) memp + MEMP_SIZE;
+}
+
+/**
+ * Turn memory given back by the caller into a free element.
+ */
+static struct memp *memp_take_back(memp_t type, void *mem)
+{
+    struct memp *memp;
+
+    LWIP_ASSERT("memp_free: mem properly aligned",
+                ((mem_ptr_t) mem % MEM_ALIGNMENT) == 0);
+    memp = (struct memp *) ((u8_t *) mem - MEMP_SIZE);
+#if MEMP_OVERFLOW_CHECK
+#if MEMP_OVERFLOW_CHECK >= 2
+    memp_overflow_check_all();
+#else
+    memp_overflow_check_element(memp, memp_sizes[type]);
+#endif                          /* MEMP_OVERFLOW_CHECK >= 2 */
+#endif                          /* MEMP_OVERFLOW_CHECK */
+    MEMP_STATS_DEC(used, type);
+    return memp;
+}
 
 /**
  * Initialize this module.
@@ -296,11 +549,14 @@ void memp_initialize_pbuf_list(void)
 
     assert(memp_memory != NULL);
     struct memp *memp;
+    struct memp_cache *cache;
     u16_t i, j;
     for (i = 0; i < MEMP_MAX; ++i) {
         MEMP_STATS_AVAIL(used, i, 0);
         MEMP_STATS_AVAIL(max, i, 0);
         MEMP_STATS_AVAIL(err, i, 0);
+        MEMP_STATS_AVAIL(exhausted, i, 0);
+        MEMP_STATS_AVAIL(grown, i, 0);
         MEMP_STATS_AVAIL(avail, i, memp_num[i]);
     }
     memp = LWIP_MEM_ALIGN(memp_memory);
@@ -310,6 +566,7 @@ void memp_initialize_pbuf_list(void)
     printf("memp_init: total types of pools %d, memp %p\n", MEMP_MAX, memp);
 */
     memp->next = NULL;
+    thread_mutex_lock(&memp_lock);
     /* for every pool: */
     for (i = 0; i < MEMP_MAX; ++i) {
         memp_tab[i] = NULL;
@@ -321,16 +578,24 @@ void memp_initialize_pbuf_list(void)
             memp->next = NULL;
             memp->next = memp_tab[i];
             memp_tab[i] = memp;
-            memp = (struct memp *) ((u8_t *) memp + MEMP_SIZE + memp_sizes[i]
-#if MEMP_OVERFLOW_CHECK
-                                    + MEMP_SANITY_REGION_AFTER_ALIGNED
-#endif
-              );
+            memp = (struct memp *) ((u8_t *) memp + MEMP_ELEMENT_SIZE(i));
         }
+        memp_tab_count[i] = memp_total[i] = memp_num[i];
+        memp_limit[i] = MEMP_CAN_GROW(i) ? (u32_t) memp_num[i] * MEMP_GROW_FACTOR
+                                         : memp_num[i];
     }
-    // Set how many free pbuf_pools are there
-//    printf("memp_num[PBUF_POOL] %" PRIu16 "\n", memp_num[MEMP_MAX - 1]);
-    pbuf_pool_counter = 0;
+    /* forget what the pools have grown by, and what the caches held */
+    while (memp_chunks != NULL) {
+        void *chunk = memp_chunks;
+        memp_chunks = *(void **) chunk;
+        free(chunk);
+    }
+    for (cache = memp_caches; cache != NULL; cache = cache->next) {
+        memset(cache->head, 0, sizeof(cache->head));
+        memset(cache->count, 0, sizeof(cache->count));
+    }
+    memp_cache_resize();
+    thread_mutex_unlock(&memp_lock);
 #if MEMP_OVERFLOW_CHECK
     memp_overflow_init();
     /* check everything a first time to see if it worked */
@@ -343,7 +608,7 @@ void memp_initialize_pbuf_list(void)
 // Returns the count of free pbufs available
 u16_t memp_pbuf_peek(void)
 {
-    return (memp_num[MEMP_MAX - 1] - pbuf_pool_counter);
+    return LWIP_MIN(memp_avail(MEMP_PBUF_POOL), 0xffff);
 }
 
 /**
@@ -364,52 +629,46 @@ memp_malloc(memp_t type)
 memp_malloc_fn(memp_t type, const char *file, const int line)
 #endif
 {
-    struct memp *memp;
-
-    SYS_ARCH_DECL_PROTECT(old_level);
+#if !MEMP_OVERFLOW_CHECK
+    const char *file = NULL;
+    const int line = 0;
+#endif                          /* !MEMP_OVERFLOW_CHECK */
+    struct memp_cache *cache = NULL;
+    struct memp *memp = NULL;
 
     LWIP_ERROR("memp_malloc: type < MEMP_MAX", (type < MEMP_MAX), return NULL;
       );
 
-    SYS_ARCH_PROTECT(old_level);
 #if MEMP_OVERFLOW_CHECK >= 2
     memp_overflow_check_all();
 #endif                          /* MEMP_OVERFLOW_CHECK >= 2 */
 
-    memp = memp_tab[type];
-
-    if (memp != NULL) {
-        memp_tab[type] = memp->next;
-        ++pbuf_pool_counter;
-//    printf("memp_malloc: %s %"PRIu16" %"PRIu16" \n",
-//            disp_name(), type, pbuf_pool_counter);
-#if MEMP_OVERFLOW_CHECK
-        memp->next = NULL;
-        memp->file = file;
-        memp->line = line;
-#endif                          /* MEMP_OVERFLOW_CHECK */
-        MEMP_STATS_INC_USED(used, type);
-        LWIP_ASSERT("memp_malloc: memp properly aligned",
-                    ((mem_ptr_t) memp % MEM_ALIGNMENT) == 0);
-        memp = (struct memp *) ((u8_t *) memp + MEMP_SIZE);
+    if (memp_cache_max[type] > 0) {
+        cache = memp_cache_self();
+    }
+    if (cache != NULL) {
+        if (cache->count[type] == 0) {
+            cache->count[type] =
+              memp_take(type, &cache->head[type],
+                        LWIP_MIN(memp_cache_batch, memp_cache_max[type]), 1);
+        }
+        memp = cache->head[type];
+        if (memp != NULL) {
+            cache->head[type] = memp->next;
+            cache->count[type]--;
+        }
     } else {
+        memp_take(type, &memp, 1, 1);
+    }
+
+    if (memp == NULL) {
         LWIP_DEBUGF(MEMP_DEBUG | 2,
                     ("memp_malloc: out of memory in pool %s\n",
                      memp_desc[type]));
         MEMP_STATS_INC(err, type);
+        return NULL;
     }
-
-    SYS_ARCH_UNPROTECT(old_level);
-/*
-    if (memp == NULL) {
-#if !MEMP_OVERFLOW_CHECK
-        printf("memp_malloc: %" PRIu16 "\n", type);
-#else
-        printf("memp_malloc_fn:\n");
-#endif
-    }
-*/
-    return memp;
+    return memp_hand_out(type, memp, file, line);
 }
 
 /**
@@ -418,48 +677,200 @@ memp_malloc_fn(memp_t type, const char *file, const int line)
  * @param type the pool where to put mem
  * @param mem the memp element to free
  */
-static uint64_t free_counter = 0;
 void memp_free(memp_t type, void *mem)
 {
-    ++free_counter;
-/*    printf("memp_free %s called for type %"PRIu16" with counter "
-            "%"PRIu16", free counter %"PRIu64"\n",
-           disp_name(), type, pbuf_pool_counter, free_counter);
-*/
+    struct memp_cache *cache;
     struct memp *memp;
 
-    SYS_ARCH_DECL_PROTECT(old_level);
-
     if (mem == NULL) {
         printf("memp_free: mem is NULL\n");
         return;
     }
-    LWIP_ASSERT("memp_free: mem properly aligned",
-                ((mem_ptr_t) mem % MEM_ALIGNMENT) == 0);
+    memp = memp_take_back(type, mem);
 
-    memp = (struct memp *) ((u8_t *) mem - MEMP_SIZE);
+    cache = memp_cache_self();
+    if (cache == NULL) {
+        memp_give(type, memp, memp, 1);
+        return;
+    }
+    memp->next = cache->head[type];
+    cache->head[type] = memp;
+    if (++cache->count[type] > memp_cache_max[type]) {
+        /* leave room for a batch of frees */
+        u16_t max = memp_cache_max[type];
+        memp_cache_trim(cache, type,
+                        max - LWIP_MIN(memp_cache_batch, max));
+    }
+}
 
-    SYS_ARCH_PROTECT(old_level);
-#if MEMP_OVERFLOW_CHECK
-#if MEMP_OVERFLOW_CHECK >= 2
-    memp_overflow_check_all();
-#else
-    memp_overflow_check_element(memp, memp_sizes[type]);
-#endif                          /* MEMP_OVERFLOW_CHECK >= 2 */
-#endif                          /* MEMP_OVERFLOW_CHECK */
+/**
+ * Get up to n elements from a pool at once, e.g. for a burst of received
+ * packets. Elements come from the calling thread's cache first, the rest
+ * from the pool with a single lock round trip.
+ *
+ * @param type the pool to get the elements from
+ * @param mem array to return the elements in
+ * @param n number of elements wanted
+ * @return the number of elements returned in mem (less than n if the
+ *         pool ran dry)
+ */
+u16_t memp_malloc_bulk(memp_t type, void **mem, u16_t n)
+{
+    struct memp_cache *cache = NULL;
+    struct memp *memp, *list;
+    u16_t got = 0, taken;
 
-    MEMP_STATS_DEC(used, type);
+    LWIP_ERROR("memp_malloc_bulk: type < MEMP_MAX", (type < MEMP_MAX),
+               return 0;
+      );
 
-    memp->next = memp_tab[type];
-    memp_tab[type] = memp;
-    assert(pbuf_pool_counter > 0);
-    --pbuf_pool_counter;
+    if (memp_cache_max[type] > 0) {
+        cache = memp_cache_self();
+    }
+    if (cache != NULL) {
+        while (got < n && (memp = cache->head[type]) != NULL) {
+            cache->head[type] = memp->next;
+            cache->count[type]--;
+            mem[got++] = memp_hand_out(type, memp, __FILE__, __LINE__);
+        }
+    }
+    if (got < n) {
+        taken = memp_take(type, &list, n - got, n - got);
+        while (taken-- > 0) {
+            memp = list;
+            list = memp->next;
+            mem[got++] = memp_hand_out(type, memp, __FILE__, __LINE__);
+        }
+    }
+    if (got < n) {
+        LWIP_DEBUGF(MEMP_DEBUG | 2,
+                    ("memp_malloc_bulk: out of memory in pool %s\n",
+                     memp_desc[type]));
+        MEMP_STATS_INC(err, type);
+    }
+    return got;
+}
 
-#if MEMP_SANITY_CHECK
-    LWIP_ASSERT("memp sanity", memp_sanity());
-#endif                          /* MEMP_SANITY_CHECK */
+/**
+ * Put n elements back into their pool at once.
+ *
+ * @param type the pool where to put the elements
+ * @param mem array of elements to free (NULL entries are skipped)
+ * @param n number of entries in mem
+ */
+void memp_free_bulk(memp_t type, void **mem, u16_t n)
+{
+    struct memp_cache *cache;
+    struct memp *memp, *first = NULL, *last = NULL;
+    u16_t i, count = 0;
 
-    SYS_ARCH_UNPROTECT(old_level);
+    for (i = 0; i < n; ++i) {
+        if (mem[i] == NULL) {
+            continue;
+        }
+        memp = memp_take_back(type, mem[i]);
+        memp->next = first;
+        first = memp;
+        if (last == NULL) {
+            last = memp;
+        }
+        count++;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    cache = memp_cache_self();
+    if (cache != NULL && cache->count[type] + count <= memp_cache_max[type]) {
+        last->next = cache->head[type];
+        cache->head[type] = first;
+        cache->count[type] += count;
+    } else {
+        memp_give(type, first, last, count);
+    }
+}
+
+/**
+ * Set the maximum number of elements of a pool. A pool grows up to its
+ * limit when it runs dry; a limit below the current size stops it growing
+ * but does not free memory. The pbuf pool cannot grow beyond its static
+ * size, as its memory is registered with the network driver.
+ *
+ * @return ERR_OK, ERR_ARG for a bad pool or ERR_VAL for a limit the pool
+ *         cannot grow to
+ */
+err_t memp_set_limit(memp_t type, u32_t limit)
+{
+    LWIP_ERROR("memp_set_limit: type < MEMP_MAX", (type < MEMP_MAX),
+               return ERR_ARG;
+      );
+    if (!MEMP_CAN_GROW(type) && limit > memp_num[type]) {
+        return ERR_VAL;
+    }
+    thread_mutex_lock(&memp_lock);
+    memp_limit[type] = limit;
+    thread_mutex_unlock(&memp_lock);
+    return ERR_OK;
+}
+
+/** Get the maximum number of elements of a pool (see memp_set_limit()). */
+u32_t memp_get_limit(memp_t type)
+{
+    LWIP_ERROR("memp_get_limit: type < MEMP_MAX", (type < MEMP_MAX),
+               return 0;
+      );
+    return memp_limit[type];
+}
+
+/**
+ * Count the free elements of a pool, including those in thread caches but
+ * not those the pool could still grow by. Only a snapshot, as other threads
+ * may be allocating.
+ */
+u32_t memp_avail(memp_t type)
+{
+    struct memp_cache *cache;
+    u32_t avail;
+
+    LWIP_ERROR("memp_avail: type < MEMP_MAX", (type < MEMP_MAX), return 0;
+      );
+    avail = memp_tab_count[type];
+    for (cache = memp_caches; cache != NULL; cache = cache->next) {
+        avail += cache->count[type];
+    }
+    return avail;
+}
+
+/**
+ * Change how many free elements of each pool a thread may keep, and how
+ * many move between a thread cache and its pool at once. Caches holding
+ * more than the new size shrink as their threads free elements.
+ *
+ * @param size elements per pool and thread (0 disables the caches)
+ * @param batch elements moved at once (at least 1)
+ */
+void memp_set_cache(u16_t size, u16_t batch)
+{
+    memp_cache_size = size;
+    memp_cache_batch = LWIP_MAX(batch, 1);
+    memp_cache_resize();
+}
+
+/**
+ * Give all elements in the calling thread's cache back to their pools, e.g.
+ * before the thread exits.
+ */
+void memp_cache_flush(void)
+{
+    struct memp_cache *cache = memp_cache_self();
+    u16_t i;
+
+    if (cache == NULL) {
+        return;
+    }
+    for (i = 0; i < MEMP_MAX; ++i) {
+        memp_cache_trim(cache, i, 0);
+    }
 }
 
 #endif                          /* MEMP_MEM_MALLOC */
@@ -520,6 +520,7 @@ netif_loop_output(struct netif *netif, struct pbuf *p, struct ip_addr *ipaddr)
     struct pbuf *r;
     err_t err;
     struct pbuf *last;
+    u8_t was_empty;
 
 #if LWIP_LOOPBACK_MAX_PBUFS
     u8_t clen = 0;
@@ -558,7 +559,8 @@ netif_loop_output(struct netif *netif, struct pbuf *p, struct ip_addr *ipaddr)
     for (last = r; last->next != NULL; last = last->next);
 
     SYS_ARCH_PROTECT(lev);
-    if (netif->loop_first != NULL) {
+    was_empty = (netif->loop_first == NULL);
+    if (!was_empty) {
         LWIP_ASSERT("if first != NULL, last must also be != NULL",
                     netif->loop_last != NULL);
         netif->loop_last->next = r;
@@ -570,8 +572,23 @@ netif_loop_output(struct netif *netif, struct pbuf *p, struct ip_addr *ipaddr)
     SYS_ARCH_UNPROTECT(lev);
 
 #if LWIP_NETIF_LOOPBACK_MULTITHREADING
-    /* For multithreading environment, schedule a call to netif_poll */
-    tcpip_callback((void (*)(void *)) (netif_poll), netif);
+    /* For multithreading environment, schedule a call to netif_poll. It
+       drains the whole list, so a call is only needed if the list was empty:
+       a burst of packets sent from one message costs one callback. */
+    if (was_empty &&
+        tcpip_callback((void (*)(void *)) (netif_poll), netif) != ERR_OK) {
+        /* nobody would poll: take our packet, the only one, off again */
+        SYS_ARCH_PROTECT(lev);
+        netif->loop_first = netif->loop_last = NULL;
+#if LWIP_LOOPBACK_MAX_PBUFS
+        netif->loop_cnt_current -= clen;
+#endif                          /* LWIP_LOOPBACK_MAX_PBUFS */
+        SYS_ARCH_UNPROTECT(lev);
+        pbuf_free(r);
+        return ERR_MEM;
+    }
+#else
+    LWIP_UNUSED_ARG(was_empty);
 #endif                          /* LWIP_NETIF_LOOPBACK_MULTITHREADING */
 
     return ERR_OK;
@@ -78,6 +78,8 @@
 #include <assert.h>
 #include <barrelfish/barrelfish.h>
 
+/* gives granted driver receive buffers back (mem_barrelfish.c) */
+void mem_barrelfish_free_granted_pbuf(struct pbuf *p);
 
 #define SIZEOF_STRUCT_PBUF        LWIP_MEM_ALIGN_SIZE(sizeof(struct pbuf))
 /* Since the pool is created in memp, PBUF_POOL_BUFSIZE will be automatically
@@ -129,6 +131,36 @@ uint16_t free_pbuf_pool_count(void)
 #define PBUF_FIXED_SIZE		1
 /* FIXME: get rid of PBUF_FIXED_SIZE */
 
+/**
+ * Determine the room to leave for headers in front of the payload of a pbuf
+ * allocated at a given layer.
+ *
+ * @return false for a bad layer
+ */
+static bool pbuf_layer_offset(pbuf_layer layer, u16_t *offset)
+{
+    *offset = 0;
+    switch (layer) {
+        case PBUF_TRANSPORT:
+            /* add room for transport (often TCP) layer header */
+            *offset += PBUF_TRANSPORT_HLEN;
+            /* FALLTHROUGH */
+        case PBUF_IP:
+            /* add room for IP layer header */
+            *offset += PBUF_IP_HLEN;
+            /* FALLTHROUGH */
+        case PBUF_LINK:
+            /* add room for link layer header */
+            *offset += PBUF_LINK_HLEN;
+            return true;
+        case PBUF_RAW:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
 /**
  * Allocates a pbuf of the given type (possibly a chain for PBUF_POOL type).
  *
@@ -176,25 +208,9 @@ struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
     /* determine header offset */
     p = q = r = NULL;
 
-    offset = 0;
-    switch (layer) {
-        case PBUF_TRANSPORT:
-            /* add room for transport (often TCP) layer header */
-            offset += PBUF_TRANSPORT_HLEN;
-            /* FALLTHROUGH */
-        case PBUF_IP:
-            /* add room for IP layer header */
-            offset += PBUF_IP_HLEN;
-            /* FALLTHROUGH */
-        case PBUF_LINK:
-            /* add room for link layer header */
-            offset += PBUF_LINK_HLEN;
-            break;
-        case PBUF_RAW:
-            break;
-        default:
-            LWIP_ASSERT("pbuf_alloc: bad pbuf layer", 0);
-            return NULL;
+    if (!pbuf_layer_offset(layer, &offset)) {
+        LWIP_ASSERT("pbuf_alloc: bad pbuf layer", 0);
+        return NULL;
     }
 
     switch (type) {
@@ -347,6 +363,112 @@ struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
     return p;
 }
 
+/**
+ * Allocates up to n pbufs of the same layer, length and type at once, e.g.
+ * to refill receive buffers after a burst of packets.
+ *
+ * Pool pbufs that fit into one pool buffer, and ROM/REF pbufs, are taken
+ * from their pool with a single memp_malloc_bulk() call. Anything else is
+ * allocated one by one with pbuf_alloc().
+ *
+ * @param layer flag to define header size
+ * @param length size of the payload of each pbuf
+ * @param type type of the pbufs, as for pbuf_alloc()
+ * @param p array to return the pbufs in
+ * @param n number of pbufs wanted
+ * @return the number of pbufs returned in p
+ */
+u16_t pbuf_alloc_bulk(pbuf_layer layer, u16_t length, pbuf_type type,
+                      struct pbuf **p, u16_t n)
+{
+    u16_t offset, got = 0, i;
+    memp_t pool;
+
+    if (!pbuf_layer_offset(layer, &offset)) {
+        LWIP_ASSERT("pbuf_alloc_bulk: bad pbuf layer", 0);
+        return 0;
+    }
+#ifdef PBUF_FIXED_SIZE
+    assert(length <= PBUF_PKT_SIZE);
+#endif                          // PBUF_FIXED_SIZE
+
+    if (type == PBUF_POOL &&
+        length <= PBUF_POOL_BUFSIZE_ALIGNED - LWIP_MEM_ALIGN_SIZE(offset)) {
+        pool = MEMP_PBUF_POOL;
+    } else if (type == PBUF_ROM || type == PBUF_REF) {
+        pool = MEMP_PBUF;
+    } else {
+        pool = MEMP_MAX;
+    }
+
+    if (pool != MEMP_MAX) {
+        got = memp_malloc_bulk(pool, (void **) p, n);
+        for (i = 0; i < got; i++) {
+            struct pbuf *q = p[i];
+            if (pool == MEMP_PBUF_POOL) {
+                q->payload =
+                  LWIP_MEM_ALIGN((void *) ((u8_t *) q +
+                                           (SIZEOF_STRUCT_PBUF + offset)));
+#ifdef PBUF_FIXED_SIZE
+                q->buff_len = PBUF_PKT_SIZE;
+#endif                          // PBUF_FIXED_SIZE
+            } else {
+                /* caller must set this field properly, afterwards */
+                q->payload = NULL;
+            }
+            q->len = q->tot_len = length;
+            q->next = NULL;
+            q->type = type;
+            q->ref = 1;
+            q->flags = 0;
+        }
+    }
+
+    /* the rest one by one, which also reclaims out-of-sequence segments */
+    for (; got < n; got++) {
+        p[got] = pbuf_alloc(layer, length, type);
+        if (p[got] == NULL) {
+            break;
+        }
+    }
+    return got;
+}
+
+/**
+ * Frees n pbufs (or chains) at once, e.g. after a burst of packets has been
+ * processed. Single pool pbufs that are no longer referenced are given back
+ * to their pool together; everything else goes through pbuf_free().
+ *
+ * @param p array of pbufs to free (NULL entries are skipped)
+ * @param n number of entries in p
+ */
+void pbuf_free_bulk(struct pbuf **p, u16_t n)
+{
+    void *batch[MEMP_CACHE_BATCH];
+    u16_t i, count = 0;
+
+    for (i = 0; i < n; i++) {
+        struct pbuf *q = p[i];
+
+        if (q == NULL) {
+            continue;
+        }
+        if (q->type == PBUF_POOL && q->next == NULL && q->ref == 1) {
+            q->ref = 0;
+            batch[count++] = q;
+            if (count == MEMP_CACHE_BATCH) {
+                memp_free_bulk(MEMP_PBUF_POOL, batch, count);
+                count = 0;
+            }
+        } else {
+            pbuf_free(q);
+        }
+    }
+    if (count > 0) {
+        memp_free_bulk(MEMP_PBUF_POOL, batch, count);
+    }
+}
+
 
 /**
  * Shrink a pbuf chain to a desired length.
@@ -637,6 +759,10 @@ u8_t pbuf_free(struct pbuf * p)
                 /* is this a ROM or RAM referencing pbuf? */
             } else if (type == PBUF_ROM || type == PBUF_REF) {
 //                printf("pbuf_free: %p: PBUF_ROM || PBUF_REF\n", (void *) p);
+                if (p->flags & PBUF_FLAG_RX_GRANT) {
+                    /* give the receive buffer back to the driver */
+                    mem_barrelfish_free_granted_pbuf(p);
+                }
                 memp_free(MEMP_PBUF, p);
                 /* type == PBUF_RAM */
             } else {
@@ -94,7 +94,9 @@ void stats_display_mem(struct stats_mem *mem, char *name)
     LWIP_PLATFORM_DIAG(("avail: %" U32_F "\n\t", (u32_t) mem->avail));
     LWIP_PLATFORM_DIAG(("used: %" U32_F "\n\t", (u32_t) mem->used));
     LWIP_PLATFORM_DIAG(("max: %" U32_F "\n\t", (u32_t) mem->max));
-    LWIP_PLATFORM_DIAG(("err: %" U32_F "\n", (u32_t) mem->err));
+    LWIP_PLATFORM_DIAG(("err: %" U32_F "\n\t", (u32_t) mem->err));
+    LWIP_PLATFORM_DIAG(("exhausted: %" U32_F "\n\t", (u32_t) mem->exhausted));
+    LWIP_PLATFORM_DIAG(("grown: %" U32_F "\n", (u32_t) mem->grown));
 }
 
 #if MEMP_STATS
@@ -144,4 +146,28 @@ void stats_display(void)
 }
 #endif                          /* LWIP_STATS_DISPLAY */
 
+#if MEMP_STATS
+/**
+ * Copy the statistics of one memp pool, e.g. for a benchmark or monitor
+ * that wants to see pool exhaustion without the display functions.
+ */
+void stats_get_memp(int index, struct stats_mem *mem)
+{
+    LWIP_ASSERT("stats_get_memp: index < MEMP_MAX", index < MEMP_MAX);
+    *mem = lwip_stats.memp[index];
+}
+
+/** Number of times any memp pool was found empty since memp_init() */
+STAT_COUNTER stats_memp_exhausted(void)
+{
+    STAT_COUNTER sum = 0;
+    int i;
+
+    for (i = 0; i < MEMP_MAX; i++) {
+        sum += lwip_stats.memp[i].exhausted;
+    }
+    return sum;
+}
+#endif                          /* MEMP_STATS */
+
 #endif                          /* LWIP_STATS */
@@ -241,6 +241,9 @@ tcp_enqueue(struct tcp_pcb * pcb, void *arg, u16_t len,
         }
         seg->next = NULL;
         seg->p = NULL;
+#if TCP_CHECKSUM_ON_COPY
+        seg->chksum = 0;
+#endif
 
 #if TRACE_ONLY_SUB_NNET
         trace_event(TRACE_SUBSYS_NNET, TRACE_EVENT_NNET_TX_MEMP_D, 0);
@@ -275,7 +278,12 @@ tcp_enqueue(struct tcp_pcb * pcb, void *arg, u16_t len,
                     (seg->p->len >= seglen + optlen));
         queuelen += pbuf_clen(seg->p);
         if (arg != NULL) {
+#if TCP_CHECKSUM_ON_COPY
+            seg->chksum = lwip_chksum_copy((char *) seg->p->payload + optlen,
+                                           ptr, seglen);
+#else
             MEMCPY((char *) seg->p->payload + optlen, ptr, seglen);
+#endif
         }
         seg->dataptr = seg->p->payload;
 //    }
@@ -398,6 +406,10 @@ tcp_enqueue(struct tcp_pcb * pcb, void *arg, u16_t len,
         LWIP_ASSERT("zero-length pbuf", (queue->p != NULL)
                     && (queue->p->len > 0));
         pbuf_cat(useg->p, queue->p);
+#if TCP_CHECKSUM_ON_COPY
+        useg->chksum = lwip_chksum_append(useg->chksum, queue->chksum,
+                                          useg->len);
+#endif
         useg->len += queue->len;
         useg->next = queue->next;
 
@@ -751,7 +763,25 @@ static void tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
     seg->p->payload = seg->tcphdr;
 
     seg->tcphdr->chksum = 0;
-#if CHECKSUM_GEN_TCP
+#if TCP_CHECKSUM_ON_COPY
+    {
+        u32_t acc;
+
+        /* sum the header and pseudo header, then add the payload sum
+           taken by tcp_enqueue(): the header length is a multiple of 4,
+           so the payload starts at an even offset */
+        acc = (u16_t) ~ inet_chksum_pseudo_partial(seg->p,
+                                                   &(pcb->local_ip),
+                                                   &(pcb->remote_ip),
+                                                   IP_PROTO_TCP,
+                                                   seg->p->tot_len,
+                                                   TCPH_HDRLEN(seg->tcphdr) *
+                                                   4);
+        acc += seg->chksum;
+        acc = FOLD_U32T(acc);
+        seg->tcphdr->chksum = (u16_t) ~ acc;
+    }
+#elif CHECKSUM_GEN_TCP
     seg->tcphdr->chksum = inet_chksum_pseudo(seg->p,
                                              &(pcb->local_ip),
                                              &(pcb->remote_ip),
@@ -446,7 +446,8 @@ udp_sendto_if(struct udp_pcb * pcb, struct pbuf * p,
     /* not enough space to add an UDP header to first pbuf in given p chain? */
     if (pbuf_header(p, UDP_HLEN)) {
         /* allocate header in a separate new pbuf */
-        printf("Not enough room in buffer for header!!\n");
+        LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_TRACE,
+                    ("udp_send: no room for header, chaining one\n"));
         q = pbuf_alloc(PBUF_IP, UDP_HLEN, PBUF_RAM);
         /* new header pbuf could not be allocated? */
         if (q == NULL) {
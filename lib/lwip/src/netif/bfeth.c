@@ -199,7 +199,9 @@ bfeth_input(struct netif *netif, uint64_t pbuf_id, uint64_t paddr, uint64_t len,
     //tot_len fields, so that should be fine.
 
     //get vaddr of p and adjust the length according to the packet length.
-    p = mem_barrelfish_get_pbuf(pbuf_id);
+    //pp is set if the driver granted us its own receive buffer instead.
+    //If the pbuf pool runs low, p is a copy and the receive pbuf is kept.
+    p = (pp != NULL) ? pp : mem_barrelfish_get_rx_pbuf(pbuf_id, packet_len);
     //* Buffer has to be found
     assert(p != 0);
 
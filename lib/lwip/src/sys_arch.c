@@ -14,7 +14,6 @@
 /*
  * TODO:
  * - implement timeout versions of semaphores and mailboxes correctly
- * - implement mboxes of size > 1
  * - implement sys_msleep
  * - implement sys_jiffies
  */
@@ -156,45 +155,63 @@ u32_t sys_jiffies(void)
 /* Mailbox functions. */
 sys_mbox_t sys_mbox_new(int size)
 {
-    // TODO: support mailboxes of size > 1. we only support size 1 right now
-
     // debug_printf("sys_mbox_new(%d)\n", size);
 
+    // the lwIP size options default to 0, meaning a single message
+    if (size <= 0) {
+        size = 1;
+    }
+
     sys_mbox_t mbox;
-    mbox = (sys_mbox_t)malloc(sizeof(struct bf_sys_mbox));
+    mbox = (sys_mbox_t)malloc(sizeof(struct bf_sys_mbox) +
+                              size * sizeof(void *));
 
     if (mbox == NULL) {
         return SYS_MBOX_NULL;
     }
-    mbox->msg = NULL;
-    mbox->empty = true;
+    mbox->size = size;
+    mbox->first = 0;
+    mbox->count = 0;
 
     thread_mutex_init(&mbox->mutex);
-    thread_cond_init(&mbox->changed_cond);
+    thread_cond_init(&mbox->not_empty);
+    thread_cond_init(&mbox->not_full);
 
 //    debug_printf("sys_mbox_new(%p): created of size %d\n", mbox, size);
     return mbox;        
 }
 
+/* append a message, the mailbox must be locked and not full */
+static void mbox_put(sys_mbox_t mbox, void *msg)
+{
+    assert(mbox->count < mbox->size);
+    mbox->msgs[(mbox->first + mbox->count) % mbox->size] = msg;
+    mbox->count++;
+    thread_cond_signal(&mbox->not_empty);
+}
+
+/* remove the oldest message, the mailbox must be locked and not empty */
+static void *mbox_get(sys_mbox_t mbox)
+{
+    assert(mbox->count > 0);
+    void *msg = mbox->msgs[mbox->first];
+    mbox->first = (mbox->first + 1) % mbox->size;
+    mbox->count--;
+    thread_cond_signal(&mbox->not_full);
+    return msg;
+}
+
 void sys_mbox_post(sys_mbox_t mbox, void *msg)
 {
 //    debug_printf("sys_mbox_post(%p)\n", mbox);
 
-    // keep trying until we succeed
-    while (1) {
-        thread_mutex_lock(&mbox->mutex);
-        if (mbox->empty) {
-            mbox->msg = msg;
-            mbox->empty = false;
-            thread_mutex_unlock(&mbox->mutex); 
-            thread_cond_signal(&mbox->changed_cond);
-            break;
-        } else {
-            // wait until something changes
-            thread_cond_wait(&mbox->changed_cond, &mbox->mutex);
-            thread_mutex_unlock(&mbox->mutex); 
-        }
+    thread_mutex_lock(&mbox->mutex);
+    while (mbox->count == mbox->size) {
+        // wait until a message is fetched
+        thread_cond_wait(&mbox->not_full, &mbox->mutex);
     }
+    mbox_put(mbox, msg);
+    thread_mutex_unlock(&mbox->mutex);
 
 //    debug_printf("sys_mbox_post(%p) done\n", mbox);
 }
@@ -205,10 +222,8 @@ err_t sys_mbox_trypost(sys_mbox_t mbox, void *msg)
 
     err_t err;
     thread_mutex_lock(&mbox->mutex);
-    if (mbox->empty) {
-        mbox->msg = msg;
-        mbox->empty = false;
-        thread_cond_signal(&mbox->changed_cond);
+    if (mbox->count < mbox->size) {
+        mbox_put(mbox, msg);
         err = ERR_OK;
     } else {
         err = ERR_MEM;
@@ -224,36 +239,30 @@ u32_t sys_arch_mbox_fetch(sys_mbox_t mbox, void **msg, u32_t timeout)
 
     u32_t time_left = timeout;
     u32_t res;
+    void *m;
 
     systime_t start, end;
     start = get_system_time();
 
-    // keep trying until we succeed
-    while (1) {
+    thread_mutex_lock(&mbox->mutex);
+    while (mbox->count == 0) {
         if (time_left <= 0 && timeout != 0) {
+            thread_mutex_unlock(&mbox->mutex);
             return SYS_ARCH_TIMEOUT;
         }
-        thread_mutex_lock(&mbox->mutex);
-        if (!mbox->empty) {
-            if (msg != NULL) {
-                *msg = mbox->msg;
-            }
-            mbox->empty = true;
-            thread_mutex_unlock(&mbox->mutex);
-            thread_cond_signal(&mbox->changed_cond);
-            break;
+        // wait until a message is posted
+        if (timeout != 0) {
+            time_left -= thread_cond_wait_timeout(&mbox->not_empty,
+                                                  &mbox->mutex, time_left);
         } else {
-            // wait until something changes
-            if (timeout != 0) {
-                time_left -= thread_cond_wait_timeout(&mbox->changed_cond, 
-                                                      &mbox->mutex,  
-                                                      time_left);
-            } else {
-                thread_cond_wait(&mbox->changed_cond, &mbox->mutex);
-            }
-            thread_mutex_unlock(&mbox->mutex);
+            thread_cond_wait(&mbox->not_empty, &mbox->mutex);
         }
     }
+    m = mbox_get(mbox);
+    thread_mutex_unlock(&mbox->mutex);
+    if (msg != NULL) {
+        *msg = m;
+    }
 
     end = get_system_time();
 
@@ -269,13 +278,14 @@ u32_t sys_arch_mbox_fetch(sys_mbox_t mbox, void **msg, u32_t timeout)
 
 u32_t sys_arch_mbox_tryfetch(sys_mbox_t mbox, void **msg)
 {
-    //    assert(!"NYI");
     u32_t res;
+    void *m;
     thread_mutex_lock(&mbox->mutex);
-    if (!mbox->empty) {
-        *msg = mbox->msg;
-        mbox->empty = true;
-        thread_cond_signal(&mbox->changed_cond);
+    if (mbox->count > 0) {
+        m = mbox_get(mbox);
+        if (msg != NULL) {
+            *msg = m;
+        }
         res = 0; // success
     } else {
         res = SYS_MBOX_EMPTY;
@@ -288,7 +298,7 @@ u32_t sys_arch_mbox_tryfetch(sys_mbox_t mbox, void **msg)
 void sys_mbox_free(sys_mbox_t mbox)
 {
     assert(mbox != NULL);
-    assert(mbox->empty);
+    assert(mbox->count == 0);
     free(mbox);
 }
 
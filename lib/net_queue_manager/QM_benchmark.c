@@ -71,6 +71,7 @@ void reset_client_closure_stat(struct client_closure *cc)
     cc->in_filter_matched_f = 0;
 
     cc->pbuf_count = 0;
+    cc->rx_granted = 0;
 }
 
 // *****************************************************
@@ -27,6 +27,7 @@
 #include <trace_definitions/trace_defs.h>
 #include <net_queue_manager/net_queue_manager.h>
 #include <bfdmuxvm/vm.h>
+#include <bfdmuxvm/classifier.h>
 #include <if/net_soft_filters_defs.h>
 #include "queue_manager_local.h"
 #include "queue_manager_debug.h"
@@ -83,6 +84,7 @@ static char sf_srv_name[MAX_NET_SERVICE_NAME_LEN];
 
 // filters state:
 static struct filter *rx_filters;
+static struct classifier rx_classifier;   // compiled form of rx_filters
 static struct filter arp_filter_rx;
 static struct filter arp_filter_tx;
 
@@ -439,8 +441,25 @@ static void register_filter(struct net_soft_filters_binding *cc, uint64_t id,
     new_filter_rx->filter_id = filter_id_counter;
     new_filter_rx->filter_type = ftype;
     new_filter_rx->buffer = buffer_rx;
-    new_filter_rx->next = rx_filters;
     new_filter_rx->paused = paused ? true : false;
+
+    // newer filters take precedence, as with the old list traversal
+    new_filter_rx->rule = classifier_add(&rx_classifier, new_filter_rx->data,
+                                         len_rx, filter_id_counter,
+                                         new_filter_rx);
+    if (new_filter_rx->rule == NULL) {
+        ETHERSRV_DEBUG("out of memory for filter classification\n");
+        err = ETHERSRV_ERR_NOT_ENOUGH_MEM;
+        wrapper_send_filter_registered_msg(cc, id, err, 0, buffer_id_rx,
+                                           buffer_id_tx, ftype);
+        free(new_filter_rx->data);
+        free(new_filter_tx->data);
+        free(new_filter_rx);
+        free(new_filter_tx);
+        return;
+    }
+
+    new_filter_rx->next = rx_filters;
     rx_filters = new_filter_rx;
     ETHERSRV_DEBUG("filter registered with id %" PRIu64 " and len %d\n",
                    new_filter_rx->filter_id, new_filter_rx->len);
@@ -526,6 +545,8 @@ static struct filter *delete_from_filter_list(struct filter *head,
             }
             return head;
         }                       /* end if: filter_id found */
+        prev = head;
+        head = head->next;
     }                           /* end while: for each element in list */
     return NULL;                /* could not not find the id. */
 }
@@ -556,6 +577,8 @@ static void deregister_filter(struct net_soft_filters_binding *cc,
     }
 
     if (rx_filter) {
+        classifier_remove(&rx_classifier, rx_filter->rule);
+        free(rx_filter->data);
         free(rx_filter);
     }
 
@@ -926,33 +949,19 @@ static void send_arp_to_all(void *data, uint64_t len)
 
 struct filter *execute_filters(void *data, size_t len)
 {
-    struct filter *head = rx_filters;
-    int res, error;
-
-    int i = 0;
-
-//      ETHERSRV_DEBUG("Starting the filter matching....\n");
-    // TODO: gracefully handle the error cases, although I think
-    // it is not really necessary. since it could only mean we have
-    // received a corrupted packet.
-    while (head) {
-        res = execute_filter(head->data, head->len, (uint8_t *) data,
-                             len, &error);
-        if (res) {
-            // FIXME IK: we need some way of testing how precise a match is
-            // and take the most precise match (ie with the least wildcards)
-            // Currently we just take the most recently added filter as
-            // reflected by the order in the list.
-            ETHERSRV_DEBUG("##### Filter_id [%" PRIu64 "] type[%" PRIu64
-                           "] matched giving buff [%" PRIu64 "]..\n",
-                           head->filter_id, head->filter_type,
-                           head->buffer->buffer_id);
-            return head;
-        }
-        head = head->next;
-        ++i;
+    // FIXME IK: we need some way of testing how precise a match is
+    // and take the most precise match (ie with the least wildcards)
+    // Currently we just take the most recently added filter, which is
+    // the one with the highest filter id.
+    struct filter *match = classifier_match(&rx_classifier, (uint8_t *) data,
+                                            len);
+    if (match != NULL) {
+        ETHERSRV_DEBUG("##### Filter_id [%" PRIu64 "] type[%" PRIu64
+                       "] matched giving buff [%" PRIu64 "]..\n",
+                       match->filter_id, match->filter_type,
+                       match->buffer->buffer_id);
     }
-    return NULL;
+    return match;
 }
 
 
@@ -962,6 +971,7 @@ void init_soft_filters_service(char *service_name, uint64_t qid)
     // exporting ether_netd interface
 
     filter_id_counter = 0;
+    classifier_init(&rx_classifier);
     snprintf(sf_srv_name, sizeof(sf_srv_name), "%s_%"PRIu64"",
             service_name, qid);
     errval_t err = net_soft_filters_export(NULL, export_soft_filters_cb,
@@ -57,12 +57,16 @@ static void register_buffer(struct net_queue_manager_binding *cc,
         uint64_t slots, uint8_t role);
 static void sp_notification_from_app(struct net_queue_manager_binding *cc,
         uint64_t queueid, uint64_t type, uint64_t ts);
+static void get_rx_pool(struct net_queue_manager_binding *cc,
+        uint64_t queueid);
+static void register_rx_pool_return(struct net_queue_manager_binding *cc,
+        uint64_t queueid, struct capref sp, uint64_t slots);
 static void get_mac_addr_qm(struct net_queue_manager_binding *cc,
         uint64_t queueid);
 static void print_statistics_handler(struct net_queue_manager_binding *cc,
         uint64_t queueid);
 
-static void do_pending_work(struct net_queue_manager_binding *b);
+static uint64_t do_pending_work(struct net_queue_manager_binding *b);
 
 /*****************************************************************
  * VTABLE
@@ -72,6 +76,8 @@ static void do_pending_work(struct net_queue_manager_binding *b);
 static struct net_queue_manager_rx_vtbl rx_nqm_vtbl = {
     .register_buffer = register_buffer,
     .sp_notification_from_app = sp_notification_from_app,
+    .get_rx_pool = get_rx_pool,
+    .register_rx_pool_return = register_rx_pool_return,
     .get_mac_address = get_mac_addr_qm,
     .print_statistics = print_statistics_handler,
     .benchmark_control_request = benchmark_control_request,
@@ -145,6 +151,8 @@ static struct client_closure *create_new_client(
     }
 
     cc->buffer_ptr = buffer;
+    deferred_event_init(&cc->notify_timer);
+    cc->notify_timer_armed = false;
     cc->debug_state = 0;        // Default debug state : no debug
     reset_client_closure_stat(cc);
     cc->start_ts = rdtsc();
@@ -218,6 +226,11 @@ static errval_t populate_buffer(struct buffer_descriptor *buffer,
 // FIXME: it is singly linked list, hence very slow if no of apps increases
 struct buffer_descriptor *find_buffer(uint64_t buffer_id)
 {
+    if (buffer_id == RX_POOL_BUFFER_ID && rx_pool_find_buffer() != NULL) {
+        // transmitting out of a granted receive buffer
+        return rx_pool_find_buffer();
+    }
+
     struct buffer_descriptor *elem = buffers_list;
     while(elem) {
         if (elem->buffer_id == buffer_id) {
@@ -329,6 +342,94 @@ static void register_buffer(struct net_queue_manager_binding *cc,
     assert(buffer->con != NULL);
 } // end function: register_buffer
 
+// *********** Interface: get_rx_pool ****************
+
+static errval_t wrapper_send_rx_pool(struct q_entry entry)
+{
+    struct net_queue_manager_binding *b = (struct net_queue_manager_binding *)
+        entry.binding_ptr;
+    struct client_closure *ccl = (struct client_closure *) b->st;
+
+    if (b->can_send(b)) {
+        return b->tx_vtbl.rx_pool(b, MKCONT(cont_queue_callback, ccl->q),
+                                  entry.plist[0], entry.plist[1], entry.cap,
+                                  entry.plist[2], entry.plist[3],
+                                  entry.plist[4]);
+        // err, queueid, buf, buffer_id, slots, slot_size
+    } else {
+        ETHERSRV_DEBUG("send_rx_pool Flounder busy.. will retry\n");
+        return FLOUNDER_ERR_TX_BUSY;
+    }
+}
+
+// Hand out the driver's receive buffer pool for zero-copy receive
+static void get_rx_pool(struct net_queue_manager_binding *cc,
+        uint64_t queueid)
+{
+    struct q_entry entry;
+    uint64_t slots = 0;
+
+    memset(&entry, 0, sizeof(struct q_entry));
+    entry.handler = wrapper_send_rx_pool;
+    entry.binding_ptr = (void *) cc;
+    struct client_closure *ccl = (struct client_closure *) cc->st;
+    assert(ccl->queueid == queueid);
+
+    entry.cap = NULL_CAP;
+    errval_t err = rx_pool_describe(&entry.cap, &slots);
+
+    entry.plist[0] = err;
+    entry.plist[1] = queueid;
+    entry.plist[2] = RX_POOL_BUFFER_ID;
+    entry.plist[3] = slots;
+    entry.plist[4] = RX_POOL_SLOT_SIZE;
+    enqueue_cont_q(ccl->q, &entry);
+}
+
+// The client has mapped the pool: packets for it are granted from now on
+static void register_rx_pool_return(struct net_queue_manager_binding *cc,
+        uint64_t queueid, struct capref sp, uint64_t slots)
+{
+    struct client_closure *closure = (struct client_closure *) cc->st;
+    struct capref pool_cap;
+    uint64_t pool_slots;
+    errval_t err;
+
+    assert(closure->queueid == queueid);
+    assert(closure->rx_pool_ret == NULL);
+
+    err = rx_pool_describe(&pool_cap, &pool_slots);
+    if (err_is_ok(err) && slots <= pool_slots) {
+        // the client must be able to give back every slot at once
+        err = ETHERSRV_ERR_RX_POOL_RETURN_SIZE;
+    }
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "register_rx_pool_return: client stays in copy mode");
+        return;
+    }
+
+    struct shared_pool_private *spp = (struct shared_pool_private *)
+                    malloc(sizeof(struct shared_pool_private));
+    if (spp == NULL) {
+        ETHERSRV_DEBUG("register_rx_pool_return: out of memory\n");
+        return;
+    }
+    memset(spp, 0, sizeof(struct shared_pool_private));
+
+    err = sp_map_shared_pool(spp, sp, slots, RX_BUFFER_ID);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "sp_map_shared_pool failed");
+        free(spp);
+        return;
+    }
+    err = rx_pool_attach(closure, spp);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "register_rx_pool_return: client stays in copy mode");
+        free(spp);
+        return;
+    }
+} // end function: register_rx_pool_return
+
 // *********** Interface: sp_send_notification_from_driver ****************
 
 // wrapper function:
@@ -364,15 +465,9 @@ static errval_t wrapper_send_sp_notification_from_driver(struct q_entry e)
     }
 }
 
-// notifiy application that something interesting has happened
-// and it should check the spp
-static bool send_notification_to_app(struct client_closure *cl)
+// queue a notification to the application
+static void enqueue_notification_to_app(struct client_closure *cl)
 {
-
-    if (cl->spp_ptr->notify_other_side == 0) {
-        return false;
-    }
-    // Send notification to application
     struct q_entry entry;
     memset(&entry, 0, sizeof(struct q_entry));
     entry.handler = wrapper_send_sp_notification_from_driver;
@@ -382,13 +477,65 @@ static bool send_notification_to_app(struct client_closure *cl)
     // FIXME: Get the remaining slots value from the driver
     entry.plist[2] = rdtsc();
     enqueue_cont_q(cl->q, &entry);
-    cl->spp_ptr->notify_other_side = 0;
-    return true;
+    sp_notify_sent(cl->spp_ptr);
+
+    if (cl->notify_timer_armed) {
+        deferred_event_cancel(&cl->notify_timer);
+        cl->notify_timer_armed = false;
+    }
+}
+
+// coalescing delay expired: tell the application about what is pending
+static void notify_timeout(void *arg)
+{
+    struct client_closure *cl = arg;
+
+    cl->notify_timer_armed = false;
+    if (cl->spp_ptr->notify.pending > 0) {
+        enqueue_notification_to_app(cl);
+    }
+}
+
+// notifiy application that count slots of its spp have been updated and
+// it should check the spp. Notifications are coalesced: the application
+// is only told right away if it may have stopped polling the spp, otherwise
+// after a batch of updates or the coalescing delay.
+static bool send_notification_to_app(struct client_closure *cl, uint64_t count)
+{
+    struct shared_pool_private *spp = cl->spp_ptr;
+    // we produce into RX pools: nothing to tell while the app polls them
+    bool notify = (cl->buffer_ptr->role == RX_BUFFER_ID) ?
+                  sp_notify_produced(spp, count) :
+                  sp_notify_update(spp, count);
+
+    if (notify) {
+        enqueue_notification_to_app(cl);
+        return true;
+    }
+
+    if (spp->notify.pending > 0 && !cl->notify_timer_armed) {
+        errval_t err = deferred_event_register(&cl->notify_timer,
+                                               get_default_waitset(),
+                                               spp->notify.delay_us,
+                                               MKCLOSURE(notify_timeout, cl));
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "deferred_event_register, notifying right away");
+            enqueue_notification_to_app(cl);
+            return true;
+        }
+        cl->notify_timer_armed = true;
+    }
+    return false;
 } // end function: send_notification_to_app
 
 
 // *********** Interface: sp_notification_from_app ****************
 
+static uint64_t poll_pending_work(void *arg)
+{
+    return do_pending_work(arg);
+}
+
 // Notification received from the application
 // Most probably, it needs some attention
 static void sp_notification_from_app(struct net_queue_manager_binding *cc,
@@ -406,9 +553,13 @@ static void sp_notification_from_app(struct net_queue_manager_binding *cc,
                 0);
 #endif // TRACE_ONLY_SUB_NNET
 
-    // FIXME : call schedule work
-    do_pending_work(cc);
-
+    // Keep sending while the application keeps producing, so that it does
+    // not need to notify us for every batch
+    if (closure->buffer_ptr->role == TX_BUFFER_ID) {
+        sp_consume_while_active(closure->spp_ptr, poll_pending_work, cc);
+    } else {
+        do_pending_work(cc);
+    }
 } // end function:  sp_notification_from_app
 
 
@@ -465,12 +616,28 @@ static void get_mac_addr_qm(struct net_queue_manager_binding *cc,
 
 // *********** Interface: print_statistics ****************
 
-// FIXME: NYI
+// Prints the notification coalescing state of all clients
 static void print_statistics_handler(struct net_queue_manager_binding *cc,
         uint64_t queueid)
 {
     //ETHERSRV_DEBUG
     printf("ETHERSRV: print_statistics_handler: called.\n");
+
+    for (struct buffer_descriptor *b = buffers_list; b != NULL; b = b->next) {
+        struct client_closure *cl = (struct client_closure *) b->con->st;
+        struct sp_notify *n = &cl->spp_ptr->notify;
+        printf("ETHERSRV: client %d %s buf[%"PRIu64"]: notify batch %"PRIu64
+               " delay %"PRIu64"us, %"PRIu64" slot updates, %"PRIu64
+               " notifications, %"PRIu64" pending, %"PRIu64
+               " seen by polling\n", cl->cl_no,
+               (b->role == RX_BUFFER_ID) ? "RX" : "TX", b->buffer_id,
+               n->batch, n->delay_us, n->updates, n->sent, n->pending,
+               n->suppressed);
+        if (b->role == RX_BUFFER_ID) {
+            printf("ETHERSRV: client %d: %"PRIu64" packets granted zero-copy\n",
+                   cl->cl_no, cl->rx_granted);
+        }
+    }
 }
 
 
@@ -617,8 +784,8 @@ bool handle_tx_done(struct net_queue_manager_binding * b, uint64_t spp_index)
         abort();
         assert(!"sp_set_read_index failed");
     }
-
-    if (spp->notify_other_side == 0) {
+    // the application learns about freed TX slots in batches
+    if (!send_notification_to_app(cc, 1)) {
 
         if (cc->debug_state_tx == 4) {
             netbench_record_event_simple(bm, RE_TX_DONE_NN, rts);
@@ -640,7 +807,7 @@ bool handle_tx_done(struct net_queue_manager_binding * b, uint64_t spp_index)
 //   * Send all pending packets.
 //   * Take care of descriptors which are sent.
 //   * If needed, notifiy application.
-static void do_pending_work(struct net_queue_manager_binding *b)
+static uint64_t do_pending_work(struct net_queue_manager_binding *b)
 {
     uint64_t ts = rdtsc();
     struct client_closure *closure = (struct client_closure *)b->st;
@@ -652,6 +819,9 @@ static void do_pending_work(struct net_queue_manager_binding *b)
     assert(spp != NULL);
     assert(spp->sp != NULL);
 
+    // Collect receive buffers the application has finished with
+    rx_pool_reclaim(closure);
+
     // Check if there are more packets to be sent on wire
     uint64_t pkts = 0;
     pkts = send_packets_on_wire(b);
@@ -675,11 +845,13 @@ static void do_pending_work(struct net_queue_manager_binding *b)
         }
     }
 
-    send_notification_to_app(closure);
+    // pass on notifications triggered meanwhile (e.g. full TX queue drained)
+    send_notification_to_app(closure, 0);
 
     if (closure->debug_state_tx == 4) {
         netbench_record_event_simple(bm, RE_TX_W_ALL, ts);
     }
+    return pkts;
 }
 
 
@@ -725,18 +897,29 @@ bool copy_packet_to_user(struct buffer_descriptor *buffer,
         return false;
     }
 
-    uint64_t offset = spp->sp->slot_list[spp->c_write_id].d.offset;
-    assert(offset < (1L << buffer->bits));
-    void *dst = (void *) (uintptr_t) buffer->va + offset;
+    struct slot_data *sld = &spp->sp->slot_list[spp->c_write_id].d;
+    uint64_t offset;
 
-    ETHERSRV_DEBUG("Copy packet pos %p %p %p\n", buffer->va, dst,
-                   (buffer->va + (1L << buffer->bits)));
+    if (rx_pool_grant(cl, data, len, &offset)) {
+        // Zero-copy: point the slot at the driver's receive buffer. The
+        // application buffer parked in this slot (pbuf_id) stays unused.
+        sld->buffer_id = RX_POOL_BUFFER_ID;
+        sld->offset = offset;
+        ++cl->rx_granted;
+    } else {
+        offset = sld->offset;
+        assert(offset < (1L << buffer->bits));
+        void *dst = (void *) (uintptr_t) buffer->va + offset;
 
-    uint64_t ts = rdtsc();
+        ETHERSRV_DEBUG("Copy packet pos %p %p %p\n", buffer->va, dst,
+                       (buffer->va + (1L << buffer->bits)));
+
+        uint64_t ts = rdtsc();
 
-    memcpy_fast((void *) (uintptr_t)dst, data, len);
-    if (cl->debug_state == 4) {
-        netbench_record_event_simple(bm, RE_COPY, ts);
+        memcpy_fast((void *) (uintptr_t)dst, data, len);
+        if (cl->debug_state == 4) {
+            netbench_record_event_simple(bm, RE_COPY, ts);
+        }
     }
 
     // add trace pkt cpy
@@ -753,8 +936,8 @@ bool copy_packet_to_user(struct buffer_descriptor *buffer,
 #endif // TRACE_ONLY_SUB_NNET
 
     // update the length of packet in sslot.len field
-    spp->sp->slot_list[spp->c_write_id].d.len = len;
-    spp->sp->slot_list[spp->c_write_id].d.no_pbufs = 1;
+    sld->len = len;
+    sld->no_pbufs = 1;
 
     if(!sp_increment_write_index(spp)){
         printf("########### ERROR: cp_pkt_2_usr: sp_set_write_index failed\n");
@@ -768,7 +951,7 @@ bool copy_packet_to_user(struct buffer_descriptor *buffer,
                 pkt_location);
 #endif // TRACE_ONLY_SUB_NNET
 
-    send_notification_to_app(cl);
+    send_notification_to_app(cl, 1);
     return true;
 } // end function: copy_packet_to_user
 
@@ -807,6 +990,18 @@ static void error_handler(struct net_queue_manager_binding *b, errval_t err)
         struct buffer_descriptor *buffer = cc->buffer_ptr;
 
         assert(buffer != NULL);
+        // find_buffer() and the RX pool walk the buffer list
+        struct buffer_descriptor **pp = &buffers_list;
+        while (*pp != NULL && *pp != buffer) {
+            pp = &(*pp)->next;
+        }
+        if (*pp != NULL) {
+            *pp = buffer->next;
+        }
+        rx_pool_detach(cc);
+        if (cc->notify_timer_armed) {
+            deferred_event_cancel(&cc->notify_timer);
+        }
         free(buffer);
         free(cc);
     }
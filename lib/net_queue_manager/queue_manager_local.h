@@ -34,5 +34,15 @@ void init_soft_filters_service(char *service_name, uint64_t qid);
 // To get the mac address from device
 uint64_t get_mac_addr_from_device(void);
 
+// Zero-copy receive buffer pool (rx_pool.c)
+errval_t rx_pool_describe(struct capref *cap, uint64_t *slots);
+struct buffer_descriptor *rx_pool_find_buffer(void);
+bool rx_pool_grant(struct client_closure *cl, void *data, uint64_t len,
+                   uint64_t *offset);
+void rx_pool_reclaim(struct client_closure *cl);
+errval_t rx_pool_attach(struct client_closure *cl,
+                        struct shared_pool_private *spp);
+void rx_pool_detach(struct client_closure *cl);
+
 #endif // Queue_Manager_local_H_
 
@@ -0,0 +1,283 @@
+/**
+ * \file
+ * \brief Zero-copy receive buffer pool of the queue manager
+ *
+ * The driver receives into fixed-size slots of a single frame which every
+ * client may map. A packet for a client that has mapped the pool is granted
+ * to it by pointing the client's receive shared pool slot at the pool slot,
+ * instead of copying the payload into the client's own buffer. The client
+ * gives the slot back through a second shared pool once its stack has freed
+ * the packet.
+ *
+ * Slots are reference counted: the driver holds one reference from
+ * ethersrv_rx_pool_get() until the packet has been demultiplexed, and every
+ * grant holds another one, so the same frame can go to several clients
+ * (e.g. ARP). Free slots are kept on a stack to reuse cache-warm buffers.
+ *
+ * Each client counts the references it holds, so that they can be dropped
+ * when it disconnects.
+ *
+ * No driver in this tree calls ethersrv_rx_pool_init() yet. Until one does,
+ * get_rx_pool answers ETHERSRV_ERR_NO_RX_POOL and every client stays on the
+ * copy path.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <barrelfish/barrelfish.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <net_queue_manager/net_queue_manager.h>
+
+#include "queue_manager_debug.h"
+#include "queue_manager_local.h"
+
+struct rx_pool {
+    struct buffer_descriptor desc; // frame backing all slots
+    uint64_t slots;     // number of slots, 0 if there is no pool
+    uint16_t *refs;     // references held on each slot
+    uint64_t *free;     // stack of unreferenced slots
+    uint64_t free_count; // number of entries on the free stack
+};
+
+static struct rx_pool pool;
+
+static inline void *slot_va(uint64_t idx)
+{
+    return pool.desc.va + idx * RX_POOL_SLOT_SIZE;
+}
+
+static void slot_put(uint64_t idx)
+{
+    assert(idx < pool.slots);
+    assert(pool.refs[idx] > 0);
+    if (--pool.refs[idx] == 0) {
+        pool.free[pool.free_count++] = idx;
+    }
+}
+
+/**
+ * \brief Allocate the zero-copy receive buffer pool
+ *
+ * Called once by the driver, after ethersrv_init().
+ *
+ * \param slots number of RX_POOL_SLOT_SIZE sized receive buffers
+ */
+errval_t ethersrv_rx_pool_init(uint64_t slots)
+{
+    errval_t err;
+    size_t retbytes;
+    struct frame_identity pa;
+
+    assert(pool.slots == 0);
+    assert(slots > 0);
+
+    err = frame_alloc(&pool.desc.cap, slots * RX_POOL_SLOT_SIZE, &retbytes);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
+    err = invoke_frame_identify(pool.desc.cap, &pa);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_IDENTIFY);
+    }
+    err = vspace_map_one_frame(&pool.desc.va, retbytes, pool.desc.cap,
+                               NULL, NULL);
+    if (err_is_fail(err)) {
+        return err_push(err, ETHERSRV_ERR_FRAME_CAP_MAP);
+    }
+
+    pool.refs = calloc(slots, sizeof(uint16_t));
+    pool.free = malloc(slots * sizeof(uint64_t));
+    if (pool.refs == NULL || pool.free == NULL) {
+        free(pool.refs);
+        free(pool.free);
+        return ETHERSRV_ERR_NOT_ENOUGH_MEM;
+    }
+
+    pool.desc.pa = pa.base;
+    pool.desc.bits = pa.bits;
+    pool.desc.role = RX_BUFFER_ID;
+    pool.desc.buffer_id = RX_POOL_BUFFER_ID;
+
+    // lowest slots on top of the stack
+    for (uint64_t i = slots; i > 0; i--) {
+        pool.free[pool.free_count++] = i - 1;
+    }
+    pool.slots = slots;
+
+    ETHERSRV_DEBUG("rx_pool: %"PRIu64" slots at pa[%"PRIxLPADDR"] va[%p]\n",
+                   slots, pool.desc.pa, pool.desc.va);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Take a free pool slot to put into the NIC receive ring
+ *
+ * If no slot is free, the slots given back by clients since the last call
+ * are collected first. Drivers that find the pool empty should retry from
+ * their housekeeping path.
+ */
+bool ethersrv_rx_pool_get(uint64_t *idx, void **va, lpaddr_t *pa)
+{
+    if (pool.free_count == 0) {
+        for (struct buffer_descriptor *b = buffers_list; b != NULL;
+             b = b->next) {
+            rx_pool_reclaim((struct client_closure *) b->con->st);
+        }
+        if (pool.free_count == 0) {
+            return false;
+        }
+    }
+
+    uint64_t i = pool.free[--pool.free_count];
+    assert(pool.refs[i] == 0);
+    pool.refs[i] = 1; // held by the driver until the packet is demuxed
+
+    *idx = i;
+    *va = slot_va(i);
+    *pa = pool.desc.pa + i * RX_POOL_SLOT_SIZE;
+    return true;
+}
+
+/**
+ * \brief Demultiplex a packet received into a pool slot
+ *
+ * Clients that have mapped the pool get the slot granted, all others get a
+ * copy. The driver's reference is dropped afterwards, so the slot is only
+ * reused once all grants have been given back.
+ */
+void process_received_pool_buffer(uint64_t idx, size_t len)
+{
+    assert(idx < pool.slots);
+    assert(len <= RX_POOL_SLOT_SIZE);
+
+    process_received_packet(slot_va(idx), len);
+    slot_put(idx);
+}
+
+/// Frame capability and size of the pool, for clients mapping it
+errval_t rx_pool_describe(struct capref *cap, uint64_t *slots)
+{
+    if (pool.slots == 0) {
+        return ETHERSRV_ERR_NO_RX_POOL;
+    }
+    *cap = pool.desc.cap;
+    *slots = pool.slots;
+    return SYS_ERR_OK;
+}
+
+/// Buffer descriptor of the pool, for transmitting out of granted slots
+struct buffer_descriptor *rx_pool_find_buffer(void)
+{
+    return (pool.slots == 0) ? NULL : &pool.desc;
+}
+
+/**
+ * \brief Grant the pool slot holding data to a client instead of copying it
+ *
+ * \param offset returns the offset of data within the pool frame
+ * \return false if the client does not use the pool or data is not in a
+ *         pool slot (e.g. a reassembled or paused packet)
+ */
+bool rx_pool_grant(struct client_closure *cl, void *data, uint64_t len,
+                   uint64_t *offset)
+{
+    if (cl->rx_pool_ret == NULL || pool.slots == 0) {
+        return false;
+    }
+    if ((uintptr_t) data < (uintptr_t) pool.desc.va) {
+        return false;
+    }
+    uint64_t off = (uintptr_t) data - (uintptr_t) pool.desc.va;
+    if (off >= pool.slots * RX_POOL_SLOT_SIZE) {
+        return false;
+    }
+
+    uint64_t idx = off / RX_POOL_SLOT_SIZE;
+    assert((off % RX_POOL_SLOT_SIZE) + len <= RX_POOL_SLOT_SIZE);
+    assert(pool.refs[idx] > 0);
+    ++pool.refs[idx];
+    ++cl->rx_pool_held[idx];
+
+    *offset = off;
+    return true;
+}
+
+/**
+ * \brief Start granting pool slots to a client
+ *
+ * \param spp shared pool through which the client gives slots back
+ */
+errval_t rx_pool_attach(struct client_closure *cl,
+                        struct shared_pool_private *spp)
+{
+    assert(cl->rx_pool_ret == NULL);
+    assert(pool.slots > 0);
+
+    cl->rx_pool_held = calloc(pool.slots, sizeof(uint16_t));
+    if (cl->rx_pool_held == NULL) {
+        return ETHERSRV_ERR_NOT_ENOUGH_MEM;
+    }
+    cl->rx_pool_ret = spp;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Drop every slot still granted to a client that has gone away
+ *
+ * Slots the client gave back are collected first; the rest it can no
+ * longer return. The return pool itself stays mapped, as procon has no
+ * call to unmap it.
+ */
+void rx_pool_detach(struct client_closure *cl)
+{
+    if (cl->rx_pool_ret == NULL) {
+        return;
+    }
+
+    rx_pool_reclaim(cl);
+    for (uint64_t i = 0; i < pool.slots; i++) {
+        while (cl->rx_pool_held[i] > 0) {
+            --cl->rx_pool_held[i];
+            slot_put(i);
+        }
+    }
+
+    free(cl->rx_pool_held);
+    free(cl->rx_pool_ret);
+    cl->rx_pool_held = NULL;
+    cl->rx_pool_ret = NULL;
+}
+
+/// Release the slots a client has given back
+void rx_pool_reclaim(struct client_closure *cl)
+{
+    struct shared_pool_private *spp = cl->rx_pool_ret;
+    struct slot_data d;
+
+    if (spp == NULL) {
+        return;
+    }
+
+    while (sp_ghost_read_slot(spp, &d)) {
+        if (d.pbuf_id >= pool.slots || cl->rx_pool_held[d.pbuf_id] == 0) {
+            // do not let a confused client corrupt the pool
+            printf("rx_pool: client %d returned bogus slot %"PRIu64"\n",
+                   cl->cl_no, d.pbuf_id);
+            continue;
+        }
+        --cl->rx_pool_held[d.pbuf_id];
+        slot_put(d.pbuf_id);
+    }
+
+    if (!sp_ghost_read_confirm(spp)) {
+        USER_PANIC("rx_pool_reclaim: sp_ghost_read_confirm failed");
+    }
+}
@@ -47,11 +47,18 @@ malloc(size_t nbytes)
 	unsigned nunits;
 	nunits = (nbytes + sizeof(Header) - 1) / sizeof(Header) + 1;
 
+	void *cached = __malloc_cache_alloc(nunits);
+	if (cached != NULL) {
+		return cached;
+	}
+
 	MALLOC_LOCK;
 	if ((prevp = state->header_freep) == NULL) {	/* no free list yet */
 		state->header_base.s.ptr = state->header_freep = prevp = &state->header_base;
 		state->header_base.s.size = 0;
 	}
+	__malloc_cache_drain_locked(state);
+	prevp = state->header_freep;
 	for (p = prevp->s.ptr;; prevp = p, p = p->s.ptr) {
 		if (p->s.size >= nunits) {	/* big enough */
 			if (p->s.size == nunits)	/* exactly */
@@ -62,6 +69,7 @@ malloc(size_t nbytes)
 				p->s.size = nunits;
 			}
 			state->header_freep = prevp;
+			__malloc_cache_set_owner(p, state);
 #ifdef CONFIG_MALLOC_DEBUG
 			{
 				/* Write bit pattern over data */
@@ -173,7 +181,12 @@ void free(void *ap)
     assert((lvaddr_t)ap >= base && (lvaddr_t)ap < limit);
 #endif
 
+    if (__malloc_cache_free((Header *) ap - 1)) {
+        return;
+    }
+
     MALLOC_LOCK;
+    __malloc_cache_drain_locked(state);
     __free_locked(ap);
     lesscore();
     MALLOC_UNLOCK;
@@ -14,10 +14,12 @@
 
 #include <assert.h>
 #include <barrelfish/barrelfish.h>
+#include <lwip/pbuf.h>
 #include <nfs/nfs.h>
 #include "nfs_debug.h"
 #include "rpc.h"
 #include "portmap_rpc.h"
+#include "xdr_pbuf.h"
 
 
 static err_t portmap_lookup(struct nfs_client *client, u_int prog, u_int vers);
@@ -607,6 +609,96 @@ err_t nfs_read(struct nfs_client *client, struct nfs_fh3 fh, offset3 offset,
 }
 
 
+/**
+ * \brief Decode a READ reply, referencing the data instead of copying it
+ *
+ * Like xdr_READ3res(), but leaves the data in the reply's pbufs.
+ */
+static bool xdr_READ3res_view(XDR *xdr, READ3res *res,
+                              struct nfs_data_view *view)
+{
+    READ3resok *ok = &res->READ3res_u.resok;
+
+    if (!xdr_nfsstat3(xdr, &res->status)) {
+        return false;
+    }
+    if (res->status != NFS3_OK) {
+        return xdr_READ3resfail(xdr, &res->READ3res_u.resfail);
+    }
+    if (!xdr_post_op_attr(xdr, &ok->file_attributes)
+        || !xdr_count3(xdr, &ok->count) || !xdr_bool(xdr, &ok->eof)
+        || !xdr_u_int(xdr, &ok->data.data_len)) {
+        return false;
+    }
+    if (!xdr_pbuf_getview(xdr, &view->pbuf, &view->offset,
+                          ok->data.data_len)) {
+        return false;
+    }
+    view->len = ok->data.data_len;
+    return true;
+}
+
+/// RPC callback for read replies that reference the data
+static void read_view_reply_handler(struct rpc_client *rpc_client, void *arg1,
+                                    void *arg2, uint32_t replystat,
+                                    uint32_t acceptstat, XDR *xdr)
+{
+    struct nfs_client *client = (void *)rpc_client;
+    nfs_read_view_callback_t callback = (nfs_read_view_callback_t)arg1;
+    struct nfs_data_view view = { .pbuf = NULL, .offset = 0, .len = 0 };
+    READ3res result;
+    bool rb;
+
+    if (replystat != RPC_MSG_ACCEPTED || acceptstat != RPC_SUCCESS) {
+        printf("Read failed\n");
+        callback(arg2, client, NULL, NULL);
+    } else {
+        memset(&result, 0, sizeof(result));
+        rb = xdr_READ3res_view(xdr, &result, &view);
+        assert(rb);
+        if (rb) {
+            callback(arg2, client, &result, &view);
+        } else {
+            /* free partial results if the xdr fails */
+            xdr_READ3res(&xdr_free, &result);
+            callback(arg2, client, NULL, NULL);
+        }
+    }
+}
+
+/** \brief Initiate an NFS read operation that does not copy the data
+ *
+ * Like nfs_read(), but the callback gets a view of the data in the packet
+ * buffers of the reply, so it can be copied straight to its destination.
+ *
+ * \param client NFS client pointer, which has completed the mount process
+ * \param fh Filehandle for file to read
+ * \param offset Offset from start of file to read from
+ * \param count Maximum number of bytes to read
+ * \param callback Callback function to call when operation returns
+ * \param cbarg Opaque argument word passed to callback function
+ *
+ * \returns ERR_OK on success, error code on failure
+ */
+err_t nfs_read_view(struct nfs_client *client, struct nfs_fh3 fh,
+                    offset3 offset, count3 count,
+                    nfs_read_view_callback_t callback, void *cbarg)
+{
+    assert(client->mount_state == NFS_INIT_COMPLETE);
+
+    struct READ3args args = {
+        .file = fh,
+        .offset = offset,
+        .count = count
+    };
+
+    return rpc_call(&client->rpc_client, client->nfs_port, NFS_PROGRAM,
+                    NFS_V3, NFSPROC3_READ, (xdrproc_t) xdr_READ3args,
+                    &args, sizeof(args) + RNDUP(fh.data_len),
+                    read_view_reply_handler, callback, cbarg);
+}
+
+
 /// RPC callback for write replies
 static void write_reply_handler(struct rpc_client *rpc_client, void *arg1,
                                void *arg2, uint32_t replystat,
@@ -671,6 +763,57 @@ err_t nfs_write(struct nfs_client *client, struct nfs_fh3 fh, offset3 offset,
 }
 
 
+/// Encode the arguments of a WRITE up to the data, which rpc_call_data() adds
+static bool xdr_WRITE3args_head(XDR *xdr, WRITE3args *args)
+{
+    return xdr_nfs_fh3(xdr, &args->file) && xdr_offset3(xdr, &args->offset)
+           && xdr_count3(xdr, &args->count)
+           && xdr_stable_how(xdr, &args->stable)
+           && xdr_u_int(xdr, &args->data.data_len);
+}
+
+/** \brief Initiate an NFS write operation of data in packet buffers
+ *
+ * Like nfs_write(), but the data is sent from #data without being copied.
+ * The client takes its own reference on #data, so the caller may free its
+ * reference when this returns, but must not modify the data until the
+ * callback has been called, as it may be retransmitted.
+ *
+ * \param client NFS client pointer, which has completed the mount process
+ * \param fh Filehandle for file to write
+ * \param offset Offset from start of file to write from
+ * \param data Packet buffers allocated by pbuf_alloc() holding the data
+ * \param stable Specifies when the server may commit data to stable storage
+ * \param callback Callback function to call when operation returns
+ * \param cbarg Opaque argument word passed to callback function
+ *
+ * \returns ERR_OK on success, error code on failure
+ */
+err_t nfs_write_pbuf(struct nfs_client *client, struct nfs_fh3 fh,
+                     offset3 offset, struct pbuf *data, stable_how stable,
+                     nfs_write_callback_t callback, void *cbarg)
+{
+    assert(client->mount_state == NFS_INIT_COMPLETE);
+
+    struct WRITE3args args = {
+        .file = fh,
+        .offset = offset,
+        .count = data->tot_len,
+        .stable = stable,
+        .data = {
+            .data_len = data->tot_len,
+            .data_val = NULL,
+        }
+    };
+
+    return rpc_call_data(&client->rpc_client, client->nfs_port, NFS_PROGRAM,
+                         NFS_V3, NFSPROC3_WRITE,
+                         (xdrproc_t) xdr_WRITE3args_head, &args,
+                         sizeof(args) + RNDUP(fh.data_len), data,
+                         write_reply_handler, callback, cbarg);
+}
+
+
 /// RPC callback for create replies
 static void create_reply_handler(struct rpc_client *rpc_client, void *arg1,
                                void *arg2, uint32_t replystat,
@@ -0,0 +1,775 @@
+/**
+ * \file
+ * \brief Cached NFS file access with read-ahead
+ *
+ * Every file handle that is open, has cached pages or recently fetched
+ * attributes has a cnode. Pages are fixed-size chunks of a file, looked up
+ * by (cnode, page index) in a hash table; pages that have been read are on
+ * a global LRU list and are evicted from its tail when the cache is full.
+ * Pages whose READ is still in flight are in the hash table too, so that a
+ * reader that catches up with the read-ahead waits for the outstanding READ
+ * rather than sending another one.
+ *
+ * Each open file tracks the end of its last read. A read that starts there
+ * doubles the read-ahead window (up to NFS_FILE_MAX_WINDOW pages past the
+ * end of the read), any other read shrinks it back to NFS_FILE_MIN_WINDOW,
+ * so random access does not waste bandwidth on pages nobody reads.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/deferred.h>
+#include <nfs/nfs_file.h>
+#include "nfs_debug.h"
+
+#define PAGE_HASH_SIZE  1024
+
+/// Per file handle state
+struct nfs_cnode {
+    struct nfs_client *client;  ///< Client the file handle belongs to
+    struct nfs_fh3 fh;          ///< File handle (owned copy)
+    struct fattr3 attr;         ///< Cached attributes
+    bool attr_valid;            ///< True iff #attr is up to date
+    systime_t attr_time;        ///< When #attr was fetched
+    struct nfs_file *files;     ///< Open files
+    uint32_t pages;             ///< Pages in the cache, including in flight
+    uint32_t inflight;          ///< READs in flight
+    uint32_t busy;              ///< GETATTRs in flight or callbacks running
+    struct nfs_cnode *next;     ///< Next in #cnodes
+};
+
+enum page_state {
+    PAGE_PENDING,               ///< READ in flight
+    PAGE_VALID                  ///< Data present, page on the LRU list
+};
+
+struct page_waiter;
+
+/// A cached page of a file
+struct nfs_page {
+    struct nfs_cnode *cnode;
+    uint64_t index;             ///< Page number in the file
+    enum page_state state;
+    size_t len;                 ///< Valid bytes (< page size only at EOF)
+    struct page_waiter *waiters;///< Reads waiting for a pending page
+    struct nfs_page *hnext;     ///< Next in hash bucket
+    struct nfs_page *prev, *next; ///< LRU list, most recently used first
+    uint8_t data[NFS_FILE_PAGE_SIZE];
+};
+
+/// An open file
+struct nfs_file {
+    struct nfs_cnode *cnode;
+    uint64_t next_offset;       ///< End of the last read
+    uint64_t ra_next;           ///< Next page to read ahead
+    uint64_t ra_limit;          ///< Read ahead up to this page (exclusive)
+    uint32_t window;            ///< Read-ahead window in pages
+    uint32_t reads;             ///< Outstanding nfs_file_read() calls
+    struct nfs_file *next;      ///< Next open file of the cnode
+};
+
+/// An outstanding nfs_file_read() call
+struct nfs_read_req {
+    struct nfs_file *file;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t bytes;
+    uint32_t pending;           ///< Pages still to arrive
+    errval_t err;
+    nfs_file_read_callback_t callback;
+    void *cbarg;
+};
+
+struct page_waiter {
+    struct nfs_read_req *req;
+    struct page_waiter *next;
+};
+
+/// An outstanding GETATTR for nfs_file_open() or nfs_file_getattr()
+struct attr_req {
+    struct nfs_cnode *cnode;
+    nfs_file_open_callback_t open_callback;
+    nfs_file_getattr_callback_t getattr_callback;
+    void *cbarg;
+};
+
+static struct nfs_cnode *cnodes;
+static struct nfs_page *page_hash[PAGE_HASH_SIZE];
+static struct nfs_page *lru_head, *lru_tail;
+static uint32_t page_count;
+static struct nfs_file_stats stats;
+
+static void readahead(struct nfs_file *file);
+
+static inline uint64_t size_to_pages(uint64_t size)
+{
+    return (size + NFS_FILE_PAGE_SIZE - 1) / NFS_FILE_PAGE_SIZE;
+}
+
+static inline unsigned page_hashfn(struct nfs_cnode *cn, uint64_t index)
+{
+    return (((uintptr_t)cn >> 4) ^ (index * 2654435761U)) % PAGE_HASH_SIZE;
+}
+
+static bool fh_equal(struct nfs_fh3 a, struct nfs_fh3 b)
+{
+    return a.data_len == b.data_len
+           && memcmp(a.data_val, b.data_val, a.data_len) == 0;
+}
+
+static bool attr_expired(struct nfs_cnode *cn)
+{
+    return !cn->attr_valid
+           || get_system_time() - cn->attr_time >= NFS_FILE_ATTR_TIMEOUT;
+}
+
+static bool attr_changed(struct fattr3 *old, struct fattr3 *new)
+{
+    return old->size != new->size
+           || old->mtime.seconds != new->mtime.seconds
+           || old->mtime.nseconds != new->mtime.nseconds
+           || old->ctime.seconds != new->ctime.seconds
+           || old->ctime.nseconds != new->ctime.nseconds;
+}
+
+static bool cnode_idle(struct nfs_cnode *cn)
+{
+    return cn->files == NULL && cn->pages == 0 && cn->busy == 0;
+}
+
+static void cnode_free(struct nfs_cnode **prevp)
+{
+    struct nfs_cnode *cn = *prevp;
+
+    *prevp = cn->next;
+    nfs_freefh(cn->fh);
+    free(cn);
+}
+
+/// Find the cnode of a file handle, dropping idle ones with stale attributes
+static struct nfs_cnode *cnode_find(struct nfs_client *client,
+                                    struct nfs_fh3 fh)
+{
+    struct nfs_cnode **prevp = &cnodes, *found = NULL;
+
+    while (*prevp != NULL) {
+        struct nfs_cnode *cn = *prevp;
+        if (cn->client == client && fh_equal(cn->fh, fh)) {
+            found = cn;
+        } else if (cnode_idle(cn) && attr_expired(cn)) {
+            cnode_free(prevp);
+            continue;
+        }
+        prevp = &cn->next;
+    }
+    return found;
+}
+
+static struct nfs_cnode *cnode_get(struct nfs_client *client,
+                                   struct nfs_fh3 fh)
+{
+    struct nfs_cnode *cn = cnode_find(client, fh);
+    if (cn != NULL) {
+        return cn;
+    }
+
+    cn = calloc(1, sizeof(*cn));
+    if (cn == NULL) {
+        return NULL;
+    }
+    cn->client = client;
+    nfs_copyfh(&cn->fh, fh);
+    cn->next = cnodes;
+    cnodes = cn;
+    return cn;
+}
+
+/// Free a cnode that is no longer used and has nothing worth caching
+static void cnode_release(struct nfs_cnode *cn)
+{
+    if (!cnode_idle(cn) || cn->attr_valid) {
+        return;
+    }
+    for (struct nfs_cnode **prevp = &cnodes; *prevp != NULL;
+         prevp = &(*prevp)->next) {
+        if (*prevp == cn) {
+            cnode_free(prevp);
+            return;
+        }
+    }
+    assert(!"cnode not on list");
+}
+
+static struct nfs_page *page_find(struct nfs_cnode *cn, uint64_t index)
+{
+    struct nfs_page *pg;
+
+    for (pg = page_hash[page_hashfn(cn, index)]; pg != NULL; pg = pg->hnext) {
+        if (pg->cnode == cn && pg->index == index) {
+            return pg;
+        }
+    }
+    return NULL;
+}
+
+static void lru_remove(struct nfs_page *pg)
+{
+    if (pg->prev != NULL) {
+        pg->prev->next = pg->next;
+    } else {
+        lru_head = pg->next;
+    }
+    if (pg->next != NULL) {
+        pg->next->prev = pg->prev;
+    } else {
+        lru_tail = pg->prev;
+    }
+    pg->prev = pg->next = NULL;
+}
+
+static void lru_push(struct nfs_page *pg)
+{
+    pg->prev = NULL;
+    pg->next = lru_head;
+    if (lru_head != NULL) {
+        lru_head->prev = pg;
+    } else {
+        lru_tail = pg;
+    }
+    lru_head = pg;
+}
+
+/// Remove a page from the cache. The caller releases the cnode.
+static void page_free(struct nfs_page *pg)
+{
+    struct nfs_page **prevp = &page_hash[page_hashfn(pg->cnode, pg->index)];
+
+    assert(pg->waiters == NULL);
+    while (*prevp != pg) {
+        prevp = &(*prevp)->hnext;
+    }
+    *prevp = pg->hnext;
+
+    if (pg->state == PAGE_VALID) {
+        lru_remove(pg);
+    }
+    page_count--;
+    pg->cnode->pages--;
+    free(pg);
+}
+
+/**
+ * \brief Allocate a pending page, evicting the least recently used one
+ *
+ * \param force Allocate even if the cache is full of pending pages, which is
+ *              the case for pages read on demand but not for read-ahead
+ */
+static struct nfs_page *page_alloc(struct nfs_cnode *cn, uint64_t index,
+                                   bool force)
+{
+    struct nfs_page *pg;
+
+    if (page_count >= NFS_FILE_CACHE_PAGES) {
+        if (lru_tail != NULL) {
+            struct nfs_cnode *victim = lru_tail->cnode;
+            page_free(lru_tail);
+            stats.evictions++;
+            cnode_release(victim);
+        } else if (!force) {
+            return NULL;
+        }
+    }
+
+    pg = malloc(sizeof(*pg));
+    if (pg == NULL) {
+        return NULL;
+    }
+    pg->cnode = cn;
+    pg->index = index;
+    pg->state = PAGE_PENDING;
+    pg->len = 0;
+    pg->waiters = NULL;
+    pg->prev = pg->next = NULL;
+
+    unsigned h = page_hashfn(cn, index);
+    pg->hnext = page_hash[h];
+    page_hash[h] = pg;
+    page_count++;
+    cn->pages++;
+    return pg;
+}
+
+/// Drop all pages of a file that have been read
+static void cnode_invalidate(struct nfs_cnode *cn)
+{
+    struct nfs_page *pg, *next;
+
+    for (pg = lru_head; pg != NULL; pg = next) {
+        next = pg->next;
+        if (pg->cnode == cn) {
+            page_free(pg);
+            stats.invalidations++;
+        }
+    }
+}
+
+/// Update the cached attributes from a reply
+static void attr_update(struct nfs_cnode *cn, struct fattr3 *attr)
+{
+    if (cn->attr_valid && attr_changed(&cn->attr, attr)) {
+        NFSDEBUGPRINT("file changed on server, dropping cached pages\n");
+        cnode_invalidate(cn);
+    }
+    cn->attr = *attr;
+    cn->attr_valid = true;
+    cn->attr_time = get_system_time();
+}
+
+/// Copy the part of a page covered by a read into its buffer
+static void req_fill(struct nfs_read_req *req, struct nfs_page *pg)
+{
+    uint64_t start = pg->index * NFS_FILE_PAGE_SIZE;
+    uint64_t end = start + pg->len;
+
+    if (pg->len < NFS_FILE_PAGE_SIZE && end < req->offset + req->bytes) {
+        // file is shorter than its attributes said
+        req->bytes = (end > req->offset) ? end - req->offset : 0;
+    }
+
+    uint64_t from = (start > req->offset) ? start : req->offset;
+    uint64_t to = req->offset + req->bytes;
+    if (end < to) {
+        to = end;
+    }
+    if (from < to) {
+        memcpy(req->buf + (from - req->offset), pg->data + (from - start),
+               to - from);
+    }
+}
+
+static void req_done(struct nfs_read_req *req)
+{
+    assert(req->pending > 0);
+    if (--req->pending > 0) {
+        return;
+    }
+
+    struct nfs_file *file = req->file;
+    file->reads--;
+    req->callback(req->cbarg, file, req->err,
+                  err_is_ok(req->err) ? req->bytes : 0);
+    free(req);
+}
+
+/// A page has been read: cache it and complete the reads waiting for it
+static void page_complete(struct nfs_page *pg)
+{
+    struct page_waiter *w = pg->waiters, *next;
+
+    pg->state = PAGE_VALID;
+    pg->waiters = NULL;
+    lru_push(pg);
+
+    for (; w != NULL; w = next) {
+        next = w->next;
+        req_fill(w->req, pg);
+        req_done(w->req);
+        free(w);
+    }
+}
+
+/// Reading a page failed: drop it and fail the reads waiting for it
+static void page_fail(struct nfs_page *pg, errval_t err)
+{
+    struct page_waiter *w = pg->waiters, *next;
+
+    pg->waiters = NULL;
+    page_free(pg);
+
+    for (; w != NULL; w = next) {
+        next = w->next;
+        w->req->err = err;
+        req_done(w->req);
+        free(w);
+    }
+}
+
+static void read_reply(void *arg, struct nfs_client *client,
+                       READ3res *result, struct nfs_data_view *data);
+
+/// Send a READ for the rest of a pending page
+static errval_t page_fetch(struct nfs_page *pg)
+{
+    struct nfs_cnode *cn = pg->cnode;
+    err_t r;
+
+    r = nfs_read_view(cn->client, cn->fh,
+                      pg->index * NFS_FILE_PAGE_SIZE + pg->len,
+                      NFS_FILE_PAGE_SIZE - pg->len, read_reply, pg);
+    if (r != ERR_OK) {
+        return NFS_ERR_TRANSPORT;
+    }
+    cn->inflight++;
+    stats.reads++;
+    return SYS_ERR_OK;
+}
+
+static void read_reply(void *arg, struct nfs_client *client,
+                       READ3res *result, struct nfs_data_view *data)
+{
+    (void)client;
+    struct nfs_page *pg = arg;
+    struct nfs_cnode *cn = pg->cnode;
+    errval_t err = SYS_ERR_OK;
+    bool done = true;
+
+    assert(cn->inflight > 0);
+    cn->inflight--;
+    cn->busy++;     // callbacks may close the last file
+
+    if (result == NULL) {
+        err = NFS_ERR_TRANSPORT;
+    } else if (result->status != NFS3_OK) {
+        err = nfsstat_to_errval(result->status);
+    } else {
+        // the only copy of the data, from the reply's pbufs to the page
+        READ3resok *res = &result->READ3res_u.resok;
+        size_t n = nfs_data_view_copy(data, 0, pg->data + pg->len,
+                                      NFS_FILE_PAGE_SIZE - pg->len);
+        pg->len += n;
+
+        if (res->file_attributes.attributes_follow) {
+            attr_update(cn, &res->file_attributes.post_op_attr_u.attributes);
+        }
+        if (pg->len < NFS_FILE_PAGE_SIZE && !res->eof && n > 0) {
+            // short read: ask for the rest of the page
+            err = page_fetch(pg);
+            done = err_is_fail(err);
+        }
+    }
+
+    if (data != NULL) {
+        nfs_data_view_free(data);
+    }
+    if (result != NULL) {
+        xdr_READ3res(&xdr_free, result);
+    }
+
+    if (err_is_fail(err)) {
+        NFSDEBUGPRINT("read of page %"PRIu64" failed\n", pg->index);
+        page_fail(pg, err);
+    } else if (done) {
+        page_complete(pg);
+    }
+
+    // keep the windows of the file's readers full
+    for (struct nfs_file *f = cn->files; f != NULL; f = f->next) {
+        readahead(f);
+    }
+
+    cn->busy--;
+    cnode_release(cn);
+}
+
+/// Send READs for the pages after the last read, up to the window
+static void readahead(struct nfs_file *file)
+{
+    struct nfs_cnode *cn = file->cnode;
+    uint64_t limit = size_to_pages(cn->attr.size);
+
+    if (limit > file->ra_limit) {
+        limit = file->ra_limit;
+    }
+
+    while (file->ra_next < limit) {
+        if (page_find(cn, file->ra_next) == NULL) {
+            struct nfs_page *pg = page_alloc(cn, file->ra_next, false);
+            if (pg == NULL) {
+                break;
+            }
+            if (err_is_fail(page_fetch(pg))) {
+                page_free(pg);
+                break;
+            }
+            stats.readahead++;
+        }
+        file->ra_next++;
+    }
+}
+
+/**
+ * \brief Read from an open file
+ *
+ * Reads beyond the end of the file are cut short. The callback is called
+ * with the number of bytes read once all data is in the buffer, which may
+ * be before this function returns if everything was cached.
+ *
+ * \param file File opened by nfs_file_open()
+ * \param offset Offset in the file to read from
+ * \param buf Buffer for the data, which must remain valid until the callback
+ * \param bytes Number of bytes to read
+ * \param callback Callback function to call when the read completes
+ * \param cbarg Opaque argument word passed to callback function
+ */
+errval_t nfs_file_read(struct nfs_file *file, uint64_t offset, void *buf,
+                       size_t bytes, nfs_file_read_callback_t callback,
+                       void *cbarg)
+{
+    struct nfs_cnode *cn = file->cnode;
+    uint64_t size = cn->attr.size;
+
+    if (offset >= size || bytes == 0) {
+        callback(cbarg, file, SYS_ERR_OK, 0);
+        return SYS_ERR_OK;
+    }
+    if (bytes > size - offset) {
+        bytes = size - offset;
+    }
+
+    struct nfs_read_req *req = malloc(sizeof(*req));
+    if (req == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    req->file = file;
+    req->offset = offset;
+    req->buf = buf;
+    req->bytes = bytes;
+    req->pending = 1;   // held until all pages have been looked at
+    req->err = SYS_ERR_OK;
+    req->callback = callback;
+    req->cbarg = cbarg;
+    file->reads++;
+
+    uint64_t first = offset / NFS_FILE_PAGE_SIZE;
+    uint64_t last = (offset + bytes - 1) / NFS_FILE_PAGE_SIZE;
+
+    if (offset == file->next_offset) {
+        if (file->window == 0) {
+            file->window = 1;
+        } else if (file->window < NFS_FILE_MAX_WINDOW) {
+            file->window *= 2;
+        }
+    } else {
+        file->window = NFS_FILE_MIN_WINDOW;
+        file->ra_next = last + 1;
+    }
+    file->next_offset = offset + bytes;
+    if (file->ra_next <= last) {
+        file->ra_next = last + 1;
+    }
+    file->ra_limit = last + 1 + file->window;
+
+    for (uint64_t i = first; i <= last; i++) {
+        struct nfs_page *pg = page_find(cn, i);
+
+        if (pg != NULL && pg->state == PAGE_VALID) {
+            stats.hits++;
+            lru_remove(pg);
+            lru_push(pg);
+            req_fill(req, pg);
+            continue;
+        }
+
+        if (pg != NULL) {
+            stats.inflight_hits++;
+        } else {
+            pg = page_alloc(cn, i, true);
+            if (pg == NULL) {
+                req->err = LIB_ERR_MALLOC_FAIL;
+                break;
+            }
+            errval_t err = page_fetch(pg);
+            if (err_is_fail(err)) {
+                page_free(pg);
+                req->err = err;
+                break;
+            }
+            stats.misses++;
+        }
+
+        struct page_waiter *w = malloc(sizeof(*w));
+        if (w == NULL) {
+            req->err = LIB_ERR_MALLOC_FAIL;
+            break;
+        }
+        w->req = req;
+        w->next = pg->waiters;
+        pg->waiters = w;
+        req->pending++;
+    }
+
+    readahead(file);
+    req_done(req);
+    return SYS_ERR_OK;
+}
+
+/// Size of an open file, as of the last revalidation
+uint64_t nfs_file_size(struct nfs_file *file)
+{
+    return file->cnode->attr.size;
+}
+
+static void getattr_reply(void *arg, struct nfs_client *client,
+                          GETATTR3res *result)
+{
+    (void)client;
+    struct attr_req *req = arg;
+    struct nfs_cnode *cn = req->cnode;
+    struct nfs_file *file = NULL;
+    errval_t err = SYS_ERR_OK;
+
+    if (result == NULL) {
+        err = NFS_ERR_TRANSPORT;
+    } else if (result->status != NFS3_OK) {
+        err = nfsstat_to_errval(result->status);
+    } else {
+        attr_update(cn, &result->GETATTR3res_u.resok.obj_attributes);
+    }
+    if (result != NULL) {
+        xdr_GETATTR3res(&xdr_free, result);
+    }
+
+    if (req->open_callback != NULL) {
+        if (err_is_ok(err) && cn->attr.type == NF3DIR) {
+            err = NFS_ERR_ISDIR;
+        }
+        if (err_is_ok(err)) {
+            file = calloc(1, sizeof(*file));
+            if (file == NULL) {
+                err = LIB_ERR_MALLOC_FAIL;
+            } else {
+                file->cnode = cn;
+                file->window = NFS_FILE_MIN_WINDOW;
+                file->next = cn->files;
+                cn->files = file;
+            }
+        }
+        cn->busy--;
+        req->open_callback(req->cbarg, file, err);
+    } else {
+        req->getattr_callback(req->cbarg, err,
+                              err_is_ok(err) ? &cn->attr : NULL);
+        cn->busy--;
+    }
+
+    cnode_release(cn);
+    free(req);
+}
+
+static errval_t attr_fetch(struct nfs_cnode *cn,
+                           nfs_file_open_callback_t open_callback,
+                           nfs_file_getattr_callback_t getattr_callback,
+                           void *cbarg)
+{
+    struct attr_req *req = malloc(sizeof(*req));
+    if (req == NULL) {
+        cnode_release(cn);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    req->cnode = cn;
+    req->open_callback = open_callback;
+    req->getattr_callback = getattr_callback;
+    req->cbarg = cbarg;
+
+    err_t r = nfs_getattr(cn->client, cn->fh, getattr_reply, req);
+    if (r != ERR_OK) {
+        free(req);
+        cnode_release(cn);
+        return NFS_ERR_TRANSPORT;
+    }
+    cn->busy++;
+    stats.attr_misses++;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Open a file for cached reading
+ *
+ * Always revalidates the attributes with the server (close-to-open
+ * consistency). Cached pages of the file are dropped if it has changed.
+ *
+ * \param client NFS client pointer, which has completed the mount process
+ * \param fh File handle of the file to open
+ * \param callback Callback function to call with the open file
+ * \param cbarg Opaque argument word passed to callback function
+ */
+errval_t nfs_file_open(struct nfs_client *client, struct nfs_fh3 fh,
+                       nfs_file_open_callback_t callback, void *cbarg)
+{
+    struct nfs_cnode *cn = cnode_get(client, fh);
+    if (cn == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    return attr_fetch(cn, callback, NULL, cbarg);
+}
+
+/// Close a file opened by nfs_file_open(); its pages stay cached
+void nfs_file_close(struct nfs_file *file)
+{
+    struct nfs_cnode *cn = file->cnode;
+
+    assert(file->reads == 0);
+    for (struct nfs_file **prevp = &cn->files; *prevp != NULL;
+         prevp = &(*prevp)->next) {
+        if (*prevp == file) {
+            *prevp = file->next;
+            break;
+        }
+    }
+    free(file);
+    cnode_release(cn);
+}
+
+/**
+ * \brief Get the attributes of a file, from the cache if they are recent
+ *
+ * \param client NFS client pointer, which has completed the mount process
+ * \param fh File handle of the file
+ * \param callback Callback function to call with the attributes, which are
+ *                 only valid during the callback
+ * \param cbarg Opaque argument word passed to callback function
+ */
+errval_t nfs_file_getattr(struct nfs_client *client, struct nfs_fh3 fh,
+                          nfs_file_getattr_callback_t callback, void *cbarg)
+{
+    struct nfs_cnode *cn = cnode_find(client, fh);
+
+    if (cn != NULL && !attr_expired(cn)) {
+        stats.attr_hits++;
+        callback(cbarg, SYS_ERR_OK, &cn->attr);
+        return SYS_ERR_OK;
+    }
+
+    cn = cnode_get(client, fh);
+    if (cn == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    return attr_fetch(cn, NULL, callback, cbarg);
+}
+
+/// Drop cached pages and attributes of a file, e.g. after writing to it
+void nfs_file_invalidate(struct nfs_client *client, struct nfs_fh3 fh)
+{
+    struct nfs_cnode *cn = cnode_find(client, fh);
+
+    if (cn != NULL) {
+        cnode_invalidate(cn);
+        cn->attr_valid = false;
+        cnode_release(cn);
+    }
+}
+
+void nfs_file_get_stats(struct nfs_file_stats *ret)
+{
+    *ret = stats;
+}
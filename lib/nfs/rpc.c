@@ -48,10 +48,10 @@ enum rpc_msg_type {
     RPC_REPLY = 1
 };
 
-//#define RPC_TIMER_PERIOD (5000 * 1000) ///< Time between RPC timer firings (us)
-#define RPC_TIMER_PERIOD (1000 * 1000) ///< Time between RPC timer firings (us)
-#define RPC_RETRANSMIT_AFTER 6   ///< Number of timer firings before a retransmit
-#define RPC_MAX_RETRANSMIT  60  ///< Max number of retransmissions before giving up
+#define RPC_RTO_INITIAL     (1000 * 1000)   ///< Timeout before any RTT sample (us)
+#define RPC_RTO_MIN         (200 * 1000)    ///< Lower bound on the timeout (us)
+#define RPC_RTO_MAX         (60 * 1000 * 1000) ///< Upper bound on the timeout (us)
+#define RPC_MAX_RETRANSMIT  10  ///< Max number of retransmissions before giving up
 
 /* XXX: hardcoded data for authentication info */
 #define AUTH_MACHINE_NAME       "barrelfish"
@@ -67,23 +67,129 @@ enum rpc_msg_type {
 extern struct thread_mutex *lwip_mutex;
 extern struct waitset *lwip_waitset;
 
-static uint8_t net_debug_state = 0;
-
-static int hash_function(uint32_t xid)
-{
-    return (xid % RPC_HTABLE_SIZE);
-}
-
 /// Data for an outstanding (unreplied) RPC call
 struct rpc_call {
     uint32_t xid;               ///< Transaction ID (XID)
-    uint16_t timers, retries;   ///< Number of timer expiries and retries
+    uint16_t retries;           ///< Number of retransmissions
     struct pbuf *pbuf;          ///< LWIP pbuf pointer for packet data
     rpc_callback_t callback;    ///< Callback function pointer
     void *cbarg1, *cbarg2;      ///< Callback function opaque arguments
-    struct rpc_call *next;      ///< Next call in queue
+    struct rpc_client *client;  ///< Client the call was made on
+    systime_t sent;             ///< Time of the first transmission
+    delayus_t rto;              ///< Current retransmit timeout (us)
+    struct deferred_event timer;///< Retransmit timer
+    struct rpc_call *next;      ///< Next call in hash bucket
 };
 
+/*
+ * Outstanding calls are hashed by XID into a table of a power-of-two size
+ * that doubles when it holds more calls than buckets. XIDs are allocated
+ * sequentially, so the calls in flight map to distinct buckets and lookups
+ * take constant time regardless of how many calls are in flight.
+ */
+
+static inline struct rpc_call **call_bucket(struct rpc_client *client,
+                                            uint32_t xid)
+{
+    return &client->call_hash[xid & (client->hash_size - 1)];
+}
+
+/// Double the size of the call hash table, if memory permits
+static void call_hash_grow(struct rpc_client *client)
+{
+    uint32_t size = client->hash_size * 2;
+    struct rpc_call **hash = calloc(size, sizeof(struct rpc_call *));
+    if (hash == NULL) {
+        return; // keep going with longer chains
+    }
+
+    for (uint32_t i = 0; i < client->hash_size; i++) {
+        struct rpc_call *call, *next;
+        for (call = client->call_hash[i]; call != NULL; call = next) {
+            next = call->next;
+            struct rpc_call **b = &hash[call->xid & (size - 1)];
+            call->next = *b;
+            *b = call;
+        }
+    }
+    free(client->call_hash);
+    client->call_hash = hash;
+    client->hash_size = size;
+}
+
+static void call_insert(struct rpc_client *client, struct rpc_call *call)
+{
+    if (client->ncalls >= client->hash_size) {
+        call_hash_grow(client);
+    }
+    struct rpc_call **b = call_bucket(client, call->xid);
+    call->next = *b;
+    *b = call;
+    client->ncalls++;
+}
+
+/// Find the call with the given XID and remove it from the hash table
+static struct rpc_call *call_remove(struct rpc_client *client, uint32_t xid)
+{
+    struct rpc_call **prevp, *call;
+
+    for (prevp = call_bucket(client, xid); (call = *prevp) != NULL;
+         prevp = &call->next) {
+        if (call->xid == xid) {
+            *prevp = call->next;
+            client->ncalls--;
+            return call;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Update the round trip time estimate with a new sample
+ *
+ * Jacobson/Karels, as in TCP (RFC 6298): the smoothed RTT is kept scaled by
+ * 8 and the mean deviation scaled by 4, and the timeout is SRTT + 4 * RTTVAR.
+ */
+static void rtt_sample(struct rpc_client *client, systime_t rtt)
+{
+    int64_t m = rtt;
+
+    if (client->srtt == 0) {
+        client->srtt = (m << 3) + 1; // +1: never 0 again, 0 means no sample
+        client->rttvar = m << 1;
+    } else {
+        int64_t delta = m - (client->srtt >> 3);
+        client->srtt += delta;
+        if (client->srtt <= 0) {
+            client->srtt = 1;
+        }
+        if (delta < 0) {
+            delta = -delta;
+        }
+        client->rttvar += delta - (client->rttvar >> 2);
+    }
+
+    int64_t rto = (client->srtt >> 3) + client->rttvar;
+    if (rto < RPC_RTO_MIN) {
+        rto = RPC_RTO_MIN;
+    } else if (rto > RPC_RTO_MAX) {
+        rto = RPC_RTO_MAX;
+    }
+    client->rto = rto;
+}
+
+static void rpc_call_timeout(void *arg);
+
+static void call_arm_timer(struct rpc_call *call)
+{
+    errval_t err = deferred_event_register(&call->timer, lwip_waitset,
+                                           call->rto,
+                                           MKCLOSURE(rpc_call_timeout, call));
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "RPC: failed to arm retransmit timer");
+    }
+}
+
 /// Utility function to prepare an outgoing packet buffer with the RPC call header
 static err_t rpc_call_init(XDR *xdr, uint32_t xid, uint32_t prog, uint32_t vers,
                            uint32_t proc)
@@ -142,20 +248,15 @@ static err_t rpc_call_init(XDR *xdr, uint32_t xid, uint32_t prog, uint32_t vers,
 /// Utility function to skip over variable-sized authentication data in a reply
 static err_t xdr_skip_auth(XDR *xdr)
 {
-    int32_t *buf;
+    uint32_t flavour, auth_size;
 
-    if ((buf = XDR_INLINE(xdr, 2 * BYTES_PER_XDR_UNIT)) == NULL) {
+    if (!xdr_uint32_t(xdr, &flavour) || !xdr_uint32_t(xdr, &auth_size)) {
         return ERR_BUF;
     }
 
-    (void) IXDR_GET_UINT32(buf); // skip auth flavour
-
-    size_t auth_size = IXDR_GET_UINT32(buf);
-
-    /* skip over auth data bytes */
+    /* skip over auth data bytes, which may span pbufs */
     if (auth_size > 0) {
-        buf = XDR_INLINE(xdr, auth_size);
-        if (buf == NULL) {
+        if (!XDR_SETPOS(xdr, XDR_GETPOS(xdr) + RNDUP(auth_size))) {
             return ERR_BUF;
         }
     }
@@ -180,16 +281,14 @@ static void rpc_recv_handler(void *arg, struct udp_pcb *pcb, struct pbuf *pbuf,
 
     xdr_pbuf_create_recv(&xdr, pbuf);
 
-    int32_t *buf;
-    if ((buf = XDR_INLINE(&xdr, 3 * BYTES_PER_XDR_UNIT)) == NULL) {
+    // XID comes first, then the message type and the reply status
+    uint32_t xid, msgtype;
+    if (!xdr_uint32_t(&xdr, &xid) || !xdr_uint32_t(&xdr, &msgtype)
+        || !xdr_uint32_t(&xdr, &replystat)) {
         fprintf(stderr, "RPC: packet too small, dropped\n");
         goto out;
     }
 
-    // XID comes first
-    uint32_t xid = IXDR_GET_UINT32(buf);
-    // message type
-    uint32_t msgtype = IXDR_GET_UINT32(buf);
     if (msgtype != RPC_REPLY) {
         fprintf(stderr, "RPC: Received non-reply message, dropped\n");
         goto out;
@@ -197,26 +296,20 @@ static void rpc_recv_handler(void *arg, struct udp_pcb *pcb, struct pbuf *pbuf,
     RPC_DEBUGP("rpc_recv_call: RPC callback for xid %u x0%x\n", xid, xid);
 
 
-    int hid = hash_function(xid);
-    struct rpc_call *hash_list = client->call_hash[hid];
     // find matching call and dequeue it
-    struct rpc_call *prev = NULL;
-    for (call = hash_list; call && call->xid != xid; call = call->next){
-        prev = call;
-    }
+    call = call_remove(client, xid);
     if (call == NULL) {
-        fprintf(stderr, "RPC: Unknown XID 0x%" PRIx32 " in reply, dropped\n", xid);
-/*        fprintf(stderr, "RPC:[%d:%s] Unknown XID 0x%x in reply, dropped\n",
-                disp_get_domain_id(), disp_name(), xid);
-*/
+        // most likely the reply to a call that was retransmitted
+        RPC_DEBUGP("Unknown XID 0x%" PRIx32 " in reply, dropped\n", xid);
         goto out;
-    } else if (prev == NULL) {
-    	client->call_hash[hid] = call->next;
-    } else {
-        prev->next = call->next;
+    }
+    deferred_event_cancel(&call->timer);
+
+    // Karn: only calls that were not retransmitted give a clean sample
+    if (call->retries == 0) {
+        rtt_sample(client, get_system_time() - call->sent);
     }
 
-    replystat = IXDR_GET_UINT32(buf);
     if (replystat == RPC_MSG_ACCEPTED) {
         r = xdr_skip_auth(&xdr);
         if (r != ERR_OK) {
@@ -249,81 +342,56 @@ out:
 //    lwip_record_event_simple(RPC_RECV_OUT_T, ts);
 }
 
-static void traverse_hash_bucket(int hid, struct rpc_client *client)
+/// Retransmit timer of a call: retransmit with backoff or expire it
+static void rpc_call_timeout(void *arg)
 {
-    struct rpc_call *call, *next, *prev = NULL;
-
-    for (call = client->call_hash[hid]; call != NULL; call = next) {
-        next = call->next;
-        bool freed_call = false;
-        if (++call->timers >= RPC_RETRANSMIT_AFTER) {
-            if (call->retries++ == RPC_MAX_RETRANSMIT) {
-                /* admit failure */
-                printf("##### [%d][%"PRIuDOMAINID"] "
-                       "RPC: timeout for XID 0x%"PRIu32"\n",
-                       disp_get_core_id(), disp_get_domain_id(), call->xid);
-                pbuf_free(call->pbuf);
-                if (prev == NULL) {
-                    client->call_hash[hid] = call->next;
-                } else {
-                    prev->next = call->next;
-                }
-                call->callback(client, call->cbarg1, call->cbarg2, -1, -1, NULL);
-                free(call);
-                freed_call = true;
-            } else {
-                /*
-                if(net_debug_state == 0) {
-                    net_debug_state = 1;
-                    printf("starting the debug in network driver\n");
-                    lwip_benchmark_control(0, BMS_START_REQUEST,
-                            0, rdtsc());
-                    lwip_benchmark_control(1, BMS_START_REQUEST,
-                            0, rdtsc());
-                } else {
-                    printf("already started the debug in network driver\n");
-                }
-                */
-
-                /* retransmit */
-                printf("###### [%d][%"PRIuDOMAINID"] "
-                       "RPC: retransmit XID 0x%"PRIu32"\n",
-                       disp_get_core_id(), disp_get_domain_id(), call->xid);
-
-                // throw away (hide) UDP/IP/ARP headers from previous transmission
-                err_t e = pbuf_header(call->pbuf,
-                                      -UDP_HLEN - IP_HLEN - PBUF_LINK_HLEN);
-                assert(e == ERR_OK);
-
-                e = udp_send(client->pcb, call->pbuf);
-                if (e != ERR_OK) {
-                    /* XXX: assume that this is a transient condition, retry */
-                    fprintf(stderr, "RPC: retransmit failed! will retry...\n");
-                    call->timers--;
-                } else {
-                    call->timers = 0;
-                }
-            }
-        }
-        if (!freed_call) {
-            prev = call;
-        }
-    } /* end for: */
-}
+    struct rpc_call *call = arg;
+    struct rpc_client *client = call->client;
 
-/// Timer callback: walk the queue of pending calls, and retransmit/expire them
-static void rpc_timer(void *arg)
-{
-    struct rpc_client *client = arg;
-    RPC_DEBUGP("rpc_timer fired\n");
     if (lwip_mutex != NULL) {
         thread_mutex_lock(lwip_mutex);
     }
-    for (int i = 0; i < RPC_HTABLE_SIZE; ++i) {
-    	if (client->call_hash[i] != NULL) {
-            traverse_hash_bucket(i, client);
-    	}
+
+    if (call->retries++ == RPC_MAX_RETRANSMIT) {
+        /* admit failure */
+        printf("##### [%d][%"PRIuDOMAINID"] "
+               "RPC: timeout for XID 0x%"PRIu32"\n",
+               disp_get_core_id(), disp_get_domain_id(), call->xid);
+        struct rpc_call *c = call_remove(client, call->xid);
+        assert(c == call);
+        pbuf_free(call->pbuf);
+        call->callback(client, call->cbarg1, call->cbarg2, -1, -1, NULL);
+        free(call);
+    } else {
+        /* retransmit */
+        RPC_DEBUGP("retransmit XID 0x%"PRIx32" after %"PRIu64" us\n",
+                   call->xid, (uint64_t)call->rto);
+        client->retransmits++;
+
+        // throw away (hide) UDP/IP/ARP headers from previous transmission
+        err_t e = pbuf_header(call->pbuf,
+                              -UDP_HLEN - IP_HLEN - PBUF_LINK_HLEN);
+        assert(e == ERR_OK);
+
+        e = udp_send(client->pcb, call->pbuf);
+        if (e != ERR_OK) {
+            /* XXX: assume that this is a transient condition, retry */
+            fprintf(stderr, "RPC: retransmit failed! will retry...\n");
+            call->retries--;
+        } else {
+            // exponential backoff, also for the client's estimate, until
+            // a clean RTT sample arrives
+            call->rto *= 2;
+            if (call->rto > RPC_RTO_MAX) {
+                call->rto = RPC_RTO_MAX;
+            }
+            if (client->rto < call->rto) {
+                client->rto = call->rto;
+            }
+        }
+        call_arm_timer(call);
     }
+
     if (lwip_mutex != NULL) {
         thread_mutex_unlock(lwip_mutex);
     }
@@ -340,20 +408,25 @@ static void rpc_timer(void *arg)
  */
 err_t rpc_init(struct rpc_client *client, struct ip_addr server)
 {
-    errval_t err;
     client->pcb = udp_new();
     if (client->pcb == NULL) {
         return ERR_MEM;
     }
 
-    net_debug_state = 0;
-
     client->server = server;
 
-    for (int i = 0; i < RPC_HTABLE_SIZE; ++i) {
-    	client->call_hash[i] = NULL;
+    client->hash_size = RPC_HTABLE_SIZE;
+    client->ncalls = 0;
+    client->call_hash = calloc(client->hash_size, sizeof(struct rpc_call *));
+    if (client->call_hash == NULL) {
+        udp_remove(client->pcb);
+        return ERR_MEM;
     }
 
+    client->srtt = client->rttvar = 0;
+    client->rto = RPC_RTO_INITIAL;
+    client->retransmits = 0;
+
     /* XXX: (very) pseudo-random number for initial XID */
     client->nextxid = (uint32_t)bench_tsc();
 
@@ -361,43 +434,19 @@ err_t rpc_init(struct rpc_client *client, struct ip_addr server)
     		client->nextxid, client->nextxid);
     udp_recv(client->pcb, rpc_recv_handler, client);
 
-    err = periodic_event_create(&client->timer, lwip_waitset,
-                                RPC_TIMER_PERIOD, MKCLOSURE(rpc_timer, client));
-    assert(err_is_ok(err));
-    if (err_is_fail(err)) {
-    	printf("rpc timer creation failed\n");
-        udp_remove(client->pcb);
-        return ERR_MEM;
-    }
-    RPC_DEBUGP("rpc timer created\n");
-
     return ERR_OK;
 }
 
 
 
-/**
- * \brief Initiate an RPC Call
- *
- * \param client RPC client, previously initialised by a call to rpc_init()
- * \param port UDP port on server to call
- * \param prog RPC program number
- * \param vers RPC program version
- * \param proc RPC procedure number
- * \param args_xdrproc XDR serialisation function for arguments to call
- * \param args Argument data to be passed to #args_xdrproc
- * \param args_size Upper bound on size of serialised argument data
- * \param callback Callback function to be invoked when call either completes or fails
- * \param cbarg1,cbarg2 Opaque arguments to be passed to callback function
- *
- * \returns Error code (ERR_OK on success)
- */
-err_t rpc_call(struct rpc_client *client, uint16_t port, uint32_t prog,
-               uint32_t vers, uint32_t proc, xdrproc_t args_xdrproc, void *args,
-               size_t args_size, rpc_callback_t callback, void *cbarg1,
-               void *cbarg2)
+/// Common implementation of rpc_call() and rpc_call_data()
+static err_t rpc_call_common(struct rpc_client *client, uint16_t port,
+                             uint32_t prog, uint32_t vers, uint32_t proc,
+                             xdrproc_t args_xdrproc, void *args,
+                             size_t args_size, struct pbuf *data,
+                             rpc_callback_t callback, void *cbarg1,
+                             void *cbarg2)
 {
-
     uint64_t ts = rdtsc();
     XDR xdr;
     err_t r;
@@ -436,11 +485,14 @@ err_t rpc_call(struct rpc_client *client, uint16_t port, uint32_t prog,
         return ERR_MEM;
     }
     call->xid = xid;
-    call->retries = call->timers = 0;
+    call->retries = 0;
     call->pbuf = (struct pbuf *)xdr.x_private;
     call->callback = callback;
     call->cbarg1 = cbarg1;
     call->cbarg2 = cbarg2;
+    call->client = client;
+    call->rto = client->rto;
+    deferred_event_init(&call->timer);
     call->next = NULL;
 
     RPC_DEBUGP("rpc_call: RPC call for xid %u x0%x\n", xid, xid);
@@ -450,6 +502,23 @@ err_t rpc_call(struct rpc_client *client, uint16_t port, uint32_t prog,
         call->pbuf->tot_len -= ((struct pbuf *)xdr.x_base)->len - xdr.x_handy;
         ((struct pbuf *)xdr.x_base)->len = xdr.x_handy;
     }
+
+    /* append the bulk data by reference, and its XDR padding */
+    if (data != NULL) {
+        size_t padlen = RNDUP(data->tot_len) - data->tot_len;
+        pbuf_chain(call->pbuf, data);
+        if (padlen > 0) {
+            struct pbuf *pad = pbuf_alloc(PBUF_RAW, padlen, PBUF_RAM);
+            if (pad == NULL) {
+                XDR_DESTROY(&xdr);
+                free(call);
+                return ERR_MEM;
+            }
+            memset(pad->payload, 0, padlen);
+            pbuf_cat(call->pbuf, pad);
+        }
+    }
+
     r = udp_connect(client->pcb, &client->server, port);
     if (r != ERR_OK) {
         XDR_DESTROY(&xdr);
@@ -458,39 +527,88 @@ err_t rpc_call(struct rpc_client *client, uint16_t port, uint32_t prog,
     }
 
     /* enqueue */
-    int hid = hash_function(xid);
-    call->next = client->call_hash[hid];
-    client->call_hash[hid] = call;
+    call_insert(client, call);
 
+    call->sent = get_system_time();
     r = udp_send(client->pcb, call->pbuf);
     if (r != ERR_OK) {
         /* dequeue */
-        assert(client->call_hash[hid] == call);
-        client->call_hash[hid] = call->next;
+        struct rpc_call *c = call_remove(client, xid);
+        assert(c == call);
         /* destroy */
         XDR_DESTROY(&xdr);
         free(call);
+    } else {
+        call_arm_timer(call);
     }
 
     lwip_record_event_simple(RPC_CALL_T, ts);
     return r;
 }
 
+/**
+ * \brief Initiate an RPC Call
+ *
+ * \param client RPC client, previously initialised by a call to rpc_init()
+ * \param port UDP port on server to call
+ * \param prog RPC program number
+ * \param vers RPC program version
+ * \param proc RPC procedure number
+ * \param args_xdrproc XDR serialisation function for arguments to call
+ * \param args Argument data to be passed to #args_xdrproc
+ * \param args_size Upper bound on size of serialised argument data
+ * \param callback Callback function to be invoked when call either completes or fails
+ * \param cbarg1,cbarg2 Opaque arguments to be passed to callback function
+ *
+ * \returns Error code (ERR_OK on success)
+ */
+err_t rpc_call(struct rpc_client *client, uint16_t port, uint32_t prog,
+               uint32_t vers, uint32_t proc, xdrproc_t args_xdrproc, void *args,
+               size_t args_size, rpc_callback_t callback, void *cbarg1,
+               void *cbarg2)
+{
+    return rpc_call_common(client, port, prog, vers, proc, args_xdrproc, args,
+                           args_size, NULL, callback, cbarg1, cbarg2);
+}
+
+/**
+ * \brief Initiate an RPC Call whose arguments end in bulk data held in pbufs
+ *
+ * The arguments serialised by #args_xdrproc are followed by the bytes of
+ * #data, which are sent without copying them, and XDR padding. The call
+ * takes its own reference on #data, so the caller may free its reference
+ * when this returns, but must not modify the data until the callback.
+ *
+ * \param data Packet buffers with the data, allocated by pbuf_alloc()
+ *
+ * \see rpc_call() for the other parameters
+ */
+err_t rpc_call_data(struct rpc_client *client, uint16_t port, uint32_t prog,
+                    uint32_t vers, uint32_t proc, xdrproc_t args_xdrproc,
+                    void *args, size_t args_size, struct pbuf *data,
+                    rpc_callback_t callback, void *cbarg1, void *cbarg2)
+{
+    assert(data != NULL);
+    return rpc_call_common(client, port, prog, vers, proc, args_xdrproc, args,
+                           args_size, data, callback, cbarg1, cbarg2);
+}
+
 /// Destroy the given client, freeing any associated memory
 void rpc_destroy(struct rpc_client *client)
 {
-    periodic_event_cancel(&client->timer);
-
     /* go through list of pending requests and free them */
     struct rpc_call *call, *next;
-    for(int i = 0; i < RPC_HTABLE_SIZE; ++i) {
+    for (uint32_t i = 0; i < client->hash_size; ++i) {
         for (call = client->call_hash[i]; call != NULL; call = next) {
+            deferred_event_cancel(&call->timer);
             pbuf_free(call->pbuf);
             next = call->next;
             free(call);
         }
-        client->call_hash[i] = NULL;
     }
+    free(client->call_hash);
+    client->call_hash = NULL;
+    client->ncalls = 0;
 
     udp_remove(client->pcb);
 }
@@ -53,16 +53,24 @@ enum rpc_auth_stat {
     RPC_AUTH_TOOWEAK      = 5   ///< rejected for security reasons
 };
 
-#define RPC_HTABLE_SIZE 128
+#define RPC_HTABLE_SIZE 128     ///< Initial size of the call hash table
+
+struct rpc_call;
 
 /// RPC client instance data
 struct rpc_client {
     struct udp_pcb *pcb;    ///< UDP connection data in LWIP
     struct ip_addr server;  ///< Server IP
-    struct rpc_call *call_hash[RPC_HTABLE_SIZE];
+    struct rpc_call **call_hash;    ///< Outstanding calls, hashed by XID
+    uint32_t hash_size;     ///< Buckets in #call_hash (power of two)
+    uint32_t ncalls;        ///< Outstanding calls
 
     uint32_t nextxid;       ///< Next transaction ID
-    struct periodic_event timer;    ///< Retransmit timer
+
+    int64_t srtt;           ///< Smoothed round trip time (us, scaled by 8)
+    int64_t rttvar;         ///< Round trip time deviation (us, scaled by 4)
+    delayus_t rto;          ///< Retransmit timeout for new calls (us)
+    uint64_t retransmits;   ///< Calls retransmitted so far
 };
 
 /**
@@ -88,5 +96,9 @@ err_t rpc_call(struct rpc_client *client, uint16_t port, uint32_t prog,
                uint32_t vers, uint32_t proc, xdrproc_t args_xdrproc, void *args,
                size_t args_size, rpc_callback_t callback, void *cbarg1,
                void *cbarg2);
+err_t rpc_call_data(struct rpc_client *client, uint16_t port, uint32_t prog,
+                    uint32_t vers, uint32_t proc, xdrproc_t args_xdrproc,
+                    void *args, size_t args_size, struct pbuf *data,
+                    rpc_callback_t callback, void *cbarg1, void *cbarg2);
 
 #endif // _RPC_H
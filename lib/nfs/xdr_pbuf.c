@@ -6,6 +6,10 @@
  *  * x_private points to the first struct pbuf in a pbuf chain
  *  * x_base points to the current struct pbuf in a pbuf chain
  *  * x_handy is the position (offset) _within the current pbuf_
+ *
+ * Received pbuf chains may be split anywhere (e.g. at IP fragment
+ * boundaries), so words and byte strings may span pbufs. Bulk data can be
+ * referenced in place with xdr_pbuf_getview() instead of being copied out.
  */
 
 /*
@@ -19,7 +23,8 @@
 
 #include <lwip/pbuf.h>
 #include <assert.h>
-#include <nfs/xdr.h>
+#include <string.h>
+#include <nfs/nfs.h>
 #include "xdr_pbuf.h"
 
 /* move to the next pbuf in the chain */
@@ -30,7 +35,6 @@ static bool nextbuf(XDR *xdr)
 
     struct pbuf *nextpbuf;
     if ((nextpbuf = ((struct pbuf *)xdr->x_base)->next) != NULL) {
-        assert(nextpbuf->len % BYTES_PER_XDR_UNIT == 0);
         xdr->x_base = nextpbuf;
         xdr->x_handy = 0;
         return true;
@@ -39,7 +43,7 @@ static bool nextbuf(XDR *xdr)
     }
 }
 
-/* make space within the buffer, returns NULL if it won't fit */
+/* make space within the buffer, returns NULL if it isn't contiguous */
 static inline int32_t *make_space(XDR *xdr, size_t size)
 {
     if (((struct pbuf *)xdr->x_base)->len == xdr->x_handy) {
@@ -48,8 +52,6 @@ static inline int32_t *make_space(XDR *xdr, size_t size)
         }
     }
     if (xdr->x_handy + size > ((struct pbuf *)xdr->x_base)->len) {
-        fprintf(stderr, "xdr_pbuf: make_space(%zu) failing (%zu available)\n",
-                size, ((size_t)((struct pbuf *)xdr->x_base)->len) - (size_t)xdr->x_handy);
         return NULL;
     } else {
         int32_t *ret = (int32_t *)((char *)((struct pbuf *)xdr->x_base)->payload + xdr->x_handy);
@@ -58,30 +60,6 @@ static inline int32_t *make_space(XDR *xdr, size_t size)
     }
 }
 
-/* get a word from underlying stream */
-static bool xdr_pbuf_getint32(XDR *xdr, int32_t *ret)
-{
-    int32_t *buf = make_space(xdr, sizeof(int32_t));
-    if (buf) {
-        *ret = ntohl((uint32_t)*buf);
-        return true;
-    } else {
-        return false;
-    }
-}
-
-/* put a word to underlying stream */
-static bool xdr_pbuf_putint32(XDR *xdr, const int32_t *val)
-{
-    int32_t *buf = make_space(xdr, sizeof(int32_t));
-    if (buf) {
-        *buf = htonl((uint32_t)(*val));
-        return true;
-    } else {
-        return false;
-    }
-}
-
 /* common implementation of getbytes and putbytes */
 static bool movebytes(bool copyin, XDR *xdr, char *callerbuf, size_t nbytes)
 {
@@ -109,6 +87,33 @@ static bool movebytes(bool copyin, XDR *xdr, char *callerbuf, size_t nbytes)
     return true;
 }
 
+/* get a word from underlying stream */
+static bool xdr_pbuf_getint32(XDR *xdr, int32_t *ret)
+{
+    uint32_t val;
+    int32_t *buf = make_space(xdr, sizeof(int32_t));
+    if (buf) {
+        memcpy(&val, buf, sizeof(val));
+    } else if (!movebytes(false, xdr, (char *)&val, sizeof(val))) {
+        return false; // end of stream
+    }
+    *ret = ntohl(val);
+    return true;
+}
+
+/* put a word to underlying stream */
+static bool xdr_pbuf_putint32(XDR *xdr, const int32_t *val)
+{
+    uint32_t nval = htonl((uint32_t)(*val));
+    int32_t *buf = make_space(xdr, sizeof(int32_t));
+    if (buf) {
+        memcpy(buf, &nval, sizeof(nval));
+        return true;
+    } else {
+        return movebytes(true, xdr, (char *)&nval, sizeof(nval));
+    }
+}
+
 /* get some bytes from underlying stream */
 static bool xdr_pbuf_getbytes(XDR *xdr, char *retbuf, size_t nbytes)
 {
@@ -150,7 +155,7 @@ static bool xdr_pbuf_setpostn(XDR *xdr, size_t pos)
     }
 }
 
-/* buf quick ptr to buffered data */
+/* buf quick ptr to buffered data, NULL if it spans pbufs */
 static int32_t *xdr_pbuf_inline(XDR *xdr, size_t nbytes)
 {
     assert(nbytes % BYTES_PER_XDR_UNIT == 0);
@@ -210,10 +215,103 @@ bool xdr_pbuf_create_send(XDR *xdr, size_t size)
 void xdr_pbuf_create_recv(XDR *xdr, struct pbuf *pbuf)
 {
     assert(xdr != NULL);
-    assert(pbuf->len % BYTES_PER_XDR_UNIT == 0);
     assert(pbuf->tot_len % BYTES_PER_XDR_UNIT == 0);
     xdr->x_private = xdr->x_base = pbuf;
     xdr->x_op = XDR_DECODE;
     xdr->x_ops = &xdr_pbuf_ops;
     xdr->x_handy = 0;
 }
+
+/**
+ * \brief Reference the next bytes of a received stream instead of copying them
+ *
+ * Takes a reference on the pbuf holding the first byte, which keeps it and
+ * the rest of the chain alive after the XDR is destroyed, and skips the
+ * bytes and their XDR padding.
+ *
+ * \param xdr XDR created by xdr_pbuf_create_recv()
+ * \param pbuf Returns the pbuf holding the first byte (NULL if nbytes is 0)
+ * \param offset Returns the offset of the first byte within #pbuf
+ * \param nbytes Number of bytes to reference
+ *
+ * \returns True on success, false if the stream is too short
+ */
+bool xdr_pbuf_getview(XDR *xdr, struct pbuf **pbuf, uint16_t *offset,
+                      size_t nbytes)
+{
+    assert(xdr->x_op == XDR_DECODE && xdr->x_ops == &xdr_pbuf_ops);
+
+    size_t pos = xdr_pbuf_getpostn(xdr);
+    if (pos + RNDUP(nbytes) > ((struct pbuf *)xdr->x_private)->tot_len) {
+        return false;
+    }
+    if (nbytes == 0) {
+        *pbuf = NULL;
+        *offset = 0;
+        return true;
+    }
+
+    if (xdr->x_handy == ((struct pbuf *)xdr->x_base)->len && !nextbuf(xdr)) {
+        return false;
+    }
+    struct pbuf *first = xdr->x_base;
+    uint16_t first_offset = xdr->x_handy;
+
+    if (!xdr_pbuf_setpostn(xdr, pos + RNDUP(nbytes))) {
+        return false;
+    }
+    pbuf_ref(first);
+    *pbuf = first;
+    *offset = first_offset;
+    return true;
+}
+
+/**
+ * \brief Copy bytes out of a view of received data
+ *
+ * \param view View returned with a reply
+ * \param offset Offset within the viewed data to copy from
+ * \param buf Buffer to copy to
+ * \param len Maximum number of bytes to copy
+ *
+ * \returns Number of bytes copied
+ */
+size_t nfs_data_view_copy(struct nfs_data_view *view, size_t offset,
+                          void *buf, size_t len)
+{
+    struct pbuf *p = view->pbuf;
+    size_t copied = 0;
+
+    if (offset >= view->len) {
+        return 0;
+    }
+    if (len > view->len - offset) {
+        len = view->len - offset;
+    }
+
+    offset += view->offset;
+    for (; p != NULL && offset >= p->len; p = p->next) {
+        offset -= p->len;
+    }
+    for (; p != NULL && copied < len; p = p->next) {
+        size_t n = p->len - offset;
+        if (n > len - copied) {
+            n = len - copied;
+        }
+        memcpy((char *)buf + copied, (char *)p->payload + offset, n);
+        copied += n;
+        offset = 0;
+    }
+    assert(copied == len);
+    return copied;
+}
+
+/// Release the packet buffers referenced by a view of received data
+void nfs_data_view_free(struct nfs_data_view *view)
+{
+    if (view->pbuf != NULL) {
+        pbuf_free(view->pbuf);
+        view->pbuf = NULL;
+    }
+    view->len = 0;
+}
@@ -18,5 +18,7 @@
 struct pbuf;
 bool xdr_pbuf_create_send(XDR *xdr, size_t size);
 void xdr_pbuf_create_recv(XDR *xdr, struct pbuf *pbuf);
+bool xdr_pbuf_getview(XDR *xdr, struct pbuf **pbuf, uint16_t *offset,
+                      size_t nbytes);
 
 #endif
@@ -17,6 +17,7 @@
 #include <string.h>
 #include <barrelfish/barrelfish.h>
 #include <barrelfish/bulk_transfer.h>
+#include <barrelfish/deferred.h>
 #include <procon/procon.h>
 
 
@@ -243,12 +244,14 @@ static void sp_reset_pool(struct shared_pool_private *spp, uint64_t slot_count)
     sp_atomic_set_reg(&sp->read_reg, 0);
     sp_atomic_set_reg(&sp->write_reg, 0);
     sp_atomic_set_reg(&sp->size_reg, slot_count);
+    sp_atomic_set_reg(&sp->poll_reg, 0);
     for(i = 0; i < slot_count; ++i)  {
        memset(&sp->slot_list[i], 0, sizeof(union slot));
     } // end for:
 
     sp_reload_regs(spp);
     spp->notify_other_side = 0;
+    sp_notify_init(&spp->notify, SP_NOTIFY_BATCH, SP_NOTIFY_DELAY_US);
     spp->ghost_read_id = spp->c_read_id;
     spp->ghost_write_id = spp->c_write_id;
     spp->pre_write_id = spp->c_read_id;
@@ -365,6 +368,7 @@ errval_t sp_map_shared_pool(struct shared_pool_private *spp, struct capref cap,
     spp->ghost_write_id = spp->c_write_id;
     spp->pre_write_id = spp->c_read_id;
     spp->notify_other_side = 0;
+    sp_notify_init(&spp->notify, SP_NOTIFY_BATCH, SP_NOTIFY_DELAY_US);
     spp->produce_counter = 0;
     spp->consume_counter = 0;
     spp->clear_counter = 0;
@@ -472,12 +476,8 @@ bool sp_set_read_index(struct shared_pool_private *spp, uint64_t idx)
 
 //    spp->ghost_read_id = spp->c_read_id;
 //    printf("changing read_index!\n");
-    if (sp_queue_empty(spp)) {
-        // There is nothing more to consume,
-        // We should inform producer to produce quickly
-        // Typically means, Producer is slow!
-        ++spp->notify_other_side;
-    }
+    // An empty pool is no reason to wake the producer: it produces when it
+    // has something to produce, and it sees the freed slots whenever it does.
 
     ++spp->consume_counter;
     return true;
@@ -798,6 +798,115 @@ bool sp_replace_slot(struct shared_pool_private *spp, struct slot_data *new_slot
 } // end function: sp_consume_slot
 
 
+// ****************** Notification coalescing **************
+
+void sp_notify_init(struct sp_notify *n, uint64_t batch, uint64_t delay_us)
+{
+    assert(batch > 0);
+    memset(n, 0, sizeof(struct sp_notify));
+    n->batch = batch;
+    n->delay_us = delay_us;
+}
+
+/**
+ * \brief Account for slots produced or consumed, and decide on notifying
+ *
+ * The other side only needs a notification if it may have stopped polling
+ * the pool, which the index updates flag in notify_other_side (empty pool
+ * made non-empty, or full pool made non-full). Otherwise it is told after
+ * spp->notify.batch updates; the caller arms a timer for spp->notify.delay_us
+ * to bound the delay when less traffic follows.
+ *
+ * \return true if the caller has to notify now, and then call
+ *         sp_notify_sent()
+ */
+bool sp_notify_update(struct shared_pool_private *spp, uint64_t count)
+{
+    struct sp_notify *n = &spp->notify;
+
+    n->updates += count;
+    n->pending += count;
+    if (spp->notify_other_side != 0) {
+        spp->notify_other_side = 0;
+        return true;
+    }
+    return n->pending >= n->batch;
+}
+
+void sp_notify_sent(struct shared_pool_private *spp)
+{
+    spp->notify.pending = 0;
+    ++spp->notify.sent;
+}
+
+/**
+ * \brief Account for slots produced, and decide on notifying the consumer
+ *
+ * Like sp_notify_update(), except that no notification is needed at all
+ * while the consumer is polling the pool (see sp_consume_while_active()).
+ */
+bool sp_notify_produced(struct shared_pool_private *spp, uint64_t count)
+{
+    // the write index must be visible before looking at the consumer, as
+    // the consumer clears poll_reg before its last look at the write index
+    __sync_synchronize();
+    if (spp->sp->poll_reg.value != 0) {
+        spp->notify_other_side = 0;
+        spp->notify.updates += count;
+        spp->notify.suppressed += count;
+        spp->notify.pending = 0;
+        return false;
+    }
+    return sp_notify_update(spp, count);
+}
+
+/**
+ * \brief Keep consuming from a pool while its producer is active
+ *
+ * Called by the consumer when a notification arrives. While it polls, the
+ * producer does not send notifications (sp_notify_produced()). consume()
+ * reads whatever the pool holds and returns how many slots it took; it is
+ * called until the pool has stayed empty for SP_POLL_IDLE_US, yielding in
+ * between, or until SP_POLL_BUDGET_US have passed so that other events on
+ * the waitset get their turn. After that the producer notifies again.
+ *
+ * \return number of slots consumed
+ */
+uint64_t sp_consume_while_active(struct shared_pool_private *spp,
+                                 uint64_t (*consume)(void *arg), void *arg)
+{
+    systime_t start = get_system_time();
+    systime_t active = start;
+    uint64_t total = 0;
+
+    sp_atomic_set_reg(&spp->sp->poll_reg, 1);
+    while (true) {
+        uint64_t n = consume(arg);
+        systime_t now = get_system_time();
+
+        total += n;
+        if (n > 0) {
+            active = now;
+        } else if (now - active >= SP_POLL_IDLE_US ||
+                   now - start >= SP_POLL_BUDGET_US) {
+            sp_atomic_set_reg(&spp->sp->poll_reg, 0);
+            __sync_synchronize();
+            // a slot produced while poll_reg was set was not notified
+            n = consume(arg);
+            total += n;
+            if (n == 0 || now - start >= SP_POLL_BUDGET_US) {
+                break;
+            }
+            active = get_system_time();
+            sp_atomic_set_reg(&spp->sp->poll_reg, 1);
+        } else {
+            thread_yield();
+        }
+    }
+    return total;
+}
+
+
 // ****************** For debugging purposes **************
 void sp_print_metadata(struct shared_pool_private *spp)
 {
@@ -19,6 +19,12 @@ errval_t spawn_arch_load(struct spawninfo *si,
                          lvaddr_t binary, size_t binary_size,
                          genvaddr_t *entry, void** arch_load_info);
 
+errval_t spawn_arch_read_image(spawn_read_fn read, void *state,
+                               struct spawn_image *image);
+
+errval_t spawn_arch_load_file(struct spawninfo *si, spawn_read_fn read,
+                              void *state, struct spawn_image *image);
+
 void spawn_arch_set_registers(void *arch_load_info,
                               dispatcher_handle_t handle,
                               arch_registers_state_t *enabled_area,
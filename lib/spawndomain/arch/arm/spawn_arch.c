@@ -12,6 +12,7 @@
  * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -180,21 +181,18 @@ static errval_t elf_allocate(void *state, genvaddr_t base, size_t size,
 } // end function: elf_allocate
 
 /**
- * \brief Load the elf image
+ * \brief Create the CNode elf_allocate() puts the segment frames in
  */
-errval_t spawn_arch_load(struct spawninfo *si,
-                         lvaddr_t binary, size_t binary_size,
-                         genvaddr_t *entry, void** arch_info)
+static errval_t create_segcn(struct spawninfo *si)
 {
-    errval_t err;
-
     // Reset the elfloader_slot
     si->elfload_slot = 0;
     struct capref cnode_cap = {
         .cnode = si->rootcn,
         .slot  = ROOTCN_SLOT_SEGCN,
     };
-    err = cnode_create_raw(cnode_cap, &si->segcn, DEFAULT_CNODE_SLOTS, NULL);
+    errval_t err = cnode_create_raw(cnode_cap, &si->segcn, DEFAULT_CNODE_SLOTS,
+                                    NULL);
     if (err_is_fail(err)) {
         return err_push(err, SPAWN_ERR_CREATE_SEGCN);
     }
@@ -203,6 +201,23 @@ errval_t spawn_arch_load(struct spawninfo *si,
     si->tls_init_base = 0;
     si->tls_init_len = si->tls_total_len = 0;
 
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Load the elf image
+ */
+errval_t spawn_arch_load(struct spawninfo *si,
+                         lvaddr_t binary, size_t binary_size,
+                         genvaddr_t *entry, void** arch_info)
+{
+    errval_t err;
+
+    err = create_segcn(si);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
     //debug_printf("spawn_arch_load: about to load elf %p\n", elf_allocate);
     // Load the binary
     err = elf_load(EM_HOST, elf_allocate, si, binary, binary_size, entry);
@@ -224,6 +239,266 @@ errval_t spawn_arch_load(struct spawninfo *si,
     return SYS_ERR_OK;
 }
 
+/// Read all \p size bytes at \p pos of the image
+static errval_t read_all(spawn_read_fn read, void *state, size_t pos,
+                         size_t size, void *buf)
+{
+    size_t got;
+    errval_t err = read(state, pos, size, buf, &got);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    return (got == size) ? SYS_ERR_OK : ELF_ERR_FILESZ;
+}
+
+static errval_t read_segments(spawn_read_fn read, void *state,
+                              struct Elf32_Ehdr *head,
+                              struct spawn_image *image)
+{
+    if (head->e_phentsize != sizeof(struct Elf32_Phdr) || head->e_phnum == 0) {
+        return ELF_ERR_PROGHDR;
+    }
+
+    size_t size = head->e_phnum * sizeof(struct Elf32_Phdr);
+    struct Elf32_Phdr *phead = malloc(size);
+    if (phead == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    errval_t err = read_all(read, state, head->e_phoff, size, phead);
+    for (int i = 0; err_is_ok(err) && i < head->e_phnum; i++) {
+        struct Elf32_Phdr *p = &phead[i];
+        if (p->p_type != PT_LOAD) {
+            continue;
+        }
+        if (image->nsegments == SPAWN_IMAGE_SEGMENTS
+            || p->p_filesz > p->p_memsz) {
+            err = ELF_ERR_PROGHDR;
+            break;
+        }
+
+        struct spawn_segment *seg = &image->segments[image->nsegments++];
+        seg->vaddr = p->p_vaddr;
+        seg->offset = p->p_offset;
+        seg->filesz = p->p_filesz;
+        seg->memsz = p->p_memsz;
+        seg->flags = p->p_flags;
+        seg->nframes = 0;
+    }
+
+    free(phead);
+    return err;
+}
+
+/// Look up the address of .got in the section headers
+static errval_t read_got(spawn_read_fn read, void *state,
+                         struct Elf32_Ehdr *head, genvaddr_t *ret)
+{
+    if (head->e_shentsize != sizeof(struct Elf32_Shdr)
+        || head->e_shstrndx >= head->e_shnum) {
+        return SPAWN_ERR_LOAD;
+    }
+
+    size_t size = head->e_shnum * sizeof(struct Elf32_Shdr);
+    struct Elf32_Shdr *shead = malloc(size);
+    if (shead == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    char *names = NULL;
+
+    errval_t err = read_all(read, state, head->e_shoff, size, shead);
+    if (err_is_fail(err)) {
+        goto out;
+    }
+
+    struct Elf32_Shdr *strtab = &shead[head->e_shstrndx];
+    names = malloc(strtab->sh_size + 1);
+    if (names == NULL) {
+        err = LIB_ERR_MALLOC_FAIL;
+        goto out;
+    }
+    err = read_all(read, state, strtab->sh_offset, strtab->sh_size, names);
+    if (err_is_fail(err)) {
+        goto out;
+    }
+    names[strtab->sh_size] = '\0';
+
+    err = SPAWN_ERR_LOAD;
+    for (int i = 0; i < head->e_shnum; i++) {
+        if (shead[i].sh_name < strtab->sh_size
+            && strcmp(names + shead[i].sh_name, ".got") == 0) {
+            *ret = shead[i].sh_addr;
+            err = SYS_ERR_OK;
+            break;
+        }
+    }
+
+out:
+    free(names);
+    free(shead);
+    return err;
+}
+
+/**
+ * \brief Read the headers of an elf image into \p image
+ */
+errval_t spawn_arch_read_image(spawn_read_fn read, void *state,
+                               struct spawn_image *image)
+{
+    struct Elf32_Ehdr head;
+    errval_t err = read_all(read, state, 0, sizeof(head), &head);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (!IS_ELF(head)
+        || head.e_ident[EI_CLASS] != ELFCLASS32
+        || head.e_ident[EI_DATA] != ELFDATA2LSB
+        || head.e_ident[EI_VERSION] != EV_CURRENT
+        || (head.e_type != ET_EXEC && head.e_type != ET_DYN)
+        || head.e_machine != EM_HOST
+        || head.e_version != EV_CURRENT) {
+        return ELF_ERR_HEADER;
+    }
+
+    err = read_segments(read, state, &head, image);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    genvaddr_t got;
+    err = read_got(read, state, &head, &got);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    image->cpu_type = CPU_ARM;
+    image->entry = head.e_entry;
+    image->arch_info = (void *)(uintptr_t)got;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Map the frames \p seg was loaded into before into the new domain
+ */
+static errval_t share_segment(struct spawninfo *si, struct spawn_segment *seg)
+{
+    lvaddr_t vaddr = seg->vaddr - BASE_PAGE_OFFSET(seg->vaddr);
+
+    for (size_t i = 0; i < seg->nframes; i++) {
+        struct capref frame = {
+            .cnode = si->segcn,
+            .slot  = si->elfload_slot++,
+        };
+        errval_t err = cap_copy(frame, seg->frames[i]);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_CAP_COPY);
+        }
+
+        struct frame_identity id;
+        err = invoke_frame_identify(frame, &id);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_FRAME_IDENTIFY);
+        }
+
+        err = paging_map_fixed_attr(si->vspace, vaddr, frame, 1UL << id.bits,
+                                    elf_to_vregion_flags(seg->flags));
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_VSPACE_MAP);
+        }
+        vaddr += 1UL << id.bits;
+    }
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Keep the frames a read-only segment was just loaded into
+ *
+ * elf_allocate() put them into the slots from \p first on, followed by
+ * the copies mapped into the new domain.
+ */
+static void keep_segment(struct spawninfo *si, struct spawn_segment *seg,
+                         cslot_t first)
+{
+    size_t nframes = (si->elfload_slot - first) / 2;
+    if (nframes > SPAWN_IMAGE_FRAMES) {
+        return;
+    }
+
+    for (seg->nframes = 0; seg->nframes < nframes; seg->nframes++) {
+        struct capref frame = {
+            .cnode = si->segcn,
+            .slot  = first + seg->nframes,
+        };
+        struct capref *copy = &seg->frames[seg->nframes];
+
+        errval_t err = slot_alloc(copy);
+        if (err_is_ok(err)) {
+            err = cap_copy(*copy, frame);
+            if (err_is_fail(err)) {
+                slot_free(*copy);
+            }
+        }
+        if (err_is_fail(err)) {
+            // the segment is read again next time
+            DEBUG_ERR(err, "could not keep segment frame");
+            while (seg->nframes > 0) {
+                cap_destroy(seg->frames[--seg->nframes]);
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * \brief Load the segments of \p image into a new domain
+ *
+ * Segments are read into the frames of the new domain as they are mapped
+ * into spawnd, without a copy of the whole image. The image runs at its
+ * link address, so the relocations elf_load() goes through would not
+ * change anything and are not read.
+ */
+errval_t spawn_arch_load_file(struct spawninfo *si, spawn_read_fn read,
+                              void *state, struct spawn_image *image)
+{
+    errval_t err = create_segcn(si);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    for (size_t i = 0; i < image->nsegments; i++) {
+        struct spawn_segment *seg = &image->segments[i];
+
+        if (seg->nframes > 0) {
+            err = share_segment(si, seg);
+            if (err_is_fail(err)) {
+                return err_push(err, ELF_ERR_ALLOCATE);
+            }
+            continue;
+        }
+
+        cslot_t first = si->elfload_slot;
+        void *dest = NULL;
+        err = elf_allocate(si, seg->vaddr, seg->memsz, seg->flags, &dest);
+        if (err_is_fail(err)) {
+            return err_push(err, ELF_ERR_ALLOCATE);
+        }
+
+        err = read_all(read, state, seg->offset, seg->filesz, dest);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        memset((char *)dest + seg->filesz, 0, seg->memsz - seg->filesz);
+
+        if (!(seg->flags & PF_W)) {
+            keep_segment(si, seg, first);
+        }
+    }
+
+    return SYS_ERR_OK;
+}
+
 void spawn_arch_set_registers(void *arch_load_info,
                               dispatcher_handle_t handle,
                               arch_registers_state_t *enabled_area,
@@ -205,6 +205,21 @@ errval_t spawn_arch_load(struct spawninfo *si,
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief Loading from a file is only done on ARM so far
+ */
+errval_t spawn_arch_read_image(spawn_read_fn read, void *state,
+                               struct spawn_image *image)
+{
+    return LIB_ERR_NOT_IMPLEMENTED;
+}
+
+errval_t spawn_arch_load_file(struct spawninfo *si, spawn_read_fn read,
+                              void *state, struct spawn_image *image)
+{
+    return LIB_ERR_NOT_IMPLEMENTED;
+}
+
 void spawn_arch_set_registers(void *arch_load_info,
                               dispatcher_handle_t handle,
                               arch_registers_state_t *enabled_area,
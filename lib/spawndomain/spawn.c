@@ -720,6 +720,126 @@ errval_t spawn_load_with_args(struct spawninfo *si, struct mem_region *module,
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief Read the headers of the image \p read returns into \p image
+ *
+ * Only the ELF, program and section headers are read, the segments are
+ * left to spawn_load_with_file().
+ */
+errval_t spawn_read_image(spawn_read_fn read, void *state,
+                          struct spawn_image *image)
+{
+    memset(image, 0, sizeof(*image));
+    errval_t err = spawn_arch_read_image(read, state, image);
+    if (err_is_fail(err)) {
+        return err_push(err, SPAWN_ERR_ELF_MAP);
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Whether \p a and \p b have the same layout
+ *
+ * Only compares the headers: the frames kept in \p a can be used for \p b
+ * if both were also read from the same version of the file, which the
+ * caller has to know.
+ */
+bool spawn_image_same(struct spawn_image *a, struct spawn_image *b)
+{
+    if (a->cpu_type != b->cpu_type || a->entry != b->entry
+        || a->arch_info != b->arch_info || a->nsegments != b->nsegments) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a->nsegments; i++) {
+        struct spawn_segment *sa = &a->segments[i], *sb = &b->segments[i];
+        if (sa->vaddr != sb->vaddr || sa->offset != sb->offset
+            || sa->filesz != sb->filesz || sa->memsz != sb->memsz
+            || sa->flags != sb->flags) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Drop the frames kept in \p image
+ *
+ * Domains spawned from it keep theirs.
+ */
+void spawn_image_free(struct spawn_image *image)
+{
+    for (size_t i = 0; i < image->nsegments; i++) {
+        struct spawn_segment *seg = &image->segments[i];
+        for (size_t j = 0; j < seg->nframes; j++) {
+            errval_t err = cap_destroy(seg->frames[j]);
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "could not drop image frame");
+            }
+        }
+        seg->nframes = 0;
+    }
+}
+
+/**
+ * \brief Spawn a domain from an image that is read with \p read
+ *
+ * The segments are read straight into the frames of the new domain, the
+ * image is never held in memory as a whole. Read-only segments keep their
+ * frames in \p image, spawning from it again maps those instead of reading
+ * the segments. \p image may come from spawn_read_image() or be zeroed, in
+ * which case its headers are read first.
+ */
+errval_t spawn_load_with_file(struct spawninfo *si, spawn_read_fn read,
+                              void *state, struct spawn_image *image,
+                              const char *name, coreid_t coreid,
+                              char *const argv[], char *const envp[])
+{
+    errval_t err;
+
+    if (image->nsegments == 0) {
+        err = spawn_read_image(read, state, image);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    si->cpu_type = image->cpu_type;
+
+    /* Initialize cspace */
+    err = spawn_setup_cspace(si);
+    if (err_is_fail(err)) {
+        return err_push(err, SPAWN_ERR_SETUP_CSPACE);
+    }
+
+    /* Initialize vspace */
+    err = spawn_setup_vspace(si);
+    if (err_is_fail(err)) {
+        return err_push(err, SPAWN_ERR_VSPACE_INIT);
+    }
+
+    /* Load the image */
+    err = spawn_arch_load_file(si, read, state, image);
+    if (err_is_fail(err)) {
+        return err_push(err, SPAWN_ERR_LOAD);
+    }
+
+    /* Setup dispatcher frame */
+    err = spawn_setup_dispatcher(si, coreid, name, image->entry,
+                                 image->arch_info);
+    if (err_is_fail(err)) {
+        return err_push(err, SPAWN_ERR_SETUP_DISPATCHER);
+    }
+
+    /* Setup cmdline args */
+    err = spawn_setup_env(si, argv, envp);
+    if (err_is_fail(err)) {
+        return err_push(err, SPAWN_ERR_SETUP_ENV);
+    }
+
+    return SYS_ERR_OK;
+}
+
 /**
  * \brief Spawn a domain and give it the bootinfo struct.
  * Just monitor and memserv should be spawned using this.
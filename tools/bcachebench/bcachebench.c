@@ -0,0 +1,477 @@
+/**
+ * \file
+ * \brief Host test and benchmark of the mmchs block cache and elevator
+ *
+ * Runs usr/mmchs_driver/blockcache.c and elevator.c unchanged on top of a
+ * RAM disk. Clients are coroutines on a run queue that behaves like THC's:
+ * suspend, schedule and yield as in the ata_rw28 service, with the
+ * elevator's dispatcher in a coroutine of its own.
+ *
+ * The test checks reads and writes, aligned or not, against a reference
+ * image, with concurrent clients, with a cache smaller than the working
+ * set, through a flush, in the synchronous mode without a scheduler, and
+ * after an injected transfer error.
+ *
+ * The benchmark replays a FAT-like mix per client: single-sector FAT
+ * reads and 4KB directory reads of a small hot region, 32KB sequential
+ * file reads and small writes. It runs once with every request going to
+ * the card as it comes (what the service did) and once through the cache,
+ * for 1, 4 and 16 clients. Card time is modelled as 100us per command plus
+ * 25us per sector.
+ *
+ * Build and run on the host, in a build directory:
+ *
+ *   make tools/bin/bcachebench
+ *   tools/bin/bcachebench
+ *
+ * Output is one line per test and per benchmark run:
+ *   test=<name> ok
+ *   mode=<direct|cached> clients=<n> commands=<n> sectors=<n> card_ms=<n>
+ *   hits=<n> misses=<n> depth_avg=<n.n>
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "../../usr/mmchs_driver/blockcache.h"
+
+#define DISK_SECTORS    (128 * 1024)            // 64MB
+#define MAX_SECTORS     128                     // MMCHS_MAX_BLOCKS
+#define STACK_SIZE      (256 * 1024)
+
+#define FAT_START       32
+#define FAT_SECTORS     256
+#define DIR_START       (FAT_START + FAT_SECTORS)
+#define DIR_SECTORS     256
+#define DATA_START      (DIR_START + DIR_SECTORS)
+
+#define FILE_START      (DATA_START + 16384)
+#define FILE_SECTORS    4096                    // 2MB per client
+
+#define CMD_US          100
+#define SECTOR_US       25
+
+//
+// RAM disk
+//
+
+static uint8_t *disk, *image;
+static uint64_t disk_commands, disk_sectors;
+static int fail_next;
+
+static errval_t disk_transfer(void *st, bool write, uint32_t lba,
+                              uint32_t count, void *buf)
+{
+    (void)st;
+    assert(count > 0 && count <= MAX_SECTORS);
+    assert(lba + count <= DISK_SECTORS);
+
+    disk_commands++;
+    disk_sectors += count;
+    if (fail_next > 0) {
+        fail_next--;
+        return MMC_ERR_TRANSFER;
+    }
+
+    uint8_t *p = disk + (size_t)lba * BLK_SECTOR_SIZE;
+    if (write) {
+        memcpy(p, buf, count * BLK_SECTOR_SIZE);
+    } else {
+        memcpy(buf, p, count * BLK_SECTOR_SIZE);
+    }
+    return SYS_ERR_OK;
+}
+
+//
+// Run queue with THC's suspend, schedule and yield
+//
+
+struct task {
+    ucontext_t ctx;
+    void (*fn)(void *);
+    void *arg;
+    bool done;
+    struct task *next;
+    char *stack;
+};
+
+static ucontext_t sched_ctx;
+static struct task *current;
+static struct task *runq, **runq_tail = &runq;
+
+static void runq_push(struct task *t)
+{
+    t->next = NULL;
+    *runq_tail = t;
+    runq_tail = &t->next;
+}
+
+static void task_main(void)
+{
+    current->fn(current->arg);
+    current->done = true;
+    swapcontext(&current->ctx, &sched_ctx);
+}
+
+static struct task *task_start(void (*fn)(void *), void *arg)
+{
+    struct task *t = calloc(1, sizeof(*t));
+    assert(t != NULL);
+    t->stack = malloc(STACK_SIZE);
+    assert(t->stack != NULL);
+    t->fn = fn;
+    t->arg = arg;
+
+    getcontext(&t->ctx);
+    t->ctx.uc_stack.ss_sp = t->stack;
+    t->ctx.uc_stack.ss_size = STACK_SIZE;
+    t->ctx.uc_link = NULL;
+    makecontext(&t->ctx, task_main, 0);
+    runq_push(t);
+    return t;
+}
+
+/// Run until nothing is runnable
+static void run(void)
+{
+    while (runq != NULL) {
+        current = runq;
+        runq = current->next;
+        if (runq == NULL) {
+            runq_tail = &runq;
+        }
+        swapcontext(&sched_ctx, &current->ctx);
+    }
+    current = NULL;
+}
+
+static void co_suspend(void **waiter)
+{
+    *waiter = current;
+    swapcontext(&current->ctx, &sched_ctx);
+}
+
+static void co_resume(void *waiter)
+{
+    runq_push(waiter);
+}
+
+static void co_yield(void)
+{
+    struct task *t = current;
+    runq_push(t);
+    swapcontext(&t->ctx, &sched_ctx);
+}
+
+static const struct blk_sched co_sched = {
+    .suspend = co_suspend,
+    .resume = co_resume,
+    .yield = co_yield,
+};
+
+//
+// Cache set-up and checks
+//
+
+static struct elevator elv;
+static struct bcache bc;
+static struct task *dispatcher;
+
+static void dispatcher_main(void *arg)
+{
+    (void)arg;
+    elevator_run(&elv);
+}
+
+static void setup(size_t blocks, bool sched)
+{
+    errval_t err = elevator_init(&elv, disk_transfer, NULL, MAX_SECTORS,
+                                 sched ? &co_sched : NULL);
+    assert(err_is_ok(err));
+    err = bcache_init(&bc, &elv, blocks);
+    assert(err_is_ok(err));
+
+    if (sched) {
+        dispatcher = task_start(dispatcher_main, NULL);
+        run();      // idle in elevator_run()
+    }
+}
+
+static void teardown(void)
+{
+    // the dispatcher is suspended for good, drop it
+    if (elv.sched != NULL) {
+        free(dispatcher->stack);
+        free(dispatcher);
+    }
+    free(elv.staging);
+    free(bc.entries);
+    free(bc.hash);
+    free(bc.data);
+}
+
+static void reset_disk(void)
+{
+    for (size_t i = 0; i < (size_t)DISK_SECTORS * BLK_SECTOR_SIZE; i++) {
+        disk[i] = (uint8_t)(i * 2654435761u >> 13);
+    }
+    memcpy(image, disk, (size_t)DISK_SECTORS * BLK_SECTOR_SIZE);
+    disk_commands = disk_sectors = 0;
+}
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+static uint32_t rnd_state;
+
+static uint32_t rnd(void)
+{
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return rnd_state >> 8;
+}
+
+static void check_read(uint32_t lba, uint32_t count)
+{
+    uint8_t *buf = malloc(count * BLK_SECTOR_SIZE);
+    errval_t err = bcache_read(&bc, lba, count, buf);
+    CHECK(err_is_ok(err));
+    CHECK(memcmp(buf, image + (size_t)lba * BLK_SECTOR_SIZE,
+                 count * BLK_SECTOR_SIZE) == 0);
+    free(buf);
+}
+
+static void check_write(uint32_t lba, uint32_t count)
+{
+    uint8_t *buf = malloc(count * BLK_SECTOR_SIZE);
+    for (size_t i = 0; i < count * BLK_SECTOR_SIZE; i++) {
+        buf[i] = rnd();
+    }
+    errval_t err = bcache_write(&bc, lba, count, buf);
+    CHECK(err_is_ok(err));
+    memcpy(image + (size_t)lba * BLK_SECTOR_SIZE, buf, count * BLK_SECTOR_SIZE);
+    free(buf);
+}
+
+static void check_disk(void)
+{
+    CHECK(memcmp(disk, image, (size_t)DISK_SECTORS * BLK_SECTOR_SIZE) == 0);
+}
+
+/// Random reads and writes in [base, base + span)
+static void random_ops(uint32_t base, uint32_t span, int ops)
+{
+    for (int i = 0; i < ops; i++) {
+        uint32_t count = 1 + rnd() % 300;
+        uint32_t lba = base + rnd() % (span - count);
+        if (rnd() % 3 == 0) {
+            check_write(lba, count);
+        } else {
+            check_read(lba, count);
+        }
+    }
+}
+
+#define SHARED_START    60000
+
+/// Writes its own region, reads that and one all clients read
+static void client_random(void *arg)
+{
+    uint32_t base = (uintptr_t)arg * 4096;
+
+    for (int i = 0; i < 50; i++) {
+        random_ops(base, 4096, 4);
+        check_read(SHARED_START + rnd() % 64, 1 + rnd() % 64);
+    }
+}
+
+static void flush_task(void *arg)
+{
+    (void)arg;
+    CHECK(err_is_ok(bcache_flush(&bc)));
+}
+
+static void test_sync(void)
+{
+    reset_disk();
+    setup(64, false);
+
+    rnd_state = 1;
+    random_ops(0, 4096, 500);
+    CHECK(err_is_ok(bcache_flush(&bc)));
+    check_disk();
+
+    // a 64KB read of cold blocks is one command
+    uint64_t before = disk_commands;
+    check_read(8192, 128);
+    CHECK(disk_commands == before + 1);
+    CHECK(elv.stats.merged >= 15);
+
+    teardown();
+    printf("test=sync ok\n");
+}
+
+static void test_concurrent(void)
+{
+    reset_disk();
+    setup(32, true);
+
+    rnd_state = 2;
+    for (uintptr_t i = 0; i < 8; i++) {
+        task_start(client_random, (void *)i);
+    }
+    run();
+
+    CHECK(bc.stats.busy_waits > 0);
+    CHECK(elv.stats.depth_max > 1);
+
+    struct task *t = task_start(flush_task, NULL);
+    run();
+    CHECK(t->done);
+    check_disk();
+
+    teardown();
+    printf("test=concurrent ok\n");
+}
+
+static void test_error(void)
+{
+    reset_disk();
+    setup(64, false);
+
+    uint8_t buf[16 * BLK_SECTOR_SIZE];
+    fail_next = 1;
+    CHECK(err_is_fail(bcache_read(&bc, 100, 16, buf)));
+    check_read(100, 16);
+
+    check_write(200, 3);
+    fail_next = 1;
+    CHECK(err_is_fail(bcache_flush(&bc)));
+    CHECK(err_is_ok(bcache_flush(&bc)));
+    check_disk();
+
+    teardown();
+    printf("test=error ok\n");
+}
+
+//
+// Benchmark
+//
+
+#define BENCH_REQUESTS  2000
+
+struct client {
+    int id;
+    bool cached;
+    uint32_t pos;           ///< Next sector of its file to read
+    uint8_t buf[64 * BLK_SECTOR_SIZE];
+};
+
+static void bench_request(struct client *c, bool write, uint32_t lba,
+                          uint32_t count)
+{
+    errval_t err;
+    if (!c->cached) {
+        // as the service did: each request goes to the card as it comes
+        err = disk_transfer(NULL, write, lba, count, c->buf);
+    } else if (write) {
+        err = bcache_write(&bc, lba, count, c->buf);
+    } else {
+        err = bcache_read(&bc, lba, count, c->buf);
+    }
+    CHECK(err_is_ok(err));
+}
+
+static void bench_client(void *arg)
+{
+    struct client *c = arg;
+    uint32_t seed = c->id * 7919 + 1;
+
+    for (int i = 0; i < BENCH_REQUESTS; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = seed >> 8;
+        int kind = r % 10;
+
+        if (kind < 4) {
+            bench_request(c, false, FAT_START + (r >> 4) % FAT_SECTORS, 1);
+        } else if (kind < 5) {
+            bench_request(c, false, DIR_START + (r >> 4) % (DIR_SECTORS / 8) * 8,
+                          8);
+        } else if (kind < 9) {
+            bench_request(c, false, FILE_START + c->id * FILE_SECTORS + c->pos,
+                          64);
+            c->pos = (c->pos + 64) % FILE_SECTORS;
+        } else {
+            uint32_t count = 1 + (r >> 4) % 8;
+            bench_request(c, true, DATA_START + (r >> 8) % 8192, count);
+        }
+
+        // the next message of this client arrives after the others'
+        if (elv.sched != NULL) {
+            co_yield();
+        }
+    }
+}
+
+static void bench(bool cached, int nclients)
+{
+    reset_disk();
+    setup(BCACHE_DEFAULT_BLOCKS, true);
+
+    struct client *clients = calloc(nclients, sizeof(struct client));
+    for (int i = 0; i < nclients; i++) {
+        clients[i].id = i;
+        clients[i].cached = cached;
+        task_start(bench_client, &clients[i]);
+    }
+    run();
+
+    if (cached) {
+        task_start(flush_task, NULL);
+        run();
+    }
+
+    uint64_t card_us = disk_commands * CMD_US + disk_sectors * SECTOR_US;
+    uint64_t transfers = elv.stats.transfers ? elv.stats.transfers : 1;
+    printf("mode=%s clients=%d commands=%" PRIu64 " sectors=%" PRIu64
+           " card_ms=%" PRIu64 " hits=%" PRIu64 " misses=%" PRIu64
+           " depth_avg=%" PRIu64 ".%" PRIu64 "\n",
+           cached ? "cached" : "direct", nclients, disk_commands,
+           disk_sectors, card_us / 1000, bc.stats.hits, bc.stats.misses,
+           elv.stats.depth_sum / transfers,
+           elv.stats.depth_sum * 10 / transfers % 10);
+
+    free(clients);
+    teardown();
+}
+
+int main(void)
+{
+    disk = malloc((size_t)DISK_SECTORS * BLK_SECTOR_SIZE);
+    image = malloc((size_t)DISK_SECTORS * BLK_SECTOR_SIZE);
+    assert(disk != NULL && image != NULL);
+
+    test_sync();
+    test_concurrent();
+    test_error();
+
+    int nclients[] = { 1, 4, 16 };
+    for (int i = 0; i < 3; i++) {
+        bench(false, nclients[i]);
+        bench(true, nclients[i]);
+    }
+    return 0;
+}
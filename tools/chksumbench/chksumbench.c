@@ -0,0 +1,339 @@
+/**
+ * \file
+ * \brief Host cross-check and benchmark for the lwIP Internet checksum
+ *
+ * Checks inet_chksum(), inet_chksum_pbuf(), inet_chksum_pseudo[_partial](),
+ * lwip_chksum_copy() and the incremental update helpers against a plain
+ * byte-wise RFC 1071 sum, over all start alignments, odd and even lengths
+ * and pbuf chains split at odd offsets. It also replays the way tcp_enqueue()
+ * and tcp_output_segment() combine a checksum taken on copy with the header
+ * sum. On x86 hosts this exercises the SSE2 variant of the wide checksum;
+ * build with -mno-sse2 (32-bit) or -DLWIP_CHKSUM_ALGORITHM=3 to compare the
+ * other variants.
+ *
+ * Build and run on the host, in a build directory:
+ *
+ *   make tools/bin/chksumbench
+ *   tools/bin/chksumbench
+ *
+ * Output is one line per buffer size:
+ *   len=<bytes> ref_mbs=<MB/s> chksum_mbs=<MB/s> copy_then_chksum_mbs=<MB/s>
+ *   chksum_copy_mbs=<MB/s>
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <lwip/inet_chksum.h>
+
+#define BUF_LEN         (65536 + 64)
+#define MAX_CHAIN       6
+#define MIN_RUN_NS      200000000ULL    // measure each variant for >= 200ms
+#define PROTO_TCP       6
+
+static uint8_t *src, *dst;
+static int failures;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/// Byte-wise one's complement sum in network order, not folded
+static uint32_t ref_sum(const uint8_t *p, int len, uint32_t acc)
+{
+    for (int i = 0; i + 1 < len; i += 2) {
+        acc += (p[i] << 8) | p[i + 1];
+    }
+    if (len & 1) {
+        acc += p[len - 1] << 8;
+    }
+    return acc;
+}
+
+/// Checksum as stored in a header, from a network order sum
+static uint16_t ref_final(uint32_t acc)
+{
+    while (acc >> 16) {
+        acc = (acc >> 16) + (acc & 0xffff);
+    }
+    return htons((uint16_t)~acc);
+}
+
+static uint32_t ref_pseudo(struct ip_addr *s, struct ip_addr *d, uint8_t proto,
+                           uint16_t len)
+{
+    uint8_t ph[12];
+
+    memcpy(ph, &s->addr, 4);
+    memcpy(ph + 4, &d->addr, 4);
+    ph[8] = 0;
+    ph[9] = proto;
+    ph[10] = len >> 8;
+    ph[11] = len;
+    return ref_sum(ph, sizeof(ph), 0);
+}
+
+/// Two checksums are equal if they agree in one's complement arithmetic
+static int same(uint16_t a, uint16_t b)
+{
+    return a == b || ((a == 0 || a == 0xffff) && (b == 0 || b == 0xffff));
+}
+
+static void check(int ok, const char *what, int a, int b)
+{
+    if (!ok && failures++ < 20) {
+        fprintf(stderr, "FAIL %s (%d, %d)\n", what, a, b);
+    }
+}
+
+static void check_flat(void)
+{
+    for (int off = 0; off < 8; off++) {
+        for (int len = 0; len <= 1600; len++) {
+            check(same(inet_chksum(src + off, len),
+                       ref_final(ref_sum(src + off, len, 0))),
+                  "inet_chksum", off, len);
+        }
+        int len = 65535;
+        check(same(inet_chksum(src + off, len),
+                   ref_final(ref_sum(src + off, len, 0))),
+              "inet_chksum 64k", off, len);
+    }
+}
+
+static void check_copy(void)
+{
+    for (int soff = 0; soff < 4; soff++) {
+        for (int doff = 0; doff < 4; doff++) {
+            for (int len = 0; len <= 1600; len += (len < 100) ? 1 : 37) {
+                memset(dst, 0xa5, len + 16);
+                uint16_t sum = lwip_chksum_copy(dst + doff, src + soff, len);
+                check(same(~sum, inet_chksum(src + soff, len)),
+                      "lwip_chksum_copy sum", soff * 4 + doff, len);
+                check(memcmp(dst + doff, src + soff, len) == 0,
+                      "lwip_chksum_copy data", soff * 4 + doff, len);
+                check(dst[doff + len] == 0xa5 && (doff == 0
+                                                  || dst[doff - 1] == 0xa5),
+                      "lwip_chksum_copy bounds", soff * 4 + doff, len);
+            }
+        }
+    }
+}
+
+/// Split len bytes at data into a chain of n pbufs of random lengths
+static struct pbuf *make_chain(struct pbuf *bufs, int n, uint8_t *data,
+                               int len)
+{
+    int left = len;
+
+    for (int i = 0; i < n; i++) {
+        int l = (i == n - 1) ? left : rand() % (left + 1);
+        bufs[i].payload = data;
+        bufs[i].len = l;
+        bufs[i].tot_len = left;
+        bufs[i].next = (i == n - 1) ? NULL : &bufs[i + 1];
+        data += l;
+        left -= l;
+    }
+    return &bufs[0];
+}
+
+static void check_chains(void)
+{
+    struct pbuf bufs[MAX_CHAIN];
+    struct ip_addr s = { .addr = htonl(0x0a000002) };
+    struct ip_addr d = { .addr = htonl(0x0a000001) };
+
+    srand(7);
+    for (int iter = 0; iter < 20000; iter++) {
+        int off = rand() % 4;
+        int len = rand() % 3000;
+        int n = 1 + rand() % MAX_CHAIN;
+        struct pbuf *p = make_chain(bufs, n, src + off, len);
+
+        check(same(inet_chksum_pbuf(p), ref_final(ref_sum(src + off, len, 0))),
+              "inet_chksum_pbuf", n, len);
+        check(same(inet_chksum_pseudo(p, &s, &d, PROTO_TCP, len),
+                   ref_final(ref_sum(src + off, len,
+                                     ref_pseudo(&s, &d, PROTO_TCP, len)))),
+              "inet_chksum_pseudo", n, len);
+
+        int part = (rand() % (len + 1)) & ~1;
+        check(same(inet_chksum_pseudo_partial(p, &s, &d, PROTO_TCP, len,
+                                              part),
+                   ref_final(ref_sum(src + off, part,
+                                     ref_pseudo(&s, &d, PROTO_TCP, len)))),
+              "inet_chksum_pseudo_partial", n, part);
+    }
+}
+
+/**
+ * Replay tcp_enqueue() and tcp_output_segment(): the payload of a segment is
+ * copied in several pieces behind a header, summing each piece on the copy
+ * and appending the sums, and the header is summed separately.
+ */
+static void check_on_copy(void)
+{
+    struct pbuf bufs[MAX_CHAIN];
+    struct ip_addr s = { .addr = htonl(0xc0a80001) };
+    struct ip_addr d = { .addr = htonl(0xc0a80002) };
+
+    srand(11);
+    for (int iter = 0; iter < 20000; iter++) {
+        int hlen = 20 + 4 * (rand() % 4);
+        int n = 1 + rand() % (MAX_CHAIN - 1);
+        uint16_t sum = 0, off = 0;
+        uint8_t *seg = dst;
+
+        memcpy(seg, src + BUF_LEN / 2, hlen);
+        bufs[0].payload = seg;
+        bufs[0].len = hlen;
+        seg += hlen;
+        for (int i = 1; i <= n; i++) {
+            int l = rand() % 700;
+            int soff = rand() % 1000;
+            sum = lwip_chksum_append(sum, lwip_chksum_copy(seg, src + soff, l),
+                                     off);
+            bufs[i].payload = seg;
+            bufs[i].len = l;
+            seg += l;
+            off += l;
+        }
+        uint16_t total = hlen + off;
+        for (int i = 0, left = total; i <= n; i++) {
+            bufs[i].tot_len = left;
+            bufs[i].next = (i == n) ? NULL : &bufs[i + 1];
+            left -= bufs[i].len;
+        }
+
+        uint32_t acc = (uint16_t)~inet_chksum_pseudo_partial(&bufs[0], &s, &d,
+                                                             PROTO_TCP,
+                                                             total, hlen);
+        acc += sum;
+        acc = FOLD_U32T(acc);
+        check(same(~acc, inet_chksum_pseudo(&bufs[0], &s, &d, PROTO_TCP,
+                                           total)),
+              "checksum on copy", n, total);
+    }
+}
+
+static void check_adjust(void)
+{
+    uint8_t hdr[20];
+
+    srand(13);
+    for (int iter = 0; iter < 100000; iter++) {
+        for (size_t i = 0; i < sizeof(hdr); i++) {
+            hdr[i] = rand();
+        }
+        hdr[10] = hdr[11] = 0;
+        uint16_t chksum = inet_chksum(hdr, sizeof(hdr));
+        memcpy(hdr + 10, &chksum, 2);
+
+        // rewrite a 16-bit field, sometimes to all zeros or all ones
+        int pos = 2 * (rand() % 10);
+        if (pos == 10) {
+            continue;
+        }
+        uint16_t from, to = (iter % 3 == 0) ? 0 : (iter % 3 == 1) ? 0xffff
+                                                               : rand();
+        memcpy(&from, hdr + pos, 2);
+        memcpy(hdr + pos, &to, 2);
+        chksum = inet_chksum_adjust(chksum, from, to);
+        memcpy(hdr + 10, &chksum, 2);
+        check(inet_chksum(hdr, sizeof(hdr)) == 0, "inet_chksum_adjust", pos,
+              to);
+
+        // and a 32-bit one, like an address in a NAT
+        pos = 12 + 4 * (rand() % 2);
+        uint32_t from32, to32 = rand();
+        memcpy(&from32, hdr + pos, 4);
+        memcpy(hdr + pos, &to32, 4);
+        chksum = inet_chksum_adjust32(chksum, from32, to32);
+        memcpy(hdr + 10, &chksum, 2);
+        check(inet_chksum(hdr, sizeof(hdr)) == 0, "inet_chksum_adjust32", pos,
+              to32);
+    }
+}
+
+static void bench(int len)
+{
+    uint64_t start, elapsed, count;
+    volatile uint32_t sink = 0;
+    double mbs[4];
+
+    for (int v = 0; v < 4; v++) {
+        count = 0;
+        start = now_ns();
+        do {
+            switch (v) {
+            case 0:
+                sink += ref_sum(src, len, 0);
+                break;
+            case 1:
+                sink += inet_chksum(src, len);
+                break;
+            case 2:
+                memcpy(dst, src, len);
+                sink += inet_chksum(dst, len);
+                break;
+            case 3:
+                sink += lwip_chksum_copy(dst, src, len);
+                break;
+            }
+            count++;
+        } while ((elapsed = now_ns() - start) < MIN_RUN_NS);
+        mbs[v] = (double)count * len * 1000.0 / elapsed;
+    }
+    (void)sink;
+
+    printf("len=%d ref_mbs=%.0f chksum_mbs=%.0f copy_then_chksum_mbs=%.0f "
+           "chksum_copy_mbs=%.0f\n", len, mbs[0], mbs[1], mbs[2], mbs[3]);
+}
+
+int main(void)
+{
+    static const int sizes[] = { 64, 1460, 65535 };
+
+    src = malloc(BUF_LEN);
+    dst = malloc(BUF_LEN);
+    if (src == NULL || dst == NULL) {
+        return EXIT_FAILURE;
+    }
+    srand(42);
+    for (int i = 0; i < BUF_LEN; i++) {
+        src[i] = rand();
+    }
+    // long runs of ones to provoke carries
+    memset(src + 4096, 0xff, 8192);
+
+    check_flat();
+    check_copy();
+    check_chains();
+    check_on_copy();
+    check_adjust();
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench(sizes[i]);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,898 @@
+/**
+ * \file
+ * \brief Host test and benchmark of the FAT32 file system of the mmchs driver
+ *
+ * Runs usr/mmchs_driver/fat.c unchanged over the block cache and the
+ * elevator, as the driver's file server does, with a disk image file in
+ * place of the card.
+ *
+ * Without an argument, a 320MB sparse image is formatted in /tmp, with a
+ * file with a long name in fragmented clusters and a subdirectory in it.
+ * A freshly formatted FAT32 image can be given instead; it is modified,
+ * and the tests that need the prepared files are skipped.
+ *
+ * The test covers lookup by long and short name, reading across
+ * fragmented clusters, creating, growing, overwriting and deleting files,
+ * growing a directory, deleting an open file, the lookup and file caches,
+ * and mounting again. At the end it checks the image: every cluster used
+ * once, chains as long as the files and both FAT copies the same.
+ *
+ * The benchmark reads an 8MB file sequentially from a cold cache in 4KB
+ * and 32KB reads, without and with read-ahead. Card time is modelled as
+ * 100us per command plus 25us per sector. It then opens a file with every
+ * cluster in an extent of its own, reads at a random offset and closes it
+ * again, and counts FAT entries followed and directory entries scanned.
+ *
+ * Build and run on the host, in a build directory (make generates the FAT
+ * device headers from devices/fat_bpb.dev, fat32_ebpb.dev and
+ * fat_direntry.dev with mackerel first):
+ *
+ *   make tools/bin/fatbench
+ *   tools/bin/fatbench [image]
+ *
+ * Output is one line per test and per benchmark run:
+ *   test=<name> ok
+ *   readahead=<off|on> read_size=<n> commands=<n> sectors=<n> card_ms=<n>
+ *   random reads=<n> fat_walked=<n> fat_loads=<n> dirents=<n> ...
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "../../usr/mmchs_driver/fat.h"
+
+#define MAX_SECTORS     128                     // MMCHS_MAX_BLOCKS
+#define CACHE_BLOCKS    256
+
+// layout of the image formatted here
+#define IMAGE_SECTORS   (320 * 2048)
+#define SPC             8
+#define RESERVED        32
+#define NFATS           2
+#define FAT_SECTORS     640
+#define DATA_LBA        (RESERVED + NFATS * FAT_SECTORS)
+
+#define LONG_NAME       "A long file name.txt"
+#define LONG_SIZE       (3 * SPC * 512 - 100)
+#define SUB_CLUSTER     30
+
+#define BIG_SIZE        (8 * 1024 * 1024)
+#define FRAG_SIZE       (2 * 1024 * 1024)       // every cluster an extent
+#define RANDOM_READS    2000
+
+#define CHECK(x) check((x), #x, __LINE__)
+#define EXPECT(x, want) expect((x), (want), #x, __LINE__)
+#define ASSERT(c) do {                                                  \
+    if (!(c)) {                                                         \
+        fprintf(stderr, "line %d: %s does not hold\n", __LINE__, #c);   \
+        exit(1);                                                        \
+    }                                                                   \
+} while (0)
+
+struct volume {
+    struct elevator elv;
+    struct bcache bc;
+    struct fat_fs fs;
+};
+
+static int disk;
+static bool prepared;
+static struct {
+    uint64_t commands;
+    uint64_t sectors;
+} card;
+
+static void check(errval_t err, const char *what, int line)
+{
+    if (err_is_fail(err)) {
+        fprintf(stderr, "line %d: %s failed with %lu\n", line, what,
+                (unsigned long)err);
+        exit(1);
+    }
+}
+
+static void expect(errval_t err, errval_t want, const char *what, int line)
+{
+    if (err != want) {
+        fprintf(stderr, "line %d: %s gave %lu instead of %lu\n", line, what,
+                (unsigned long)err, (unsigned long)want);
+        exit(1);
+    }
+}
+
+//
+// Block device stand-in
+//
+
+static errval_t image_transfer(void *st, bool write, uint32_t lba,
+                               uint32_t count, void *buf)
+{
+    (void)st;
+    off_t offset = (off_t)lba * BLK_SECTOR_SIZE;
+    size_t bytes = (size_t)count * BLK_SECTOR_SIZE;
+    ssize_t done;
+
+    if (write) {
+        done = pwrite(disk, buf, bytes, offset);
+    } else {
+        done = pread(disk, buf, bytes, offset);
+    }
+    card.commands++;
+    card.sectors += count;
+    return (done == (ssize_t)bytes) ? SYS_ERR_OK : MMC_ERR_TRANSFER;
+}
+
+static void mount(struct volume *v)
+{
+    CHECK(elevator_init(&v->elv, image_transfer, NULL, MAX_SECTORS, NULL));
+    CHECK(bcache_init(&v->bc, &v->elv, CACHE_BLOCKS));
+    CHECK(fat_mount(&v->fs, &v->bc));
+}
+
+static void unmount(struct volume *v)
+{
+    for (struct fat_file *f = v->fs.open; f != NULL; f = f->next) {
+        ASSERT(f->refs == 0);
+    }
+    CHECK(fat_unmount(&v->fs));
+    free(v->bc.entries);
+    free(v->bc.data);
+    free(v->bc.hash);
+    free(v->elv.staging);
+}
+
+//
+// Formatting
+//
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static void put_sector(uint32_t lba, const void *buf, size_t len)
+{
+    ssize_t done = pwrite(disk, buf, len, (off_t)lba * BLK_SECTOR_SIZE);
+    ASSERT(done == (ssize_t)len);
+}
+
+static uint32_t cluster_lba(uint32_t cluster)
+{
+    return DATA_LBA + (cluster - 2) * SPC;
+}
+
+static void set_fat(uint32_t cluster, uint32_t val)
+{
+    uint8_t entry[4];
+    put32(entry, val);
+    for (int i = 0; i < NFATS; i++) {
+        ssize_t done = pwrite(disk, entry, 4, (off_t)(RESERVED + i * FAT_SECTORS)
+                              * BLK_SECTOR_SIZE + cluster * 4);
+        ASSERT(done == 4);
+    }
+}
+
+static void make_dirent(uint8_t *e, const char *name11, uint8_t attr,
+                        uint32_t start, uint32_t size)
+{
+    memset(e, 0, FAT_DIRENT_SIZE);
+    memcpy(e, name11, 11);
+    e[11] = attr;
+    put16(e + 20, start >> 16);
+    put16(e + 26, start & 0xffff);
+    put32(e + 28, size);
+}
+
+/// Long name entries for \p name, last part first as on disk
+static int make_lfn(uint8_t *e, const char *name, const uint8_t *name11)
+{
+    static const uint8_t pos[13] = {
+        1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30
+    };
+    int len = strlen(name);
+    int n = (len + 12) / 13;
+    uint8_t sum = 0;
+
+    for (int i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + name11[i];
+    }
+    for (int k = 0; k < n; k++) {
+        int ord = n - k;
+        uint8_t *p = e + k * FAT_DIRENT_SIZE;
+        memset(p, 0, FAT_DIRENT_SIZE);
+        p[0] = ord | (k == 0 ? 0x40 : 0);
+        p[11] = 0x0f;
+        p[13] = sum;
+        for (int i = 0; i < 13; i++) {
+            int c = (ord - 1) * 13 + i;
+            uint16_t ch = c < len ? (uint8_t)name[c] : (c == len ? 0 : 0xffff);
+            put16(p + pos[i], ch);
+        }
+    }
+    return n;
+}
+
+static uint8_t long_pattern(size_t i)
+{
+    return i * 7 + 3;
+}
+
+/// A fresh volume with a long-named file in clusters 10, 11 and 20, and
+/// SUB/INNER.TXT
+static void format(void)
+{
+    uint8_t bs[BLK_SECTOR_SIZE] = { 0 };
+    uint8_t cluster[SPC * BLK_SECTOR_SIZE];
+
+    ASSERT(ftruncate(disk, (off_t)IMAGE_SECTORS * BLK_SECTOR_SIZE) == 0);
+
+    bs[0] = 0xeb;
+    bs[1] = 0x58;
+    bs[2] = 0x90;
+    memcpy(bs + 3, "BFISH   ", 8);
+    put16(bs + 0x0b, BLK_SECTOR_SIZE);
+    bs[0x0d] = SPC;
+    put16(bs + 0x0e, RESERVED);
+    bs[0x10] = NFATS;
+    bs[0x15] = 0xf8;
+    put16(bs + 0x18, 32);
+    put16(bs + 0x1a, 64);
+    put32(bs + 0x20, IMAGE_SECTORS);
+    put32(bs + 0x24, FAT_SECTORS);
+    put32(bs + 0x2c, 2);
+    put16(bs + 0x30, 1);
+    put16(bs + 0x32, 6);
+    bs[0x40] = 0x80;
+    bs[0x42] = 0x29;
+    put32(bs + 0x43, 0x12345678);
+    memcpy(bs + 0x47, "NO NAME    FAT32   ", 19);
+    bs[510] = 0x55;
+    bs[511] = 0xaa;
+    put_sector(0, bs, sizeof(bs));
+    put_sector(6, bs, sizeof(bs));
+
+    uint8_t fsinfo[BLK_SECTOR_SIZE] = { 0 };
+    put32(fsinfo, 0x41615252);
+    put32(fsinfo + 484, 0x61417272);
+    put32(fsinfo + 488, 0xffffffff);
+    put32(fsinfo + 492, 0xffffffff);
+    put32(fsinfo + 508, 0xaa550000);
+    put_sector(1, fsinfo, sizeof(fsinfo));
+    put_sector(7, fsinfo, sizeof(fsinfo));
+
+    set_fat(0, 0x0ffffff8);
+    set_fat(1, 0x0fffffff);
+    set_fat(2, 0x0fffffff);
+
+    // the long-named file, fragmented
+    set_fat(10, 11);
+    set_fat(11, 20);
+    set_fat(20, 0x0fffffff);
+    static const uint32_t parts[3] = { 10, 11, 20 };
+    for (int k = 0; k < 3; k++) {
+        for (size_t i = 0; i < sizeof(cluster); i++) {
+            cluster[i] = long_pattern(k * sizeof(cluster) + i);
+        }
+        put_sector(cluster_lba(parts[k]), cluster, sizeof(cluster));
+    }
+
+    // SUB/INNER.TXT
+    set_fat(SUB_CLUSTER, 0x0fffffff);
+    set_fat(SUB_CLUSTER + 1, 0x0fffffff);
+    memset(cluster, 0, sizeof(cluster));
+    make_dirent(cluster, ".          ", 0x10, SUB_CLUSTER, 0);
+    make_dirent(cluster + 32, "..         ", 0x10, 0, 0);
+    make_dirent(cluster + 64, "INNER   TXT", 0x20, SUB_CLUSTER + 1, 5);
+    put_sector(cluster_lba(SUB_CLUSTER), cluster, sizeof(cluster));
+    memset(cluster, 0, sizeof(cluster));
+    memcpy(cluster, "inner", 5);
+    put_sector(cluster_lba(SUB_CLUSTER + 1), cluster, sizeof(cluster));
+
+    // root: volume label, the long-named file, SUB
+    memset(cluster, 0, sizeof(cluster));
+    uint8_t *e = cluster;
+    make_dirent(e, "NO NAME    ", 0x08, 0, 0);
+    e += FAT_DIRENT_SIZE;
+    const uint8_t *sn = (const uint8_t *)"ALONGF~1TXT";
+    e += make_lfn(e, LONG_NAME, sn) * FAT_DIRENT_SIZE;
+    make_dirent(e, (const char *)sn, 0x20, 10, LONG_SIZE);
+    e += FAT_DIRENT_SIZE;
+    make_dirent(e, "SUB        ", 0x10, SUB_CLUSTER, 0);
+    put_sector(cluster_lba(2), cluster, sizeof(cluster));
+}
+
+//
+// Helpers
+//
+
+static uint8_t data_pattern(size_t i, uint8_t seed)
+{
+    return (i * 13 + (i >> 12) + seed) & 0xff;
+}
+
+static void write_all(struct fat_file *f, size_t pos, const uint8_t *buf,
+                      size_t len, size_t chunk)
+{
+    for (size_t done = 0; done < len; ) {
+        size_t n = (len - done < chunk) ? len - done : chunk;
+        size_t ret;
+        CHECK(fat_write(f, pos + done, n, buf + done, &ret));
+        ASSERT(ret == n);
+        done += n;
+    }
+}
+
+static void read_all(struct fat_file *f, size_t pos, uint8_t *buf,
+                     size_t len, size_t chunk)
+{
+    for (size_t done = 0; done < len; ) {
+        size_t n = (len - done < chunk) ? len - done : chunk;
+        size_t ret;
+        CHECK(fat_read(f, pos + done, n, buf + done, &ret));
+        ASSERT(ret == n);
+        done += n;
+    }
+}
+
+static bool listed(struct fat_fs *fs, const char *dir_path, const char *name,
+                   struct fat_dirent_info *ret)
+{
+    struct fat_file *dir;
+    struct fat_dirent_info info;
+    uint32_t slot = 0;
+    errval_t err;
+    bool found = false;
+
+    CHECK(fat_open(fs, dir_path, &dir));
+    while (err_is_ok(err = fat_readdir(dir, &slot, &info))) {
+        if (strcmp(info.name, name) == 0) {
+            found = true;
+            if (ret != NULL) {
+                *ret = info;
+            }
+        }
+    }
+    EXPECT(err, FS_ERR_INDEX_BOUNDS);
+    fat_close(dir);
+    return found;
+}
+
+//
+// Tests
+//
+
+static void test_lookup(struct fat_fs *fs)
+{
+    struct fat_file *f, *g;
+    uint8_t buf[LONG_SIZE + 100];
+    size_t ret;
+
+    CHECK(fat_open(fs, "/" LONG_NAME, &f));
+    CHECK(fat_open(fs, "/a LONG file NAME.TXT", &g));
+    ASSERT(f == g);
+    fat_close(g);
+    CHECK(fat_open(fs, "alongf~1.txt", &g));
+    ASSERT(f == g);
+    fat_close(g);
+
+    // across the gap between clusters 11 and 20, in odd pieces
+    ASSERT(f->size == LONG_SIZE);
+    read_all(f, 0, buf, LONG_SIZE, 1000);
+    for (size_t i = 0; i < LONG_SIZE; i++) {
+        ASSERT(buf[i] == long_pattern(i));
+    }
+    CHECK(fat_read(f, 8000, 5000, buf, &ret));
+    ASSERT(ret == LONG_SIZE - 8000);
+    ASSERT(buf[0] == long_pattern(8000));
+    CHECK(fat_read(f, LONG_SIZE, 10, buf, &ret));
+    ASSERT(ret == 0);
+    ASSERT(f->chain_len == 3 && f->nextents == 2);
+    ASSERT(f->extents[0].cluster == 10 && f->extents[0].count == 2);
+    ASSERT(f->extents[1].cluster == 20 && f->extents[1].index == 2);
+    fat_close(f);
+
+    CHECK(fat_open(fs, "/sub//inner.txt", &f));
+    CHECK(fat_read(f, 0, sizeof(buf), buf, &ret));
+    ASSERT(ret == 5 && memcmp(buf, "inner", 5) == 0);
+    fat_close(f);
+
+    EXPECT(fat_open(fs, "/nothere", &f), FS_ERR_NOTFOUND);
+    EXPECT(fat_open(fs, "/sub/inner.txt/x", &f), FS_ERR_NOTDIR);
+
+    struct fat_dirent_info info;
+    ASSERT(listed(fs, "/", LONG_NAME, &info));
+    ASSERT(!info.dir && info.size == LONG_SIZE && info.lfn_slots == 2);
+    ASSERT(strcmp(info.short_name, "ALONGF~1.TXT") == 0);
+    ASSERT(listed(fs, "/", "SUB", &info) && info.dir);
+    ASSERT(!listed(fs, "/", "NO NAME", NULL));
+    ASSERT(!listed(fs, "/sub", ".", NULL));
+    printf("test=lookup ok\n");
+}
+
+static void test_create(struct fat_fs *fs)
+{
+    struct fat_file *f;
+
+    CHECK(fat_create(fs, "/hello.txt", &f));
+    ASSERT(f->size == 0 && f->start == 0);
+    fat_close(f);
+    ASSERT(listed(fs, "/", "hello.txt", NULL));
+    CHECK(fat_create(fs, "/README", &f));
+    fat_close(f);
+    ASSERT(listed(fs, "/", "README", NULL));
+
+    EXPECT(fat_create(fs, "/HELLO.TXT", &f), FS_ERR_EXISTS);
+    EXPECT(fat_create(fs, "/", &f), FS_ERR_EXISTS);
+    EXPECT(fat_create(fs, "/MixedCase.txt", &f), FAT_ERR_NAME);
+    EXPECT(fat_create(fs, "/verylongname.txt", &f), FAT_ERR_NAME);
+    EXPECT(fat_create(fs, "/a.b.c", &f), FAT_ERR_NAME);
+    EXPECT(fat_create(fs, "/nodir/x.txt", &f), FS_ERR_NOTFOUND);
+
+    if (prepared) {
+        CHECK(fat_create(fs, "/sub/new.txt", &f));
+        fat_close(f);
+        ASSERT(listed(fs, "/sub", "new.txt", NULL));
+        ASSERT(listed(fs, "/sub", "INNER.TXT", NULL));
+    }
+    printf("test=create ok\n");
+}
+
+static void test_write(struct fat_fs *fs)
+{
+    const size_t len = 1024 * 1024 + 333;
+    uint8_t *buf = malloc(len + 20000);
+    uint8_t *back = malloc(len + 20000);
+    struct fat_file *f;
+    size_t ret;
+    ASSERT(buf != NULL && back != NULL);
+
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = data_pattern(i, 1);
+    }
+    CHECK(fat_create(fs, "/data.bin", &f));
+    write_all(f, 0, buf, len, 1000);
+    ASSERT(f->size == len);
+    read_all(f, 0, back, len, 4096 + 7);
+    ASSERT(memcmp(buf, back, len) == 0);
+
+    // overwrite in the middle, unaligned
+    for (size_t i = 5000; i < 300000; i++) {
+        buf[i] = data_pattern(i, 2);
+    }
+    write_all(f, 5000, buf + 5000, 300000 - 5000, 65536);
+    ASSERT(f->size == len);
+
+    // past the end, the gap reads as zeroes
+    memset(buf + len, 0, 10000);
+    for (size_t i = len + 10000; i < len + 20000; i++) {
+        buf[i] = data_pattern(i, 3);
+    }
+    write_all(f, len + 10000, buf + len + 10000, 10000, 10000);
+    ASSERT(f->size == len + 20000);
+    read_all(f, 0, back, len + 20000, 65536);
+    ASSERT(memcmp(buf, back, len + 20000) == 0);
+
+    // a file written in one piece only goes around clusters in use
+    for (uint32_t i = 1; i < f->nextents; i++) {
+        struct fat_extent *e = &f->extents[i - 1];
+        for (uint32_t c = e->cluster + e->count; c < e[1].cluster; c++) {
+            ASSERT(c == 10 || c == 11 || c == 20 || c == SUB_CLUSTER
+                   || c == SUB_CLUSTER + 1 || !prepared);
+        }
+    }
+    fat_close(f);
+
+    // the entry was updated
+    struct fat_dirent_info info;
+    ASSERT(listed(fs, "/", "data.bin", &info));
+    ASSERT(info.size == len + 20000 && info.start != 0);
+
+    EXPECT(fat_open(fs, "/", &f), SYS_ERR_OK);
+    EXPECT(fat_read(f, 0, 10, back, &ret), FS_ERR_NOTFILE);
+    EXPECT(fat_write(f, 0, 10, back, &ret), FS_ERR_NOTFILE);
+    fat_close(f);
+
+    free(buf);
+    free(back);
+    printf("test=write ok\n");
+}
+
+static void test_dir_grow(struct fat_fs *fs)
+{
+    char path[32];
+    struct fat_file *f;
+    size_t ret;
+
+    // 300 entries need three clusters of the root directory
+    for (int i = 0; i < 300; i++) {
+        snprintf(path, sizeof(path), "/f%03d.dat", i);
+        CHECK(fat_create(fs, path, &f));
+        CHECK(fat_write(f, 0, sizeof(i), &i, &ret));
+        fat_close(f);
+    }
+    for (int i = 0; i < 300; i += 2) {
+        snprintf(path, sizeof(path), "/f%03d.dat", i);
+        CHECK(fat_delete(fs, path));
+    }
+
+    struct fat_file *dir;
+    struct fat_dirent_info info;
+    uint32_t slot = 0;
+    int count = 0;
+    CHECK(fat_open(fs, "/", &dir));
+    while (err_is_ok(fat_readdir(dir, &slot, &info))) {
+        count += info.name[0] == 'f';
+    }
+    ASSERT(dir->chain_len >= 3);
+    fat_close(dir);
+    ASSERT(count == 150);
+
+    // freed entries are used again
+    CHECK(fat_create(fs, "/again.dat", &f));
+    fat_close(f);
+    ASSERT(listed(fs, "/", "again.dat", &info));
+    ASSERT(info.slot < 300);
+    printf("test=dir_grow ok\n");
+}
+
+static void test_delete(struct fat_fs *fs)
+{
+    struct fat_file *f;
+
+    CHECK(fat_open(fs, "/hello.txt", &f));
+    EXPECT(fat_delete(fs, "/hello.txt"), FS_ERR_BUSY);
+    fat_close(f);
+    CHECK(fat_delete(fs, "/HELLO.TXT"));
+    EXPECT(fat_open(fs, "/hello.txt", &f), FS_ERR_NOTFOUND);
+    EXPECT(fat_delete(fs, "/hello.txt"), FS_ERR_NOTFOUND);
+    EXPECT(fat_delete(fs, "/"), FS_ERR_NOTFILE);
+
+    if (prepared) {
+        CHECK(fat_delete(fs, "/" LONG_NAME));
+        ASSERT(!listed(fs, "/", LONG_NAME, NULL));
+        ASSERT(!listed(fs, "/", "ALONGF~1.TXT", NULL));
+        EXPECT(fat_delete(fs, "/sub"), FS_ERR_NOTFILE);
+    }
+    printf("test=delete ok\n");
+}
+
+static void test_cache(struct fat_fs *fs)
+{
+    struct fat_file *f, *g;
+    struct fat_stats before;
+    uint8_t buf[16];
+    size_t ret;
+
+    // a name that is not there is remembered, and forgotten once created
+    EXPECT(fat_open(fs, "/sub/later.txt", &f), FS_ERR_NOTFOUND);
+    before = fs->stats;
+    EXPECT(fat_open(fs, "/sub/LATER.TXT", &f), FS_ERR_NOTFOUND);
+    ASSERT(fs->stats.dirents == before.dirents);
+    CHECK(fat_create(fs, "/sub/later.txt", &f));
+    CHECK(fat_write(f, 0, 5, "later", &ret));
+    fat_close(f);
+    CHECK(fat_open(fs, "/sub/later.txt", &f));
+    ASSERT(f->size == 5);
+    fat_close(f);
+
+    // looking the same path up again scans no directory
+    before = fs->stats;
+    for (int i = 0; i < 10; i++) {
+        CHECK(fat_open(fs, "/sub/inner.txt", &f));
+        fat_close(f);
+    }
+    ASSERT(fs->stats.dirents == before.dirents);
+    ASSERT(fs->stats.dcache_hits == before.dcache_hits + 20);
+
+    // a closed file keeps its extents, reading it again walks no FAT
+    CHECK(fat_open(fs, "/data.bin", &f));
+    CHECK(fat_read(f, f->size - 1, 1, buf, &ret));
+    fat_close(f);
+    before = fs->stats;
+    CHECK(fat_open(fs, "/data.bin", &g));
+    ASSERT(g == f);
+    CHECK(fat_read(g, g->size - 1, 1, buf, &ret));
+    CHECK(fat_read(g, 0, 1, buf, &ret));
+    ASSERT(ret == 1 && fs->stats.fat_walked == before.fat_walked);
+    fat_close(g);
+
+    // deleting a closed file drops it from the caches
+    CHECK(fat_open(fs, "/sub/later.txt", &f));
+    uint64_t dirent = f->dirent;
+    fat_close(f);
+    CHECK(fat_delete(fs, "/sub/later.txt"));
+    EXPECT(fat_open(fs, "/sub/later.txt", &f), FS_ERR_NOTFOUND);
+    for (f = fs->open; f != NULL; f = f->next) {
+        ASSERT(f->dirent != dirent);
+    }
+    printf("test=cache ok\n");
+}
+
+static void test_remount(void)
+{
+    struct volume v;
+    struct fat_file *f;
+    const size_t len = 1024 * 1024 + 333 + 20000;
+    uint8_t *back = malloc(len);
+    ASSERT(back != NULL);
+
+    mount(&v);
+    CHECK(fat_open(&v.fs, "/data.bin", &f));
+    ASSERT(f->size == len);
+    read_all(f, 0, back, len, 32768);
+    for (size_t i = 0; i < len; i++) {
+        uint8_t want;
+        if (i >= 5000 && i < 300000) {
+            want = data_pattern(i, 2);
+        } else if (i < len - 20000) {
+            want = data_pattern(i, 1);
+        } else if (i < len - 10000) {
+            want = 0;
+        } else {
+            want = data_pattern(i, 3);
+        }
+        ASSERT(back[i] == want);
+    }
+    fat_close(f);
+
+    int n;
+    size_t ret;
+    CHECK(fat_open(&v.fs, "/f123.dat", &f));
+    CHECK(fat_read(f, 0, sizeof(n), &n, &ret));
+    ASSERT(ret == sizeof(n) && n == 123);
+    fat_close(f);
+    EXPECT(fat_open(&v.fs, "/f122.dat", &f), FS_ERR_NOTFOUND);
+
+    unmount(&v);
+    free(back);
+    printf("test=remount ok\n");
+}
+
+static void fsck_dir(struct fat_fs *fs, const char *path, uint32_t *fat,
+                     uint8_t *used, uint32_t *nused)
+{
+    struct fat_file *dir;
+    struct fat_dirent_info info;
+    uint32_t slot = 0;
+    errval_t err;
+    char sub[FAT_NAME_MAX + 64];
+
+    CHECK(fat_open(fs, path, &dir));
+    uint32_t c = dir->start;
+    while (c < 0x0ffffff8) {
+        ASSERT(c >= 2 && c < fs->clusters && !used[c]);
+        used[c] = 1;
+        (*nused)++;
+        c = fat[c];
+    }
+
+    while (err_is_ok(err = fat_readdir(dir, &slot, &info))) {
+        if (info.dir) {
+            snprintf(sub, sizeof(sub), "%s/%s", path, info.name);
+            fsck_dir(fs, sub, fat, used, nused);
+            continue;
+        }
+
+        uint32_t n = 0;
+        for (c = info.start; c != 0 && c < 0x0ffffff8; c = fat[c], n++) {
+            ASSERT(c >= 2 && c < fs->clusters && !used[c]);
+            used[c] = 1;
+            (*nused)++;
+        }
+        ASSERT(n == (info.size + fs->cluster_size - 1) / fs->cluster_size);
+    }
+    EXPECT(err, FS_ERR_INDEX_BOUNDS);
+    fat_close(dir);
+}
+
+/// Check the image as written, not as cached
+static void test_fsck(void)
+{
+    struct volume v;
+    mount(&v);
+
+    size_t bytes = (size_t)v.fs.fat_sectors * BLK_SECTOR_SIZE;
+    uint32_t *fat = malloc(bytes);
+    uint32_t *copy = malloc(bytes);
+    uint8_t *used = calloc(v.fs.clusters, 1);
+    uint32_t nused = 0;
+    ASSERT(fat != NULL && copy != NULL && used != NULL);
+
+    for (uint32_t i = 0; i < v.fs.nfats; i++) {
+        off_t offset = (off_t)(v.fs.fat_lba + i * v.fs.fat_sectors)
+                       * BLK_SECTOR_SIZE;
+        ASSERT(pread(disk, i ? copy : fat, bytes, offset) == (ssize_t)bytes);
+        if (i > 0) {
+            ASSERT(memcmp(fat, copy, bytes) == 0);
+        }
+    }
+    for (uint32_t i = 0; i < v.fs.clusters; i++) {
+        fat[i] &= 0x0fffffff;
+    }
+
+    fsck_dir(&v.fs, "", fat, used, &nused);
+
+    uint32_t allocated = 0;
+    for (uint32_t c = 2; c < v.fs.clusters; c++) {
+        allocated += fat[c] != 0;
+        ASSERT((fat[c] != 0) == (used[c] != 0));
+    }
+    ASSERT(allocated == nused);
+
+    unmount(&v);
+    free(fat);
+    free(copy);
+    free(used);
+    printf("test=fsck ok\n");
+}
+
+//
+// Benchmark
+//
+
+static void bench(size_t read_size, bool readahead)
+{
+    struct volume v;
+    struct fat_file *f;
+    struct fat_readahead ra = { 0, 0 };
+    uint8_t *buf = malloc(read_size);
+    ASSERT(buf != NULL);
+
+    mount(&v);
+    CHECK(fat_open(&v.fs, "/big.bin", &f));
+    memset(&card, 0, sizeof(card));
+
+    for (size_t pos = 0; pos < BIG_SIZE; pos += read_size) {
+        size_t ret;
+        if (readahead) {
+            CHECK(fat_read_ahead(f, &ra, pos, read_size));
+        }
+        CHECK(fat_read(f, pos, read_size, buf, &ret));
+        ASSERT(ret == read_size && buf[0] == data_pattern(pos, 4));
+    }
+
+    printf("readahead=%s read_size=%zu commands=%" PRIu64 " sectors=%" PRIu64
+           " card_ms=%" PRIu64 "\n", readahead ? "on" : "off", read_size,
+           card.commands, card.sectors,
+           (card.commands * 100 + card.sectors * 25) / 1000);
+
+    fat_close(f);
+    unmount(&v);
+    free(buf);
+}
+
+static void bench_setup(struct fat_fs *fs)
+{
+    uint8_t *buf = malloc(BIG_SIZE);
+    struct fat_file *f;
+    ASSERT(buf != NULL);
+
+    for (size_t i = 0; i < BIG_SIZE; i++) {
+        buf[i] = data_pattern(i, 4);
+    }
+    CHECK(fat_create(fs, "/big.bin", &f));
+    write_all(f, 0, buf, BIG_SIZE, 65536);
+    fat_close(f);
+
+    if (prepared) {
+        // two files growing a cluster at a time take turns
+        struct fat_file *pad;
+        size_t ret;
+        CHECK(fat_create(fs, "/sub/frag.bin", &f));
+        CHECK(fat_create(fs, "/sub/pad.bin", &pad));
+        for (size_t pos = 0; pos < FRAG_SIZE; pos += fs->cluster_size) {
+            CHECK(fat_write(f, pos, fs->cluster_size, buf + pos, &ret));
+            CHECK(fat_write(pad, pos, fs->cluster_size, buf, &ret));
+        }
+        ASSERT(f->nextents == FRAG_SIZE / fs->cluster_size);
+        fat_close(pad);
+        fat_close(f);
+    }
+    free(buf);
+}
+
+/// Open, read a little at a random offset and close, as a file client does
+static void bench_random(void)
+{
+    struct volume v;
+    struct fat_file *f;
+    uint8_t buf[512];
+    size_t ret;
+    struct timespec t0, t1;
+
+    mount(&v);
+    srand(1);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < RANDOM_READS; i++) {
+        size_t pos = (size_t)rand() % (FRAG_SIZE - sizeof(buf));
+        CHECK(fat_open(&v.fs, "/sub/frag.bin", &f));
+        CHECK(fat_read(f, pos, sizeof(buf), buf, &ret));
+        ASSERT(ret == sizeof(buf) && buf[0] == data_pattern(pos, 4));
+        fat_close(f);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    struct fat_stats *st = &v.fs.stats;
+    printf("random reads=%d fat_walked=%" PRIu64 " fat_loads=%" PRIu64
+           " dirents=%" PRIu64 " dcache_hits=%" PRIu64 " dcache_misses=%"
+           PRIu64 " cpu_us=%" PRIu64 "\n", RANDOM_READS, st->fat_walked,
+           st->fat_loads, st->dirents, st->dcache_hits, st->dcache_misses,
+           (uint64_t)((t1.tv_sec - t0.tv_sec) * 1000000
+                      + (t1.tv_nsec - t0.tv_nsec) / 1000));
+
+    // each cluster of the chain is followed once
+    ASSERT(st->fat_walked < FRAG_SIZE / v.fs.cluster_size);
+    ASSERT(st->dcache_misses == 2);
+    unmount(&v);
+}
+
+int main(int argc, char *argv[])
+{
+    char tmp[] = "/tmp/fatbench.XXXXXX";
+    struct volume v;
+
+    if (argc > 1) {
+        disk = open(argv[1], O_RDWR);
+    } else {
+        disk = mkstemp(tmp);
+        prepared = true;
+    }
+    if (disk < 0) {
+        perror("open");
+        return 1;
+    }
+    if (prepared) {
+        format();
+    }
+
+    mount(&v);
+    printf("test=mount ok\n");
+    if (prepared) {
+        test_lookup(&v.fs);
+    }
+    test_create(&v.fs);
+    test_write(&v.fs);
+    test_dir_grow(&v.fs);
+    test_delete(&v.fs);
+    if (prepared) {
+        test_cache(&v.fs);
+    }
+    bench_setup(&v.fs);
+    unmount(&v);
+
+    test_remount();
+    test_fsck();
+
+    bench(4096, false);
+    bench(4096, true);
+    bench(32768, false);
+    bench(32768, true);
+    if (prepared) {
+        bench_random();
+    }
+
+    close(disk);
+    if (prepared) {
+        unlink(tmp);
+    }
+    return 0;
+}
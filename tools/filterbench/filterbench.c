@@ -0,0 +1,303 @@
+/**
+ * \file
+ * \brief Host benchmark for the compiled bfdmux packet classifier
+ *
+ * Registers 1, 100 and 10000 socket filters, built and compiled exactly as
+ * lib/net_device_manager does, and classifies packets both by running every
+ * filter through the interpreter (the old execute_filters() loop) and with
+ * the compiled classifier. Both must agree on every packet. Packets are read
+ * from a pcap capture (Ethernet link type) if one is given, otherwise a mix
+ * of matching and non-matching UDP/TCP packets is synthesized.
+ *
+ * Build and run on the host, in a build directory:
+ *
+ *   make tools/bin/filterbench
+ *   tools/bin/filterbench [capture.pcap]
+ *
+ * Output is one line per filter count:
+ *   filters=<n> interpreted_ns=<ns/pkt> compiled_ns=<ns/pkt> matched=<pkts>
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <bfdmuxvm/vm.h>
+#include <bfdmuxvm/classifier.h>
+#include <bfdmuxtools/codegen.h>
+#include <bfdmuxtools/tools.h>
+
+#define MAX_PACKETS     65536
+#define MAX_PKT_LEN     1600
+#define SYNTH_PACKETS   4096
+#define BASE_PORT       1024
+#define LOCAL_IP        0x0a000001      // 10.0.0.1
+#define MIN_RUN_NS      200000000ULL    // measure each variant for >= 200ms
+
+struct packet {
+    uint8_t data[MAX_PKT_LEN];
+    int len;
+};
+
+struct bench_filter {
+    uint8_t *code;
+    int32_t len;
+    uint64_t id;
+    struct classifier_rule *rule;
+};
+
+static struct packet *packets;
+static int npackets;
+
+static const struct eth_addr local_mac = {
+    .addr = { 0x00, 0x0a, 0x35, 0x00, 0x01, 0x22 }
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v >> 16);
+    put16(p + 2, v);
+}
+
+static uint32_t rd32(const uint8_t *p, int swap)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+/// Load Ethernet frames from a pcap file
+static int load_pcap(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    uint8_t hdr[24];
+    if (fread(hdr, sizeof(hdr), 1, f) != 1) {
+        fprintf(stderr, "%s: short pcap header\n", path);
+        fclose(f);
+        return -1;
+    }
+    uint32_t magic = rd32(hdr, 0);
+    int swap;
+    if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) {
+        swap = 0;
+    } else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1) {
+        swap = 1;
+    } else {
+        fprintf(stderr, "%s: not a pcap file\n", path);
+        fclose(f);
+        return -1;
+    }
+    if (rd32(hdr + 20, swap) != 1) {
+        fprintf(stderr, "%s: link type is not Ethernet\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    uint8_t rec[16];
+    while (npackets < MAX_PACKETS && fread(rec, sizeof(rec), 1, f) == 1) {
+        uint32_t caplen = rd32(rec + 8, swap);
+        struct packet *p = &packets[npackets];
+        uint32_t keep = caplen < MAX_PKT_LEN ? caplen : MAX_PKT_LEN;
+        if (fread(p->data, 1, keep, f) != keep) {
+            break;
+        }
+        if (caplen > keep) {
+            fseek(f, caplen - keep, SEEK_CUR);
+        }
+        p->len = keep;
+        npackets++;
+    }
+
+    fclose(f);
+    return npackets;
+}
+
+/// Synthesize UDP and TCP packets, 3/4 of them for a port below max_port
+static void synth_packets(int max_port)
+{
+    srand(42);
+    for (npackets = 0; npackets < SYNTH_PACKETS; npackets++) {
+        struct packet *p = &packets[npackets];
+        memset(p->data, 0, 64);
+        p->len = 64;
+
+        memcpy(p->data, local_mac.addr, MAC_ADDR_SIZE);
+        put16(p->data + 12, 0x0800);                    // IPv4
+        p->data[14] = 0x45;
+        p->data[23] = (rand() & 1) ? 0x06 : 0x11;       // TCP or UDP
+        put32(p->data + 26, 0x0a000002);
+        put32(p->data + 30, LOCAL_IP);
+        put16(p->data + 34, 40000 + (rand() % 1000));
+
+        int port = (rand() % 4 != 0) ? BASE_PORT + rand() % max_port
+                                     : 60000 + rand() % 1000;
+        put16(p->data + 36, port);
+    }
+}
+
+/// Build and compile filters like net_device_manager does for bound ports
+static struct bench_filter *make_filters(int n)
+{
+    struct bench_filter *filters = calloc(n + 1, sizeof(struct bench_filter));
+    if (filters == NULL) {
+        return NULL;
+    }
+
+    // one filter the classifier cannot compile, registered first
+    char *exotic = strdup("int16[12]==2054||int8[23]==1");
+    compile_filter(exotic, &filters[0].code, &filters[0].len);
+    filters[0].id = 1;
+    free(exotic);
+
+    for (int i = 1; i <= n; i++) {
+        port_t port = BASE_PORT + (i - 1) / 2;
+        char *filter;
+        if (i & 1) {
+            filter = build_ether_dst_ipv4_tcp_filter(local_mac,
+                                                     BFDMUX_IP_ADDR_ANY,
+                                                     LOCAL_IP, PORT_ANY, port);
+        } else {
+            filter = build_ether_dst_ipv4_udp_filter(local_mac,
+                                                     BFDMUX_IP_ADDR_ANY,
+                                                     LOCAL_IP, PORT_ANY, port);
+        }
+        compile_filter(filter, &filters[i].code, &filters[i].len);
+        if (filters[i].code == NULL) {
+            fprintf(stderr, "failed to compile %s\n", filter);
+            exit(EXIT_FAILURE);
+        }
+        filters[i].id = i + 1;
+        free(filter);
+    }
+    return filters;
+}
+
+/// The old execute_filters(): newest filter first, first match wins
+static struct bench_filter *match_interpreted(struct bench_filter *filters,
+                                              int n, struct packet *p)
+{
+    for (int i = n; i >= 0; i--) {
+        if (execute_filter(filters[i].code, filters[i].len, p->data, p->len,
+                           NULL)) {
+            return &filters[i];
+        }
+    }
+    return NULL;
+}
+
+static int run(int n)
+{
+    struct bench_filter *filters = make_filters(n);
+    struct classifier c;
+    uint64_t start, elapsed, count;
+    int matched = 0;
+    volatile void *sink;
+
+    if (filters == NULL) {
+        return -1;
+    }
+    classifier_init(&c);
+    for (int i = 0; i <= n; i++) {
+        filters[i].rule = classifier_add(&c, filters[i].code, filters[i].len,
+                                         filters[i].id, &filters[i]);
+        if (filters[i].rule == NULL) {
+            fprintf(stderr, "classifier_add failed\n");
+            return -1;
+        }
+    }
+
+    // both classifiers must agree on every packet
+    for (int i = 0; i < npackets; i++) {
+        void *a = match_interpreted(filters, n, &packets[i]);
+        void *b = classifier_match(&c, packets[i].data, packets[i].len);
+        if (a != b) {
+            fprintf(stderr, "mismatch on packet %d with %d filters\n", i, n);
+            return -1;
+        }
+        if (a != NULL) {
+            matched++;
+        }
+    }
+
+    count = 0;
+    start = now_ns();
+    do {
+        sink = match_interpreted(filters, n, &packets[count % npackets]);
+        count++;
+    } while ((elapsed = now_ns() - start) < MIN_RUN_NS);
+    double interpreted_ns = (double)elapsed / count;
+
+    count = 0;
+    start = now_ns();
+    do {
+        struct packet *p = &packets[count % npackets];
+        sink = classifier_match(&c, p->data, p->len);
+        count++;
+    } while ((elapsed = now_ns() - start) < MIN_RUN_NS);
+    double compiled_ns = (double)elapsed / count;
+    (void)sink;
+
+    printf("filters=%d interpreted_ns=%.1f compiled_ns=%.1f matched=%d/%d "
+           "compiled=%zu interpreted=%zu\n", n, interpreted_ns, compiled_ns,
+           matched, npackets, c.compiled_count, c.interpreted_count);
+
+    for (int i = 0; i <= n; i++) {
+        classifier_remove(&c, filters[i].rule);
+        free(filters[i].code);
+    }
+    free(filters);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const int counts[] = { 1, 100, 10000 };
+
+    packets = calloc(MAX_PACKETS, sizeof(struct packet));
+    if (packets == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    if (argc > 1) {
+        if (load_pcap(argv[1]) <= 0) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        synth_packets(counts[2] / 2);
+    }
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        if (run(counts[i]) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+##########################################################################
+# Copyright (c) 2015, ETH Zurich.
+# All rights reserved.
+#
+# This file is distributed under the terms in the attached LICENSE file.
+# If you do not find this file, copies can be found by writing to:
+# ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+##########################################################################
+
+import re
+import tests
+from common import TestCommon
+from results import RowResults
+
+@tests.add_test
+class ShellBench(TestCommon):
+    '''runs the micro-benchmarks of the shell bench command'''
+    name = "shellbench"
+
+    def get_modules(self, build, machine):
+        modules = super(ShellBench, self).get_modules(build, machine)
+        modules.add_module("shell", ["bench", "all"])
+        return modules
+
+    def get_finish_string(self):
+        return "bench: done"
+
+    def process_data(self, testdir, rawiter):
+        results = RowResults(['bench', 'runs', 'avg', 'var', 'min', 'max'])
+        for line in rawiter:
+            m = re.match(r"bench: (\w+) runs=(\d+) avg=(\d+) var=(\d+) "
+                         r"min=(\d+) max=(\d+)", line)
+            if m:
+                results.add_row(list(m.groups()))
+                continue
+            m = re.match(r"bench: (\w+) failed", line)
+            if m:
+                results.mark_failed()
+        return results
@@ -0,0 +1,94 @@
+/**
+ * \file
+ * \brief Host stand-in for <barrelfish/barrelfish.h>
+ *
+ * Declares what the library code run by the host benchmarks in tools/
+ * uses. Functions without a host equivalent (frames, interrupts, waitsets)
+ * are only declared; a benchmark that needs them provides them, as
+ * mmchsmodel does with its register model.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef HOSTSTUBS_BARRELFISH_H
+#define HOSTSTUBS_BARRELFISH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <errors/errno.h>
+#include <barrelfish/types.h>
+#include <barrelfish/thread_sync.h>
+#include <barrelfish/threads.h>
+#include <barrelfish/deferred.h>
+
+#define BASE_PAGE_SIZE 4096
+
+#define VREGION_FLAGS_READ     0x01
+#define VREGION_FLAGS_WRITE    0x02
+#define VREGION_FLAGS_NOCACHE  0x08
+#define VREGION_FLAGS_READ_WRITE_NOCACHE \
+    (VREGION_FLAGS_READ | VREGION_FLAGS_WRITE | VREGION_FLAGS_NOCACHE)
+
+struct capref {
+    int slot;
+};
+
+struct frame_identity {
+    genpaddr_t base;
+    uint8_t bits;
+};
+
+struct paging_state;
+
+struct waitset {
+    int id;
+};
+
+extern struct capref cap_irq;
+
+errval_t frame_alloc(struct capref *dest, size_t bytes, size_t *retbytes);
+errval_t invoke_frame_identify(struct capref frame, struct frame_identity *ret);
+struct paging_state *get_current_paging_state(void);
+errval_t paging_map_frame_attr(struct paging_state *st, void **buf,
+                               size_t bytes, struct capref frame,
+                               int flags, void *arg1, void *arg2);
+
+void waitset_init(struct waitset *ws);
+errval_t event_dispatch(struct waitset *ws);
+errval_t invoke_irqtable_ack(struct capref irqcap, int irq);
+
+#define debug_printf(x...) printf(x)
+
+#define DEBUG_ERR(err, msg...) do { \
+    fprintf(stderr, "%s: %s: ", __func__, err_getstring(err)); \
+    fprintf(stderr, msg); \
+    fprintf(stderr, "\n"); \
+} while (0)
+
+#define USER_PANIC(msg...) do { \
+    fprintf(stderr, msg); \
+    fprintf(stderr, "\n"); \
+    abort(); \
+} while (0)
+
+/// A 2.8GHz cycle counter, the clock contmng/netbench.c converts from
+static inline uint64_t rdtsc(void)
+{
+    return get_system_time() * 2800;
+}
+
+#endif
@@ -0,0 +1,28 @@
+/**
+ * \file
+ * \brief Host stand-in for <barrelfish/deferred.h>
+ *
+ * get_system_time() is left to the benchmark: sockbench reads the host's
+ * monotonic clock, nfsbench runs on a simulated one.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef HOSTSTUBS_DEFERRED_H
+#define HOSTSTUBS_DEFERRED_H
+
+#include <stdint.h>
+
+typedef uint64_t systime_t;
+
+/// Microseconds since an arbitrary point in time, as on Barrelfish
+systime_t get_system_time(void);
+
+#endif
@@ -0,0 +1,25 @@
+/**
+ * \file
+ * \brief Host stand-in for <barrelfish/inthandler.h>
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef HOSTSTUBS_INTHANDLER_H
+#define HOSTSTUBS_INTHANDLER_H
+
+struct waitset;
+
+typedef void (*interrupt_handler_fn)(void *);
+
+errval_t inthandler_setup_arm_ws(struct waitset *ws,
+        interrupt_handler_fn handler, void *handler_arg, uint32_t irq);
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * \file
+ * \brief Host stand-in for <barrelfish/thread_sync.h>
+ *
+ * Barrelfish mutexes, condition variables and semaphores map onto POSIX
+ * ones, enough for lwIP's sys_arch.c.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef HOSTSTUBS_THREAD_SYNC_H
+#define HOSTSTUBS_THREAD_SYNC_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+struct thread_mutex {
+    pthread_mutex_t m;
+    volatile int locked;
+};
+
+#define THREAD_MUTEX_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, 0 }
+
+static inline void thread_mutex_init(struct thread_mutex *mutex)
+{
+    pthread_mutex_init(&mutex->m, NULL);
+    mutex->locked = 0;
+}
+
+static inline void thread_mutex_lock(struct thread_mutex *mutex)
+{
+    pthread_mutex_lock(&mutex->m);
+    mutex->locked = 1;
+}
+
+static inline void thread_mutex_unlock(struct thread_mutex *mutex)
+{
+    mutex->locked = 0;
+    pthread_mutex_unlock(&mutex->m);
+}
+
+struct thread_cond {
+    pthread_cond_t c;
+};
+
+static inline void thread_cond_init(struct thread_cond *cond)
+{
+    pthread_cond_init(&cond->c, NULL);
+}
+
+static inline void thread_cond_wait(struct thread_cond *cond,
+                                    struct thread_mutex *mutex)
+{
+    mutex->locked = 0;
+    pthread_cond_wait(&cond->c, &mutex->m);
+    mutex->locked = 1;
+}
+
+static inline void thread_cond_signal(struct thread_cond *cond)
+{
+    pthread_cond_signal(&cond->c);
+}
+
+struct thread_sem {
+    pthread_mutex_t m;
+    pthread_cond_t c;
+    unsigned value;
+};
+
+static inline void thread_sem_init(struct thread_sem *sem, unsigned value)
+{
+    pthread_mutex_init(&sem->m, NULL);
+    pthread_cond_init(&sem->c, NULL);
+    sem->value = value;
+}
+
+static inline void thread_sem_wait(struct thread_sem *sem)
+{
+    pthread_mutex_lock(&sem->m);
+    while (sem->value == 0) {
+        pthread_cond_wait(&sem->c, &sem->m);
+    }
+    sem->value--;
+    pthread_mutex_unlock(&sem->m);
+}
+
+static inline void thread_sem_post(struct thread_sem *sem)
+{
+    pthread_mutex_lock(&sem->m);
+    sem->value++;
+    pthread_cond_signal(&sem->c);
+    pthread_mutex_unlock(&sem->m);
+}
+
+#endif
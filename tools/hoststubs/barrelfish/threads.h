@@ -0,0 +1,61 @@
+/**
+ * \file
+ * \brief Host stand-in for <barrelfish/threads.h>
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef HOSTSTUBS_THREADS_H
+#define HOSTSTUBS_THREADS_H
+
+#include <pthread.h>
+#include <stdlib.h>
+
+struct thread;
+typedef int (*thread_func_t)(void *);
+
+static inline struct thread *thread_self(void)
+{
+    return (struct thread *) pthread_self();
+}
+
+struct thread_start {
+    thread_func_t start_func;
+    void *arg;
+};
+
+static inline void *thread_start_posix(void *p)
+{
+    struct thread_start start = *(struct thread_start *) p;
+    free(p);
+    start.start_func(start.arg);
+    return NULL;
+}
+
+/// Start a detached POSIX thread, returns NULL on failure
+static inline struct thread *thread_create(thread_func_t start_func, void *arg)
+{
+    struct thread_start *start = malloc(sizeof(*start));
+    if (start == NULL) {
+        return NULL;
+    }
+    start->start_func = start_func;
+    start->arg = arg;
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, thread_start_posix, start) != 0) {
+        free(start);
+        return NULL;
+    }
+    pthread_detach(t);
+    return (struct thread *) t;
+}
+
+#endif
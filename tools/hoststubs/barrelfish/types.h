@@ -0,0 +1,26 @@
+/**
+ * \file
+ * \brief Host stand-in for <barrelfish/types.h>
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef HOSTSTUBS_TYPES_H
+#define HOSTSTUBS_TYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// as on ARMv7
+typedef uint32_t lpaddr_t;
+typedef uint64_t genpaddr_t;
+typedef uintptr_t lvaddr_t;
+
+#endif
@@ -0,0 +1,38 @@
+/**
+ * \file
+ * \brief Host stand-in for <bfdmuxtools/bfdmux.h>
+ *
+ * Provides the few definitions the filter compiler and VM need, without
+ * pulling in lwIP.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __BFDMUX_H__
+#define __BFDMUX_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ERR_OK 0
+
+#define PORT_ANY            0x00
+#define BFDMUX_IP_ADDR_ANY  0x00
+
+typedef int8_t err_t;
+typedef uint8_t prot_t;
+typedef uint32_t addr_t;
+typedef uint16_t port_t;
+
+#define MAC_ADDR_SIZE 6
+struct eth_addr { uint8_t addr[MAC_ADDR_SIZE]; };
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * \file
+ * \brief Host stand-in for the generated <errors/errno.h>
+ *
+ * One code per error the library code run by the host benchmarks returns;
+ * add new ones to HOST_ERR_CODES. err_push() keeps the code that failed
+ * rather than building a stack, so the benchmarks can check which error
+ * came up.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef HOSTSTUBS_ERRNO_H
+#define HOSTSTUBS_ERRNO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uintptr_t errval_t;
+
+#define HOST_ERR_CODES(X) \
+    X(SYS_ERR_OK) \
+    X(LIB_ERR_MALLOC_FAIL) \
+    X(LIB_ERR_FRAME_ALLOC) \
+    X(LIB_ERR_FRAME_IDENTIFY) \
+    X(LIB_ERR_VSPACE_MAP) \
+    X(LIB_ERR_NO_EVENT) \
+    X(LIB_ERR_NOT_IMPLEMENTED) \
+    X(MMC_ERR_TRANSFER) \
+    X(MMC_ERR_READ_READY) \
+    X(MMC_ERR_WRITE_READY) \
+    X(MMC_ERR_COMMAND) \
+    X(MMC_ERR_DMA) \
+    X(MMC_ERR_NO_DMA) \
+    X(FS_ERR_NOTDIR) \
+    X(FS_ERR_NOTFILE) \
+    X(FS_ERR_INDEX_BOUNDS) \
+    X(FS_ERR_NOTFOUND) \
+    X(FS_ERR_EXISTS) \
+    X(FS_ERR_BUSY) \
+    X(FS_ERR_NOSPACE) \
+    X(FAT_ERR_BAD_FS) \
+    X(FAT_ERR_NAME) \
+    X(NFS_ERR_TRANSPORT) \
+    X(NFS_ERR_NOENT) \
+    X(NFS_ERR_IO) \
+    X(NFS_ERR_ISDIR) \
+    X(NFS_ERR_STALE) \
+    X(ETHERSRV_ERR_NOT_ENOUGH_MEM)
+
+#define HOST_ERR_ENUM(code)     code,
+enum err_code {
+    HOST_ERR_CODES(HOST_ERR_ENUM)
+};
+#undef HOST_ERR_ENUM
+
+static inline bool err_is_ok(errval_t err)
+{
+    return err == SYS_ERR_OK;
+}
+
+static inline bool err_is_fail(errval_t err)
+{
+    return err != SYS_ERR_OK;
+}
+
+static inline errval_t err_push(errval_t err, enum err_code code)
+{
+    (void)code;
+    return err;
+}
+
+static inline const char *err_getstring(errval_t err)
+{
+#define HOST_ERR_NAME(code)     #code,
+    static const char *names[] = { HOST_ERR_CODES(HOST_ERR_NAME) };
+#undef HOST_ERR_NAME
+    return err < sizeof(names) / sizeof(names[0]) ? names[err] : "?";
+}
+
+#endif
@@ -0,0 +1,38 @@
+/**
+ * \file
+ * \brief Host stand-in for lwIP's idc_barrelfish.h
+ *
+ * Only the port and ARP calls made by the core; the benchmark answers them
+ * itself instead of asking netd.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef HOSTSTUBS_IDC_BARRELFISH_H
+#define HOSTSTUBS_IDC_BARRELFISH_H
+
+#include <barrelfish/barrelfish.h>
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+
+err_t idc_tcp_new_port(uint16_t * port_no);
+err_t idc_udp_new_port(uint16_t * port_no);
+err_t idc_redirect_tcp(struct ip_addr *local_ip,
+                       u16_t local_port,
+                       struct ip_addr *remote_ip, u16_t remote_port);
+err_t idc_close_udp_port(uint16_t port);
+err_t idc_close_tcp_port(uint16_t port);
+err_t idc_bind_udp_port(uint16_t port);
+err_t idc_bind_tcp_port(uint16_t port);
+err_t idc_pause_tcp(struct ip_addr *local_ip, u16_t local_port,
+                    struct ip_addr *remote_ip, u16_t remote_port);
+uint64_t idc_ARP_lookup(uint32_t ip);
+
+#endif
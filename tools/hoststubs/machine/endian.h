@@ -0,0 +1,20 @@
+/**
+ * \file
+ * \brief Host stand-in for <machine/endian.h>
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef HOSTSTUBS_MACHINE_ENDIAN_H
+#define HOSTSTUBS_MACHINE_ENDIAN_H
+
+#include <endian.h>
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * \file
+ * \brief Host stand-in for <mackerel/mackerel.h>
+ *
+ * By default the accessors read and write memory, which suits devices that
+ * are in-memory structures with registers that need not be aligned (the
+ * FAT devices). With MACKEREL_HOST_MODEL defined, 32-bit accesses go to
+ * model_read() and model_write() instead, which a benchmark provides to
+ * model a device's registers (mmchsmodel); other widths abort.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef HOSTSTUBS_MACKEREL_H
+#define HOSTSTUBS_MACKEREL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+typedef char *mackerel_addr_t;
+
+#ifdef MACKEREL_HOST_MODEL
+
+uint32_t model_read(uint32_t offset);
+void model_write(uint32_t offset, uint32_t val);
+
+#define MACKEREL_ACCESSORS(bits)                                            \
+static inline uint##bits##_t mackerel_read_addr_##bits(mackerel_addr_t base,\
+                                                       int offset)          \
+{                                                                           \
+    (void)base;                                                             \
+    if (bits != 32) {                                                       \
+        abort();                                                            \
+    }                                                                       \
+    return model_read(offset);                                              \
+}                                                                           \
+static inline void mackerel_write_addr_##bits(mackerel_addr_t base,         \
+                                              int offset, uint##bits##_t v) \
+{                                                                           \
+    (void)base;                                                             \
+    if (bits != 32) {                                                       \
+        abort();                                                            \
+    }                                                                       \
+    model_write(offset, v);                                                 \
+}
+
+#else
+
+#define MACKEREL_ACCESSORS(bits)                                            \
+static inline uint##bits##_t mackerel_read_addr_##bits(mackerel_addr_t base,\
+                                                       int offset)          \
+{                                                                           \
+    uint##bits##_t v;                                                       \
+    memcpy(&v, base + offset, sizeof(v));                                   \
+    return v;                                                               \
+}                                                                           \
+static inline void mackerel_write_addr_##bits(mackerel_addr_t base,         \
+                                              int offset, uint##bits##_t v) \
+{                                                                           \
+    memcpy(base + offset, &v, sizeof(v));                                   \
+}
+
+#endif
+
+MACKEREL_ACCESSORS(8)
+MACKEREL_ACCESSORS(16)
+MACKEREL_ACCESSORS(32)
+MACKEREL_ACCESSORS(64)
+
+#endif
@@ -0,0 +1,18 @@
+/**
+ * \file
+ * \brief Forwards to the Barrelfish <nfs/nfs.h>
+ *
+ * The host's C library has its own <nfs/nfs.h>, which would otherwise be
+ * found before the one in the source tree.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include "../../../include/nfs/nfs.h"
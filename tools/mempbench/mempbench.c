@@ -0,0 +1,311 @@
+/**
+ * \file
+ * \brief Host cross-check and benchmark for the lwIP memp pools
+ *
+ * Runs lib/lwip/src/core/memp.c with POSIX threads standing in for
+ * Barrelfish threads. The checks drain the pbuf pool (which must not grow,
+ * as its memory is registered with the driver), grow a pool that may, up to
+ * its runtime limit, and let several threads allocate and free bursts of
+ * elements through their caches and the bulk calls, tagging every element
+ * to catch one handed out twice. Afterwards all elements must be back.
+ *
+ * The benchmark has each thread allocate and free bursts of BURST pbuf pool
+ * elements, as the receive path does, with the thread caches disabled (so
+ * every call takes the pool lock, like one pool shared under one mutex),
+ * with the caches, and with the caches and the bulk calls.
+ *
+ * Build and run on the host, in a build directory:
+ *
+ *   make tools/bin/mempbench
+ *   tools/bin/mempbench
+ *
+ * Output is one line per run:
+ *   mode=<name> threads=<n> mops=<million allocations and frees per second>
+ *   exhausted=<times the pool was found empty>
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <barrelfish/barrelfish.h>
+#include <time.h>
+#include <lwip/memp.h>
+#include <lwip/stats.h>
+#include <lwip/tcp.h>
+
+#define BURST           32              // elements per burst, like an RX burst
+#define MAX_THREADS     4
+#define STRESS_ROUNDS   20000
+#define MIN_RUN_NS      200000000ULL    // measure each run for >= 200ms
+
+static int failures;
+static uint8_t *memory;
+static size_t memory_size;
+
+/* stand-ins for mem_barrelfish.c, which registers the memory with the NIC */
+uint8_t *mem_barrelfish_alloc(uint8_t buf_index, uint32_t size)
+{
+    (void)buf_index;
+    memory = malloc(size);
+    memory_size = size;
+    return memory;
+}
+
+uint8_t *mem_barrelfish_register_buf(uint8_t binding_index, uint32_t size)
+{
+    (void)binding_index; (void)size;
+    return memory;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void check(int ok, const char *what, long a, long b)
+{
+    if (!ok && __sync_fetch_and_add(&failures, 1) < 20) {
+        fprintf(stderr, "FAIL %s (%ld, %ld)\n", what, a, b);
+    }
+}
+
+static bool in_memory(void *p)
+{
+    return (uint8_t *)p >= memory && (uint8_t *)p < memory + memory_size;
+}
+
+/**
+ * All elements of every pool are free. The used counters are only updated
+ * consistently by a single thread, like the rest of the lwIP statistics.
+ */
+static void check_all_free(const char *what, bool check_used)
+{
+    struct stats_mem st;
+
+    for (int i = 0; i < MEMP_MAX; i++) {
+        stats_get_memp(i, &st);
+        check(!check_used || st.used == 0, what, i, st.used);
+        check(memp_avail(i) == st.avail, what, i, memp_avail(i));
+    }
+}
+
+static void check_pbuf_pool(void)
+{
+    u32_t n = memp_avail(MEMP_PBUF_POOL);
+    void **mem = malloc(n * sizeof(void *));
+    struct stats_mem st;
+
+    assert(mem != NULL);
+    for (u32_t i = 0; i < n; i++) {
+        mem[i] = memp_malloc(MEMP_PBUF_POOL);
+        check(mem[i] != NULL && in_memory(mem[i]), "pbuf pool alloc", i, n);
+    }
+    check(memp_malloc(MEMP_PBUF_POOL) == NULL, "pbuf pool must not grow", n,
+          0);
+    check(memp_set_limit(MEMP_PBUF_POOL, n + 1) == ERR_VAL,
+          "pbuf pool limit", n, 0);
+    stats_get_memp(MEMP_PBUF_POOL, &st);
+    check(st.exhausted > 0 && st.err == 1 && st.grown == 0,
+          "pbuf pool stats", st.exhausted, st.err);
+    check(st.used == n && st.max == n, "pbuf pool used", st.used, n);
+    memp_free_bulk(MEMP_PBUF_POOL, mem, n);
+    memp_cache_flush();
+    free(mem);
+    check_all_free("pbuf pool free", true);
+}
+
+static void check_growth(void)
+{
+    u32_t limit = memp_get_limit(MEMP_TCP_SEG);
+    void **mem = malloc((limit + 100) * sizeof(void *));
+    struct stats_mem st;
+    u32_t n;
+
+    assert(mem != NULL);
+    check(limit == MEMP_NUM_TCP_SEG * MEMP_GROW_FACTOR, "default limit",
+          limit, 0);
+    for (n = 0; n < limit + 100; n++) {
+        mem[n] = memp_malloc(MEMP_TCP_SEG);
+        if (mem[n] == NULL) {
+            break;
+        }
+        memset(mem[n], 0x5a, sizeof(struct tcp_seg));
+    }
+    check(n == limit, "grow to limit", n, limit);
+
+    check(memp_set_limit(MEMP_TCP_SEG, limit + 50) == ERR_OK,
+          "raise limit", limit, 0);
+    n += memp_malloc_bulk(MEMP_TCP_SEG, &mem[n], 100);
+    check(n == limit + 50, "grow to new limit", n, limit + 50);
+
+    stats_get_memp(MEMP_TCP_SEG, &st);
+    check(st.grown == limit + 50 - MEMP_NUM_TCP_SEG, "grown", st.grown, 0);
+    check(st.avail == limit + 50, "avail", st.avail, limit + 50);
+    check(st.err == 2, "failed allocations", st.err, 0);
+
+    // free in two halves: one at a time, and in bulk
+    for (u32_t i = 0; i < n / 2; i++) {
+        memp_free(MEMP_TCP_SEG, mem[i]);
+    }
+    memp_free_bulk(MEMP_TCP_SEG, &mem[n / 2], n - n / 2);
+    memp_cache_flush();
+    free(mem);
+    check_all_free("grown pool free", true);
+}
+
+struct worker {
+    pthread_t thread;
+    int id;
+    bool bulk;
+    volatile bool *stop;
+    uint64_t ops;
+};
+
+/// Allocate and free random bursts, tagging elements with the thread id
+static void *stress_worker(void *arg)
+{
+    struct worker *w = arg;
+    void *mem[BURST * 2];
+    unsigned seed = w->id;
+    int held = 0;
+
+    for (int r = 0; r < STRESS_ROUNDS; r++) {
+        int n = rand_r(&seed) % BURST + 1;
+        memp_t type = (r & 1) ? MEMP_PBUF_POOL : MEMP_PBUF;
+        if (held + n > BURST * 2) {
+            n = BURST * 2 - held;
+        }
+        int got;
+        if (rand_r(&seed) & 1) {
+            got = memp_malloc_bulk(type, &mem[held], n);
+        } else {
+            for (got = 0; got < n; got++) {
+                if ((mem[held + got] = memp_malloc(type)) == NULL) {
+                    break;
+                }
+            }
+        }
+        for (int i = held; i < held + got; i++) {
+            *(int *)mem[i] = w->id;
+        }
+        for (int i = held; i < held + got; i++) {
+            check(*(int *)mem[i] == w->id, "element handed out twice", w->id,
+                  i);
+        }
+        // free what we got, the same way or the other way
+        if (rand_r(&seed) & 1) {
+            memp_free_bulk(type, &mem[held], got);
+        } else {
+            for (int i = held; i < held + got; i++) {
+                memp_free(type, mem[i]);
+            }
+        }
+    }
+    memp_cache_flush();
+    return NULL;
+}
+
+static void check_threads(void)
+{
+    struct worker w[MAX_THREADS];
+
+    for (int i = 0; i < MAX_THREADS; i++) {
+        w[i].id = i + 1;
+        pthread_create(&w[i].thread, NULL, stress_worker, &w[i]);
+    }
+    for (int i = 0; i < MAX_THREADS; i++) {
+        pthread_join(w[i].thread, NULL);
+    }
+    check_all_free("threads free", false);
+}
+
+static void *bench_worker(void *arg)
+{
+    struct worker *w = arg;
+    void *mem[BURST];
+
+    while (!*w->stop) {
+        int got;
+        if (w->bulk) {
+            got = memp_malloc_bulk(MEMP_PBUF_POOL, mem, BURST);
+            memp_free_bulk(MEMP_PBUF_POOL, mem, got);
+        } else {
+            for (got = 0; got < BURST; got++) {
+                mem[got] = memp_malloc(MEMP_PBUF_POOL);
+            }
+            for (int i = 0; i < got; i++) {
+                memp_free(MEMP_PBUF_POOL, mem[i]);
+            }
+        }
+        w->ops += 2 * got;
+    }
+    memp_cache_flush();
+    return NULL;
+}
+
+static void bench(const char *mode, bool cache, bool bulk, int threads)
+{
+    struct worker w[MAX_THREADS];
+    volatile bool stop = false;
+    struct stats_mem st;
+    uint64_t ops = 0;
+
+    memp_initialize_pbuf_list();
+    memp_set_cache(cache ? MEMP_CACHE_SIZE : 0, MEMP_CACHE_BATCH);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < threads; i++) {
+        w[i] = (struct worker) { .bulk = bulk, .stop = &stop };
+        pthread_create(&w[i].thread, NULL, bench_worker, &w[i]);
+    }
+    while (now_ns() - start < MIN_RUN_NS) {
+        struct timespec ts = { .tv_nsec = 10000000 };
+        nanosleep(&ts, NULL);
+    }
+    stop = true;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(w[i].thread, NULL);
+        ops += w[i].ops;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    stats_get_memp(MEMP_PBUF_POOL, &st);
+    check(memp_avail(MEMP_PBUF_POOL) == st.avail, "bench leaked",
+          memp_avail(MEMP_PBUF_POOL), st.avail);
+    printf("mode=%s threads=%d mops=%.1f exhausted=%" PRIu32 "\n", mode,
+           threads, (double)ops * 1000.0 / elapsed, (uint32_t)st.exhausted);
+}
+
+int main(void)
+{
+    memp_init();
+
+    check_pbuf_pool();
+    memp_initialize_pbuf_list();
+    check_growth();
+    memp_initialize_pbuf_list();
+    check_threads();
+    memp_initialize_pbuf_list();
+    memp_set_cache(0, 1);
+    check_threads();
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        bench("locked", false, false, threads);
+        bench("cache", true, false, threads);
+        bench("cache_bulk", true, true, threads);
+    }
+    return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
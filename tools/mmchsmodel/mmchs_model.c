@@ -0,0 +1,485 @@
+/**
+ * \file
+ * \brief Register-level software model of the OMAP44xx MMCHS with an SD card
+ *
+ * Models what usr/mmchs_driver relies on: soft and line resets, command
+ * issue with responses of an SDHC card in the identification and transfer
+ * states, single and multi-block reads and writes with auto CMD12, both
+ * through MMCHS_DATA (BRR/BWR) and through ADMA2 descriptor tables in model
+ * RAM, the interrupt status/enable/signal logic and injected errors.
+ * Commands complete as soon as MMCHS_CMD is written, so status bits and the
+ * interrupt line are already set when the driver looks.
+ *
+ * Register offsets and bit positions follow devices/omap/omap44xx_mmchs1.dev;
+ * the driver under test reaches them through the mackerel accessors
+ * generated from it.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "mmchs_model.h"
+
+#define REG_HL_HWINFO   0x004
+#define REG_SYSCONFIG   0x110
+#define REG_SYSSTATUS   0x114
+#define REG_CON         0x12C
+#define REG_BLK         0x204
+#define REG_ARG         0x208
+#define REG_CMD         0x20C
+#define REG_RSP10       0x210
+#define REG_RSP32       0x214
+#define REG_RSP54       0x218
+#define REG_RSP76       0x21C
+#define REG_DATA        0x220
+#define REG_PSTATE      0x224
+#define REG_HCTL        0x228
+#define REG_SYSCTL      0x22C
+#define REG_STAT        0x230
+#define REG_IE          0x234
+#define REG_ISE         0x238
+#define REG_ADMAES      0x254
+#define REG_ADMASAL     0x258
+#define REG_END         0x300
+
+// MMCHS_STAT
+#define STAT_CC         (1u << 0)
+#define STAT_TC         (1u << 1)
+#define STAT_BWR        (1u << 4)
+#define STAT_BRR        (1u << 5)
+#define STAT_ERRI       (1u << 15)
+#define STAT_CTO        (1u << 16)
+#define STAT_DTO        (1u << 20)
+#define STAT_DCRC       (1u << 21)
+#define STAT_ADMAE      (1u << 25)
+#define STAT_BADA       (1u << 29)
+#define STAT_ERRORS     0xffff0000u
+
+// MMCHS_CMD
+#define CMD_DE          (1u << 0)
+#define CMD_BCE         (1u << 1)
+#define CMD_ACEN        (1u << 2)
+#define CMD_DDIR        (1u << 4)
+#define CMD_MSBS        (1u << 5)
+#define CMD_DP          (1u << 21)
+#define CMD_INDX(v)     (((v) >> 24) & 0x3f)
+
+#define CON_INIT        (1u << 1)
+#define CON_DMA_MNS     (1u << 20)
+#define HCTL_DMAS(v)    (((v) >> 3) & 0x3)
+#define SYSCTL_ICS      (1u << 1)
+#define SYSCTL_SRA      (1u << 24)
+#define SYSCTL_SRC      (1u << 25)
+#define SYSCTL_SRD      (1u << 26)
+#define SYSCONFIG_SOFTRESET (1u << 1)
+#define PSTATE_DATI     (1u << 1)
+
+// ADMA2 descriptor attributes
+#define ADMA2_VALID     (1u << 0)
+#define ADMA2_END       (1u << 1)
+#define ADMA2_ACT_MASK  (3u << 4)
+#define ADMA2_ACT_TRAN  (2u << 4)
+#define ADMA2_MAX_LINES 1024
+
+#define CARD_RCA        0x1234
+
+struct model_stats model_stats;
+
+static uint32_t regs[REG_END / 4];
+static bool adma_present;
+static enum model_fault fault;
+
+static uint8_t *card;
+static size_t card_blocks;
+static bool app_cmd;
+static bool selected;
+
+static uint8_t *ram;
+static size_t ram_size, ram_used;
+
+// PIO transfer in progress
+static struct {
+    bool active;
+    bool read;
+    bool multi;
+    uint32_t lba;
+    uint32_t left;          ///< blocks still to move, including the current
+    uint32_t word;          ///< next word in the current block
+} pio;
+
+static inline uint32_t *reg(uint32_t offset)
+{
+    assert(offset < REG_END && (offset & 3) == 0);
+    return &regs[offset / 4];
+}
+
+/// Set status bits, as far as MMCHS_IE lets them
+static void raise(uint32_t bits)
+{
+    *reg(REG_STAT) |= bits & *reg(REG_IE);
+}
+
+void model_init(size_t blocks, size_t ram_bytes, bool adma)
+{
+    memset(regs, 0, sizeof(regs));
+    memset(&pio, 0, sizeof(pio));
+    adma_present = adma;
+    fault = FAULT_NONE;
+    app_cmd = selected = false;
+
+    free(card);
+    card_blocks = blocks;
+    card = malloc(blocks * MODEL_BLOCK_SIZE);
+    assert(card != NULL);
+    for (size_t i = 0; i < blocks * MODEL_BLOCK_SIZE / 4; i++) {
+        ((uint32_t *)card)[i] = i * 2654435761u;
+    }
+
+    free(ram);
+    ram_size = ram_bytes;
+    ram_used = 0;
+    ram = calloc(1, ram_bytes);
+    assert(ram != NULL);
+
+    model_reset_stats();
+}
+
+void model_reset_stats(void)
+{
+    memset(&model_stats, 0, sizeof(model_stats));
+}
+
+void model_inject(enum model_fault f)
+{
+    fault = f;
+}
+
+uint8_t *model_card(void)
+{
+    return card;
+}
+
+size_t model_card_blocks(void)
+{
+    return card_blocks;
+}
+
+void *model_ram_alloc(size_t bytes, uint32_t *pa)
+{
+    size_t start = (ram_used + 0xfff) & ~(size_t)0xfff;
+    if (start + bytes > ram_size) {
+        return NULL;
+    }
+    ram_used = start + bytes;
+    *pa = MODEL_PHYS_BASE + start;
+    return ram + start;
+}
+
+static uint8_t *ram_at(uint32_t pa, size_t len)
+{
+    if (pa < MODEL_PHYS_BASE || pa - MODEL_PHYS_BASE + len > ram_size) {
+        return NULL;
+    }
+    return ram + (pa - MODEL_PHYS_BASE);
+}
+
+bool model_irq_line(void)
+{
+    return (*reg(REG_STAT) & *reg(REG_ISE)) != 0;
+}
+
+static void finish_transfer(bool multi)
+{
+    if (multi && (*reg(REG_CMD) & CMD_ACEN)) {
+        model_stats.auto_cmd12++;
+    }
+    pio.active = false;
+    raise(STAT_TC);
+}
+
+/// Walk the ADMA2 descriptor table, moving \p len bytes of the card at \p off
+static bool adma_transfer(bool read, size_t off, size_t len)
+{
+    uint32_t desc_pa = *reg(REG_ADMASAL);
+
+    if (!(*reg(REG_CON) & CON_DMA_MNS) || HCTL_DMAS(*reg(REG_HCTL)) != 2) {
+        return false;
+    }
+
+    for (int line = 0; line < ADMA2_MAX_LINES; line++, desc_pa += 8) {
+        uint8_t *d = ram_at(desc_pa, 8);
+        if (d == NULL) {
+            return false;
+        }
+        uint16_t attr, dlen;
+        uint32_t addr;
+        memcpy(&attr, d, 2);
+        memcpy(&dlen, d + 2, 2);
+        memcpy(&addr, d + 4, 4);
+
+        if (!(attr & ADMA2_VALID) || (line == 0 && fault == FAULT_ADMA)) {
+            return false;
+        }
+        if ((attr & ADMA2_ACT_MASK) == ADMA2_ACT_TRAN) {
+            size_t n = dlen == 0 ? 0x10000 : dlen;
+            uint8_t *mem = ram_at(addr, n);
+            if (mem == NULL || n > len) {
+                *reg(REG_ADMAES) |= (n > len) ? (1u << 2) : 0; // LME
+                return false;
+            }
+            if (read) {
+                memcpy(mem, card + off, n);
+            } else {
+                memcpy(card + off, mem, n);
+            }
+            off += n;
+            len -= n;
+            model_stats.dma_bytes += n;
+        }
+        if (attr & ADMA2_END) {
+            if (len != 0) {
+                *reg(REG_ADMAES) |= 1u << 2;
+                return false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static void data_command(uint32_t cmd, uint32_t lba)
+{
+    uint32_t blk = *reg(REG_BLK);
+    uint32_t blen = blk & 0xfff;
+    bool multi = (cmd & CMD_MSBS) != 0;
+    uint32_t nblk = multi ? blk >> 16 : 1;
+    bool read = (cmd & CMD_DDIR) != 0;
+
+    model_stats.data_commands++;
+
+    if (!selected || blen != MODEL_BLOCK_SIZE || nblk == 0 ||
+        (multi && !(cmd & CMD_BCE)) || lba + (size_t)nblk > card_blocks) {
+        // the card flags an address error and never sends data
+        raise(STAT_DTO);
+        return;
+    }
+
+    if (fault == FAULT_DCRC) {
+        fault = FAULT_NONE;
+        raise(STAT_DCRC);
+        return;
+    }
+
+    if (cmd & CMD_DE) {
+        bool ok = adma_transfer(read, (size_t)lba * MODEL_BLOCK_SIZE,
+                                (size_t)nblk * MODEL_BLOCK_SIZE);
+        fault = FAULT_NONE;
+        if (!ok) {
+            raise(STAT_ADMAE);
+            return;
+        }
+        finish_transfer(multi);
+        return;
+    }
+
+    pio.active = true;
+    pio.read = read;
+    pio.multi = multi;
+    pio.lba = lba;
+    pio.left = nblk;
+    pio.word = 0;
+    raise(read ? STAT_BRR : STAT_BWR);
+}
+
+static void command(uint32_t cmd)
+{
+    uint32_t arg = *reg(REG_ARG);
+    uint32_t indx = CMD_INDX(cmd);
+    bool app = app_cmd;
+
+    model_stats.commands++;
+    app_cmd = false;
+
+    if (*reg(REG_CON) & CON_INIT) {
+        // initialization stream, no command on the line
+        raise(STAT_CC);
+        return;
+    }
+
+    if (fault == FAULT_CTO && (cmd & CMD_DP)) {
+        fault = FAULT_NONE;
+        raise(STAT_CTO);
+        return;
+    }
+
+    uint32_t r1 = selected ? (4u << 9) : (3u << 9);     // tran or stby
+    *reg(REG_RSP10) = r1;
+
+    switch (indx) {
+    case 0:
+        selected = false;
+        break;
+    case 8:
+        *reg(REG_RSP10) = arg & 0xfff;
+        break;
+    case 55:
+        app_cmd = true;
+        *reg(REG_RSP10) = r1 | (1u << 5);
+        break;
+    case 41:
+        if (!app) {
+            raise(STAT_CTO);
+            return;
+        }
+        // powered up, SDHC, 2.7-3.6V
+        *reg(REG_RSP10) = 0xc0ff8000;
+        break;
+    case 2:
+    case 9:
+        *reg(REG_RSP10) = 0x01234567;
+        *reg(REG_RSP32) = 0x89abcdef;
+        *reg(REG_RSP54) = 0x01234567;
+        *reg(REG_RSP76) = 0x89abcdef;
+        break;
+    case 3:
+        *reg(REG_RSP10) = (CARD_RCA << 16) | 0x0500;
+        break;
+    case 7:
+        selected = (arg >> 16) == CARD_RCA;
+        break;
+    case 12:
+    case 16:
+        break;
+    case 17:
+    case 18:
+    case 24:
+    case 25:
+        raise(STAT_CC);
+        data_command(cmd, arg);
+        return;
+    default:
+        raise(STAT_CTO);
+        return;
+    }
+    raise(STAT_CC);
+}
+
+static uint32_t data_read(void)
+{
+    if (!pio.active || !pio.read) {
+        raise(STAT_BADA);
+        return 0;
+    }
+
+    size_t off = (size_t)pio.lba * MODEL_BLOCK_SIZE + pio.word * 4;
+    uint32_t v;
+    memcpy(&v, card + off, 4);
+    model_stats.pio_words++;
+
+    if (++pio.word == MODEL_BLOCK_SIZE / 4) {
+        pio.word = 0;
+        pio.lba++;
+        if (--pio.left == 0) {
+            finish_transfer(pio.multi);
+        } else {
+            raise(STAT_BRR);
+        }
+    }
+    return v;
+}
+
+static void data_write(uint32_t v)
+{
+    if (!pio.active || pio.read) {
+        raise(STAT_BADA);
+        return;
+    }
+
+    size_t off = (size_t)pio.lba * MODEL_BLOCK_SIZE + pio.word * 4;
+    memcpy(card + off, &v, 4);
+    model_stats.pio_words++;
+
+    if (++pio.word == MODEL_BLOCK_SIZE / 4) {
+        pio.word = 0;
+        pio.lba++;
+        if (--pio.left == 0) {
+            finish_transfer(pio.multi);
+        } else {
+            raise(STAT_BWR);
+        }
+    }
+}
+
+uint32_t model_read(uint32_t offset)
+{
+    uint32_t v;
+
+    model_stats.reg_reads++;
+
+    switch (offset) {
+    case REG_HL_HWINFO:
+        return adma_present ? 0x1 : 0x0;
+    case REG_SYSSTATUS:
+        return 0x1;             // reset done
+    case REG_PSTATE:
+        return pio.active ? PSTATE_DATI : 0x0;
+    case REG_DATA:
+        return data_read();
+    case REG_STAT:
+        v = *reg(REG_STAT);
+        return (v & STAT_ERRORS) ? v | STAT_ERRI : v;
+    case REG_SYSCTL:
+        // line resets read back as set once, then as done
+        v = *reg(REG_SYSCTL) | SYSCTL_ICS;
+        *reg(REG_SYSCTL) &= ~(SYSCTL_SRC | SYSCTL_SRD);
+        return v;
+    default:
+        return *reg(offset);
+    }
+}
+
+void model_write(uint32_t offset, uint32_t val)
+{
+    model_stats.reg_writes++;
+
+    switch (offset) {
+    case REG_STAT:
+        // write 1 to clear
+        *reg(REG_STAT) &= ~val;
+        break;
+    case REG_CMD:
+        *reg(REG_CMD) = val;
+        command(val);
+        break;
+    case REG_DATA:
+        data_write(val);
+        break;
+    case REG_SYSCONFIG:
+        *reg(REG_SYSCONFIG) = val & ~SYSCONFIG_SOFTRESET;
+        break;
+    case REG_SYSCTL:
+        if (val & SYSCTL_SRD) {
+            pio.active = false;
+        }
+        *reg(REG_SYSCTL) = val & ~SYSCTL_SRA;
+        break;
+    case REG_HL_HWINFO:
+    case REG_SYSSTATUS:
+    case REG_PSTATE:
+        break;
+    default:
+        *reg(offset) = val;
+        break;
+    }
+}
@@ -0,0 +1,62 @@
+/**
+ * \file
+ * \brief Register-level software model of the OMAP44xx MMCHS with an SD card
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef MMCHS_MODEL_H
+#define MMCHS_MODEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MODEL_BLOCK_SIZE    512
+#define MODEL_PHYS_BASE     0x80000000u     ///< Where model RAM starts
+
+/// Errors the model can be told to raise on the next data command
+enum model_fault {
+    FAULT_NONE,
+    FAULT_DCRC,         ///< Data CRC error in the first block
+    FAULT_CTO,          ///< The card does not answer the command
+    FAULT_ADMA,         ///< First descriptor line marked invalid
+};
+
+struct model_stats {
+    uint64_t reg_reads;
+    uint64_t reg_writes;
+    uint64_t commands;
+    uint64_t data_commands;
+    uint64_t auto_cmd12;
+    uint64_t irqs;
+    uint64_t dma_bytes;
+    uint64_t pio_words;
+};
+
+extern struct model_stats model_stats;
+
+void model_init(size_t card_blocks, size_t ram_bytes, bool adma);
+void model_reset_stats(void);
+void model_inject(enum model_fault fault);
+
+uint8_t *model_card(void);
+size_t model_card_blocks(void);
+
+/// Model RAM, the memory ADMA transfers go to
+void *model_ram_alloc(size_t bytes, uint32_t *pa);
+
+uint32_t model_read(uint32_t offset);
+void model_write(uint32_t offset, uint32_t val);
+
+/// The MMC1 interrupt line: MMCHS_STAT & MMCHS_ISE
+bool model_irq_line(void);
+
+#endif // MMCHS_MODEL_H
@@ -0,0 +1,355 @@
+/**
+ * \file
+ * \brief Host test and benchmark of the MMCHS driver against a register model
+ *
+ * Runs usr/mmchs_driver/mmchs.c unchanged, its register accesses going
+ * through the mackerel accessors generated from omap44xx_mmchs1.dev into
+ * the software model of mmchs_model.c. The driver is brought up like on
+ * the board (mmchs_init() with card identification) in three set-ups:
+ * ADMA2 with the MMC1 interrupt, ADMA2 polled, and PIO with the interrupt,
+ * the latter as on a controller without the master DMA generic. Each set-up
+ * checks single and multi-block reads and writes against the card image,
+ * transfers crossing MMCHS_MAX_BLOCKS, and recovery from an injected data
+ * CRC error, a command timeout, an ADMA descriptor error and an access past
+ * the end of the card. When the driver waits for the interrupt, it must
+ * already be pending: the driver never blocks on an interrupt that the
+ * hardware would not raise.
+ *
+ * The benchmark then reads 1MB with one mmchs_read_block() per block, as
+ * the ata_rw28 service did, and with mmchs_read_blocks().
+ *
+ * Build and run on the host, in a build directory (make generates the
+ * mackerel headers of the ARMv7 build in armv7/include/dev first):
+ *
+ *   make tools/bin/mmchsmodel
+ *   tools/bin/mmchsmodel
+ *
+ * Output is one line per set-up and one per benchmark run:
+ *   setup=<name> ok
+ *   setup=<name> mode=<per-block|multi-block> commands=<n> irqs=<n>
+ *   regs_per_mb=<accesses> time_ms=<host>
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/inthandler.h>
+#include <driverkit/driverkit.h>
+#include <arch/arm/omap44xx/device_registers.h>
+#include <time.h>
+
+#include "mmchs_model.h"
+#include "../../usr/mmchs_driver/mmchs.h"
+
+#define CARD_BLOCKS     8192                    // 4MB
+#define MODEL_RAM       (1024 * 1024)
+#define MMCHS_IRQ       (32 + 83)
+#define BENCH_BLOCKS    2048                    // 1MB
+#define MAX_FRAMES      8
+
+struct capref cap_irq;
+
+static struct {
+    void *va;
+    uint32_t pa;
+    size_t bytes;
+} frames[MAX_FRAMES];
+static int nframes;
+static bool mapped_uncached;
+
+static char device_page[4096];
+
+static struct {
+    bool available;
+    struct waitset *ws;
+    interrupt_handler_fn handler;
+    void *arg;
+    bool masked;            ///< delivered, not yet acked
+} irq;
+
+static uint64_t stalls;     ///< waits that would block forever
+
+static const char *setup_name;
+
+errval_t map_device_register(lpaddr_t address, size_t size, lvaddr_t *return_address)
+{
+    (void)size;
+    assert(address == OMAP44XX_MMCHS1);
+    *return_address = (lvaddr_t)device_page;
+    return SYS_ERR_OK;
+}
+
+errval_t frame_alloc(struct capref *dest, size_t bytes, size_t *retbytes)
+{
+    if (nframes == MAX_FRAMES) {
+        return LIB_ERR_FRAME_ALLOC;
+    }
+    void *va = model_ram_alloc(bytes, &frames[nframes].pa);
+    if (va == NULL) {
+        return LIB_ERR_FRAME_ALLOC;
+    }
+    frames[nframes].va = va;
+    frames[nframes].bytes = bytes;
+    dest->slot = nframes++;
+    if (retbytes != NULL) {
+        *retbytes = bytes;
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t invoke_frame_identify(struct capref frame, struct frame_identity *ret)
+{
+    assert(frame.slot < nframes);
+    ret->base = frames[frame.slot].pa;
+    ret->bits = 0;
+    return SYS_ERR_OK;
+}
+
+struct paging_state *get_current_paging_state(void)
+{
+    return NULL;
+}
+
+errval_t paging_map_frame_attr(struct paging_state *st, void **buf,
+                               size_t bytes, struct capref frame,
+                               int flags, void *arg1, void *arg2)
+{
+    (void)st; (void)arg1; (void)arg2;
+    assert(frame.slot < nframes && bytes <= frames[frame.slot].bytes);
+    mapped_uncached = (flags & VREGION_FLAGS_NOCACHE) != 0;
+    *buf = frames[frame.slot].va;
+    return SYS_ERR_OK;
+}
+
+errval_t inthandler_setup_arm_ws(struct waitset *ws,
+        interrupt_handler_fn handler, void *handler_arg, uint32_t irqno)
+{
+    if (!irq.available) {
+        return LIB_ERR_NOT_IMPLEMENTED;
+    }
+    assert(irqno == MMCHS_IRQ);
+    irq.ws = ws;
+    irq.handler = handler;
+    irq.arg = handler_arg;
+    irq.masked = false;
+    return SYS_ERR_OK;
+}
+
+void waitset_init(struct waitset *ws)
+{
+    ws->id = 0;
+}
+
+errval_t event_dispatch(struct waitset *ws)
+{
+    if (ws != irq.ws || irq.masked || !model_irq_line()) {
+        stalls++;
+        return LIB_ERR_NO_EVENT;
+    }
+    irq.masked = true;
+    model_stats.irqs++;
+    irq.handler(irq.arg);
+    return SYS_ERR_OK;
+}
+
+errval_t invoke_irqtable_ack(struct capref irqcap, int irqno)
+{
+    (void)irqcap;
+    assert(irqno == MMCHS_IRQ && irq.masked);
+    irq.masked = false;
+    return SYS_ERR_OK;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int fail(const char *what, errval_t err)
+{
+    fprintf(stderr, "setup=%s: %s: %s\n", setup_name, what,
+            err_getstring(err));
+    return -1;
+}
+
+static int check_read(size_t lba, size_t count, uint8_t *buf)
+{
+    uint64_t cmds = model_stats.data_commands;
+
+    memset(buf, 0xa5, count * MMCHS_BLOCK_SIZE);
+    errval_t err = mmchs_read_blocks(lba, count, buf);
+    if (err_is_fail(err)) {
+        return fail("read", err);
+    }
+    if (memcmp(buf, model_card() + lba * MMCHS_BLOCK_SIZE,
+               count * MMCHS_BLOCK_SIZE) != 0) {
+        fprintf(stderr, "setup=%s: read of %zu blocks at %zu differs\n",
+                setup_name, count, lba);
+        return -1;
+    }
+    uint64_t expect = (count + MMCHS_MAX_BLOCKS - 1) / MMCHS_MAX_BLOCKS;
+    if (model_stats.data_commands - cmds != expect) {
+        fprintf(stderr, "setup=%s: %zu blocks took %"PRIu64" commands\n",
+                setup_name, count, model_stats.data_commands - cmds);
+        return -1;
+    }
+    return 0;
+}
+
+static int check_write(size_t lba, size_t count, uint8_t *buf)
+{
+    for (size_t i = 0; i < count * MMCHS_BLOCK_SIZE; i++) {
+        buf[i] = rand();
+    }
+    errval_t err = mmchs_write_blocks(lba, count, buf);
+    if (err_is_fail(err)) {
+        return fail("write", err);
+    }
+    if (memcmp(buf, model_card() + lba * MMCHS_BLOCK_SIZE,
+               count * MMCHS_BLOCK_SIZE) != 0) {
+        fprintf(stderr, "setup=%s: write of %zu blocks at %zu differs\n",
+                setup_name, count, lba);
+        return -1;
+    }
+    return check_read(lba, count, buf);
+}
+
+static int check_fault(enum model_fault fault, errval_t expect, uint8_t *buf)
+{
+    model_inject(fault);
+    errval_t err = mmchs_read_blocks(10, 4, buf);
+    model_inject(FAULT_NONE);
+    if (err != expect) {
+        fprintf(stderr, "setup=%s: fault %d gave %s, expected %s\n",
+                setup_name, fault, err_getstring(err), err_getstring(expect));
+        return -1;
+    }
+    // the controller is usable again
+    return check_read(10, 4, buf);
+}
+
+static int run_checks(bool adma, uint8_t *buf)
+{
+    static const size_t counts[] = { 1, 2, 7, MMCHS_MAX_BLOCKS,
+                                     MMCHS_MAX_BLOCKS + 1, 300 };
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        if (check_read(100 + i * 7, counts[i], buf) != 0) {
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        if (check_write(1000 + i * 400, counts[i], buf) != 0) {
+            return -1;
+        }
+    }
+
+    if (check_fault(FAULT_DCRC, MMC_ERR_TRANSFER, buf) != 0 ||
+        check_fault(FAULT_CTO, MMC_ERR_COMMAND, buf) != 0) {
+        return -1;
+    }
+    if (adma && check_fault(FAULT_ADMA, MMC_ERR_DMA, buf) != 0) {
+        return -1;
+    }
+
+    errval_t err = mmchs_read_blocks(CARD_BLOCKS - 1, 2, buf);
+    if (err != MMC_ERR_TRANSFER) {
+        return fail("read past the end of the card", err);
+    }
+    return check_read(CARD_BLOCKS - 2, 2, buf);
+}
+
+static int bench(bool per_block, uint8_t *buf)
+{
+    model_reset_stats();
+    uint64_t start = now_ns();
+
+    if (per_block) {
+        for (size_t i = 0; i < BENCH_BLOCKS; i++) {
+            errval_t err = mmchs_read_block(i, buf + i * MMCHS_BLOCK_SIZE);
+            if (err_is_fail(err)) {
+                return fail("read_block", err);
+            }
+        }
+    } else {
+        errval_t err = mmchs_read_blocks(0, BENCH_BLOCKS, buf);
+        if (err_is_fail(err)) {
+            return fail("read_blocks", err);
+        }
+    }
+
+    uint64_t elapsed = now_ns() - start;
+    if (memcmp(buf, model_card(), BENCH_BLOCKS * MMCHS_BLOCK_SIZE) != 0) {
+        fprintf(stderr, "setup=%s: benchmark data differs\n", setup_name);
+        return -1;
+    }
+
+    double mb = BENCH_BLOCKS * MMCHS_BLOCK_SIZE / (1024.0 * 1024.0);
+    printf("setup=%s mode=%s commands=%"PRIu64" irqs=%"PRIu64
+           " regs_per_mb=%.0f time_ms=%.1f\n", setup_name,
+           per_block ? "per-block" : "multi-block", model_stats.data_commands,
+           model_stats.irqs,
+           (model_stats.reg_reads + model_stats.reg_writes) / mb,
+           elapsed / 1e6);
+    return 0;
+}
+
+static int run_setup(const char *name, bool adma, bool with_irq, uint8_t *buf)
+{
+    setup_name = name;
+    model_init(CARD_BLOCKS, MODEL_RAM, adma);
+    nframes = 0;
+    mapped_uncached = false;
+    memset(&irq, 0, sizeof(irq));
+    irq.available = with_irq;
+    stalls = 0;
+
+    mmchs_init();
+
+    if (adma && !mapped_uncached) {
+        fprintf(stderr, "setup=%s: ADMA buffer mapped cacheable\n", name);
+        return -1;
+    }
+    if (run_checks(adma, buf) != 0) {
+        return -1;
+    }
+    if (with_irq && stalls != 0) {
+        fprintf(stderr, "setup=%s: driver waited %"PRIu64" times for an "
+                "interrupt that was not raised\n", name, stalls);
+        return -1;
+    }
+    if (adma && model_stats.pio_words != 0) {
+        fprintf(stderr, "setup=%s: PIO used with ADMA\n", name);
+        return -1;
+    }
+    printf("setup=%s ok\n", name);
+
+    if (bench(true, buf) != 0 || bench(false, buf) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    uint8_t *buf = malloc(BENCH_BLOCKS * MMCHS_BLOCK_SIZE);
+    assert(buf != NULL);
+
+    if (run_setup("adma-irq", true, true, buf) != 0 ||
+        run_setup("adma-poll", true, false, buf) != 0 ||
+        run_setup("pio-irq", false, true, buf) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    free(buf);
+    return EXIT_SUCCESS;
+}
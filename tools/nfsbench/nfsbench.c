@@ -0,0 +1,677 @@
+/**
+ * \file
+ * \brief Host benchmark for the cached NFS file layer (nfs_file.c)
+ *
+ * Runs lib/nfs/nfs_file.c against a stand-in for the NFS client calls it
+ * uses (nfs_mount, nfs_getattr, nfs_read_view) that serves a file from
+ * memory. READ replies are handed over as chains of pbufs split like IP
+ * fragments, decoded with the real xdr_pbuf.c, so the zero-copy path from
+ * the packet buffers to the page cache is checked as well, including words
+ * that span pbufs and pbuf references that outlive the reply.
+ * Replies are delivered in order of a simulated clock, so throughput
+ * depends on how many READs the client keeps in flight rather than on the
+ * host. The link model is a round trip of RTT_US plus the serialisation of
+ * each reply on a LINK_MBIT link that carries one reply at a time, which is
+ * roughly a Pandaboard talking to a server on the same switch.
+ *
+ * The benchmark compares reading a file with one nfs_read() per chunk, as
+ * usr/ applications do today, against nfs_file_read() with a cold cache, a
+ * warm cache after reopening, and after the file has changed on the server,
+ * and the same for random reads. All data read is checked.
+ *
+ * Build and run on the host, in a build directory:
+ *
+ *   make tools/bin/nfsbench
+ *   tools/bin/nfsbench
+ *
+ * Output is one line per run:
+ *   mode=<name> chunk=<bytes> bytes=<read> time_ms=<simulated> mbs=<MB/s>
+ *   rpcs=<calls sent> hits=<pages> misses=<pages> readahead=<pages>
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/deferred.h>
+#include <lwip/pbuf.h>
+#include <nfs/nfs_file.h>
+#include "../../lib/nfs/xdr_pbuf.h"
+
+#define RTT_US          200     // round trip time to the server
+#define LINK_MBIT       100     // link speed
+#define CALL_US         10      // client CPU time per call and reply
+#define HDR_BYTES       120     // Ethernet, IP, UDP and RPC headers per reply
+#define MAX_READ        8192    // largest READ the server answers in full
+#define REPLY_HDR       112     // RPC and NFS reply header before the data
+#define FRAG_FIRST      1472    // UDP payload in the first IP fragment
+#define FRAG_NEXT       1480    // IP payload in the other fragments
+
+#define FILE_SIZE       (4 * 1024 * 1024 + 1000)
+#define RANDOM_READS    256
+
+/// File handles of the two objects on the server
+#define FH_ROOT         1
+#define FH_FILE         2
+
+struct nfs_client {
+    int mounted;
+};
+
+enum event_type {
+    EV_MOUNT,
+    EV_GETATTR,
+    EV_READ,
+    EV_READ_VIEW,
+};
+
+/// A reply on its way to the client
+struct event {
+    systime_t time;
+    enum event_type type;
+    void *callback;
+    void *cbarg;
+    uint32_t obj;
+    uint64_t offset;
+    uint32_t count;
+    struct event *next;
+};
+
+static struct nfs_client client;
+static struct event *events;        // sorted by time
+static systime_t now, link_free;
+static uint64_t rpcs;
+static uint32_t file_version;       // bumped when the file changes
+static uint8_t *buf;
+static int failures;
+static int pbufs_live;               // pbufs allocated and not yet freed
+static unsigned replies;
+
+systime_t get_system_time(void)
+{
+    return now;
+}
+
+static uint8_t file_byte(uint64_t off)
+{
+    return (off * 7 + (off >> 12) + file_version * 13) & 0xff;
+}
+
+/// Time at which a reply of the given size reaches the client
+static systime_t reply_time(size_t bytes)
+{
+    systime_t start = now + RTT_US / 2;
+
+    if (start < link_free) {
+        start = link_free;
+    }
+    link_free = start + (bytes + HDR_BYTES) * 8 / LINK_MBIT;
+    return link_free + RTT_US / 2;
+}
+
+static void send_call(enum event_type type, void *callback, void *cbarg,
+                      uint32_t obj, uint64_t offset, uint32_t count)
+{
+    struct event *ev = malloc(sizeof(*ev)), **p;
+    assert(ev != NULL);
+
+    now += CALL_US;
+    rpcs++;
+    ev->type = type;
+    ev->callback = callback;
+    ev->cbarg = cbarg;
+    ev->obj = obj;
+    ev->offset = offset;
+    ev->count = count;
+    ev->time = reply_time(type == EV_READ || type == EV_READ_VIEW ? count
+                                                                  : 100);
+
+    for (p = &events; *p != NULL && (*p)->time <= ev->time; p = &(*p)->next) {
+    }
+    ev->next = *p;
+    *p = ev;
+}
+
+static void get_attr(uint32_t obj, struct fattr3 *attr)
+{
+    memset(attr, 0, sizeof(*attr));
+    attr->type = (obj == FH_ROOT) ? NF3DIR : NF3REG;
+    attr->mode = 0644;
+    attr->nlink = 1;
+    attr->size = (obj == FH_ROOT) ? 4096 : FILE_SIZE;
+    attr->fileid = obj;
+    attr->mtime.seconds = 1420070400 + file_version;
+    attr->ctime = attr->mtime;
+}
+
+static uint32_t fh_obj(struct nfs_fh3 fh)
+{
+    uint32_t obj;
+
+    assert(fh.data_len == sizeof(obj));
+    memcpy(&obj, fh.data_val, sizeof(obj));
+    return obj;
+}
+
+/**
+ * Build the pbuf chain of a READ reply: a header, the data length and the
+ * data, split like IP fragments. Every other reply has the first fragment
+ * end in the middle of the length word.
+ */
+static struct pbuf *read_reply_chain(uint64_t offset, uint32_t count)
+{
+    size_t total = REPLY_HDR + 4 + RNDUP(count);
+    uint8_t *flat = calloc(1, total);
+    struct pbuf *head = NULL, **tail = &head;
+    uint32_t len = htonl(count);
+
+    assert(flat != NULL);
+    memset(flat, 0xee, REPLY_HDR);
+    memcpy(flat + REPLY_HDR, &len, 4);
+    for (uint32_t i = 0; i < count; i++) {
+        flat[REPLY_HDR + 4 + i] = file_byte(offset + i);
+    }
+
+    size_t first = (replies++ % 2) ? REPLY_HDR + 2 : FRAG_FIRST;
+    for (size_t pos = 0; pos < total;) {
+        size_t n = (pos == 0) ? first : FRAG_NEXT;
+        if (n > total - pos) {
+            n = total - pos;
+        }
+        struct pbuf *p = pbuf_alloc(PBUF_RAW, n, PBUF_POOL);
+        assert(p != NULL);
+        memcpy(p->payload, flat + pos, n);
+        *tail = p;
+        tail = &p->next;
+        pos += n;
+    }
+    for (struct pbuf *p = head; p != NULL; p = p->next) {
+        p->tot_len = total;
+        total -= p->len;
+    }
+    free(flat);
+    return head;
+}
+
+/// Deliver the next reply, advancing the clock to its arrival
+static void dispatch(void)
+{
+    struct event *ev = events;
+
+    assert(ev != NULL);
+    events = ev->next;
+    if (now < ev->time) {
+        now = ev->time;
+    }
+    now += CALL_US;
+
+    switch (ev->type) {
+    case EV_MOUNT: {
+        uint32_t obj = FH_ROOT;
+        struct nfs_fh3 fh = { .data_len = sizeof(obj),
+                              .data_val = (char *)&obj };
+        if (ev->callback != NULL) { // NULL for the portmap lookups
+            client.mounted = 1;
+            ((nfs_mount_callback_t)ev->callback)(ev->cbarg, &client, MNT3_OK,
+                                                 fh);
+        }
+        break;
+    }
+
+    case EV_GETATTR: {
+        GETATTR3res res = { .status = NFS3_OK };
+        get_attr(ev->obj, &res.GETATTR3res_u.resok.obj_attributes);
+        ((nfs_getattr_callback_t)ev->callback)(ev->cbarg, &client, &res);
+        break;
+    }
+
+    case EV_READ: {
+        READ3res res = { .status = NFS3_OK };
+        READ3resok *ok = &res.READ3res_u.resok;
+        uint64_t end = ev->offset + ev->count;
+
+        if (end > FILE_SIZE) {
+            end = FILE_SIZE;
+        }
+        ok->count = (end > ev->offset) ? end - ev->offset : 0;
+        ok->eof = (end == FILE_SIZE);
+        ok->data.data_len = ok->count;
+        ok->data.data_val = malloc(ok->count + 1);
+        assert(ok->data.data_val != NULL);
+        for (uint32_t i = 0; i < ok->count; i++) {
+            ok->data.data_val[i] = file_byte(ev->offset + i);
+        }
+        ok->file_attributes.attributes_follow = TRUE;
+        get_attr(ev->obj, &ok->file_attributes.post_op_attr_u.attributes);
+        ((nfs_read_callback_t)ev->callback)(ev->cbarg, &client, &res);
+        break;
+    }
+
+    case EV_READ_VIEW: {
+        // decoded like read_view_reply_handler() in nfs.c
+        READ3res res = { .status = NFS3_OK };
+        READ3resok *ok = &res.READ3res_u.resok;
+        struct nfs_data_view view;
+        uint64_t end = ev->offset + ev->count;
+        XDR xdr;
+        bool rb;
+
+        if (end > FILE_SIZE) {
+            end = FILE_SIZE;
+        }
+        ok->count = (end > ev->offset) ? end - ev->offset : 0;
+        ok->eof = (end == FILE_SIZE);
+        ok->file_attributes.attributes_follow = TRUE;
+        get_attr(ev->obj, &ok->file_attributes.post_op_attr_u.attributes);
+
+        xdr_pbuf_create_recv(&xdr, read_reply_chain(ev->offset, ok->count));
+        rb = XDR_SETPOS(&xdr, REPLY_HDR)
+             && xdr_u_int(&xdr, &ok->data.data_len)
+             && xdr_pbuf_getview(&xdr, &view.pbuf, &view.offset,
+                                 ok->data.data_len);
+        assert(rb && ok->data.data_len == ok->count);
+        view.len = ok->data.data_len;
+        ((nfs_read_view_callback_t)ev->callback)(ev->cbarg, &client, &res,
+                                                 &view);
+        XDR_DESTROY(&xdr); // as rpc_recv_handler() frees the packet
+        break;
+    }
+    }
+    free(ev);
+}
+
+static void wait_for(volatile bool *done)
+{
+    while (!*done) {
+        dispatch();
+    }
+}
+
+/*
+ * Stand-in for the NFS client calls used by nfs_file.c
+ */
+
+struct nfs_client *nfs_mount(struct ip_addr server, const char *path,
+                             nfs_mount_callback_t callback, void *cbarg)
+{
+    (void)path; (void)server;
+    // portmap lookups of the mount and NFS ports, then MNT
+    send_call(EV_MOUNT, NULL, NULL, 0, 0, 0);
+    dispatch();
+    send_call(EV_MOUNT, NULL, NULL, 0, 0, 0);
+    dispatch();
+    send_call(EV_MOUNT, callback, cbarg, FH_ROOT, 0, 0);
+    return &client;
+}
+
+err_t nfs_getattr(struct nfs_client *c, struct nfs_fh3 fh,
+                  nfs_getattr_callback_t callback, void *cbarg)
+{
+    (void)c;
+    send_call(EV_GETATTR, callback, cbarg, fh_obj(fh), 0, 0);
+    return ERR_OK;
+}
+
+err_t nfs_read(struct nfs_client *c, struct nfs_fh3 fh, offset3 offset,
+               count3 count, nfs_read_callback_t callback, void *cbarg)
+{
+    (void)c;
+    send_call(EV_READ, callback, cbarg, fh_obj(fh), offset,
+              count > MAX_READ ? MAX_READ : count);
+    return ERR_OK;
+}
+
+err_t nfs_read_view(struct nfs_client *c, struct nfs_fh3 fh, offset3 offset,
+                    count3 count, nfs_read_view_callback_t callback,
+                    void *cbarg)
+{
+    (void)c;
+    send_call(EV_READ_VIEW, callback, cbarg, fh_obj(fh), offset,
+              count > MAX_READ ? MAX_READ : count);
+    return ERR_OK;
+}
+
+void nfs_copyfh(struct nfs_fh3 *dest, struct nfs_fh3 src)
+{
+    dest->data_len = src.data_len;
+    dest->data_val = malloc(src.data_len);
+    assert(dest->data_val != NULL);
+    memcpy(dest->data_val, src.data_val, src.data_len);
+}
+
+void nfs_freefh(struct nfs_fh3 fh)
+{
+    free(fh.data_val);
+}
+
+errval_t nfsstat_to_errval(enum nfsstat3 s)
+{
+    switch (s) {
+    case NFS3_OK:
+        return SYS_ERR_OK;
+    case NFS3ERR_NOENT:
+        return NFS_ERR_NOENT;
+    case NFS3ERR_ISDIR:
+        return NFS_ERR_ISDIR;
+    case NFS3ERR_STALE:
+        return NFS_ERR_STALE;
+    default:
+        return NFS_ERR_IO;
+    }
+}
+
+/*
+ * Stand-in for the parts of lwIP used by xdr_pbuf.c
+ */
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t size, pbuf_type type)
+{
+    (void)layer;
+    struct pbuf *p = malloc(sizeof(*p) + size);
+
+    if (p != NULL) {
+        memset(p, 0, sizeof(*p));
+        p->payload = p + 1;
+        p->len = p->tot_len = p->buff_len = size;
+        p->type = type;
+        p->ref = 1;
+        pbufs_live++;
+    }
+    return p;
+}
+
+void pbuf_ref(struct pbuf *p)
+{
+    p->ref++;
+}
+
+u8_t pbuf_free(struct pbuf *p)
+{
+    u8_t count = 0;
+
+    while (p != NULL && --p->ref == 0) {
+        struct pbuf *next = p->next;
+        free(p);
+        pbufs_live--;
+        count++;
+        p = next;
+    }
+    return count;
+}
+
+u32_t lwip_htonl(u32_t n)
+{
+    return __builtin_bswap32(n);
+}
+
+u32_t lwip_ntohl(u32_t n)
+{
+    return __builtin_bswap32(n);
+}
+
+/*
+ * Benchmark
+ */
+
+static struct nfs_fh3 root_fh, file_fh;
+static uint32_t file_obj = FH_FILE;
+
+static void check(int ok, const char *what, uint64_t a)
+{
+    if (!ok && failures++ < 20) {
+        fprintf(stderr, "FAIL %s (%"PRIu64")\n", what, a);
+    }
+}
+
+static void check_data(uint64_t offset, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != file_byte(offset + i)) {
+            check(0, "data", offset + i);
+            return;
+        }
+    }
+}
+
+static void mount_cb(void *arg, struct nfs_client *c, enum mountstat3 stat,
+                     struct nfs_fh3 fh)
+{
+    (void)c;
+    assert(stat == MNT3_OK);
+    nfs_copyfh(&root_fh, fh);
+    *(volatile bool *)arg = true;
+}
+
+/// State of one synchronous call
+struct call {
+    bool done;
+    errval_t err;
+    size_t bytes;
+    uint8_t *dst;
+    struct nfs_file *file;
+};
+
+static void open_cb(void *arg, struct nfs_file *file, errval_t err)
+{
+    struct call *c = arg;
+    c->err = err;
+    c->file = file;
+    c->done = true;
+}
+
+static void file_read_cb(void *arg, struct nfs_file *file, errval_t err,
+                         size_t bytes)
+{
+    (void)file;
+    struct call *c = arg;
+    c->err = err;
+    c->bytes = bytes;
+    c->done = true;
+}
+
+static void raw_read_cb(void *arg, struct nfs_client *c, READ3res *result)
+{
+    (void)c;
+    struct call *call = arg;
+
+    assert(result != NULL && result->status == NFS3_OK);
+    call->bytes = result->READ3res_u.resok.data.data_len;
+    memcpy(call->dst, result->READ3res_u.resok.data.data_val, call->bytes);
+    xdr_READ3res(&xdr_free, result);
+    call->done = true;
+}
+
+static struct nfs_file *open_file(struct nfs_fh3 fh, errval_t *err)
+{
+    struct call c = { .done = false };
+
+    check(err_is_ok(nfs_file_open(&client, fh, open_cb, &c)), "open", 0);
+    wait_for(&c.done);
+    *err = c.err;
+    return c.file;
+}
+
+/// Read [offset, offset + len) with nfs_read(), one call at a time
+static void raw_read(uint64_t offset, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len && offset + got < FILE_SIZE) {
+        struct call c = { .done = false, .dst = buf + got };
+
+        nfs_read(&client, file_fh, offset + got, len - got, raw_read_cb, &c);
+        wait_for(&c.done);
+        got += c.bytes;
+    }
+    check(got == len || offset + got == FILE_SIZE, "raw length", offset);
+    check_data(offset, got);
+}
+
+static void file_read(struct nfs_file *f, uint64_t offset, size_t len)
+{
+    struct call c = { .done = false };
+    size_t expect = len;
+
+    if (offset + expect > FILE_SIZE) {
+        expect = FILE_SIZE - offset;
+    }
+    check(err_is_ok(nfs_file_read(f, offset, buf, len, file_read_cb, &c)),
+          "read call", offset);
+    wait_for(&c.done);
+    check(err_is_ok(c.err), "read", offset);
+    check(c.bytes == expect, "read length", offset);
+    check_data(offset, c.bytes);
+}
+
+struct run {
+    systime_t start;
+    uint64_t rpcs;
+    struct nfs_file_stats stats;
+};
+
+static void run_start(struct run *r)
+{
+    // let read-ahead of the previous run drain
+    while (events != NULL) {
+        dispatch();
+    }
+    r->start = now;
+    r->rpcs = rpcs;
+    nfs_file_get_stats(&r->stats);
+}
+
+static void run_end(struct run *r, const char *mode, size_t chunk,
+                    uint64_t bytes)
+{
+    struct nfs_file_stats s;
+    systime_t t = now - r->start;
+
+    nfs_file_get_stats(&s);
+    printf("mode=%s chunk=%zu bytes=%"PRIu64" time_ms=%.1f mbs=%.2f "
+           "rpcs=%"PRIu64" hits=%"PRIu64" misses=%"PRIu64" "
+           "readahead=%"PRIu64"\n", mode, chunk, bytes, t / 1000.0,
+           (double)bytes / t, rpcs - r->rpcs,
+           s.hits + s.inflight_hits - r->stats.hits - r->stats.inflight_hits,
+           s.misses - r->stats.misses, s.readahead - r->stats.readahead);
+}
+
+static void bench_sequential(size_t chunk)
+{
+    struct run r;
+    errval_t err;
+    struct nfs_file *f;
+
+    run_start(&r);
+    for (uint64_t off = 0; off < FILE_SIZE; off += chunk) {
+        raw_read(off, chunk);
+    }
+    run_end(&r, "nfs_read", chunk, FILE_SIZE);
+
+    nfs_file_invalidate(&client, file_fh);
+    run_start(&r);
+    f = open_file(file_fh, &err);
+    check(err_is_ok(err), "open", 0);
+    check(nfs_file_size(f) == FILE_SIZE, "size", nfs_file_size(f));
+    for (uint64_t off = 0; off < FILE_SIZE; off += chunk) {
+        file_read(f, off, chunk);
+    }
+    nfs_file_close(f);
+    run_end(&r, "cold", chunk, FILE_SIZE);
+
+    // the file is larger than the cache, so read a part that fits
+    uint64_t part = NFS_FILE_CACHE_PAGES / 2 * NFS_FILE_PAGE_SIZE;
+    f = open_file(file_fh, &err);
+    for (uint64_t off = 0; off < part; off += chunk) {
+        file_read(f, off, chunk);
+    }
+    nfs_file_close(f);
+
+    run_start(&r);
+    f = open_file(file_fh, &err);
+    for (uint64_t off = 0; off < part; off += chunk) {
+        file_read(f, off, chunk);
+    }
+    nfs_file_close(f);
+    run_end(&r, "warm", chunk, part);
+
+    // close-to-open: a change on the server is seen on the next open
+    file_version++;
+    run_start(&r);
+    f = open_file(file_fh, &err);
+    for (uint64_t off = 0; off < part; off += chunk) {
+        file_read(f, off, chunk);
+    }
+    nfs_file_close(f);
+    run_end(&r, "changed", chunk, part);
+}
+
+static void bench_random(void)
+{
+    struct run r;
+    errval_t err;
+    uint64_t offs[RANDOM_READS];
+    size_t chunk = NFS_FILE_PAGE_SIZE;
+
+    srand(1);
+    for (int i = 0; i < RANDOM_READS; i++) {
+        offs[i] = (rand() % (FILE_SIZE / chunk)) * chunk;
+    }
+
+    run_start(&r);
+    for (int i = 0; i < RANDOM_READS; i++) {
+        raw_read(offs[i], chunk);
+    }
+    run_end(&r, "nfs_read_random", chunk, RANDOM_READS * chunk);
+
+    file_version++;
+    run_start(&r);
+    struct nfs_file *f = open_file(file_fh, &err);
+    for (int i = 0; i < RANDOM_READS; i++) {
+        file_read(f, offs[i], chunk);
+    }
+    nfs_file_close(f);
+    run_end(&r, "random", chunk, RANDOM_READS * chunk);
+}
+
+int main(void)
+{
+    static const size_t chunks[] = { 1024, 4096, 16384 };
+    volatile bool mounted = false;
+    struct ip_addr server = { 0 };
+    errval_t err;
+
+    buf = malloc(65536);
+    assert(buf != NULL);
+
+    nfs_mount(server, "/", mount_cb, (void *)&mounted);
+    wait_for(&mounted);
+    file_fh.data_len = sizeof(file_obj);
+    file_fh.data_val = (char *)&file_obj;
+
+    struct nfs_file *f = open_file(root_fh, &err);
+    check(err == NFS_ERR_ISDIR && f == NULL, "open directory", err);
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        bench_sequential(chunks[i]);
+    }
+    bench_random();
+
+    while (events != NULL) {
+        dispatch();
+    }
+    nfs_freefh(root_fh);
+    check(pbufs_live == 0, "pbufs leaked", pbufs_live);
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,397 @@
+/**
+ * \file
+ * \brief Host cross-check and benchmark for lwIP's batched socket calls
+ *
+ * Runs the lwIP core, the netconn and socket layers and the tcpip thread
+ * (lib/lwip/src/{core,api}, sys_arch.c) with POSIX threads standing in for
+ * Barrelfish threads, and sends UDP datagrams over the loop interface
+ * (lib/lwip/src/netif/loopif.c) from one socket to another.
+ *
+ * The checks send a vector of datagrams with lwip_sendmmsg(), receive them
+ * with lwip_recvmmsg() and compare contents, lengths and source addresses,
+ * then try vectors longer than LWIP_MMSG_BATCH, truncation, MSG_DONTWAIT on
+ * an empty socket, an invalid destination and a partly invalid vector.
+ *
+ * The benchmark moves batches of 1 to 64 datagrams per round, either with
+ * one lwip_sendto()/lwip_recvfrom() per datagram or with one
+ * lwip_sendmmsg()/lwip_recvmmsg() per batch, and prints packets per second
+ * with netbench_batch_sweep() from lib/contmng/netbench.c.
+ *
+ * Build and run on the host, in a build directory:
+ *
+ *   make tools/bin/sockbench
+ *   tools/bin/sockbench
+ *
+ * Output is one line per batch size and mode:
+ *   Batch <mode>: SIZE[<batch>], N[<datagrams>], PPS[<datagrams per second>]
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <barrelfish/barrelfish.h>
+#include <lwip/init.h>
+#include <lwip/sockets.h>
+#include <lwip/tcpip.h>
+#include <lwip/netif.h>
+#include <lwip/stats.h>
+#include <lwip/sys.h>
+#include <lwip/mem.h>
+#include <lwip/memp.h>
+#include <lwip/udp.h>
+#include <lwip/raw.h>
+#include <lwip/tcp.h>
+#include <netif/loopif.h>
+#include <contmng/netbench.h>
+
+#define PAYLOAD         64              // bytes per datagram, a small packet
+#define MAX_BATCH       64
+#define BENCH_PACKETS   200000          // datagrams per batch size
+#define RX_PORT         7000
+#define TX_PORT         7001
+
+static int failures;
+static struct netif loop_netif;
+static struct thread_sem init_done;
+static int rx_sock, tx_sock;
+static struct sockaddr_in rx_addr;
+
+systime_t get_system_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* stand-ins for mem_barrelfish.c, which registers the memory with the NIC */
+uint8_t *mem_barrelfish_alloc(uint8_t buf_index, uint32_t size)
+{
+    (void)buf_index;
+    return malloc(size);
+}
+
+uint8_t *mem_barrelfish_register_buf(uint8_t binding_index, uint32_t size)
+{
+    (void)binding_index; (void)size;
+    return NULL;
+}
+
+void mem_barrelfish_free_granted_pbuf(struct pbuf *p)
+{
+    (void)p;
+    assert(!"no driver buffers on the host");
+}
+
+/* stand-ins for the port manager in netd: every port is free */
+static uint16_t next_port = 49152;
+
+err_t idc_tcp_new_port(uint16_t *port_no)
+{
+    *port_no = next_port++;
+    return ERR_OK;
+}
+
+err_t idc_udp_new_port(uint16_t *port_no)
+{
+    *port_no = next_port++;
+    return ERR_OK;
+}
+
+err_t idc_redirect_tcp(struct ip_addr *local_ip, u16_t local_port,
+                       struct ip_addr *remote_ip, u16_t remote_port)
+{
+    (void)local_ip; (void)local_port; (void)remote_ip; (void)remote_port;
+    return ERR_OK;
+}
+
+err_t idc_pause_tcp(struct ip_addr *local_ip, u16_t local_port,
+                    struct ip_addr *remote_ip, u16_t remote_port)
+{
+    (void)local_ip; (void)local_port; (void)remote_ip; (void)remote_port;
+    return ERR_OK;
+}
+
+err_t idc_close_udp_port(uint16_t port)
+{
+    (void)port;
+    return ERR_OK;
+}
+
+err_t idc_close_tcp_port(uint16_t port)
+{
+    (void)port;
+    return ERR_OK;
+}
+
+err_t idc_bind_udp_port(uint16_t port)
+{
+    (void)port;
+    return ERR_OK;
+}
+
+err_t idc_bind_tcp_port(uint16_t port)
+{
+    (void)port;
+    return ERR_OK;
+}
+
+uint64_t idc_ARP_lookup(uint32_t ip)
+{
+    (void)ip;
+    return 0;
+}
+
+/* stand-ins for lib/lwip/src/core/init.c and idc_barrelfish.c, without a
+ * driver to connect to */
+bool lwip_in_packet_received = false;
+
+bool is_this_special_app(void)
+{
+    return false;
+}
+
+bool lwip_init_auto(void)
+{
+    stats_init();
+    sys_init();
+    memp_init();
+    mem_init();
+    netif_init();
+    lwip_socket_init();
+    ip_init();
+    raw_init();
+    udp_init();
+    tcp_init();
+    return true;
+}
+
+/* runs on the tcpip thread once it is up */
+static void add_loop_netif(void *arg)
+{
+    (void)arg;
+    struct ip_addr ip, mask, gw;
+
+    IP4_ADDR(&ip, 127, 0, 0, 1);
+    IP4_ADDR(&mask, 255, 0, 0, 0);
+    IP4_ADDR(&gw, 127, 0, 0, 1);
+    netif_add(&loop_netif, &ip, &mask, &gw, NULL, loopif_init, ip_input);
+    netif_set_up(&loop_netif);
+    thread_sem_post(&init_done);
+}
+
+static void check(int ok, const char *what, long a, long b)
+{
+    if (!ok && failures++ < 20) {
+        fprintf(stderr, "FAIL %s (%ld, %ld)\n", what, a, b);
+    }
+}
+
+/// The error of the last call on a socket (lwIP does not set errno here)
+static int sock_error(int s)
+{
+    int err = -1;
+    socklen_t len = sizeof(err);
+    lwip_getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len);
+    return err;
+}
+
+static int udp_socket(uint16_t port)
+{
+    struct sockaddr_in addr;
+    int s = lwip_socket(AF_INET, SOCK_DGRAM, 0);
+
+    assert(s >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(0x7f000001);
+    if (lwip_bind(s, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "bind to port %u failed\n", port);
+        exit(EXIT_FAILURE);
+    }
+    return s;
+}
+
+static void fill(uint8_t *buf, size_t len, unsigned seq)
+{
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(seq * 31 + i);
+    }
+}
+
+/// Receive exactly n datagrams (one vector may not hold them all yet)
+static int recv_all(struct lwip_mmsghdr *msgs, int n)
+{
+    int got = 0;
+    while (got < n) {
+        int r = lwip_recvmmsg(rx_sock, &msgs[got], n - got, 0);
+        if (r <= 0) {
+            return got;
+        }
+        got += r;
+    }
+    return got;
+}
+
+static void check_roundtrip(int n, size_t len)
+{
+    static uint8_t tx[MAX_BATCH][PAYLOAD * 2], rx[MAX_BATCH][PAYLOAD * 2];
+    struct lwip_mmsghdr out[MAX_BATCH], in[MAX_BATCH];
+    struct sockaddr_in from[MAX_BATCH];
+
+    assert(n <= MAX_BATCH && len <= sizeof(tx[0]));
+    for (int i = 0; i < n; i++) {
+        fill(tx[i], len, i);
+        out[i] = (struct lwip_mmsghdr) {
+            .msg_buf = tx[i], .msg_buflen = len - i % 3,
+            .msg_name = (struct sockaddr *) &rx_addr,
+            .msg_namelen = sizeof(rx_addr),
+        };
+        in[i] = (struct lwip_mmsghdr) {
+            .msg_buf = rx[i], .msg_buflen = sizeof(rx[i]),
+            .msg_name = (struct sockaddr *) &from[i],
+            .msg_namelen = sizeof(from[i]),
+        };
+    }
+
+    int sent = lwip_sendmmsg(tx_sock, out, n, 0);
+    check(sent == n, "sendmmsg count", sent, n);
+    int got = recv_all(in, n);
+    check(got == n, "recvmmsg count", got, n);
+    for (int i = 0; i < got; i++) {
+        check(out[i].msg_len == len - i % 3, "sent length", i, out[i].msg_len);
+        check(in[i].msg_len == len - i % 3, "received length", i,
+              in[i].msg_len);
+        check(memcmp(rx[i], tx[i], in[i].msg_len) == 0, "contents", i, n);
+        check(in[i].msg_namelen == sizeof(struct sockaddr_in) &&
+              from[i].sin_port == htons(TX_PORT) &&
+              from[i].sin_addr.s_addr == htonl(0x7f000001),
+              "source address", i, ntohs(from[i].sin_port));
+    }
+}
+
+static void check_errors(void)
+{
+    uint8_t buf[PAYLOAD], small[8];
+    struct sockaddr_in bad = rx_addr;
+    struct lwip_mmsghdr m[3];
+
+    // nothing queued: MSG_DONTWAIT must not wait
+    m[0] = (struct lwip_mmsghdr) { .msg_buf = buf, .msg_buflen = sizeof(buf) };
+    check(lwip_recvmmsg(rx_sock, m, 1, MSG_DONTWAIT) == -1 &&
+          sock_error(rx_sock) == EWOULDBLOCK, "recvmmsg MSG_DONTWAIT", 0, 0);
+
+    // a datagram longer than the buffer is truncated
+    fill(buf, sizeof(buf), 7);
+    m[0] = (struct lwip_mmsghdr) {
+        .msg_buf = buf, .msg_buflen = sizeof(buf),
+        .msg_name = (struct sockaddr *) &rx_addr,
+        .msg_namelen = sizeof(rx_addr),
+    };
+    check(lwip_sendmmsg(tx_sock, m, 1, 0) == 1, "send to truncate", 0, 0);
+    m[1] = (struct lwip_mmsghdr) { .msg_buf = small,
+                                   .msg_buflen = sizeof(small) };
+    check(lwip_recvmmsg(rx_sock, &m[1], 1, 0) == 1 &&
+          m[1].msg_len == sizeof(small) && memcmp(small, buf,
+                                                   sizeof(small)) == 0,
+          "truncated", m[1].msg_len, 0);
+
+    // invalid first destination: nothing sent
+    bad.sin_family = AF_INET + 1;
+    m[0].msg_name = (struct sockaddr *) &bad;
+    check(lwip_sendmmsg(tx_sock, m, 1, 0) == -1 &&
+          sock_error(tx_sock) != 0, "invalid destination", 0, 0);
+
+    // invalid third destination: the first two are sent
+    m[0].msg_name = (struct sockaddr *) &rx_addr;
+    m[1] = m[0];
+    m[2] = m[0];
+    m[2].msg_name = (struct sockaddr *) &bad;
+    check(lwip_sendmmsg(tx_sock, m, 3, 0) == 2, "partly invalid vector", 0,
+          0);
+    m[0].msg_name = m[1].msg_name = NULL;
+    check(recv_all(m, 2) == 2, "partly invalid vector received", 0, 0);
+}
+
+static uint64_t move_single(void *arg, uint32_t batch)
+{
+    (void)arg;
+    static uint8_t buf[PAYLOAD];
+    uint32_t got = 0;
+
+    for (uint32_t i = 0; i < batch; i++) {
+        if (lwip_sendto(tx_sock, buf, sizeof(buf), 0,
+                        (struct sockaddr *) &rx_addr, sizeof(rx_addr)) < 0) {
+            return 0;
+        }
+    }
+    for (; got < batch; got++) {
+        if (lwip_recvfrom(rx_sock, buf, sizeof(buf), 0, NULL, NULL) <= 0) {
+            break;
+        }
+    }
+    return got;
+}
+
+static uint64_t move_batched(void *arg, uint32_t batch)
+{
+    (void)arg;
+    static uint8_t buf[MAX_BATCH][PAYLOAD];
+    static struct lwip_mmsghdr out[MAX_BATCH], in[MAX_BATCH];
+
+    if (out[0].msg_buf == NULL) {
+        for (int i = 0; i < MAX_BATCH; i++) {
+            out[i] = (struct lwip_mmsghdr) {
+                .msg_buf = buf[i], .msg_buflen = PAYLOAD,
+                .msg_name = (struct sockaddr *) &rx_addr,
+                .msg_namelen = sizeof(rx_addr),
+            };
+            in[i] = (struct lwip_mmsghdr) {
+                .msg_buf = buf[i], .msg_buflen = PAYLOAD,
+            };
+        }
+    }
+    if (lwip_sendmmsg(tx_sock, out, batch, 0) != (int)batch) {
+        return 0;
+    }
+    return recv_all(in, batch);
+}
+
+int main(void)
+{
+    thread_sem_init(&init_done, 0);
+    tcpip_init(add_loop_netif, NULL);
+    thread_sem_wait(&init_done);
+
+    rx_sock = udp_socket(RX_PORT);
+    tx_sock = udp_socket(TX_PORT);
+    memset(&rx_addr, 0, sizeof(rx_addr));
+    rx_addr.sin_len = sizeof(rx_addr);
+    rx_addr.sin_family = AF_INET;
+    rx_addr.sin_port = htons(RX_PORT);
+    rx_addr.sin_addr.s_addr = htonl(0x7f000001);
+
+    check_roundtrip(1, PAYLOAD);
+    check_roundtrip(MAX_BATCH, PAYLOAD * 2);
+    check_roundtrip(LWIP_MMSG_BATCH < MAX_BATCH ? LWIP_MMSG_BATCH + 1 :
+                    MAX_BATCH / 2 + 1, PAYLOAD);
+    check_errors();
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+
+    netbench_batch_sweep("sendto/recvfrom", move_single, NULL, MAX_BATCH,
+                         BENCH_PACKETS);
+    netbench_batch_sweep("sendmmsg/recvmmsg", move_batched, NULL, MAX_BATCH,
+                         BENCH_PACKETS);
+    return EXIT_SUCCESS;
+}
@@ -30,7 +30,13 @@
 
 static coreid_t my_core_id;
 static lvaddr_t spawnd_bi_addr;
-static struct ps_state *ps_states;
+static struct ps_state *ps_states, **ps_states_tail = &ps_states;
+
+/// All clients by pid
+static collections_hash_table *ps_table;
+
+/// Endpoint of the file server, handed to clients on FS_CONNECT
+static struct capref fs_server_ep;
 
 struct bootinfo *bi;
 struct capref cap_spawndep;
@@ -50,15 +56,7 @@ struct serial_read_lock {
 void send_handler(void *proc_in)
 {
     struct ps_state *proc = (struct ps_state*)proc_in;
-    
-    uint32_t buf[9];
-    for (uint8_t i = 0; i < 9; i++){
-        buf[i] = proc->send_msg[i];
-        if((char*)buf[i] == '\0'){
-            break;
-        }
-    }
-    
+    uint32_t *buf = proc->send_msg;
     struct capref cap = proc->send_cap;    
     
     errval_t err = lmp_chan_send9(&proc->lc, LMP_SEND_FLAGS_DEFAULT, cap, buf[0],
@@ -78,7 +76,23 @@ void send_handler(void *proc_in)
     }
 }
 
-static errval_t get_ram_cap(struct ps_state *ps_state, size_t req_bits)
+/**
+ * \brief Set the reply to the call tagged \p seq, for send_handler()
+ *
+ * Clients wait for the error as much as for the result.
+ */
+static void set_reply(struct ps_state *ps_state, uint32_t code, uint16_t seq,
+                      errval_t err, uintptr_t ret, struct capref cap)
+{
+    memset(ps_state->send_msg, 0, sizeof(ps_state->send_msg));
+    ps_state->send_msg[0] = AOS_RPC_TAG(code, seq);
+    ps_state->send_msg[1] = err;
+    ps_state->send_msg[2] = ret;
+    ps_state->send_cap = cap;
+}
+
+static errval_t get_ram_cap(struct ps_state *ps_state, size_t req_bits,
+                            uint16_t seq)
 {
     struct capref dest = NULL_CAP;
     
@@ -87,18 +101,23 @@ static errval_t get_ram_cap(struct ps_state *ps_state, size_t req_bits)
     if (err_is_fail(err)){
         debug_printf("Could not allocate ram.\n");
         err_print_calltrace(err);
-        return err;
+        dest = NULL_CAP;
     }
     
-    // Send cap and return bits back to caller
-    ps_state->send_msg[0] = REQUEST_RAM_CAP;
-    ps_state->send_msg[1] = req_bits;
-    ps_state->send_cap = dest;
-
+    // Send cap and return bits back to caller, or why there is none
+    set_reply(ps_state, REQUEST_RAM_CAP, seq, err, req_bits, dest);
     return err;
 }
 
-static struct ps_state *create_ps_state(void)
+/// Reply to FS_CONNECT with the file server's endpoint
+static void fs_connect(struct ps_state *ps_state, uint16_t seq)
+{
+    errval_t err = capref_is_null(fs_server_ep) ? AOS_ERR_FS_UNAVAILABLE
+                                                : SYS_ERR_OK;
+    set_reply(ps_state, FS_CONNECT, seq, err, 0, fs_server_ep);
+}
+
+static struct ps_state *create_ps_state(domainid_t pid)
 {
     struct ps_state *new_state =
         (struct ps_state*)malloc(sizeof(struct ps_state));
@@ -107,30 +126,33 @@ static struct ps_state *create_ps_state(void)
     new_state->send_cap = NULL_CAP;
     new_state->pending_request = false;
     new_state->status = WAITING;
+    new_state->serial_rnext = NULL;
+    new_state->serial_wnext = NULL;
+    new_state->serial_held_len = 0;
+    new_state->pid = pid;
     
     if (ps_states == NULL) {
         debug_printf("setting first process\n");
-        ps_states = new_state;
-    } else {
-    
-        struct ps_state *cur = ps_states;
-        while (cur->next != NULL){
-            cur = cur->next;
-        }
-        cur->next = new_state;
     }
+    *ps_states_tail = new_state;
+    ps_states_tail = &new_state->next;
+
+    if (ps_table == NULL) {
+        collections_hash_create_with_buckets(&ps_table, AOS_RPC_MAX_DOMAINS,
+                                             NULL);
+    }
+    collections_hash_insert(ps_table, pid, new_state);
     return new_state;
 }
 
 static struct ps_state *get_ps_state_by_pid(domainid_t pid)
 {
-    struct ps_state *cur = ps_states;
-    while (cur != NULL && cur->pid != pid) {
-        cur = cur->next;
+    struct ps_state *cur = NULL;
+    if (ps_table != NULL) {
+        cur = collections_hash_find(ps_table, pid);
     }
     if (cur == NULL){
-        cur = create_ps_state();
-        cur->pid = pid;
+        cur = create_ps_state(pid);
     }
     
     return cur;
@@ -160,9 +182,10 @@ static void spawnd_recv_handler(void *lc_in)
     struct capref remote_cap;
     struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
     uint32_t rpc_code;
+    uint16_t seq;
     
-    errval_t err = aos_retrieve_msg(&spawnd_state.lc, &remote_cap,
-                                    &rpc_code, &msg);
+    errval_t err = aos_retrieve_tagged_msg(&spawnd_state.lc, &remote_cap,
+                                           &rpc_code, &seq, &msg);
     if (err_is_fail(err)) {
         debug_printf("Could not retrieve msg on main channel\n");
         err_print_calltrace(err);
@@ -208,14 +231,18 @@ static void spawnd_recv_handler(void *lc_in)
             break;
         }
         
-        // Returns a frame capability to the client
+        // Returns a frame capability to the client, or the error
         case REQUEST_RAM_CAP:
+        case FS_CONNECT:
         {
-            err = get_ram_cap(&spawnd_state, msg.words[0]);
-            if (err_is_fail(err)){
-                debug_printf("Could not allocate ram for spawnd.\n");
-                err_print_calltrace(err);
-                abort();
+            if (rpc_code == REQUEST_RAM_CAP) {
+                err = get_ram_cap(&spawnd_state, msg.words[0], seq);
+                if (err_is_fail(err)){
+                    debug_printf("Could not allocate ram for spawnd.\n");
+                }
+            } else {
+                // spawnd spawns binaries from the file system
+                fs_connect(&spawnd_state, seq);
             }
             
             err = lmp_chan_register_send(&spawnd_state.lc,
@@ -227,6 +254,16 @@ static void spawnd_recv_handler(void *lc_in)
             
             break;
         }
+
+        // How spawning the shell went
+        case PROCESS_SPAWN:
+        {
+            err = msg.words[0];
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "spawnd could not spawn the shell");
+            }
+            break;
+        }
         
         case PROCESS_TO_FOREGROUND:
         {
@@ -269,13 +306,12 @@ static void default_recv_handler(void *ps_state_in)
     uint32_t rpc_code;
 
     struct ps_state *ps_state = (struct ps_state *)ps_state_in;
-    err = aos_retrieve_msg(&ps_state->lc, &remote_cap, &rpc_code, &msg);
-    
-    // Re-register
-    lmp_chan_register_recv(&ps_state->lc, get_default_waitset(),
-        MKCLOSURE(default_recv_handler, ps_state));
+    uint16_t seq;
+    err = aos_retrieve_tagged_msg(&ps_state->lc, &remote_cap, &rpc_code, &seq,
+                                  &msg);
     
     bool reply = false;
+    bool hold = false; // output waits for the serial TX ring, stop receiving
 
     switch(rpc_code) {
         
@@ -296,7 +332,7 @@ static void default_recv_handler(void *ps_state_in)
         // Returns a RAM capability to the client
         case REQUEST_RAM_CAP:
         {
-            err = get_ram_cap(ps_state, msg.words[0]);
+            get_ram_cap(ps_state, msg.words[0], seq);
             reply = true;            
             break;
         }
@@ -304,44 +340,65 @@ static void default_recv_handler(void *ps_state_in)
         case REQUEST_DEV_CAP:
         {
             debug_printf("handing out REQUEST_DEV_CAP\n");
-            ps_state->send_msg[0] = REQUEST_DEV_CAP;
-            ps_state->send_cap = cap_io;
+            set_reply(ps_state, REQUEST_DEV_CAP, seq, SYS_ERR_OK, 0, cap_io);
             reply = true;
             
             break;
         }
 
+        // Serial I/O of background processes is dropped. Reads are
+        // answered by the serial server once input is there.
         case SERIAL_PUT_CHAR:
         {
             if (ps_state->status == BACKGROUND) {
                 break;
-            } else if (ps_state->status == WAITING) {
-                reply = true;
+            }
+
+            char c = msg.words[0];
+            hold = !serial_client_write(ps_state, &c, 1);
+            break;
+        }
+
+        case SERIAL_WRITE:
+        {
+            if (ps_state->status == BACKGROUND) {
                 break;
             }
 
-            serial_put_char((char *) &msg.buf.words[0]);
-            
+            size_t len = msg.words[0];
+            if (len > AOS_RPC_SERIAL_CHUNK) {
+                len = AOS_RPC_SERIAL_CHUNK;
+            }
+            hold = !serial_client_write(ps_state, (char *)&msg.words[1], len);
             break;
         }
 
         case SERIAL_GET_CHAR:
+        case SERIAL_READ_LINE:
         {
             if (ps_state->status == BACKGROUND) {
                 break;
-            } else if (ps_state->status == WAITING) {
-                reply = true;
+            }
+
+            serial_client_read(ps_state, rpc_code, msg.words[0]);
+            break;
+        }
+
+        // The file server announces itself, clients ask for its endpoint
+        case FS_REGISTER:
+        {
+            if (capref_is_null(remote_cap)) {
+                debug_printf("File server sent no endpoint\n");
                 break;
             }
-            
-            char c;
-            serial_get_char(&c);
-            
-            ps_state->send_msg[0] = SERIAL_GET_CHAR;
-            ps_state->send_msg[1] = c;
-            ps_state->send_cap = NULL_CAP;
+            fs_server_ep = remote_cap;
+            break;
+        }
+
+        case FS_CONNECT:
+        {
+            fs_connect(ps_state, seq);
             reply = true;
-            
             break;
         }
         
@@ -349,9 +406,15 @@ static void default_recv_handler(void *ps_state_in)
         {
             debug_printf("Could not handle code %d in "
                          "default_recv_handler\n", rpc_code);
+            resume_recv(ps_state);
             return;
         }
     }
+
+    // Re-register, unless the serial server resumes us later
+    if (!hold) {
+        resume_recv(ps_state);
+    }
     
     if(reply){
         if (ps_state->status == WAITING){
@@ -376,6 +439,15 @@ static void default_recv_handler(void *ps_state_in)
     }
 }
 
+void resume_recv(struct ps_state *ps)
+{
+    errval_t err = lmp_chan_register_recv(&ps->lc, get_default_waitset(),
+        MKCLOSURE(default_recv_handler, ps));
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "could not re-register receive for pid %d", ps->pid);
+    }
+}
+
 static void initial_recv_handler(void *null_ptr)
 {
     assert(null_ptr == NULL);
@@ -383,9 +455,10 @@ static void initial_recv_handler(void *null_ptr)
     struct capref remote_cap;
     struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
     uint32_t rpc_code;
+    uint16_t seq;
     
-    errval_t err = aos_retrieve_msg(&main_channel, &remote_cap,
-                                    &rpc_code, &msg);
+    errval_t err = aos_retrieve_tagged_msg(&main_channel, &remote_cap,
+                                           &rpc_code, &seq, &msg);
     if (err_is_fail(err)) {
         debug_printf("Could not retrieve msg on main channel\n");
         err_print_calltrace(err);
@@ -397,10 +470,16 @@ static void initial_recv_handler(void *null_ptr)
     struct ps_state *new_state = get_ps_state_by_pid(msg.words[0]);
     err = aos_setup_channel(&new_state->lc, remote_cap,
         MKCLOSURE(default_recv_handler, new_state));
-
-    new_state->send_msg[0] = REGISTER_CHANNEL;
-    new_state->send_cap = new_state->lc.local_cap;
-    send_handler(new_state);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "could not set up channel for pid %d", new_state->pid);
+        // answer over the endpoint the client registered with
+        lmp_ep_send2(remote_cap, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+                     AOS_RPC_TAG(REGISTER_CHANNEL, seq), err);
+    } else {
+        set_reply(new_state, REGISTER_CHANNEL, seq, SYS_ERR_OK, 0,
+                  new_state->lc.local_cap);
+        send_handler(new_state);
+    }
     
     // re-register receive handler
     err = lmp_chan_register_recv(&main_channel, get_default_waitset(),
@@ -487,6 +566,17 @@ static errval_t spawn_spawnd(void)
                        "communication to new process' cspace\n");
         return err;
     }
+
+    // spawnd passes the IRQ table on to the SD card driver
+    struct capref spawnd_irq = {
+        .cnode = si.taskcn,
+        .slot = TASKCN_SLOT_IRQ
+    };
+    err = cap_copy(spawnd_irq, cap_irq);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "Failed to copy IRQ cap to spawnd's cspace\n");
+        return err;
+    }
     
     struct capref module_cap_init = {
         .cnode = cnode_root,
@@ -733,7 +823,11 @@ int main(int argc, char *argv[])
         debug_printf("cap_io mapped OK.\n");
     }
 
-    set_uart3_registers(uart_addr);
+    err = serial_init(uart_addr);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "failed to start the serial server\n");
+        abort();
+    }
     
     struct thread *urpc_poll_thread = thread_create((thread_func_t) urpc_poll, 
                                                     NULL);
@@ -758,7 +852,7 @@ int main(int argc, char *argv[])
 
     debug_printf("Entering dispatch loop\n");
     while(true) {
-        event_dispatch(get_default_waitset());
+        event_dispatch_many(get_default_waitset(), INIT_EVENT_BATCH);
     }
 
     return EXIT_SUCCESS;
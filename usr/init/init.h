@@ -28,15 +28,15 @@
 #include <barrelfish/sys_debug.h>
 #include <omap44xx_map.h>
 #include <spawndomain/spawndomain.h>
+#include <collections/hash_table.h>
 
 #include "urpc.h"
+#include "serial.h"
 
 extern struct bootinfo *bi;
 
-static volatile uint32_t *uart3_thr = NULL;
-static volatile uint32_t *uart3_rhr = NULL;
-static volatile uint32_t *uart3_fcr = NULL;
-static volatile uint32_t *uart3_lsr = NULL;
+/// Maximum number of events handled per pass of the dispatch loop
+#define INIT_EVENT_BATCH 16
 
 enum urpc_request {
 	REMOTE_SPAWN,
@@ -64,6 +64,14 @@ struct ps_state {
     enum state_status status;
     bool pending_request;
     domainid_t pid;
+
+    // serial server (serial.c)
+    struct ps_state *serial_rnext;  ///< Next client waiting for input
+    uint32_t serial_code;           ///< Its read request
+    size_t serial_max;
+    struct ps_state *serial_wnext;  ///< Next client waiting for TX space
+    char serial_held[AOS_RPC_SERIAL_CHUNK]; ///< Output not yet queued
+    size_t serial_held_len;
 };
 
 errval_t initialize_ram_alloc(void);
@@ -72,36 +80,9 @@ errval_t initialize_mem_serv(void);
 errval_t memserv_alloc(struct capref *ret, uint8_t bits,
                        genpaddr_t minbase, genpaddr_t maxlimit);
 
-static inline void set_uart3_registers(lvaddr_t base)
-{
-    uart3_thr = (uint32_t *)((uint32_t)base + 0x0000);
-    uart3_rhr = (uint32_t *)((uint32_t)base + 0x0000);
-    uart3_fcr = (uint32_t *)((uint32_t)base + 0x0008);
-    uart3_lsr = (uint32_t *)((uint32_t)base + 0x0014);
-}
-
-static inline errval_t serial_put_char(const char *c) 
-{
-    //debug_printf("serial put char ----> %c\n\n", *c);
-    assert(uart3_lsr && uart3_thr);
-    while(*uart3_lsr == 0x20);
-    *uart3_thr = *c;
-
-    return SYS_ERR_OK;
-}
-
-static inline errval_t serial_get_char(char *c) 
-{
-    *uart3_fcr &= ~1; // write 0 to bit 0
-    *uart3_rhr = 0;
-    while((*uart3_lsr & 1) == 0);
-    *c = (char)*uart3_rhr;
-
-    return SYS_ERR_OK;
-}
-
 void recv_handler(void *lc_in);
 void send_handler(void *client_state_in);
+void resume_recv(struct ps_state *ps);
 errval_t spawn(char *name, domainid_t *pid, coreid_t coreid);
 
 
@@ -0,0 +1,311 @@
+/**
+ * \file
+ * \brief Interrupt-driven serial server of init
+ *
+ * Owns UART3. Output of all clients is queued in a TX ring, which the UART
+ * interrupt drains a FIFO load at a time. Input is taken off the RX FIFO in
+ * the interrupt handler and edited into lines (with echo, backspace and
+ * LF to CRLF translation); completed lines are kept in an RX ring until a
+ * client reads them. Nothing here waits for the UART.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include "init.h"
+#include "serial.h"
+#include <barrelfish/inthandler.h>
+#include <dev/omap/omap_uart_dev.h>
+
+#define BACKSPACE   8
+#define DELETE      127
+
+static omap_uart_t uart;
+
+// output to the UART, LF already expanded to CRLF
+static char tx_ring[SERIAL_TX_RING];
+static uint32_t tx_head, tx_tail;
+static bool tx_busy;            ///< THR interrupt enabled, FIFO draining
+
+// completed input lines
+static char rx_ring[SERIAL_RX_RING];
+static uint32_t rx_head, rx_tail;
+
+// line being edited
+static char line[SERIAL_LINE_MAX];
+static size_t line_len;
+static bool last_cr;            ///< swallow the LF of a CRLF
+
+// clients waiting for input or for room in the TX ring, in arrival order
+static struct ps_state *readers, **readers_tail = &readers;
+static struct ps_state *writers, **writers_tail = &writers;
+
+static inline uint32_t tx_space(void)
+{
+    return SERIAL_TX_RING - (tx_tail - tx_head);
+}
+
+/// Refill the empty TX FIFO, keep the THR interrupt on while output remains
+static void tx_fill(void)
+{
+    for (int i = 0; i < UART_FIFO_SIZE && tx_head != tx_tail; i++) {
+        omap_uart_THR_thr_wrf(&uart, tx_ring[tx_head++ % SERIAL_TX_RING]);
+    }
+
+    bool more = tx_head != tx_tail;
+    if (more != tx_busy) {
+        omap_uart_IER_thr_it_wrf(&uart, more);
+        tx_busy = more;
+    }
+}
+
+static void tx_start(void)
+{
+    if (tx_busy) {
+        return; // the interrupt refills the FIFO
+    }
+    if (omap_uart_LSR_tx_fifo_e_rdf(&uart)) {
+        tx_fill();
+    } else {
+        omap_uart_IER_thr_it_wrf(&uart, 1);
+        tx_busy = true;
+    }
+}
+
+/**
+ * \brief Queue output, translating LF to CRLF
+ *
+ * \return number of bytes of \p buf queued, less than \p len if the TX
+ * ring is full
+ */
+size_t serial_write(const char *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        uint32_t need = (buf[i] == '\n') ? 2 : 1;
+        if (tx_space() < need) {
+            break;
+        }
+        if (buf[i] == '\n') {
+            tx_ring[tx_tail++ % SERIAL_TX_RING] = '\r';
+        }
+        tx_ring[tx_tail++ % SERIAL_TX_RING] = buf[i];
+    }
+
+    if (i > 0) {
+        tx_start();
+    }
+    return i;
+}
+
+static void line_commit(void)
+{
+    if (SERIAL_RX_RING - (rx_tail - rx_head) < line_len) {
+        debug_printf("serial: input line dropped, nobody reads\n");
+    } else {
+        for (size_t i = 0; i < line_len; i++) {
+            rx_ring[rx_tail++ % SERIAL_RX_RING] = line[i];
+        }
+    }
+    line_len = 0;
+}
+
+/// Line discipline for one received character
+static void line_input(char c)
+{
+    bool cr = last_cr;
+    last_cr = (c == '\r');
+
+    if (c == '\r' || c == '\n') {
+        if (c == '\n' && cr) {
+            return;
+        }
+        line[line_len++] = '\n';
+        serial_write("\n", 1);
+        line_commit();
+    } else if (c == BACKSPACE || c == DELETE) {
+        if (line_len > 0) {
+            line_len--;
+            serial_write("\b \b", 3);
+        }
+    } else if ((c >= ' ' && c < DELETE) || c == '\t') {
+        // keep room for the newline
+        if (line_len < SERIAL_LINE_MAX - 1) {
+            line[line_len++] = c;
+            serial_write(&c, 1);
+        }
+    }
+}
+
+/// Answer a read from the RX ring, which must not be empty
+static void reply_read(struct ps_state *ps, uint32_t code, size_t max)
+{
+    assert(rx_head != rx_tail);
+
+    memset(ps->send_msg, 0, sizeof(ps->send_msg));
+    ps->send_msg[0] = code;
+    ps->send_cap = NULL_CAP;
+
+    if (code == SERIAL_GET_CHAR) {
+        ps->send_msg[1] = rx_ring[rx_head++ % SERIAL_RX_RING];
+    } else {
+        char *data = (char *)&ps->send_msg[2];
+        size_t n = 0;
+        bool eol = false;
+
+        if (max > AOS_RPC_SERIAL_CHUNK) {
+            max = AOS_RPC_SERIAL_CHUNK;
+        }
+        while (n < max && rx_head != rx_tail && !eol) {
+            data[n] = rx_ring[rx_head++ % SERIAL_RX_RING];
+            eol = (data[n++] == '\n');
+        }
+        ps->send_msg[1] = n | (eol ? AOS_RPC_SERIAL_EOL : 0);
+    }
+
+    errval_t err = lmp_chan_register_send(&ps->lc, get_default_waitset(),
+                                          MKCLOSURE(send_handler, ps));
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "serial: could not reply to pid %d", ps->pid);
+    }
+}
+
+/**
+ * \brief Read input for a client, now or once a line has been entered
+ *
+ * \param code SERIAL_GET_CHAR for one character, SERIAL_READ_LINE for up to
+ * \p max bytes of the current line
+ */
+void serial_client_read(struct ps_state *ps, uint32_t code, size_t max)
+{
+    if (readers == NULL && rx_head != rx_tail) {
+        reply_read(ps, code, max);
+        return;
+    }
+
+    ps->serial_code = code;
+    ps->serial_max = max;
+    ps->serial_rnext = NULL;
+    *readers_tail = ps;
+    readers_tail = &ps->serial_rnext;
+}
+
+/**
+ * \brief Queue output of a client
+ *
+ * \return false if the TX ring is full. The rest of \p buf is then held
+ * and the client's channel is resumed by resume_recv() once it is queued,
+ * which keeps the client's further output from overtaking it.
+ */
+bool serial_client_write(struct ps_state *ps, const char *buf, size_t len)
+{
+    assert(len <= sizeof(ps->serial_held));
+
+    size_t n = serial_write(buf, len);
+    if (n == len) {
+        return true;
+    }
+
+    memcpy(ps->serial_held, buf + n, len - n);
+    ps->serial_held_len = len - n;
+    ps->serial_wnext = NULL;
+    *writers_tail = ps;
+    writers_tail = &ps->serial_wnext;
+    return false;
+}
+
+static void serve_clients(void)
+{
+    while (readers != NULL && rx_head != rx_tail) {
+        struct ps_state *ps = readers;
+        readers = ps->serial_rnext;
+        if (readers == NULL) {
+            readers_tail = &readers;
+        }
+        reply_read(ps, ps->serial_code, ps->serial_max);
+    }
+
+    while (writers != NULL) {
+        struct ps_state *ps = writers;
+        size_t n = serial_write(ps->serial_held, ps->serial_held_len);
+        if (n < ps->serial_held_len) {
+            memmove(ps->serial_held, ps->serial_held + n,
+                    ps->serial_held_len - n);
+            ps->serial_held_len -= n;
+            break;
+        }
+
+        ps->serial_held_len = 0;
+        writers = ps->serial_wnext;
+        if (writers == NULL) {
+            writers_tail = &writers;
+        }
+        resume_recv(ps);
+    }
+}
+
+static void serial_poll(void)
+{
+    // receive: take everything out of the RX FIFO
+    while (omap_uart_LSR_rx_fifo_e_rdf(&uart)) {
+        line_input(omap_uart_RHR_rhr_rdf(&uart));
+    }
+
+    // transmit: the FIFO ran empty
+    if (tx_busy && omap_uart_LSR_tx_fifo_e_rdf(&uart)) {
+        tx_fill();
+    }
+
+    serve_clients();
+}
+
+static void serial_interrupt(void *arg)
+{
+    serial_poll();
+
+    errval_t err = invoke_irqtable_ack(cap_irq, UART3_IRQ);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "serial: failed to ack IRQ %d", UART3_IRQ);
+    }
+}
+
+/**
+ * \brief Take over UART3 mapped at \p base
+ */
+errval_t serial_init(lvaddr_t base)
+{
+    omap_uart_initialize(&uart, (mackerel_addr_t) base);
+
+    // Interrupt on an empty TX FIFO rather than at the trigger level
+    omap_uart_SCR_tx_empty_ctl_it_wrf(&uart, 1);
+
+    omap_uart_FCR_t fcr = omap_uart_FCR_default;
+    fcr = omap_uart_FCR_rx_fifo_trig_insert(fcr, 0);
+    fcr = omap_uart_FCR_tx_fifo_trig_insert(fcr, 0);
+    fcr = omap_uart_FCR_tx_fifo_clear_insert(fcr, 1);
+    fcr = omap_uart_FCR_fifo_en_insert(fcr, 1);
+    omap_uart_FCR_wr(&uart, fcr);
+
+    // RX interrupts (trigger level and time-out) only, until output is queued
+    omap_uart_IER_t ier = omap_uart_IER_rd(&uart);
+    ier = omap_uart_IER_rhr_it_insert(ier, 1);
+    ier = omap_uart_IER_thr_it_insert(ier, 0);
+    omap_uart_IER_wr(&uart, ier);
+    tx_busy = false;
+
+    errval_t err = inthandler_setup_arm(serial_interrupt, NULL, UART3_IRQ);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // input may have arrived before the handler was installed
+    serial_poll();
+    return SYS_ERR_OK;
+}
@@ -0,0 +1,37 @@
+/**
+ * \file
+ * \brief Interrupt-driven serial server of init
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef INIT_SERIAL_H
+#define INIT_SERIAL_H
+
+#include <barrelfish/barrelfish.h>
+
+/// UART3 interrupt: MA_IRQ_74 on the Cortex-A9 MPU, after the 32 PPIs/SGIs
+#define UART3_IRQ           (32 + 74)
+
+#define UART_FIFO_SIZE      64      ///< Bytes the TX FIFO takes when empty
+
+#define SERIAL_TX_RING      4096    ///< Output queued for the UART
+#define SERIAL_RX_RING      1024    ///< Completed input lines
+#define SERIAL_LINE_MAX     256     ///< Longest line being edited
+
+struct ps_state;
+
+errval_t serial_init(lvaddr_t base);
+size_t serial_write(const char *buf, size_t len);
+
+bool serial_client_write(struct ps_state *ps, const char *buf, size_t len);
+void serial_client_read(struct ps_state *ps, uint32_t code, size_t max);
+
+#endif // INIT_SERIAL_H
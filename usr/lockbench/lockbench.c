@@ -0,0 +1,161 @@
+/**
+ * \file
+ * \brief Mutex and reader-writer lock contention benchmark
+ *
+ * Usage: lockbench [threads] [span]
+ *
+ * With "span", the domain is spanned to core 1 and half of the threads run
+ * there, so that contention crosses dispatchers.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/threads.h>
+#include <barrelfish/waitset.h>
+#include <bench/bench.h>
+
+#define UNCONTENDED_ROUNDS  10000
+#define CONTENDED_ROUNDS    1000
+#define DEFAULT_THREADS     4
+
+/// One in every WRITE_RATIO rwlock operations is a write
+#define WRITE_RATIO         10
+
+static struct thread_mutex mutex = THREAD_MUTEX_INITIALIZER;
+static struct thread_rwlock rwlock = THREAD_RWLOCK_INITIALIZER;
+static struct thread_sem done = THREAD_SEM_INITIALIZER;
+
+static volatile uint32_t counter;
+static volatile uint32_t table[16];
+
+static bool spanned;
+
+static void span_cb(void *arg, errval_t err)
+{
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "domain_new_dispatcher");
+    }
+    spanned = err_is_ok(err);
+    *(bool *)arg = true;
+}
+
+static int mutex_thread(void *arg)
+{
+    for (int i = 0; i < CONTENDED_ROUNDS; i++) {
+        thread_mutex_lock(&mutex);
+        counter++;
+        thread_mutex_unlock(&mutex);
+    }
+    thread_sem_post(&done);
+    return 0;
+}
+
+static int rwlock_thread(void *arg)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < CONTENDED_ROUNDS; i++) {
+        if (i % WRITE_RATIO == 0) {
+            thread_rwlock_write_lock(&rwlock);
+            table[i % 16]++;
+            thread_rwlock_write_unlock(&rwlock);
+        } else {
+            thread_rwlock_read_lock(&rwlock);
+            for (int j = 0; j < 16; j++) {
+                sum += table[j];
+            }
+            thread_rwlock_read_unlock(&rwlock);
+        }
+    }
+    thread_sem_post(&done);
+    return sum == 0xdeadbeef; // keep the reads alive
+}
+
+/// Run \p nthreads copies of \p func and return the elapsed time
+static cycles_t run_contended(thread_func_t func, int nthreads)
+{
+    cycles_t start = bench_tsc();
+
+    for (int i = 0; i < nthreads; i++) {
+        coreid_t core = (spanned && (i & 1)) ? 1 : disp_get_core_id();
+        errval_t err = domain_thread_create_on(core, func, NULL);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "domain_thread_create_on");
+        }
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        thread_sem_wait(&done);
+    }
+
+    return bench_tsc() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    int nthreads = DEFAULT_THREADS;
+    if (argc > 1) {
+        nthreads = atoi(argv[1]);
+    }
+
+    bench_init();
+
+    if (argc > 2 && strcmp(argv[2], "span") == 0) {
+        bool span_done = false;
+        errval_t err = domain_new_dispatcher(1, span_cb, &span_done);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "domain_new_dispatcher");
+        }
+        while (!span_done) {
+            event_dispatch(get_default_waitset());
+        }
+    }
+
+    cycles_t *samples = malloc(UNCONTENDED_ROUNDS * sizeof(cycles_t));
+    assert(samples != NULL);
+
+    for (int i = 0; i < UNCONTENDED_ROUNDS; i++) {
+        cycles_t start = bench_tsc();
+        thread_mutex_lock(&mutex);
+        thread_mutex_unlock(&mutex);
+        samples[i] = bench_tsc() - start;
+    }
+    printf("lockbench: mutex uncontended avg %" PRIuCYCLES " var %"
+           PRIuCYCLES " ticks\n", bench_avg(samples, UNCONTENDED_ROUNDS),
+           bench_variance(samples, UNCONTENDED_ROUNDS));
+
+    for (int i = 0; i < UNCONTENDED_ROUNDS; i++) {
+        cycles_t start = bench_tsc();
+        thread_rwlock_read_lock(&rwlock);
+        thread_rwlock_read_unlock(&rwlock);
+        samples[i] = bench_tsc() - start;
+    }
+    printf("lockbench: rwlock read uncontended avg %" PRIuCYCLES " var %"
+           PRIuCYCLES " ticks\n", bench_avg(samples, UNCONTENDED_ROUNDS),
+           bench_variance(samples, UNCONTENDED_ROUNDS));
+
+    free(samples);
+
+    cycles_t t = run_contended(mutex_thread, nthreads);
+    assert(counter == nthreads * CONTENDED_ROUNDS);
+    printf("lockbench: mutex threads %d%s %" PRIuCYCLES " ticks/op\n",
+           nthreads, spanned ? " spanned" : "",
+           t / (nthreads * CONTENDED_ROUNDS));
+
+    t = run_contended(rwlock_thread, nthreads);
+    printf("lockbench: rwlock threads %d%s writes 1/%d %" PRIuCYCLES
+           " ticks/op\n", nthreads, spanned ? " spanned" : "", WRITE_RATIO,
+           t / (nthreads * CONTENDED_ROUNDS));
+
+    return EXIT_SUCCESS;
+}
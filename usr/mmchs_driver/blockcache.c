@@ -0,0 +1,530 @@
+/**
+ * \file
+ * \brief Write-back block cache of the SD card
+ *
+ * Caches the card in 4KB blocks, replaced by a segmented LRU: a block
+ * enters the probation segment and moves to the protected one when it is
+ * used again, so a long sequential read does not push out the FAT and
+ * directory blocks everybody keeps coming back to. Written blocks stay
+ * dirty in the cache until they are evicted or bcache_flush() is called.
+ *
+ * The misses of one access are queued on the elevator together and only
+ * then waited for, so a large read turns into few multi-block transfers.
+ * A block is busy while it is read or written back; whoever wants it
+ * meanwhile waits for the transfer rather than starting a second one.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockcache.h"
+
+struct bcache_waiter {
+    void *token;
+    struct bcache_waiter *next;
+};
+
+/// A miss of the current access, queued on the elevator
+struct bcache_fill {
+    struct bcache_entry *e;
+    struct blk_request r;
+    size_t first, last;         ///< Bytes of the access within the block
+    uint8_t *buf;               ///< Where they go to or come from
+};
+
+static void lru_remove(struct bcache_lru *l, struct bcache_entry *e)
+{
+    if (e->prev != NULL) {
+        e->prev->next = e->next;
+    } else {
+        l->head = e->next;
+    }
+    if (e->next != NULL) {
+        e->next->prev = e->prev;
+    } else {
+        l->tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+    l->count--;
+}
+
+static void lru_push(struct bcache_lru *l, struct bcache_entry *e)
+{
+    e->prev = NULL;
+    e->next = l->head;
+    if (l->head != NULL) {
+        l->head->prev = e;
+    } else {
+        l->tail = e;
+    }
+    l->head = e;
+    l->count++;
+}
+
+static void lru_append(struct bcache_lru *l, struct bcache_entry *e)
+{
+    e->next = NULL;
+    e->prev = l->tail;
+    if (l->tail != NULL) {
+        l->tail->next = e;
+    } else {
+        l->head = e;
+    }
+    l->tail = e;
+    l->count++;
+}
+
+static inline struct bcache_lru *lru_of(struct bcache *bc,
+                                        struct bcache_entry *e)
+{
+    return e->protected ? &bc->protected : &bc->probation;
+}
+
+/// A cached block is used again
+static void touch(struct bcache *bc, struct bcache_entry *e)
+{
+    lru_remove(lru_of(bc, e), e);
+    e->protected = true;
+    lru_push(&bc->protected, e);
+
+    if (bc->protected.count > bc->protected_max) {
+        struct bcache_entry *old = bc->protected.tail;
+        lru_remove(&bc->protected, old);
+        old->protected = false;
+        lru_push(&bc->probation, old);
+    }
+}
+
+static struct bcache_entry *lookup(struct bcache *bc, uint32_t block)
+{
+    struct bcache_entry *e = bc->hash[block & bc->hash_mask];
+    while (e != NULL && e->block != block) {
+        e = e->hnext;
+    }
+    return e;
+}
+
+static void unhash(struct bcache *bc, struct bcache_entry *e)
+{
+    struct bcache_entry **p = &bc->hash[e->block & bc->hash_mask];
+    while (*p != e) {
+        p = &(*p)->hnext;
+    }
+    *p = e->hnext;
+    e->hnext = NULL;
+    e->valid = false;
+}
+
+static void wait_on(struct bcache *bc, struct bcache_waiter **list)
+{
+    // without a scheduler nothing stays busy beyond one access
+    assert(bc->elv->sched != NULL);
+
+    struct bcache_waiter w = { .token = NULL, .next = *list };
+    *list = &w;
+    bc->stats.busy_waits++;
+    bc->elv->sched->suspend(&w.token);
+}
+
+static void wake_all(struct bcache *bc, struct bcache_waiter **list)
+{
+    struct bcache_waiter *w = *list;
+    *list = NULL;
+    while (w != NULL) {
+        // w lives on the stack of the waiter
+        struct bcache_waiter *next = w->next;
+        bc->elv->sched->resume(w->token);
+        w = next;
+    }
+}
+
+/// A transfer of \p e is over
+static void release(struct bcache *bc, struct bcache_entry *e)
+{
+    e->busy = false;
+    wake_all(bc, &e->waiters);
+    wake_all(bc, &bc->free_waiters);
+}
+
+/// Least recently used entry that is not busy
+static struct bcache_entry *victim(struct bcache *bc)
+{
+    for (struct bcache_entry *e = bc->probation.tail; e; e = e->prev) {
+        if (!e->busy) {
+            return e;
+        }
+    }
+    for (struct bcache_entry *e = bc->protected.tail; e; e = e->prev) {
+        if (!e->busy) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static errval_t writeback(struct bcache *bc, struct bcache_entry *e)
+{
+    e->busy = true;
+    errval_t err = elevator_submit(bc->elv, true,
+                                   e->block * BCACHE_BLOCK_SECTORS,
+                                   BCACHE_BLOCK_SECTORS, e->data);
+    if (err_is_ok(err)) {
+        e->dirty = false;
+        bc->stats.writebacks++;
+    }
+    release(bc, e);
+    return err;
+}
+
+/**
+ * \brief Take the least recently used entry for \p block
+ *
+ * \param ret  The entry, hashed as \p block and at the head of probation.
+ *             NULL if no entry is idle, or if a dirty one had to be written
+ *             back first; the block has to be looked up again then.
+ */
+static errval_t claim(struct bcache *bc, uint32_t block,
+                      struct bcache_entry **ret)
+{
+    *ret = NULL;
+    struct bcache_entry *e = victim(bc);
+    if (e == NULL) {
+        return SYS_ERR_OK;
+    }
+
+    if (e->valid && e->dirty) {
+        bc->stats.dirty_evictions++;
+        return writeback(bc, e);
+    }
+
+    if (e->valid) {
+        unhash(bc, e);
+        bc->stats.evictions++;
+    }
+
+    e->block = block;
+    e->valid = true;
+    e->hnext = bc->hash[block & bc->hash_mask];
+    bc->hash[block & bc->hash_mask] = e;
+
+    lru_remove(lru_of(bc, e), e);
+    e->protected = false;
+    lru_push(&bc->probation, e);
+
+    *ret = e;
+    return SYS_ERR_OK;
+}
+
+/// A NULL \p buf only loads the block
+static inline void copy_block(struct bcache_entry *e, bool write,
+                              size_t first, size_t last, uint8_t *buf)
+{
+    if (buf == NULL) {
+        return;
+    }
+    if (write) {
+        memcpy(e->data + first, buf, last - first);
+        e->dirty = true;
+    } else {
+        memcpy(buf, e->data + first, last - first);
+    }
+}
+
+/// Wait for the queued misses and do their part of the access
+static errval_t complete_fills(struct bcache *bc, bool write,
+                               struct bcache_fill *fills, size_t *nfills)
+{
+    errval_t err = SYS_ERR_OK;
+
+    for (size_t i = 0; i < *nfills; i++) {
+        struct bcache_fill *f = &fills[i];
+        errval_t ferr = elevator_wait(bc->elv, &f->r);
+        if (err_is_ok(ferr)) {
+            copy_block(f->e, write, f->first, f->last, f->buf);
+        } else {
+            // forget the block, it is reused first
+            unhash(bc, f->e);
+            lru_remove(lru_of(bc, f->e), f->e);
+            lru_append(&bc->probation, f->e);
+            err = ferr;
+        }
+        release(bc, f->e);
+    }
+
+    *nfills = 0;
+    return err;
+}
+
+static errval_t cache_access(struct bcache *bc, bool write, uint64_t offset,
+                             size_t bytes, uint8_t *buf)
+{
+    struct bcache_fill fills[BCACHE_BATCH];
+    size_t nfills = 0, batch = BCACHE_BATCH;
+    errval_t err = SYS_ERR_OK;
+
+    // leave idle entries to the others
+    if (batch > bc->nentries / 2) {
+        batch = bc->nentries / 2;
+    }
+
+    uint64_t end = offset + bytes;
+    uint32_t block = offset / BCACHE_BLOCK_SIZE;
+    while ((uint64_t)block * BCACHE_BLOCK_SIZE < end && err_is_ok(err)) {
+        uint64_t start = (uint64_t)block * BCACHE_BLOCK_SIZE;
+        size_t first = (offset > start) ? offset - start : 0;
+        size_t last = (end < start + BCACHE_BLOCK_SIZE) ?
+                      end - start : BCACHE_BLOCK_SIZE;
+        uint8_t *bbuf = (buf == NULL) ? NULL : buf + (start + first - offset);
+
+        struct bcache_entry *e = lookup(bc, block);
+        if (e != NULL && e->busy) {
+            // finish ours first, we may hold what the other one waits for
+            err = complete_fills(bc, write, fills, &nfills);
+            wait_on(bc, &e->waiters);
+            continue;
+        }
+        if (e != NULL) {
+            // prefetching does not make a block any more valuable
+            if (buf != NULL) {
+                bc->stats.hits++;
+                touch(bc, e);
+            }
+            copy_block(e, write, first, last, bbuf);
+            block++;
+            continue;
+        }
+
+        if (nfills == batch) {
+            err = complete_fills(bc, write, fills, &nfills);
+            continue;
+        }
+
+        err = claim(bc, block, &e);
+        if (err_is_fail(err)) {
+            break;
+        }
+        if (e == NULL) {
+            if (victim(bc) == NULL) {
+                err = complete_fills(bc, write, fills, &nfills);
+                if (victim(bc) == NULL) {
+                    wait_on(bc, &bc->free_waiters);
+                }
+            }
+            continue;
+        }
+
+        bc->stats.misses++;
+        if (write && first == 0 && last == BCACHE_BLOCK_SIZE) {
+            // overwritten as a whole, nothing to read
+            copy_block(e, write, first, last, bbuf);
+            block++;
+            continue;
+        }
+
+        e->busy = true;
+        struct bcache_fill *f = &fills[nfills++];
+        f->e = e;
+        f->first = first;
+        f->last = last;
+        f->buf = bbuf;
+        f->r = (struct blk_request) {
+            .write = false,
+            .lba = block * BCACHE_BLOCK_SECTORS,
+            .count = BCACHE_BLOCK_SECTORS,
+            .buf = e->data,
+        };
+        elevator_queue(bc->elv, &f->r);
+        block++;
+    }
+
+    errval_t ferr = complete_fills(bc, write, fills, &nfills);
+    return err_is_fail(err) ? err : ferr;
+}
+
+/**
+ * \brief Set up a cache of \p blocks 4KB blocks in front of \p elv
+ */
+errval_t bcache_init(struct bcache *bc, struct elevator *elv, size_t blocks)
+{
+    assert(blocks >= 2);
+    assert(elv->max_sectors >= BCACHE_BLOCK_SECTORS);
+
+    memset(bc, 0, sizeof(*bc));
+    bc->elv = elv;
+    bc->nentries = blocks;
+    bc->protected_max = blocks * 3 / 4;
+
+    size_t hash_size = 1;
+    while (hash_size < blocks) {
+        hash_size <<= 1;
+    }
+    bc->hash_mask = hash_size - 1;
+
+    bc->entries = calloc(blocks, sizeof(struct bcache_entry));
+    bc->hash = calloc(hash_size, sizeof(struct bcache_entry *));
+    bc->data = malloc(blocks * BCACHE_BLOCK_SIZE);
+    if (bc->entries == NULL || bc->hash == NULL || bc->data == NULL) {
+        free(bc->entries);
+        free(bc->hash);
+        free(bc->data);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    for (size_t i = 0; i < blocks; i++) {
+        bc->entries[i].data = bc->data + i * BCACHE_BLOCK_SIZE;
+        lru_append(&bc->probation, &bc->entries[i]);
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Read \p count sectors at \p lba
+ */
+errval_t bcache_read(struct bcache *bc, uint32_t lba, uint32_t count,
+                     void *buf)
+{
+    return cache_access(bc, false, (uint64_t)lba * BLK_SECTOR_SIZE,
+                        count * BLK_SECTOR_SIZE, buf);
+}
+
+/**
+ * \brief Write \p count sectors at \p lba into the cache
+ *
+ * The card is written when the blocks are evicted or flushed.
+ */
+errval_t bcache_write(struct bcache *bc, uint32_t lba, uint32_t count,
+                      const void *buf)
+{
+    return cache_access(bc, true, (uint64_t)lba * BLK_SECTOR_SIZE,
+                        count * BLK_SECTOR_SIZE, (uint8_t *)buf);
+}
+
+/**
+ * \brief Read \p bytes at byte \p offset of the card
+ */
+errval_t bcache_read_bytes(struct bcache *bc, uint64_t offset, size_t bytes,
+                           void *buf)
+{
+    return cache_access(bc, false, offset, bytes, buf);
+}
+
+/**
+ * \brief Write \p bytes at byte \p offset of the card into the cache
+ */
+errval_t bcache_write_bytes(struct bcache *bc, uint64_t offset, size_t bytes,
+                            const void *buf)
+{
+    return cache_access(bc, true, offset, bytes, (uint8_t *)buf);
+}
+
+/**
+ * \brief Load \p count sectors at \p lba into the cache
+ *
+ * For read-ahead: the misses go to the card together, as few transfers.
+ */
+errval_t bcache_prefetch(struct bcache *bc, uint32_t lba, uint32_t count)
+{
+    return cache_access(bc, false, (uint64_t)lba * BLK_SECTOR_SIZE,
+                        count * BLK_SECTOR_SIZE, NULL);
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+    const struct bcache_entry *ea = *(struct bcache_entry * const *)a;
+    const struct bcache_entry *eb = *(struct bcache_entry * const *)b;
+    return (ea->block > eb->block) - (ea->block < eb->block);
+}
+
+/**
+ * \brief Write all dirty blocks to the card
+ *
+ * The blocks are written in LBA order, so the elevator merges runs of
+ * them. Blocks written to while the flush is going on may stay dirty.
+ */
+errval_t bcache_flush(struct bcache *bc)
+{
+    struct bcache_entry **dirty = malloc(bc->nentries * sizeof(*dirty));
+    if (dirty == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    size_t ndirty = 0;
+    for (size_t i = 0; i < bc->nentries; i++) {
+        struct bcache_entry *e = &bc->entries[i];
+        if (e->valid && e->dirty && !e->busy) {
+            dirty[ndirty++] = e;
+        }
+    }
+    qsort(dirty, ndirty, sizeof(*dirty), entry_cmp);
+
+    struct blk_request reqs[BCACHE_BATCH];
+    struct bcache_entry *batch[BCACHE_BATCH];
+    errval_t err = SYS_ERR_OK;
+
+    for (size_t i = 0; i < ndirty; ) {
+        size_t n = 0;
+        for (; i < ndirty && n < BCACHE_BATCH; i++) {
+            // things changed if we waited for the previous batch
+            struct bcache_entry *e = dirty[i];
+            if (!e->valid || !e->dirty || e->busy) {
+                continue;
+            }
+
+            e->busy = true;
+            reqs[n] = (struct blk_request) {
+                .write = true,
+                .lba = e->block * BCACHE_BLOCK_SECTORS,
+                .count = BCACHE_BLOCK_SECTORS,
+                .buf = e->data,
+            };
+            elevator_queue(bc->elv, &reqs[n]);
+            batch[n++] = e;
+        }
+
+        for (size_t j = 0; j < n; j++) {
+            errval_t werr = elevator_wait(bc->elv, &reqs[j]);
+            if (err_is_ok(werr)) {
+                batch[j]->dirty = false;
+                bc->stats.writebacks++;
+            } else {
+                err = werr;
+            }
+            release(bc, batch[j]);
+        }
+    }
+
+    free(dirty);
+    return err;
+}
+
+void bcache_print_stats(struct bcache *bc)
+{
+    struct bcache_stats *s = &bc->stats;
+    struct elevator_stats *es = &bc->elv->stats;
+    uint64_t accesses = s->hits + s->misses;
+    uint64_t transfers = es->transfers ? es->transfers : 1;
+
+    debug_printf("bcache: %" PRIu64 " hits %" PRIu64 " misses (%" PRIu64
+                 "%% hits), %" PRIu64 " evictions (%" PRIu64 " dirty), %"
+                 PRIu64 " blocks written back, %" PRIu64 " busy waits\n",
+                 s->hits, s->misses,
+                 accesses ? s->hits * 100 / accesses : 0,
+                 s->evictions, s->dirty_evictions, s->writebacks,
+                 s->busy_waits);
+    debug_printf("elevator: %" PRIu64 " requests in %" PRIu64
+                 " transfers (%" PRIu64 " merged, %" PRIu64
+                 " sectors), queue depth avg %" PRIu64 ".%" PRIu64
+                 " max %" PRIu32 "\n",
+                 es->requests, es->transfers, es->merged, es->sectors,
+                 es->depth_sum / transfers, es->depth_sum * 10 / transfers % 10,
+                 es->depth_max);
+}
@@ -0,0 +1,85 @@
+/**
+ * \file
+ * \brief Write-back block cache of the SD card
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef MMCHS_BLOCKCACHE_H
+#define MMCHS_BLOCKCACHE_H
+
+#include "elevator.h"
+
+#define BCACHE_BLOCK_SECTORS    8       ///< 4KB cache blocks
+#define BCACHE_BLOCK_SIZE       (BCACHE_BLOCK_SECTORS * BLK_SECTOR_SIZE)
+#define BCACHE_DEFAULT_BLOCKS   1024    ///< 4MB
+#define BCACHE_BATCH            32      ///< Blocks one access queues at once
+
+struct bcache_waiter;
+
+struct bcache_entry {
+    uint32_t block;                     ///< LBA / BCACHE_BLOCK_SECTORS
+    bool valid;                         ///< In the hash, data loaded
+    bool busy;                          ///< Being read or written back
+    bool dirty;
+    bool protected;                     ///< In the protected LRU segment
+    uint8_t *data;
+
+    struct bcache_entry *hnext;
+    struct bcache_entry *prev, *next;   ///< LRU order, most recent first
+    struct bcache_waiter *waiters;      ///< Waiting for !busy
+};
+
+struct bcache_lru {
+    struct bcache_entry *head, *tail;
+    size_t count;
+};
+
+struct bcache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t writebacks;    ///< Blocks written to the card
+    uint64_t evictions;
+    uint64_t dirty_evictions;
+    uint64_t busy_waits;    ///< Accesses that waited for another's transfer
+};
+
+struct bcache {
+    struct elevator *elv;
+    size_t nentries;
+    struct bcache_entry *entries;
+    uint8_t *data;
+
+    struct bcache_entry **hash;
+    size_t hash_mask;
+
+    /// Segmented LRU: new blocks go to probation, blocks used again move
+    /// to protected, which holds at most protected_max blocks
+    struct bcache_lru probation, protected;
+    size_t protected_max;
+
+    struct bcache_waiter *free_waiters;     ///< Waiting for an idle entry
+    struct bcache_stats stats;
+};
+
+errval_t bcache_init(struct bcache *bc, struct elevator *elv, size_t blocks);
+errval_t bcache_read(struct bcache *bc, uint32_t lba, uint32_t count,
+                     void *buf);
+errval_t bcache_write(struct bcache *bc, uint32_t lba, uint32_t count,
+                      const void *buf);
+errval_t bcache_read_bytes(struct bcache *bc, uint64_t offset, size_t bytes,
+                           void *buf);
+errval_t bcache_write_bytes(struct bcache *bc, uint64_t offset, size_t bytes,
+                            const void *buf);
+errval_t bcache_prefetch(struct bcache *bc, uint32_t lba, uint32_t count);
+errval_t bcache_flush(struct bcache *bc);
+void bcache_print_stats(struct bcache *bc);
+
+#endif // MMCHS_BLOCKCACHE_H
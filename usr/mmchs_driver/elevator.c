@@ -0,0 +1,216 @@
+/**
+ * \file
+ * \brief Elevator request queue in front of the SD card
+ *
+ * Requests are kept sorted by LBA and served in one direction (C-SCAN):
+ * the next transfer starts at the first request at or after the position
+ * of the last one, wrapping around to the lowest LBA. Requests of the same
+ * direction that continue each other are merged into one multi-block
+ * transfer of up to max_sectors, gathered in a staging buffer.
+ *
+ * With scheduling hooks, a dispatcher in elevator_run() issues the
+ * transfers and callers suspend until theirs is done. The dispatcher
+ * yields before each transfer, so that everything the clients can queue
+ * by then takes part in the merge. Without hooks, the caller waiting in
+ * elevator_wait() runs the queue itself; this still merges the requests
+ * a caller queued together.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "elevator.h"
+
+/**
+ * \brief Set up an empty queue
+ *
+ * \param transfer     Device access, called with at most \p max_sectors
+ * \param sched        Cooperative scheduling, or NULL to run transfers in
+ *                     the waiting caller
+ */
+errval_t elevator_init(struct elevator *e, blk_transfer_fn transfer,
+                       void *transfer_st, uint32_t max_sectors,
+                       const struct blk_sched *sched)
+{
+    assert(max_sectors > 0);
+
+    memset(e, 0, sizeof(*e));
+    e->transfer = transfer;
+    e->transfer_st = transfer_st;
+    e->max_sectors = max_sectors;
+    e->sched = sched;
+
+    e->staging = malloc(max_sectors * BLK_SECTOR_SIZE);
+    if (e->staging == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Add a request to the queue without waiting for it
+ *
+ * The request must stay valid until elevator_wait() returned for it.
+ */
+void elevator_queue(struct elevator *e, struct blk_request *r)
+{
+    assert(r->count > 0 && r->count <= e->max_sectors);
+
+    r->done = false;
+    r->waiter = NULL;
+    r->err = SYS_ERR_OK;
+
+    struct blk_request **p = &e->pending;
+    while (*p != NULL && (*p)->lba <= r->lba) {
+        p = &(*p)->next;
+    }
+    r->next = *p;
+    *p = r;
+
+    e->depth++;
+    e->stats.requests++;
+
+    if (e->dispatcher != NULL) {
+        void *d = e->dispatcher;
+        e->dispatcher = NULL;
+        e->sched->resume(d);
+    }
+}
+
+/// Take the next run of requests off the queue
+static struct blk_request *take_batch(struct elevator *e, uint32_t *sectors)
+{
+    struct blk_request **p = &e->pending;
+    while (*p != NULL && (*p)->lba < e->head) {
+        p = &(*p)->next;
+    }
+    if (*p == NULL) {
+        p = &e->pending;
+    }
+
+    struct blk_request *first = *p, *last = first;
+    uint32_t count = first->count;
+    while (last->next != NULL && last->next->write == first->write
+           && last->next->lba == first->lba + count
+           && count + last->next->count <= e->max_sectors) {
+        last = last->next;
+        count += last->count;
+    }
+
+    *p = last->next;
+    last->next = NULL;
+    *sectors = count;
+    return first;
+}
+
+/// Issue the next transfer and complete its requests
+static void dispatch_one(struct elevator *e)
+{
+    uint32_t count, n = 0;
+    struct blk_request *batch = take_batch(e, &count);
+    bool write = batch->write;
+    uint32_t lba = batch->lba;
+
+    e->stats.depth_sum += e->depth;
+    if (e->depth > e->stats.depth_max) {
+        e->stats.depth_max = e->depth;
+    }
+
+    errval_t err;
+    if (batch->next == NULL) {
+        err = e->transfer(e->transfer_st, write, lba, count, batch->buf);
+        n = 1;
+    } else {
+        if (write) {
+            for (struct blk_request *r = batch; r != NULL; r = r->next) {
+                memcpy(e->staging + (r->lba - lba) * BLK_SECTOR_SIZE, r->buf,
+                       r->count * BLK_SECTOR_SIZE);
+            }
+        }
+        err = e->transfer(e->transfer_st, write, lba, count, e->staging);
+        for (struct blk_request *r = batch; r != NULL; r = r->next, n++) {
+            if (!write && err_is_ok(err)) {
+                memcpy(r->buf, e->staging + (r->lba - lba) * BLK_SECTOR_SIZE,
+                       r->count * BLK_SECTOR_SIZE);
+            }
+        }
+    }
+
+    e->head = lba + count;
+    e->depth -= n;
+    e->stats.transfers++;
+    e->stats.merged += n - 1;
+    e->stats.sectors += count;
+
+    // the callers may reuse their requests as soon as they run again
+    struct blk_request *r = batch;
+    while (r != NULL) {
+        struct blk_request *next = r->next;
+        void *waiter = r->waiter;
+        r->err = err;
+        r->done = true;
+        if (waiter != NULL) {
+            e->sched->resume(waiter);
+        }
+        r = next;
+    }
+}
+
+/**
+ * \brief Wait until a queued request has been transferred
+ */
+errval_t elevator_wait(struct elevator *e, struct blk_request *r)
+{
+    while (!r->done) {
+        if (e->sched == NULL) {
+            dispatch_one(e);
+        } else {
+            e->sched->suspend(&r->waiter);
+        }
+    }
+    return r->err;
+}
+
+/**
+ * \brief Transfer \p count sectors at \p lba, at most max_sectors
+ */
+errval_t elevator_submit(struct elevator *e, bool write, uint32_t lba,
+                         uint32_t count, void *buf)
+{
+    struct blk_request r = {
+        .write = write,
+        .lba = lba,
+        .count = count,
+        .buf = buf,
+    };
+
+    elevator_queue(e, &r);
+    return elevator_wait(e, &r);
+}
+
+/**
+ * \brief Dispatcher loop, run in a context of its own. Does not return.
+ */
+void elevator_run(struct elevator *e)
+{
+    assert(e->sched != NULL);
+
+    for (;;) {
+        if (e->pending == NULL) {
+            e->sched->suspend(&e->dispatcher);
+            continue;
+        }
+
+        // let the clients that are runnable add to the queue first
+        e->sched->yield();
+        dispatch_one(e);
+    }
+}
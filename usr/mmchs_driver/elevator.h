@@ -0,0 +1,83 @@
+/**
+ * \file
+ * \brief Elevator request queue in front of the SD card
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef MMCHS_ELEVATOR_H
+#define MMCHS_ELEVATOR_H
+
+#include <barrelfish/barrelfish.h>
+
+#define BLK_SECTOR_SIZE 512
+
+/**
+ * Cooperative scheduling of the callers, THC in the driver. Everything
+ * between two calls of these hooks runs without interference.
+ */
+struct blk_sched {
+    void (*suspend)(void **waiter);     ///< Block, *waiter names the caller
+    void (*resume)(void *waiter);       ///< Make a suspended caller runnable
+    void (*yield)(void);                ///< Let runnable callers go first
+};
+
+/// Moves \p count sectors at \p lba to or from \p buf
+typedef errval_t (*blk_transfer_fn)(void *st, bool write, uint32_t lba,
+                                    uint32_t count, void *buf);
+
+struct blk_request {
+    bool write;
+    uint32_t lba;
+    uint32_t count;
+    void *buf;
+
+    errval_t err;
+    bool done;
+    void *waiter;
+    struct blk_request *next;
+};
+
+struct elevator_stats {
+    uint64_t requests;
+    uint64_t transfers;     ///< Device commands issued
+    uint64_t merged;        ///< Requests that joined another's transfer
+    uint64_t sectors;
+    uint64_t depth_sum;     ///< Queue depth seen by each transfer
+    uint32_t depth_max;
+};
+
+struct elevator {
+    blk_transfer_fn transfer;
+    void *transfer_st;
+    uint32_t max_sectors;           ///< Largest single transfer
+    uint8_t *staging;               ///< Gathers merged requests
+
+    /// NULL: transfers run in elevator_wait() of the caller
+    const struct blk_sched *sched;
+    void *dispatcher;               ///< Suspended in elevator_run()
+
+    struct blk_request *pending;    ///< Sorted by LBA
+    uint32_t depth;
+    uint32_t head;                  ///< LBA after the last transfer
+
+    struct elevator_stats stats;
+};
+
+errval_t elevator_init(struct elevator *e, blk_transfer_fn transfer,
+                       void *transfer_st, uint32_t max_sectors,
+                       const struct blk_sched *sched);
+void elevator_queue(struct elevator *e, struct blk_request *r);
+errval_t elevator_wait(struct elevator *e, struct blk_request *r);
+errval_t elevator_submit(struct elevator *e, bool write, uint32_t lba,
+                         uint32_t count, void *buf);
+void elevator_run(struct elevator *e);
+
+#endif // MMCHS_ELEVATOR_H
@@ -0,0 +1,1380 @@
+/**
+ * \file
+ * \brief FAT32 file system on the SD card
+ *
+ * Everything goes through the block cache; file data is read and written
+ * in runs of physically contiguous clusters, so a read of an unfragmented
+ * file is one cache access. The clusters of a file are remembered as
+ * extents as far as the chain has been walked, so reading at an offset
+ * follows the FAT only once, and closed files stay cached with their
+ * extents. The FAT itself is read through a window of one cache block.
+ * Lookups of a name in a directory are cached, including names that do
+ * not exist, so resolving a path does not scan the directories again.
+ *
+ * Long names are read, new entries get 8.3 names. The volume is either
+ * the whole card or its first primary partition. FAT12 and FAT16 are not
+ * supported.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dev/fat_bpb_dev.h>
+#include <dev/fat32_ebpb_dev.h>
+#include <dev/fat_direntry_dev.h>
+
+#include "fat.h"
+
+#define FAT_MASK            0x0FFFFFFFu
+#define FAT_EOC             0x0FFFFFF8u     ///< This and above end a chain
+#define FAT_EOC_MARK        0x0FFFFFFFu
+#define FAT_PER_SECTOR      (BLK_SECTOR_SIZE / sizeof(uint32_t))
+
+#define DIRENT_END          0x00
+#define DIRENT_FREE         0xE5
+#define DIRENT_KANJI_E5     0x05            ///< Stands for a leading 0xE5
+#define ATTR_LFN            0x0F
+#define LFN_LAST            0x40
+#define LFN_CHARS           13
+
+#define MBR_PART_TABLE      0x1BE
+#define PART_FAT32_CHS      0x0B
+#define PART_FAT32_LBA      0x0C
+
+/// 1 January 2015, for the dates of new entries
+#define FAT_DATE            (((2015 - 1980) << 9) | (1 << 5) | 1)
+
+static uint8_t zeroes[BCACHE_BLOCK_SIZE];
+
+static inline uint64_t cluster_offset(struct fat_fs *fs, uint32_t cluster)
+{
+    return (uint64_t)(fs->data_lba + (cluster - 2) * fs->sectors_per_cluster)
+           * BLK_SECTOR_SIZE;
+}
+
+static inline uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//
+// FAT
+//
+
+/**
+ * \brief The entry of \p cluster in the FAT window, loading the block of
+ * the first FAT that holds it
+ *
+ * Chains mostly stay within a block of the FAT, so following one costs a
+ * copy out of the block cache per block, not per entry.
+ */
+static errval_t fat_entry(struct fat_fs *fs, uint32_t cluster, uint8_t **entry)
+{
+    uint32_t win = cluster / FAT_WIN_ENTRIES;
+
+    if (fs->fat_win_index != win + 1) {
+        uint64_t first = (uint64_t)win * BCACHE_BLOCK_SIZE;
+        uint64_t bytes = (uint64_t)fs->fat_sectors * BLK_SECTOR_SIZE - first;
+        if (bytes > BCACHE_BLOCK_SIZE) {
+            bytes = BCACHE_BLOCK_SIZE;
+        }
+
+        fs->fat_win_index = 0;
+        errval_t err = bcache_read_bytes(fs->bc, (uint64_t)fs->fat_lba
+                                         * BLK_SECTOR_SIZE + first, bytes,
+                                         fs->fat_win);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        fs->fat_win_index = win + 1;
+        fs->stats.fat_loads++;
+    }
+
+    *entry = fs->fat_win + (cluster % FAT_WIN_ENTRIES) * sizeof(uint32_t);
+    return SYS_ERR_OK;
+}
+
+static errval_t fat_get(struct fat_fs *fs, uint32_t cluster, uint32_t *next)
+{
+    uint8_t *entry;
+    errval_t err = fat_entry(fs, cluster, &entry);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    *next = le32(entry) & FAT_MASK;
+    return SYS_ERR_OK;
+}
+
+/// Sets the entry in the window and in all copies of the FAT
+static errval_t fat_set(struct fat_fs *fs, uint32_t cluster, uint32_t val)
+{
+    uint8_t *entry;
+    errval_t err = fat_entry(fs, cluster, &entry);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // the top four bits are reserved
+    val = (val & FAT_MASK) | (le32(entry) & ~FAT_MASK);
+    entry[0] = val;
+    entry[1] = val >> 8;
+    entry[2] = val >> 16;
+    entry[3] = val >> 24;
+
+    for (uint32_t i = 0; i < fs->nfats; i++) {
+        uint64_t offset = (uint64_t)(fs->fat_lba + i * fs->fat_sectors)
+                          * BLK_SECTOR_SIZE + cluster * 4;
+        err = bcache_write_bytes(fs->bc, offset, 4, entry);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+static errval_t find_free(struct fat_fs *fs, uint32_t *ret)
+{
+    uint32_t c = fs->free_hint;
+
+    for (uint32_t checked = 0; checked < fs->clusters - 2; checked++, c++) {
+        if (c < 2 || c >= fs->clusters) {
+            c = 2;
+        }
+
+        uint8_t *entry;
+        errval_t err = fat_entry(fs, c, &entry);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        if ((le32(entry) & FAT_MASK) == 0) {
+            *ret = c;
+            return SYS_ERR_OK;
+        }
+    }
+    return FS_ERR_NOSPACE;
+}
+
+/// Allocate a cluster and append it to the chain ending in \p prev, if any
+static errval_t alloc_cluster(struct fat_fs *fs, uint32_t prev, uint32_t *ret)
+{
+    errval_t err;
+    uint32_t c = 0;
+
+    // right behind the previous one keeps the file contiguous
+    if (prev != 0 && prev + 1 < fs->clusters) {
+        uint32_t val;
+        err = fat_get(fs, prev + 1, &val);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        if (val == 0) {
+            c = prev + 1;
+        }
+    }
+    if (c == 0) {
+        err = find_free(fs, &c);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    err = fat_set(fs, c, FAT_EOC_MARK);
+    if (err_is_ok(err) && prev != 0) {
+        err = fat_set(fs, prev, c);
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    fs->free_hint = c + 1;
+    *ret = c;
+    return SYS_ERR_OK;
+}
+
+static errval_t free_chain(struct fat_fs *fs, uint32_t c)
+{
+    while (c >= 2 && c < fs->clusters) {
+        uint32_t next;
+        errval_t err = fat_get(fs, c, &next);
+        if (err_is_ok(err)) {
+            err = fat_set(fs, c, 0);
+        }
+        if (err_is_fail(err)) {
+            return err;
+        }
+        if (c < fs->free_hint) {
+            fs->free_hint = c;
+        }
+        c = next;
+    }
+    return SYS_ERR_OK;
+}
+
+//
+// Cluster chain cache
+//
+
+/// The last cluster of the chain as far as it is known, 0 if none is
+static inline uint32_t chain_last(struct fat_file *f)
+{
+    if (f->nextents == 0) {
+        return 0;
+    }
+    struct fat_extent *last = &f->extents[f->nextents - 1];
+    return last->cluster + last->count - 1;
+}
+
+static errval_t chain_push(struct fat_file *f, uint32_t cluster)
+{
+    if (f->nextents > 0 && chain_last(f) + 1 == cluster) {
+        f->extents[f->nextents - 1].count++;
+        f->chain_len++;
+        return SYS_ERR_OK;
+    }
+
+    if (f->nextents == f->extents_cap) {
+        uint32_t cap = f->extents_cap ? f->extents_cap * 2 : 4;
+        struct fat_extent *extents = realloc(f->extents, cap * sizeof(*extents));
+        if (extents == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        f->extents = extents;
+        f->extents_cap = cap;
+    }
+    f->extents[f->nextents++] = (struct fat_extent) {
+        .index = f->chain_len, .cluster = cluster, .count = 1
+    };
+    f->chain_len++;
+    return SYS_ERR_OK;
+}
+
+/// The extent holding the \p index-th cluster, which must be known
+static struct fat_extent *extent_find(struct fat_file *f, uint32_t index)
+{
+    struct fat_extent *e = &f->extents[f->ext_hint];
+
+    // sequential access stays in or moves to the next extent
+    if (e->index <= index && index < e->index + e->count) {
+        return e;
+    }
+    if (f->ext_hint + 1 < f->nextents && e[1].index <= index
+        && index < e[1].index + e[1].count) {
+        f->ext_hint++;
+        return e + 1;
+    }
+
+    uint32_t lo = 0, hi = f->nextents;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (f->extents[mid].index <= index) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    f->ext_hint = lo;
+    return &f->extents[lo];
+}
+
+/**
+ * \brief The \p index-th cluster of \p f, 0 if the chain is shorter
+ */
+static errval_t chain_get(struct fat_file *f, uint32_t index,
+                          uint32_t *cluster)
+{
+    errval_t err;
+
+    *cluster = 0;
+    if (f->start == 0) {
+        return SYS_ERR_OK;
+    }
+    if (f->chain_len == 0) {
+        err = chain_push(f, f->start);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    while (f->chain_len <= index && !f->chain_done) {
+        uint32_t next;
+        err = fat_get(f->fs, chain_last(f), &next);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        f->fs->stats.fat_walked++;
+        if (next >= FAT_EOC) {
+            f->chain_done = true;
+        } else if (next < 2 || next >= f->fs->clusters) {
+            return FAT_ERR_BAD_FS;
+        } else {
+            err = chain_push(f, next);
+            if (err_is_fail(err)) {
+                return err;
+            }
+        }
+    }
+
+    if (index < f->chain_len) {
+        struct fat_extent *e = extent_find(f, index);
+        *cluster = e->cluster + (index - e->index);
+    }
+    return SYS_ERR_OK;
+}
+
+/// Allocate clusters until the chain has an \p index-th one
+static errval_t chain_extend(struct fat_file *f, uint32_t index)
+{
+    uint32_t c;
+    errval_t err = chain_get(f, index, &c);
+    if (err_is_fail(err) || c != 0) {
+        return err;
+    }
+
+    while (f->chain_len <= index) {
+        uint32_t prev = chain_last(f);
+        err = alloc_cluster(f->fs, prev, &c);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        if (prev == 0) {
+            f->start = c;
+        }
+        err = chain_push(f, c);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+    f->chain_done = true;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Where byte \p pos of \p f is on the card, and how many of the
+ * following \p len bytes are stored contiguously from there
+ */
+static errval_t file_run(struct fat_file *f, size_t pos, size_t len,
+                         uint64_t *offset, size_t *run)
+{
+    struct fat_fs *fs = f->fs;
+    uint32_t index = pos / fs->cluster_size;
+    size_t in = pos % fs->cluster_size;
+    uint32_t c, next;
+
+    errval_t err = chain_get(f, index, &c);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    if (c == 0) {
+        return FAT_ERR_BAD_FS;  // chain shorter than the file
+    }
+
+    // the run is the rest of the extent, which may go on past what is known
+    struct fat_extent *e = extent_find(f, index);
+    uint32_t end = e->index + e->count;
+    while ((size_t)(end - index) * fs->cluster_size - in < len
+           && end == f->chain_len && !f->chain_done) {
+        err = chain_get(f, end, &next);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        e = extent_find(f, index);
+        if (e->index + e->count == end) {
+            break;
+        }
+        end = e->index + e->count;
+    }
+
+    size_t n = (size_t)(end - index) * fs->cluster_size - in;
+    *offset = cluster_offset(fs, c) + in;
+    *run = (n < len) ? n : len;
+    return SYS_ERR_OK;
+}
+
+//
+// Open files
+//
+
+static void file_drop(struct fat_file *f)
+{
+    struct fat_file **p = &f->fs->open;
+    while (*p != f) {
+        p = &(*p)->next;
+    }
+    *p = f->next;
+    f->fs->closed--;
+    free(f->extents);
+    free(f);
+}
+
+/// Open the file with its entry at \p dirent, from the file cache if it is there
+static struct fat_file *file_get(struct fat_fs *fs, uint64_t dirent,
+                                 uint32_t start, uint32_t size, bool dir)
+{
+    struct fat_file *f;
+    for (struct fat_file **p = &fs->open; *p != NULL; p = &(*p)->next) {
+        f = *p;
+        if (f->dirent == dirent) {
+            *p = f->next;
+            f->next = fs->open;
+            fs->open = f;
+            if (f->refs++ == 0) {
+                fs->closed--;
+            }
+            return f;
+        }
+    }
+
+    f = calloc(1, sizeof(*f));
+    if (f == NULL) {
+        return NULL;
+    }
+    f->fs = fs;
+    f->dirent = dirent;
+    f->start = start;
+    f->size = size;
+    f->dir = dir;
+    // not known to be older, as the file may have been dropped from the
+    // cache after it was changed
+    f->version = fs->generation;
+    f->refs = 1;
+    f->next = fs->open;
+    fs->open = f;
+    return f;
+}
+
+/**
+ * \brief Drop a reference to \p f from fat_open() or fat_create()
+ *
+ * The last one leaves \p f in the file cache, so opening it again does not
+ * walk its chain again.
+ */
+void fat_close(struct fat_file *f)
+{
+    struct fat_fs *fs = f->fs;
+
+    assert(f->refs > 0);
+    if (--f->refs > 0) {
+        return;
+    }
+
+    if (++fs->closed > FAT_FILE_CACHE) {
+        // the least recently used closed file goes
+        struct fat_file *victim = NULL;
+        for (struct fat_file *g = fs->open; g != NULL; g = g->next) {
+            if (g->refs == 0) {
+                victim = g;
+            }
+        }
+        file_drop(victim);
+    }
+}
+
+static struct fat_file *open_root(struct fat_fs *fs)
+{
+    return file_get(fs, 0, fs->root_cluster, 0, true);
+}
+
+/// Store size and first cluster of \p f in its directory entry
+static errval_t update_dirent(struct fat_file *f)
+{
+    uint8_t raw[FAT_DIRENT_SIZE];
+    fat_direntry_t de;
+
+    if (f->dirent == 0) {
+        return SYS_ERR_OK;
+    }
+
+    errval_t err = bcache_read_bytes(f->fs->bc, f->dirent, sizeof(raw), raw);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    fat_direntry_initialize(&de, (mackerel_addr_t)raw);
+    fat_direntry_starth_wr(&de, f->start >> 16);
+    fat_direntry_start_wr(&de, f->start & 0xffff);
+    fat_direntry_size_wr(&de, f->size);
+    fat_direntry_wdate_wr(&de, FAT_DATE);
+
+    f->fs->dir_buf_cluster = 0;
+    return bcache_write_bytes(f->fs->bc, f->dirent, sizeof(raw), raw);
+}
+
+//
+// Directories
+//
+
+/// Bring the \p index-th cluster of \p dir into dir_buf
+static errval_t dir_load(struct fat_file *dir, uint32_t index,
+                         uint32_t *cluster)
+{
+    struct fat_fs *fs = dir->fs;
+
+    errval_t err = chain_get(dir, index, cluster);
+    if (err_is_fail(err) || *cluster == 0) {
+        return err;
+    }
+    if (fs->dir_buf_cluster == *cluster) {
+        return SYS_ERR_OK;
+    }
+
+    fs->dir_buf_cluster = 0;
+    err = bcache_read_bytes(fs->bc, cluster_offset(fs, *cluster),
+                            fs->cluster_size, fs->dir_buf);
+    if (err_is_ok(err)) {
+        fs->dir_buf_cluster = *cluster;
+    }
+    return err;
+}
+
+/// Card byte offset of the entry in \p slot of \p dir
+static errval_t slot_addr(struct fat_file *dir, uint32_t slot, uint64_t *addr)
+{
+    uint32_t per_cluster = dir->fs->cluster_size / FAT_DIRENT_SIZE;
+    uint32_t c;
+
+    errval_t err = chain_get(dir, slot / per_cluster, &c);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    if (c == 0) {
+        return FS_ERR_INDEX_BOUNDS;
+    }
+    *addr = cluster_offset(dir->fs, c) + (slot % per_cluster) * FAT_DIRENT_SIZE;
+    return SYS_ERR_OK;
+}
+
+static void short_name_str(fat_direntry_t *de, char *buf)
+{
+    size_t n = 0;
+    bool lower = fat_direntry_lwr_bl_rdf(de);
+
+    for (int i = 0; i < 8; i++) {
+        char c = fat_direntry_fn_rd(de, i);
+        if (i == 0 && (uint8_t)c == DIRENT_KANJI_E5) {
+            c = (char)DIRENT_FREE;
+        }
+        buf[n++] = lower ? tolower(c) : c;
+    }
+    while (n > 0 && buf[n - 1] == ' ') {
+        n--;
+    }
+
+    lower = fat_direntry_lwr_el_rdf(de);
+    if (fat_direntry_ext_rd(de, 0) != ' ') {
+        buf[n++] = '.';
+        for (int i = 0; i < 3; i++) {
+            char c = fat_direntry_ext_rd(de, i);
+            buf[n++] = lower ? tolower(c) : c;
+        }
+        while (buf[n - 1] == ' ') {
+            n--;
+        }
+    }
+    buf[n] = '\0';
+}
+
+static uint8_t short_name_sum(const uint8_t *raw)
+{
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + raw[i];
+    }
+    return sum;
+}
+
+/// Take the characters of a long name entry into \p name
+static void lfn_collect(const uint8_t *raw, char *name)
+{
+    static const uint8_t pos[LFN_CHARS] = {
+        1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30
+    };
+    uint32_t first = ((raw[0] & 0x1f) - 1) * LFN_CHARS;
+
+    for (int i = 0; i < LFN_CHARS; i++) {
+        uint16_t c = raw[pos[i]] | (raw[pos[i] + 1] << 8);
+        if (first + i >= FAT_NAME_MAX || c == 0) {
+            break;
+        }
+        name[first + i] = (c < 0x80) ? c : '?';
+    }
+}
+
+/**
+ * \brief The next entry of \p dir at or after \p slot
+ *
+ * Skips free entries, "." and "..", and the volume label. Advances \p slot
+ * past the entry returned.
+ *
+ * \return FS_ERR_INDEX_BOUNDS at the end of the directory
+ */
+errval_t fat_readdir(struct fat_file *dir, uint32_t *slot,
+                     struct fat_dirent_info *info)
+{
+    struct fat_fs *fs = dir->fs;
+    uint32_t per_cluster = fs->cluster_size / FAT_DIRENT_SIZE;
+    uint32_t lfn_slots = 0;
+    uint8_t lfn_sum = 0;
+    errval_t err;
+
+    if (!dir->dir) {
+        return FS_ERR_NOTDIR;
+    }
+
+    memset(info->name, 0, sizeof(info->name));
+    for (uint32_t s = *slot; ; s++) {
+        uint32_t c;
+        err = dir_load(dir, s / per_cluster, &c);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        if (c == 0) {
+            return FS_ERR_INDEX_BOUNDS;
+        }
+
+        uint8_t *raw = fs->dir_buf + (s % per_cluster) * FAT_DIRENT_SIZE;
+        fat_direntry_t de;
+        fat_direntry_initialize(&de, (mackerel_addr_t)raw);
+        fs->stats.dirents++;
+
+        if (raw[0] == DIRENT_END) {
+            return FS_ERR_INDEX_BOUNDS;
+        }
+        if (raw[0] == DIRENT_FREE) {
+            lfn_slots = 0;
+            continue;
+        }
+        if (fat_direntry_attr_rd(&de) == ATTR_LFN) {
+            if (raw[0] & LFN_LAST) {
+                memset(info->name, 0, sizeof(info->name));
+                lfn_slots = 0;
+                lfn_sum = raw[13];
+            }
+            if (raw[13] == lfn_sum) {
+                lfn_collect(raw, info->name);
+                lfn_slots++;
+            }
+            continue;
+        }
+        if (fat_direntry_attr_vlb_rdf(&de) || raw[0] == '.') {
+            lfn_slots = 0;
+            continue;
+        }
+
+        short_name_str(&de, info->short_name);
+        if (lfn_slots == 0 || lfn_sum != short_name_sum(raw)
+            || info->name[0] == '\0') {
+            strcpy(info->name, info->short_name);
+            lfn_slots = 0;
+        }
+        info->size = fat_direntry_size_rd(&de);
+        info->dir = fat_direntry_attr_dir_rdf(&de);
+        info->start = (fat_direntry_starth_rd(&de) << 16)
+                      | fat_direntry_start_rd(&de);
+        info->addr = cluster_offset(fs, c) + (s % per_cluster) * FAT_DIRENT_SIZE;
+        info->slot = s;
+        info->lfn_slots = lfn_slots;
+        *slot = s + 1;
+        return SYS_ERR_OK;
+    }
+}
+
+//
+// Lookup cache
+//
+
+static uint32_t dcache_hash(uint32_t parent, const char *name)
+{
+    uint32_t h = 2166136261u ^ parent;
+    for (; *name != '\0'; name++) {
+        h = (h ^ (uint8_t)tolower((unsigned char)*name)) * 16777619u;
+    }
+    return h & (FAT_DCACHE_SIZE - 1);
+}
+
+static struct fat_dentry *dcache_find(struct fat_fs *fs, uint32_t parent,
+                                      const char *name)
+{
+    if (parent == 0 || strlen(name) > FAT_DCACHE_NAME) {
+        return NULL;
+    }
+    struct fat_dentry *d = &fs->dcache[dcache_hash(parent, name)];
+    if (d->parent == parent && strcasecmp(d->name, name) == 0) {
+        return d;
+    }
+    return NULL;
+}
+
+/// Remember \p name in \p parent, or that there is no such name if \p info is NULL
+static void dcache_set(struct fat_fs *fs, uint32_t parent, const char *name,
+                       const struct fat_dirent_info *info)
+{
+    if (parent == 0 || strlen(name) > FAT_DCACHE_NAME) {
+        return;
+    }
+    struct fat_dentry *d = &fs->dcache[dcache_hash(parent, name)];
+    d->parent = parent;
+    d->addr = info ? info->addr : 0;
+    d->slot = info ? info->slot : 0;
+    d->lfn_slots = info ? info->lfn_slots : 0;
+    strcpy(d->name, name);
+}
+
+static void dcache_forget(struct fat_fs *fs, uint64_t addr)
+{
+    for (uint32_t i = 0; i < FAT_DCACHE_SIZE; i++) {
+        if (fs->dcache[i].parent != 0 && fs->dcache[i].addr == addr) {
+            fs->dcache[i].parent = 0;
+        }
+    }
+}
+
+/**
+ * \brief Look \p name up in \p dir
+ *
+ * Cached lookups read the entry itself from the card, so its size and first
+ * cluster are current. They do not fill in the names.
+ */
+static errval_t dir_lookup(struct fat_file *dir, const char *name,
+                           struct fat_dirent_info *info)
+{
+    struct fat_fs *fs = dir->fs;
+    uint32_t slot = 0;
+    errval_t err;
+
+    struct fat_dentry *d = dcache_find(fs, dir->start, name);
+    if (d != NULL) {
+        fs->stats.dcache_hits++;
+        if (d->addr == 0) {
+            return FS_ERR_NOTFOUND;
+        }
+
+        uint8_t raw[FAT_DIRENT_SIZE];
+        fat_direntry_t de;
+        err = bcache_read_bytes(fs->bc, d->addr, sizeof(raw), raw);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        fat_direntry_initialize(&de, (mackerel_addr_t)raw);
+        info->name[0] = '\0';
+        info->short_name[0] = '\0';
+        info->size = fat_direntry_size_rd(&de);
+        info->dir = fat_direntry_attr_dir_rdf(&de);
+        info->start = (fat_direntry_starth_rd(&de) << 16)
+                      | fat_direntry_start_rd(&de);
+        info->addr = d->addr;
+        info->slot = d->slot;
+        info->lfn_slots = d->lfn_slots;
+        return SYS_ERR_OK;
+    }
+
+    fs->stats.dcache_misses++;
+    while (err_is_ok(err = fat_readdir(dir, &slot, info))) {
+        if (strcasecmp(info->name, name) == 0
+            || strcasecmp(info->short_name, name) == 0) {
+            dcache_set(fs, dir->start, name, info);
+            return SYS_ERR_OK;
+        }
+    }
+    if (err == FS_ERR_INDEX_BOUNDS) {
+        dcache_set(fs, dir->start, name, NULL);
+        return FS_ERR_NOTFOUND;
+    }
+    return err;
+}
+
+/**
+ * \brief Open the directory holding the last component of \p path
+ *
+ * \param name  Receives the last component, empty for the root
+ */
+static errval_t walk(struct fat_fs *fs, const char *path,
+                     struct fat_file **parent, char *name)
+{
+    struct fat_file *dir = open_root(fs);
+    if (dir == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    for (;;) {
+        while (*path == '/') {
+            path++;
+        }
+        size_t len = 0;
+        while (path[len] != '\0' && path[len] != '/') {
+            len++;
+        }
+        if (len > FAT_NAME_MAX) {
+            fat_close(dir);
+            return FS_ERR_NOTFOUND;
+        }
+        memcpy(name, path, len);
+        name[len] = '\0';
+
+        path += len;
+        while (*path == '/') {
+            path++;
+        }
+        if (*path == '\0') {
+            *parent = dir;
+            return SYS_ERR_OK;
+        }
+
+        struct fat_dirent_info info;
+        errval_t err = dir_lookup(dir, name, &info);
+        if (err_is_ok(err) && !info.dir) {
+            err = FS_ERR_NOTDIR;
+        }
+        struct fat_file *sub = NULL;
+        if (err_is_ok(err)) {
+            sub = file_get(fs, info.addr, info.start, info.size, true);
+            if (sub == NULL) {
+                err = LIB_ERR_MALLOC_FAIL;
+            }
+        }
+        fat_close(dir);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        dir = sub;
+    }
+}
+
+/// Make the 8.3 entry name of \p name
+static errval_t make_short_name(const char *name, uint8_t *sn, uint8_t *lwr)
+{
+    static const char *special = "$%'-_@~`!(){}^#&";
+    const char *dot = strrchr(name, '.');
+    size_t base = dot ? (size_t)(dot - name) : strlen(name);
+    size_t ext = dot ? strlen(dot + 1) : 0;
+
+    if (base == 0 || base > 8 || ext > 3 || (dot && ext == 0)) {
+        return FAT_ERR_NAME;
+    }
+
+    memset(sn, ' ', 11);
+    *lwr = 0;
+    for (int part = 0; part < 2; part++) {
+        const char *s = part ? dot + 1 : name;
+        size_t n = part ? ext : base;
+        bool upper = false, lower = false;
+
+        for (size_t i = 0; i < n; i++) {
+            char c = s[i];
+            if (!isalnum((unsigned char)c) && strchr(special, c) == NULL) {
+                return FAT_ERR_NAME;
+            }
+            upper |= isupper((unsigned char)c);
+            lower |= islower((unsigned char)c);
+            sn[(part ? 8 : 0) + i] = toupper((unsigned char)c);
+        }
+
+        // mixed case needs a long name
+        if (upper && lower) {
+            return FAT_ERR_NAME;
+        }
+        if (lower) {
+            *lwr |= part ? 0x10 : 0x08;
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+/// Find a free entry in \p dir, growing it by a cluster if it is full
+static errval_t dir_alloc_slot(struct fat_file *dir, uint64_t *addr,
+                               uint32_t *slot)
+{
+    struct fat_fs *fs = dir->fs;
+    uint32_t per_cluster = fs->cluster_size / FAT_DIRENT_SIZE;
+    errval_t err;
+
+    for (uint32_t s = 0; ; s++) {
+        uint32_t c;
+        err = dir_load(dir, s / per_cluster, &c);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        if (c == 0) {
+            err = chain_extend(dir, s / per_cluster);
+            if (err_is_ok(err)) {
+                err = chain_get(dir, s / per_cluster, &c);
+            }
+            if (err_is_ok(err)) {
+                memset(fs->dir_buf, 0, fs->cluster_size);
+                err = bcache_write_bytes(fs->bc, cluster_offset(fs, c),
+                                         fs->cluster_size, fs->dir_buf);
+            }
+            if (err_is_fail(err)) {
+                return err;
+            }
+            fs->dir_buf_cluster = c;
+            *addr = cluster_offset(fs, c);
+            *slot = s;
+            return SYS_ERR_OK;
+        }
+
+        uint8_t first = fs->dir_buf[(s % per_cluster) * FAT_DIRENT_SIZE];
+        if (first == DIRENT_END || first == DIRENT_FREE) {
+            *addr = cluster_offset(fs, c) + (s % per_cluster) * FAT_DIRENT_SIZE;
+            *slot = s;
+            return SYS_ERR_OK;
+        }
+    }
+}
+
+//
+// Interface
+//
+
+/**
+ * \brief Mount the FAT32 volume on the card behind \p bc
+ */
+errval_t fat_mount(struct fat_fs *fs, struct bcache *bc)
+{
+    uint8_t sector[BLK_SECTOR_SIZE];
+    fat_bpb_t bpb;
+    fat32_ebpb_t ebpb;
+    uint32_t volume = 0;
+
+    memset(fs, 0, sizeof(*fs));
+    fs->bc = bc;
+    fs->generation = 1;
+
+    errval_t err = bcache_read(bc, 0, 1, sector);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    if (sector[510] != 0x55 || sector[511] != 0xAA) {
+        return FAT_ERR_BAD_FS;
+    }
+
+    fat_bpb_initialize(&bpb, (mackerel_addr_t)sector);
+    if (sector[0] != 0xEB && sector[0] != 0xE9) {
+        // a partition table, take the first partition
+        uint8_t *part = sector + MBR_PART_TABLE;
+        if (part[4] != PART_FAT32_CHS && part[4] != PART_FAT32_LBA) {
+            return FAT_ERR_BAD_FS;
+        }
+        volume = le32(part + 8);
+        err = bcache_read(bc, volume, 1, sector);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    uint32_t spc = fat_bpb_spc_rd(&bpb);
+    if (fat_bpb_bps_rd(&bpb) != BLK_SECTOR_SIZE || spc == 0
+        || (spc & (spc - 1)) != 0 || fat_bpb_fatc_rd(&bpb) == 0) {
+        return FAT_ERR_BAD_FS;
+    }
+    // FAT12 and FAT16 have a sector count per FAT and a fixed root
+    if (fat_bpb_spf_rd(&bpb) != 0 || fat_bpb_rtc_rd(&bpb) != 0) {
+        return FAT_ERR_BAD_FS;
+    }
+
+    fat32_ebpb_initialize(&ebpb, (mackerel_addr_t)sector);
+    uint32_t total = fat_bpb_ssc_rd(&bpb);
+    if (total == 0) {
+        total = fat_bpb_lsc_rd(&bpb);
+    }
+
+    fs->sectors_per_cluster = spc;
+    fs->cluster_size = spc * BLK_SECTOR_SIZE;
+    fs->fat_lba = volume + fat_bpb_rsvs_rd(&bpb);
+    fs->fat_sectors = fat32_ebpb_spf_rd(&ebpb);
+    fs->nfats = fat_bpb_fatc_rd(&bpb);
+    fs->data_lba = fs->fat_lba + fs->nfats * fs->fat_sectors;
+    fs->root_cluster = fat32_ebpb_rtst_rd(&ebpb);
+    fs->free_hint = 2;
+
+    if (total <= fs->data_lba - volume) {
+        return FAT_ERR_BAD_FS;
+    }
+    fs->clusters = (total - (fs->data_lba - volume)) / spc + 2;
+    if (fs->clusters > fs->fat_sectors * FAT_PER_SECTOR) {
+        fs->clusters = fs->fat_sectors * FAT_PER_SECTOR;
+    }
+    if (fs->root_cluster < 2 || fs->root_cluster >= fs->clusters) {
+        return FAT_ERR_BAD_FS;
+    }
+
+    fs->dir_buf = malloc(fs->cluster_size);
+    fs->fat_win = malloc(BCACHE_BLOCK_SIZE);
+    fs->dcache = calloc(FAT_DCACHE_SIZE, sizeof(struct fat_dentry));
+    if (fs->dir_buf == NULL || fs->fat_win == NULL || fs->dcache == NULL) {
+        free(fs->dir_buf);
+        free(fs->fat_win);
+        free(fs->dcache);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Write everything to the card and drop the caches of \p fs
+ *
+ * Nothing may be open.
+ */
+errval_t fat_unmount(struct fat_fs *fs)
+{
+    errval_t err = fat_sync(fs);
+
+    while (fs->open != NULL) {
+        assert(fs->open->refs == 0);
+        file_drop(fs->open);
+    }
+    free(fs->dir_buf);
+    free(fs->fat_win);
+    free(fs->dcache);
+    fs->dir_buf = NULL;
+    fs->fat_win = NULL;
+    fs->dcache = NULL;
+    return err;
+}
+
+/**
+ * \brief Open the file or directory at \p path
+ */
+errval_t fat_open(struct fat_fs *fs, const char *path, struct fat_file **ret)
+{
+    char name[FAT_NAME_MAX + 1];
+    struct fat_file *dir;
+
+    errval_t err = walk(fs, path, &dir, name);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    if (name[0] == '\0') {
+        *ret = dir;
+        return SYS_ERR_OK;
+    }
+
+    struct fat_dirent_info info;
+    err = dir_lookup(dir, name, &info);
+    if (err_is_ok(err)) {
+        *ret = file_get(fs, info.addr, info.start, info.size, info.dir);
+        if (*ret == NULL) {
+            err = LIB_ERR_MALLOC_FAIL;
+        }
+    }
+    fat_close(dir);
+    return err;
+}
+
+/**
+ * \brief Create and open an empty file at \p path
+ *
+ * The directory it goes into must exist.
+ */
+errval_t fat_create(struct fat_fs *fs, const char *path, struct fat_file **ret)
+{
+    char name[FAT_NAME_MAX + 1];
+    struct fat_file *dir;
+    struct fat_dirent_info info;
+    uint8_t sn[11], lwr;
+    uint64_t addr;
+    uint32_t slot;
+
+    errval_t err = walk(fs, path, &dir, name);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (name[0] == '\0') {
+        err = FS_ERR_EXISTS;
+    } else {
+        err = dir_lookup(dir, name, &info);
+        if (err_is_ok(err)) {
+            err = FS_ERR_EXISTS;
+        } else if (err == FS_ERR_NOTFOUND) {
+            err = make_short_name(name, sn, &lwr);
+        }
+    }
+    if (err_is_ok(err)) {
+        err = dir_alloc_slot(dir, &addr, &slot);
+    }
+    if (err_is_fail(err)) {
+        fat_close(dir);
+        return err;
+    }
+
+    uint8_t raw[FAT_DIRENT_SIZE] = { 0 };
+    fat_direntry_t de;
+    fat_direntry_initialize(&de, (mackerel_addr_t)raw);
+    for (int i = 0; i < 8; i++) {
+        fat_direntry_fn_wr(&de, i, sn[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        fat_direntry_ext_wr(&de, i, sn[8 + i]);
+    }
+    fat_direntry_attr_ar_wrf(&de, 1);
+    fat_direntry_lwr_wr(&de, lwr);
+    fat_direntry_cdate_wr(&de, FAT_DATE);
+    fat_direntry_adate_wr(&de, FAT_DATE);
+    fat_direntry_wdate_wr(&de, FAT_DATE);
+
+    fs->dir_buf_cluster = 0;
+    err = bcache_write_bytes(fs->bc, addr, sizeof(raw), raw);
+    if (err_is_ok(err)) {
+        info.addr = addr;
+        info.slot = slot;
+        info.lfn_slots = 0;
+        dcache_set(fs, dir->start, name, &info);
+    }
+    fat_close(dir);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    *ret = file_get(fs, addr, 0, 0, false);
+    return (*ret == NULL) ? LIB_ERR_MALLOC_FAIL : SYS_ERR_OK;
+}
+
+/**
+ * \brief Read up to \p len bytes at \p pos
+ *
+ * \param ret   Bytes read, less than \p len only at the end of the file
+ */
+errval_t fat_read(struct fat_file *f, size_t pos, size_t len, void *buf,
+                  size_t *ret)
+{
+    size_t done = 0;
+    errval_t err = SYS_ERR_OK;
+
+    *ret = 0;
+    if (f->dir) {
+        return FS_ERR_NOTFILE;
+    }
+    if (pos >= f->size) {
+        return SYS_ERR_OK;
+    }
+    if (len > f->size - pos) {
+        len = f->size - pos;
+    }
+
+    while (done < len && err_is_ok(err)) {
+        uint64_t offset;
+        size_t run;
+        err = file_run(f, pos + done, len - done, &offset, &run);
+        if (err_is_ok(err)) {
+            err = bcache_read_bytes(f->fs->bc, offset, run,
+                                    (uint8_t *)buf + done);
+            done += run;
+        }
+    }
+
+    *ret = err_is_ok(err) ? done : 0;
+    return err;
+}
+
+/// Write \p len bytes of \p buf, or zeroes if it is NULL, into allocated clusters
+static errval_t write_runs(struct fat_file *f, size_t pos, size_t len,
+                           const uint8_t *buf)
+{
+    while (len > 0) {
+        uint64_t offset;
+        size_t run;
+        errval_t err = file_run(f, pos, len, &offset, &run);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        if (buf == NULL && run > sizeof(zeroes)) {
+            run = sizeof(zeroes);
+        }
+
+        err = bcache_write_bytes(f->fs->bc, offset, run,
+                                 buf ? buf : zeroes);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        pos += run;
+        len -= run;
+        if (buf != NULL) {
+            buf += run;
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Write \p len bytes at \p pos, growing the file as needed
+ *
+ * A gap between the end of the file and \p pos is filled with zeroes.
+ */
+errval_t fat_write(struct fat_file *f, size_t pos, size_t len,
+                   const void *buf, size_t *ret)
+{
+    struct fat_fs *fs = f->fs;
+    errval_t err;
+
+    *ret = 0;
+    if (f->dir) {
+        return FS_ERR_NOTFILE;
+    }
+    if (len == 0) {
+        return SYS_ERR_OK;
+    }
+    if (pos + len < pos || pos + len > UINT32_MAX) {
+        return FS_ERR_NOSPACE;
+    }
+
+    // even a failed write may have changed some of the contents
+    f->version = ++fs->generation;
+
+    uint32_t start = f->start;
+    err = chain_extend(f, (pos + len - 1) / fs->cluster_size);
+    if (err_is_ok(err) && pos > f->size) {
+        err = write_runs(f, f->size, pos - f->size, NULL);
+    }
+    if (err_is_ok(err)) {
+        err = write_runs(f, pos, len, buf);
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    f->written = true;
+    if (pos + len > f->size || f->start != start) {
+        if (pos + len > f->size) {
+            f->size = pos + len;
+        }
+        err = update_dirent(f);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    *ret = len;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Load \p len bytes at \p pos into the block cache
+ */
+errval_t fat_prefetch(struct fat_file *f, size_t pos, size_t len)
+{
+    if (f->dir || pos >= f->size) {
+        return SYS_ERR_OK;
+    }
+    if (len > f->size - pos) {
+        len = f->size - pos;
+    }
+
+    while (len > 0) {
+        uint64_t offset;
+        size_t run;
+        errval_t err = file_run(f, pos, len, &offset, &run);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        uint32_t lba = offset / BLK_SECTOR_SIZE;
+        uint32_t end = (offset + run + BLK_SECTOR_SIZE - 1) / BLK_SECTOR_SIZE;
+        err = bcache_prefetch(f->fs->bc, lba, end - lba);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        pos += run;
+        len -= run;
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Read ahead of a sequential reader, before it reads \p len bytes
+ * at \p pos
+ *
+ * Once a sequential read passes the marker in \p ra, the next
+ * FAT_READ_AHEAD bytes are loaded in as few card commands as the layout of
+ * the file allows, instead of one command per cache block missed.
+ */
+errval_t fat_read_ahead(struct fat_file *f, struct fat_readahead *ra,
+                        size_t pos, size_t len)
+{
+    errval_t err = SYS_ERR_OK;
+
+    if (pos != ra->last_end) {
+        ra->next = 0;
+    } else if (pos + len > ra->next) {
+        err = fat_prefetch(f, pos, FAT_READ_AHEAD);
+        ra->next = pos + FAT_READ_AHEAD;
+    }
+    ra->last_end = pos + len;
+    return err;
+}
+
+/**
+ * \brief Delete the file at \p path, which must not be open
+ */
+errval_t fat_delete(struct fat_fs *fs, const char *path)
+{
+    char name[FAT_NAME_MAX + 1];
+    struct fat_file *dir;
+    struct fat_dirent_info info;
+
+    errval_t err = walk(fs, path, &dir, name);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (name[0] == '\0') {
+        err = FS_ERR_NOTFILE;
+    } else {
+        err = dir_lookup(dir, name, &info);
+    }
+    if (err_is_ok(err) && info.dir) {
+        err = FS_ERR_NOTFILE;
+    }
+    for (struct fat_file *f = fs->open; f != NULL && err_is_ok(err);
+         f = f->next) {
+        if (f->dirent == info.addr) {
+            if (f->refs > 0) {
+                err = FS_ERR_BUSY;
+            } else {
+                file_drop(f);
+            }
+            break;
+        }
+    }
+
+    if (err_is_ok(err)) {
+        fs->generation++;
+        dcache_forget(fs, info.addr);
+        err = free_chain(fs, info.start);
+    }
+
+    // the 8.3 entry and its long name entries
+    uint8_t free_mark = DIRENT_FREE;
+    for (uint32_t s = info.slot - info.lfn_slots;
+         s <= info.slot && err_is_ok(err); s++) {
+        uint64_t addr;
+        err = slot_addr(dir, s, &addr);
+        if (err_is_ok(err)) {
+            err = bcache_write_bytes(fs->bc, addr, 1, &free_mark);
+        }
+    }
+
+    fs->dir_buf_cluster = 0;
+    fat_close(dir);
+    return err;
+}
+
+/**
+ * \brief Write everything to the card
+ */
+errval_t fat_sync(struct fat_fs *fs)
+{
+    for (struct fat_file *f = fs->open; f != NULL; f = f->next) {
+        f->written = false;
+    }
+    return bcache_flush(fs->bc);
+}
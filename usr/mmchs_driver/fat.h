@@ -0,0 +1,139 @@
+/**
+ * \file
+ * \brief FAT32 file system on the SD card
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef MMCHS_FAT_H
+#define MMCHS_FAT_H
+
+#include "blockcache.h"
+
+#define FAT_NAME_MAX        255
+#define FAT_DIRENT_SIZE     32
+#define FAT_READ_AHEAD      (64 * 1024)     ///< Loaded ahead of sequential readers
+#define FAT_FILE_CACHE      64              ///< Closed files kept with their extents
+#define FAT_DCACHE_SIZE     1024            ///< Lookup cache entries, a power of two
+#define FAT_DCACHE_NAME     39              ///< Longer names are not cached
+#define FAT_WIN_ENTRIES     (BCACHE_BLOCK_SIZE / sizeof(uint32_t))
+
+struct fat_file;
+
+/// A cached lookup of \p name in the directory starting at \p parent
+struct fat_dentry {
+    uint32_t parent;                ///< First cluster of the directory, 0: unused
+    uint64_t addr;                  ///< Card byte offset of the entry, 0: no such name
+    uint32_t slot;
+    uint32_t lfn_slots;
+    char name[FAT_DCACHE_NAME + 1];
+};
+
+struct fat_stats {
+    uint64_t dcache_hits;
+    uint64_t dcache_misses;
+    uint64_t fat_walked;            ///< FAT entries followed along chains
+    uint64_t fat_loads;             ///< FAT window loads
+    uint64_t dirents;               ///< Directory entries scanned
+};
+
+struct fat_fs {
+    struct bcache *bc;
+    uint32_t sectors_per_cluster;
+    uint32_t cluster_size;          ///< Bytes
+    uint32_t fat_lba;               ///< First sector of the first FAT
+    uint32_t fat_sectors;           ///< Per FAT copy
+    uint32_t nfats;
+    uint32_t data_lba;              ///< Sector of cluster 2
+    uint32_t clusters;              ///< Highest cluster number + 1
+    uint32_t root_cluster;
+    uint32_t free_hint;             ///< Where to look for a free cluster
+    uint32_t generation;            ///< Bumped by every change to a file
+
+    uint8_t *dir_buf;               ///< One cluster of a directory
+    uint32_t dir_buf_cluster;       ///< Which one, 0 if none
+
+    uint8_t *fat_win;               ///< One cache block of the first FAT
+    uint32_t fat_win_index;         ///< Which one plus one, 0 if none
+
+    struct fat_dentry *dcache;      ///< Direct mapped by name and parent
+
+    /// Open files and directories and up to FAT_FILE_CACHE closed ones,
+    /// most recently used first
+    struct fat_file *open;
+    uint32_t closed;                ///< Closed ones on the list
+
+    struct fat_stats stats;
+};
+
+/// Clusters index to index + count - 1 of a file are cluster to cluster + count - 1
+struct fat_extent {
+    uint32_t index;
+    uint32_t cluster;
+    uint32_t count;
+};
+
+/// A file or directory in use, shared by everyone who opened it
+struct fat_file {
+    struct fat_fs *fs;
+    uint32_t start;                 ///< First cluster, 0 while empty
+    uint32_t size;
+    bool dir;
+    uint64_t dirent;                ///< Card byte offset of its entry, 0: root
+    uint32_t refs;                  ///< 0: closed, only cached
+    bool written;                   ///< Since the last fat_sync()
+    uint32_t version;               ///< Changes whenever the contents may have
+
+    /// Cluster chain cache, as far as the chain has been walked
+    struct fat_extent *extents;
+    uint32_t nextents;
+    uint32_t extents_cap;
+    uint32_t ext_hint;              ///< Extent of the last lookup
+    uint32_t chain_len;             ///< Clusters known
+    bool chain_done;                ///< chain_len is the whole chain
+
+    struct fat_file *next;
+};
+
+/// Read-ahead state of one reader of a file
+struct fat_readahead {
+    size_t last_end;                ///< Where the previous read ended
+    size_t next;                    ///< Read ahead once a read passes this
+};
+
+struct fat_dirent_info {
+    char name[FAT_NAME_MAX + 1];    ///< Long name if it has one
+    char short_name[13];            ///< 8.3 name, as in "README.TXT"
+    uint32_t size;
+    bool dir;
+    uint32_t start;
+    uint64_t addr;                  ///< Card byte offset of the 8.3 entry
+    uint32_t slot;                  ///< Index of the 8.3 entry in the directory
+    uint32_t lfn_slots;             ///< Long name entries in front of it
+};
+
+errval_t fat_mount(struct fat_fs *fs, struct bcache *bc);
+errval_t fat_unmount(struct fat_fs *fs);
+errval_t fat_open(struct fat_fs *fs, const char *path, struct fat_file **ret);
+errval_t fat_create(struct fat_fs *fs, const char *path, struct fat_file **ret);
+void fat_close(struct fat_file *f);
+errval_t fat_read(struct fat_file *f, size_t pos, size_t len, void *buf,
+                  size_t *ret);
+errval_t fat_write(struct fat_file *f, size_t pos, size_t len,
+                   const void *buf, size_t *ret);
+errval_t fat_prefetch(struct fat_file *f, size_t pos, size_t len);
+errval_t fat_read_ahead(struct fat_file *f, struct fat_readahead *ra,
+                        size_t pos, size_t len);
+errval_t fat_readdir(struct fat_file *dir, uint32_t *slot,
+                     struct fat_dirent_info *info);
+errval_t fat_delete(struct fat_fs *fs, const char *path);
+errval_t fat_sync(struct fat_fs *fs);
+
+#endif // MMCHS_FAT_H
@@ -0,0 +1,406 @@
+/**
+ * \file
+ * \brief File server for the aos_rpc file calls
+ *
+ * The server registers its endpoint with init, which hands it to clients
+ * asking for FS_CONNECT. Each client then gets a channel of its own and
+ * shares a frame with the server: paths, directory entries and file data
+ * go through that frame, the LMP messages only carry the request and the
+ * reply.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/aos_rpc.h>
+#include <barrelfish/paging.h>
+
+#include "fs_server.h"
+
+struct fs_fd {
+    struct fat_file *file;          ///< NULL if unused
+    struct fat_readahead ra;
+};
+
+struct fs_client {
+    struct lmp_chan lc;
+    uint8_t *bulk;                  ///< Frame shared with the client
+    size_t bulk_size;
+    struct fs_fd fds[AOS_RPC_FS_MAX_FDS];
+
+    uintptr_t reply[4];             ///< Code, error and two results
+    struct capref reply_cap;
+
+    struct fs_client *next;
+};
+
+static struct fat_fs *fs;
+static struct lmp_chan listen_lc;
+static struct fs_client *clients;
+
+static void reply_handler(void *cl_void)
+{
+    struct fs_client *cl = cl_void;
+
+    errval_t err = lmp_chan_send4(&cl->lc, LMP_SEND_FLAGS_DEFAULT,
+                                  cl->reply_cap, cl->reply[0], cl->reply[1],
+                                  cl->reply[2], cl->reply[3]);
+    if (lmp_err_is_transient(err)) {
+        err = lmp_chan_register_send(&cl->lc, get_default_waitset(),
+                                     MKCLOSURE(reply_handler, cl));
+    }
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "could not reply to file client");
+    }
+}
+
+/// Clients wait for the reply before their next request, one slot is enough
+static void reply(struct fs_client *cl, uint32_t code, errval_t err,
+                  uintptr_t a, uintptr_t b)
+{
+    cl->reply[0] = code;
+    cl->reply[1] = err;
+    cl->reply[2] = a;
+    cl->reply[3] = b;
+    cl->reply_cap = NULL_CAP;
+    reply_handler(cl);
+}
+
+static errval_t share_frame(struct fs_client *cl, struct capref frame,
+                            size_t size)
+{
+    struct frame_identity id;
+    void *buf;
+
+    errval_t err = invoke_frame_identify(frame, &id);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_IDENTIFY);
+    }
+    if (size > (1UL << id.bits)) {
+        size = 1UL << id.bits;
+    }
+
+    err = paging_map_frame_attr(get_current_paging_state(), &buf, size, frame,
+                                VREGION_FLAGS_READ_WRITE, NULL, NULL);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_VSPACE_MAP);
+    }
+
+    cl->bulk = buf;
+    cl->bulk_size = size;
+    return SYS_ERR_OK;
+}
+
+/// Copy the path the client put in the frame, it may change under us
+static errval_t get_path(struct fs_client *cl, size_t len, char *path)
+{
+    if (cl->bulk == NULL) {
+        return FS_ERR_BULK_NOT_INIT;
+    }
+    if (len >= AOS_RPC_FS_PATH_MAX || len >= cl->bulk_size) {
+        return FS_ERR_NOTFOUND;
+    }
+    memcpy(path, cl->bulk, len);
+    path[len] = '\0';
+    return SYS_ERR_OK;
+}
+
+static struct fs_fd *get_fd(struct fs_client *cl, uintptr_t fd)
+{
+    if (fd >= AOS_RPC_FS_MAX_FDS || cl->fds[fd].file == NULL) {
+        return NULL;
+    }
+    return &cl->fds[fd];
+}
+
+static errval_t open_fd(struct fs_client *cl, const char *path, bool create,
+                        size_t *ret)
+{
+    struct fat_file *f;
+    size_t fd;
+
+    for (fd = 0; fd < AOS_RPC_FS_MAX_FDS; fd++) {
+        if (cl->fds[fd].file == NULL) {
+            break;
+        }
+    }
+    if (fd == AOS_RPC_FS_MAX_FDS) {
+        return FS_ERR_INVALID_FH;
+    }
+
+    errval_t err = create ? fat_create(fs, path, &f) : fat_open(fs, path, &f);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    cl->fds[fd].file = f;
+    cl->fds[fd].ra.last_end = 0;
+    cl->fds[fd].ra.next = 0;
+    *ret = fd;
+    return SYS_ERR_OK;
+}
+
+static errval_t close_fd(struct fs_fd *fd)
+{
+    errval_t err = SYS_ERR_OK;
+    if (fd->file->written) {
+        err = fat_sync(fs);
+    }
+    fat_close(fd->file);
+    fd->file = NULL;
+    return err;
+}
+
+static errval_t read_fd(struct fs_client *cl, struct fs_fd *fd, size_t pos,
+                        size_t len, size_t *ret)
+{
+    if (len > cl->bulk_size) {
+        len = cl->bulk_size;
+    }
+
+    // a failed read-ahead leaves the read to fetch its own blocks
+    errval_t err = fat_read_ahead(fd->file, &fd->ra, pos, len);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "read-ahead failed");
+    }
+    return fat_read(fd->file, pos, len, cl->bulk, ret);
+}
+
+/// Pack the entries of \p path from \p slot on into the frame
+static errval_t read_dir(struct fs_client *cl, const char *path,
+                         uint32_t *slot, size_t *count)
+{
+    struct aos_dirent *out = (struct aos_dirent *)cl->bulk;
+    size_t max = cl->bulk_size / sizeof(struct aos_dirent);
+    struct fat_dirent_info info;
+    struct fat_file *dir;
+
+    errval_t err = fat_open(fs, path, &dir);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    *count = 0;
+    while (*count < max) {
+        err = fat_readdir(dir, slot, &info);
+        if (err == FS_ERR_INDEX_BOUNDS) {
+            err = SYS_ERR_OK;
+            *slot = 0;
+            break;
+        }
+        if (err_is_fail(err)) {
+            break;
+        }
+
+        strncpy(out[*count].name, info.name, MAXNAMELEN - 1);
+        out[*count].name[MAXNAMELEN - 1] = '\0';
+        out[*count].size = info.size;
+        (*count)++;
+    }
+
+    fat_close(dir);
+    return err;
+}
+
+static void client_recv_handler(void *cl_void)
+{
+    struct fs_client *cl = cl_void;
+    struct capref remote_cap;
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    char path[AOS_RPC_FS_PATH_MAX];
+    uint32_t rpc_code;
+    uint16_t seq;
+    size_t a = 0, b = 0;
+    struct fs_fd *fd;
+
+    errval_t err = aos_retrieve_tagged_msg(&cl->lc, &remote_cap, &rpc_code,
+                                           &seq, &msg);
+    lmp_chan_register_recv(&cl->lc, get_default_waitset(),
+                           MKCLOSURE(client_recv_handler, cl));
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "could not receive from file client");
+        return;
+    }
+
+    switch (rpc_code) {
+        case FS_SHARE_FRAME:
+        {
+            err = share_frame(cl, remote_cap, msg.words[0]);
+            break;
+        }
+
+        case FS_OPEN:
+        case FS_CREATE:
+        {
+            err = get_path(cl, msg.words[0], path);
+            if (err_is_ok(err)) {
+                err = open_fd(cl, path, rpc_code == FS_CREATE, &a);
+            }
+            if (err_is_ok(err)) {
+                b = cl->fds[a].file->version;
+            }
+            break;
+        }
+
+        case FS_READ:
+        {
+            fd = get_fd(cl, msg.words[0]);
+            if (fd == NULL) {
+                err = FS_ERR_INVALID_FH;
+            } else if (cl->bulk == NULL) {
+                err = FS_ERR_BULK_NOT_INIT;
+            } else {
+                err = read_fd(cl, fd, msg.words[1], msg.words[2], &a);
+            }
+            break;
+        }
+
+        case FS_WRITE:
+        {
+            fd = get_fd(cl, msg.words[0]);
+            if (fd == NULL) {
+                err = FS_ERR_INVALID_FH;
+            } else if (cl->bulk == NULL) {
+                err = FS_ERR_BULK_NOT_INIT;
+            } else {
+                size_t len = msg.words[2];
+                if (len > cl->bulk_size) {
+                    len = cl->bulk_size;
+                }
+                err = fat_write(fd->file, msg.words[1], len, cl->bulk, &a);
+            }
+            break;
+        }
+
+        case FS_CLOSE:
+        {
+            fd = get_fd(cl, msg.words[0]);
+            err = (fd == NULL) ? FS_ERR_INVALID_FH : close_fd(fd);
+            break;
+        }
+
+        case FS_READDIR:
+        {
+            uint32_t slot = msg.words[1];
+            err = get_path(cl, msg.words[0], path);
+            if (err_is_ok(err)) {
+                err = read_dir(cl, path, &slot, &a);
+                b = slot;
+            }
+            break;
+        }
+
+        case FS_DELETE:
+        {
+            err = get_path(cl, msg.words[0], path);
+            if (err_is_ok(err)) {
+                err = fat_delete(fs, path);
+            }
+            break;
+        }
+
+        default:
+        {
+            debug_printf("Could not handle code %d in file server\n",
+                         rpc_code);
+            err = AOS_ERR_LMP_MSGTYPE_UNKNOWN;
+        }
+    }
+
+    reply(cl, AOS_RPC_TAG(rpc_code, seq), err, a, b);
+}
+
+/// Tell a client that could not be registered why, it waits for the reply
+static void refuse(struct capref ep, uint16_t seq, errval_t err)
+{
+    errval_t send_err = lmp_ep_send2(ep, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+                                     AOS_RPC_TAG(REGISTER_CHANNEL, seq), err);
+    if (err_is_fail(send_err)) {
+        DEBUG_ERR(send_err, "could not refuse file client");
+    }
+}
+
+/// New clients send their endpoint here and get a channel of their own
+static void listen_recv_handler(void *arg)
+{
+    struct capref remote_cap;
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    uint32_t rpc_code;
+    uint16_t seq;
+
+    errval_t err = aos_retrieve_tagged_msg(&listen_lc, &remote_cap, &rpc_code,
+                                           &seq, &msg);
+    lmp_chan_register_recv(&listen_lc, get_default_waitset(),
+                           MKCLOSURE(listen_recv_handler, NULL));
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "could not receive on file server endpoint");
+        return;
+    }
+    if (capref_is_null(remote_cap)) {
+        debug_printf("Bad registration at file server\n");
+        return;
+    }
+    if (rpc_code != REGISTER_CHANNEL) {
+        debug_printf("Bad registration at file server\n");
+        refuse(remote_cap, seq, AOS_ERR_LMP_MSGTYPE_UNKNOWN);
+        return;
+    }
+
+    struct fs_client *cl = calloc(1, sizeof(*cl));
+    if (cl == NULL) {
+        DEBUG_ERR(LIB_ERR_MALLOC_FAIL, "no memory for file client");
+        refuse(remote_cap, seq, LIB_ERR_MALLOC_FAIL);
+        return;
+    }
+
+    err = aos_setup_channel(&cl->lc, remote_cap,
+                            MKCLOSURE(client_recv_handler, cl));
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "could not set up channel to file client");
+        free(cl);
+        refuse(remote_cap, seq, err);
+        return;
+    }
+    cl->next = clients;
+    clients = cl;
+
+    cl->reply[0] = AOS_RPC_TAG(REGISTER_CHANNEL, seq);
+    cl->reply[1] = SYS_ERR_OK;
+    cl->reply[2] = 0;
+    cl->reply[3] = 0;
+    cl->reply_cap = cl->lc.local_cap;
+    reply_handler(cl);
+}
+
+/**
+ * \brief Serve \p fat to the aos_rpc file calls
+ *
+ * Requests are handled on the default waitset.
+ */
+errval_t fs_server_init(struct fat_fs *fat)
+{
+    fs = fat;
+
+    errval_t err = aos_setup_channel(&listen_lc, NULL_CAP,
+                                     MKCLOSURE(listen_recv_handler, NULL));
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // init hands our endpoint to the clients
+    err = lmp_chan_send1(&local_rpc.init_lc, LMP_SEND_FLAGS_DEFAULT,
+                         listen_lc.local_cap, FS_REGISTER);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_LMP_CHAN_SEND);
+    }
+    return SYS_ERR_OK;
+}
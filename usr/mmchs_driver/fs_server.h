@@ -0,0 +1,22 @@
+/**
+ * \file
+ * \brief File server for the aos_rpc file calls
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef MMCHS_FS_SERVER_H
+#define MMCHS_FS_SERVER_H
+
+#include "fat.h"
+
+errval_t fs_server_init(struct fat_fs *fs);
+
+#endif // MMCHS_FS_SERVER_H
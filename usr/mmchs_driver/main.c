@@ -16,9 +16,28 @@
 #include <arch/arm/omap44xx/device_registers.h>
 
 #include "mmchs.h"
+#include "elevator.h"
+#include "blockcache.h"
+#include "fat.h"
+#include "fs_server.h"
 
 static struct cnoderef cnode;
 
+/// The file server is the only user of the card, it waits for its transfers
+static struct elevator elevator;
+static struct bcache cache;
+static struct fat_fs fat;
+
+static errval_t card_transfer(void *st, bool write, uint32_t lba,
+                              uint32_t count, void *buf)
+{
+    if (write) {
+        return mmchs_write_blocks(lba, count, buf);
+    } else {
+        return mmchs_read_blocks(lba, count, buf);
+    }
+}
+
 static void get_cap(lpaddr_t base, size_t size)
 {
     errval_t err;
@@ -86,24 +105,36 @@ int main(int argc, char **argv)
 
 
     //
-    // Reading the first block from the SD-Card
-    // This should be the same information you get with
-    // dd when reading the first block on linux...
+    // Serving the file system on the card
     //
 
-    void *buffer = malloc(512);
-    assert(buffer != NULL);
-
-    err = mmchs_read_block(0, buffer);
-    assert(err_is_ok(err));
-    printf("Read block %d:\n", 0);
-    for (int i = 1; i <= 512; ++i)
-    {
-        printf("%"PRIu8"\t", ((uint8_t*) buffer)[i-1]);
-        if (i % 4 == 0) {
-            printf("\n");
+    err = elevator_init(&elevator, card_transfer, NULL, MMCHS_MAX_BLOCKS,
+                        NULL);
+    if (err_is_ok(err)) {
+        err = bcache_init(&cache, &elevator, BCACHE_DEFAULT_BLOCKS);
+    }
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "block cache init failed");
+    }
+
+    err = fat_mount(&fat, &cache);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "no FAT32 file system on the card");
+    }
+
+    err = fs_server_init(&fat);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "file server init failed");
+    }
+
+    struct waitset *ws = get_default_waitset();
+    while (true) {
+        err = event_dispatch(ws);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "in event_dispatch");
+            break;
         }
     }
 
     return 0;
-}
\ No newline at end of file
+}
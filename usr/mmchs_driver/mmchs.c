@@ -25,8 +25,45 @@
 #define DBUF_SIZE (64*1024)
 static char dbuf[DBUF_SIZE];
 
+/// MMC1_IRQ is MA_IRQ_83 of the Cortex-A9 MPU, after the 32 PPIs/SGIs
+#define MMCHS_IRQ (32 + 83)
+
 static omap44xx_mmchs1_t mmchs;
 
+/**
+ * ADMA2 descriptor line (32-bit addressing)
+ *
+ * \see SD Host Controller Simplified Spec 3.00, Section 1.13.4
+ */
+struct adma2_desc {
+    uint16_t attr;
+    uint16_t len;
+    uint32_t addr;
+};
+
+#define ADMA2_VALID     (1 << 0)
+#define ADMA2_END       (1 << 1)
+#define ADMA2_ACT_TRAN  (2 << 4)
+#define ADMA2_LINE_MAX  0x8000  ///< Bytes per line, keeps clear of len 0 = 64KB
+
+/**
+ * Physically contiguous memory the controller transfers to and from: the
+ * descriptor table in the first page, followed by a bounce buffer for
+ * MMCHS_MAX_BLOCKS blocks.
+ */
+static struct {
+    struct adma2_desc *desc;
+    lpaddr_t desc_pa;
+    uint8_t *buf;
+    lpaddr_t buf_pa;
+} dma;
+static bool use_dma;
+
+// Transfer completion, signalled by the MMC1 interrupt
+static struct waitset irq_ws;
+static bool use_irq;
+static bool xfer_done;
+
 static void mmchs_soft_reset(void)
 {
     MMCHS_DEBUG("%s:%d\n", __FUNCTION__, __LINE__);
@@ -136,9 +173,12 @@ static void wait_msec(long msec)
 
 
 /**
+ * \brief Send a command, moving \p blocks blocks if it is a data command
+ *
  * \see TRM rev Z, Section 24.5.1.2.1.7.1
  */
-static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
+static errval_t send_data_command(omap44xx_mmchs1_indx_status_t cmd,
+                                  uint32_t arg, size_t blocks)
 {
     MMCHS_DEBUG("%s:%d: cmd = 0x%x arg=0x%x\n", __FUNCTION__, __LINE__, cmd, arg);
 
@@ -155,7 +195,7 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
     omap44xx_mmchs1_mmchs_csre_rawwr(&mmchs, 0x0);
 
     omap44xx_mmchs1_mmchs_blk_blen_wrf(&mmchs, 512);
-    omap44xx_mmchs1_mmchs_blk_nblk_wrf(&mmchs, 0x1);
+    omap44xx_mmchs1_mmchs_blk_nblk_wrf(&mmchs, blocks);
 
     omap44xx_mmchs1_mmchs_sysctl_dto_wrf(&mmchs, 0xE); // omapconf
 
@@ -167,6 +207,12 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
 
     omap44xx_mmchs1_mmchs_cmd_t cmdreg = omap44xx_mmchs1_mmchs_cmd_default;
 
+    // The controller counts the blocks and sends CMD12 after the last one
+    if (cmd == omap44xx_mmchs1_INDX_18 || cmd == omap44xx_mmchs1_INDX_25) {
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_msbs_insert(cmdreg, 0x1);
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_bce_insert(cmdreg, 0x1);
+    }
+
     // see TRM rev Z, Table 24-4
     // and Physical Layer Simplified Spec 3.01, Section 4.7.4
     switch (cmd) {
@@ -178,10 +224,14 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
         break;
         // R1, R6, R5, R7
     case omap44xx_mmchs1_INDX_17:
+    case omap44xx_mmchs1_INDX_18:
         cmdreg = omap44xx_mmchs1_mmchs_cmd_ddir_insert(cmdreg, 0x1);
+        // Fallthrough desired!
     case omap44xx_mmchs1_INDX_24:
+    case omap44xx_mmchs1_INDX_25:
         cmdreg = omap44xx_mmchs1_mmchs_cmd_dp_insert(cmdreg, 0x1);
         cmdreg = omap44xx_mmchs1_mmchs_cmd_acen_insert(cmdreg, 0x1);
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_de_insert(cmdreg, use_dma);
         // Fallthrough desired!
     case omap44xx_mmchs1_INDX_0:
     case omap44xx_mmchs1_INDX_3:
@@ -220,12 +270,12 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
         if (cto == 0x1 && ccrc == 0x1) {
             MMCHS_DEBUG("%s:%d: cto = 1 ccrc = 1: Conflict on cmd line.\n", __FUNCTION__, __LINE__);
             cmd_line_reset();
-            return;
+            return MMC_ERR_COMMAND;
         }
         if (cto == 0x1 && ccrc == 0x0) {
             MMCHS_DEBUG("%s:%d: cto = 1 ccrc = 0: Abort.\n", __FUNCTION__, __LINE__);
             cmd_line_reset();
-            return;
+            return MMC_ERR_COMMAND;
         }
 
         if (i++ > 1000) {
@@ -252,8 +302,13 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
     uint32_t resp_type = omap44xx_mmchs1_mmchs_cmd_rsp_type_rdf(&mmchs);
     if (resp_type == 0x0) {
         MMCHS_DEBUG("%s:%d: No response.\n", __FUNCTION__, __LINE__);
-        return;
     }
+    return SYS_ERR_OK;
+}
+
+static errval_t send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
+{
+    return send_data_command(cmd, arg, 1);
 }
 
 
@@ -320,23 +375,141 @@ static void mmchs_identify_card(void)
     send_command(16, 512);
 }
 
+/**
+ * \brief Set up ADMA2 into a physically contiguous bounce buffer
+ */
+static errval_t dma_init(void)
+{
+    errval_t err;
+    struct capref frame;
+    struct frame_identity id;
+    size_t bytes = BASE_PAGE_SIZE + MMCHS_MAX_BLOCKS * MMCHS_BLOCK_SIZE;
+    void *va;
+
+    if (omap44xx_mmchs1_mmchs_hl_hwinfo_madma_en_rdf(&mmchs) == 0x0) {
+        return MMC_ERR_NO_DMA;
+    }
+
+    err = frame_alloc(&frame, bytes, &bytes);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
+    err = invoke_frame_identify(frame, &id);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_IDENTIFY);
+    }
+
+    // The controller does not snoop the caches
+    err = paging_map_frame_attr(get_current_paging_state(), &va, bytes, frame,
+                                VREGION_FLAGS_READ_WRITE_NOCACHE, NULL, NULL);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_VSPACE_MAP);
+    }
+
+    dma.desc = va;
+    dma.desc_pa = id.base;
+    dma.buf = (uint8_t *)va + BASE_PAGE_SIZE;
+    dma.buf_pa = id.base + BASE_PAGE_SIZE;
+
+    // The controller is master of the data transfers, using ADMA2
+    omap44xx_mmchs1_mmchs_con_dma_mns_wrf(&mmchs, 0x1);
+    omap44xx_mmchs1_mmchs_hctl_dmas_wrf(&mmchs, 0x2);
+
+    return SYS_ERR_OK;
+}
+
+/// Describe the first \p bytes of the bounce buffer to the ADMA engine
+static void dma_prepare(size_t bytes)
+{
+    struct adma2_desc *d = dma.desc;
+    lpaddr_t pa = dma.buf_pa;
+
+    while (bytes > 0) {
+        size_t len = bytes < ADMA2_LINE_MAX ? bytes : ADMA2_LINE_MAX;
+        bytes -= len;
+
+        d->attr = ADMA2_VALID | ADMA2_ACT_TRAN | (bytes == 0 ? ADMA2_END : 0);
+        d->len = len;
+        d->addr = pa;
+        pa += len;
+        d++;
+    }
+
+    omap44xx_mmchs1_mmchs_admasal_rawwr(&mmchs, dma.desc_pa);
+}
+
+/// Status bits that end a data transfer
+static omap44xx_mmchs1_mmchs_ise_t transfer_signals(void)
+{
+    omap44xx_mmchs1_mmchs_ise_t ise = 0x0;
+
+    ise = omap44xx_mmchs1_mmchs_ise_tc_sigen_insert(ise, 0x1);
+    ise = omap44xx_mmchs1_mmchs_ise_cto_sigen_insert(ise, 0x1);
+    ise = omap44xx_mmchs1_mmchs_ise_dto_sigen_insert(ise, 0x1);
+    ise = omap44xx_mmchs1_mmchs_ise_dcrc_sigen_insert(ise, 0x1);
+    ise = omap44xx_mmchs1_mmchs_ise_deb_sigen_insert(ise, 0x1);
+    ise = omap44xx_mmchs1_mmchs_ise_ace_sigen_insert(ise, 0x1);
+    ise = omap44xx_mmchs1_mmchs_ise_admae_sigen_insert(ise, 0x1);
+
+    return ise;
+}
+
+static void mmchs_interrupt(void *arg)
+{
+    // Quiet the line until the next transfer, the status stays for us
+    omap44xx_mmchs1_mmchs_ise_rawwr(&mmchs, 0x0);
+    xfer_done = true;
+
+    errval_t err = invoke_irqtable_ack(cap_irq, MMCHS_IRQ);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "failed to ack IRQ %d", MMCHS_IRQ);
+    }
+}
+
+/**
+ * \brief Take the MMC1 interrupt on a waitset of our own
+ *
+ * Transfers stay synchronous: waiting for one dispatches nothing but the
+ * interrupt.
+ */
+static errval_t irq_init(void)
+{
+    waitset_init(&irq_ws);
+    omap44xx_mmchs1_mmchs_ise_rawwr(&mmchs, 0x0);
+
+    return inthandler_setup_arm_ws(&irq_ws, mmchs_interrupt, NULL, MMCHS_IRQ);
+}
+
 static errval_t complete_card_transaction(void)
 {
+    // Sleep until the controller signals the end of the transfer. Without
+    // the interrupt, or if it was a stale one, we poll below.
+    while (use_irq && !xfer_done) {
+        errval_t err = event_dispatch(&irq_ws);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "event_dispatch on the MMC interrupt waitset");
+            break;
+        }
+    }
+    omap44xx_mmchs1_mmchs_ise_rawwr(&mmchs, 0x0);
+
     size_t i = 0;
     do {
         if ( omap44xx_mmchs1_mmchs_stat_tc_rdf(&mmchs) == 0x1 )  {
-            //send_command(12, 0);
-            return SYS_ERR_OK; // Fine as long as we support only finite transfers
+            // Multi-block transfers end with the auto CMD12
+            return SYS_ERR_OK;
         } else {
             bool deb = omap44xx_mmchs1_mmchs_stat_deb_rdf(&mmchs);
             bool dcrc = omap44xx_mmchs1_mmchs_stat_dcrc_rdf(&mmchs);
             bool dto = omap44xx_mmchs1_mmchs_stat_dto_rdf(&mmchs);
+            bool ace = omap44xx_mmchs1_mmchs_stat_ace_rdf(&mmchs);
+            bool admae = omap44xx_mmchs1_mmchs_stat_admae_rdf(&mmchs);
 
-            if (deb || dcrc || dto) {
-                MMCHS_DEBUG("%s:%d: Error interrupt during transfer: deb=%d dcrc=%d dto=%d.\n",
-                            __FUNCTION__, __LINE__, deb, dcrc, dto);
+            if (deb || dcrc || dto || ace || admae) {
+                MMCHS_DEBUG("%s:%d: Error interrupt during transfer: deb=%d dcrc=%d dto=%d ace=%d admae=%d.\n",
+                            __FUNCTION__, __LINE__, deb, dcrc, dto, ace, admae);
                 dat_line_reset();
-                return MMC_ERR_TRANSFER;
+                return admae ? MMC_ERR_DMA : MMC_ERR_TRANSFER;
             }
         }
 
@@ -347,38 +520,191 @@ static errval_t complete_card_transaction(void)
     return MMC_ERR_TRANSFER;
 }
 
+static errval_t wait_data_lines(errval_t busy)
+{
+    MMCHS_DEBUG("%s:%d: Wait for free data lines.\n", __FUNCTION__, __LINE__);
+    for (size_t i = 0; omap44xx_mmchs1_mmchs_pstate_dati_rdf(&mmchs) != 0x0; i++) {
+        if (i == 1000) {
+            return busy;
+        }
+        wait_msec(1);
+    }
+    return SYS_ERR_OK;
+}
+
+/// Move \p count blocks through MMCHS_DATA, without DMA
+static errval_t pio_read(uint32_t *buffer, size_t count)
+{
+    omap44xx_mmchs1_mmchs_stat_t brr = omap44xx_mmchs1_mmchs_stat_brr_insert(0x0, 0x1);
+
+    for (size_t b = 0; b < count; b++) {
+        for (size_t timeout = 0; omap44xx_mmchs1_mmchs_stat_brr_rdf(&mmchs) == 0x0; timeout++) {
+            if (omap44xx_mmchs1_mmchs_stat_erri_rdf(&mmchs)) {
+                return MMC_ERR_TRANSFER;
+            }
+            if (timeout == 1000) {
+                return MMC_ERR_READ_READY;
+            }
+            wait_msec(1);
+        }
+        omap44xx_mmchs1_mmchs_stat_rawwr(&mmchs, brr);
+
+        for (size_t i = 0; i < MMCHS_BLOCK_SIZE / 4; i++) {
+            *buffer++ = omap44xx_mmchs1_mmchs_data_rd(&mmchs);
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+static errval_t pio_write(const uint32_t *buffer, size_t count)
+{
+    omap44xx_mmchs1_mmchs_stat_t bwr = omap44xx_mmchs1_mmchs_stat_bwr_insert(0x0, 0x1);
+
+    for (size_t b = 0; b < count; b++) {
+        for (size_t timeout = 0; omap44xx_mmchs1_mmchs_stat_bwr_rdf(&mmchs) == 0x0; timeout++) {
+            if (omap44xx_mmchs1_mmchs_stat_erri_rdf(&mmchs)) {
+                return MMC_ERR_TRANSFER;
+            }
+            if (timeout == 1000) {
+                return MMC_ERR_WRITE_READY;
+            }
+            wait_msec(1);
+        }
+        omap44xx_mmchs1_mmchs_stat_rawwr(&mmchs, bwr);
+
+        for (size_t i = 0; i < MMCHS_BLOCK_SIZE / 4; i++) {
+            omap44xx_mmchs1_mmchs_data_wr(&mmchs, *buffer++);
+        }
+    }
+    return SYS_ERR_OK;
+}
+
 /**
- * \brief Reads a 512-byte block on the card.
+ * \brief One read or write command of up to MMCHS_MAX_BLOCKS blocks
  *
- * \param block_nr Index number of block to read.
- * \param buffer Non-null buffer with a size of at least 512 bytes.
+ * CMD17/CMD24 for a single block, CMD18/CMD25 with auto CMD12 otherwise.
+ */
+static errval_t transfer(bool read, size_t block_nr, size_t count, void *buffer)
+{
+    errval_t err;
+    size_t bytes = count * MMCHS_BLOCK_SIZE;
+
+    assert(count > 0 && count <= MMCHS_MAX_BLOCKS);
+
+    err = wait_data_lines(read ? MMC_ERR_READ_READY : MMC_ERR_WRITE_READY);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (use_dma) {
+        if (!read) {
+            memcpy(dma.buf, buffer, bytes);
+        }
+        dma_prepare(bytes);
+    }
+
+    xfer_done = false;
+    if (use_irq) {
+        omap44xx_mmchs1_mmchs_ise_rawwr(&mmchs, transfer_signals());
+    }
+
+    omap44xx_mmchs1_indx_status_t cmd;
+    if (read) {
+        cmd = count > 1 ? omap44xx_mmchs1_INDX_18 : omap44xx_mmchs1_INDX_17;
+    } else {
+        cmd = count > 1 ? omap44xx_mmchs1_INDX_25 : omap44xx_mmchs1_INDX_24;
+    }
+
+    err = send_data_command(cmd, block_nr, count);
+    if (err_is_ok(err) && !use_dma) {
+        err = read ? pio_read(buffer, count) : pio_write(buffer, count);
+    }
+    if (err_is_fail(err)) {
+        omap44xx_mmchs1_mmchs_ise_rawwr(&mmchs, 0x0);
+        dat_line_reset();
+        return err;
+    }
+
+    err = complete_card_transaction();
+    if (err_is_ok(err) && use_dma && read) {
+        memcpy(buffer, dma.buf, bytes);
+    }
+    return err;
+}
+
+/**
+ * \brief Reads consecutive 512-byte blocks from the card.
  *
- * \retval SYS_ERR_OK Block successfully written in buffer.
+ * \param block_nr Index number of the first block to read.
+ * \param count Number of blocks.
+ * \param buffer Non-null buffer with a size of at least count * 512 bytes.
+ *
+ * \retval SYS_ERR_OK Blocks successfully written in buffer.
  * \retval MMC_ERR_TRANSFER Error interrupt or no transfer complete interrupt.
+ * \retval MMC_ERR_DMA ADMA error.
+ * \retval MMC_ERR_COMMAND The card did not take the read command.
  * \retval MMC_ERR_READ_READY Card not ready to read.
  */
-errval_t mmchs_read_block(size_t block_nr, void *buffer)
+errval_t mmchs_read_blocks(size_t block_nr, size_t count, void *buffer)
 {
-    MMCHS_DEBUG("%s:%d: Wait for free data lines.\n", __FUNCTION__, __LINE__);
-    while (omap44xx_mmchs1_mmchs_pstate_dati_rdf(&mmchs) != 0x0);
-
-    // Send data command
-    send_command(17, block_nr);
-    // TODO(gz): Check for errors
+    uint8_t *buf = buffer;
 
-    for (size_t i = 0; i < (omap44xx_mmchs1_mmchs_blk_blen_rdf(&mmchs) + 3) / 4; i++) {
-        size_t timeout = 1000;
-        while (omap44xx_mmchs1_mmchs_stat_brr_rdf(&mmchs) == 0x0 && timeout--) {
-            wait_msec(1);
-        }
-        if (timeout == 0) {
-            return MMC_ERR_READ_READY;
+    while (count > 0) {
+        size_t n = count < MMCHS_MAX_BLOCKS ? count : MMCHS_MAX_BLOCKS;
+        errval_t err = transfer(true, block_nr, n, buf);
+        if (err_is_fail(err)) {
+            return err;
         }
+        block_nr += n;
+        count -= n;
+        buf += n * MMCHS_BLOCK_SIZE;
+    }
+    return SYS_ERR_OK;
+}
 
-        ((uint32_t *) buffer)[i] = omap44xx_mmchs1_mmchs_data_rd(&mmchs);
+/**
+ * \brief Write consecutive 512-byte blocks to the card.
+ *
+ * \param block_nr Index number of the first block to write.
+ * \param count Number of blocks.
+ * \param buffer Data to write (must be at least count * 512 bytes in size).
+ *
+ * \retval SYS_ERR_OK Blocks written to card.
+ * \retval MMC_ERR_TRANSFER Error interrupt or no transfer complete interrupt.
+ * \retval MMC_ERR_DMA ADMA error.
+ * \retval MMC_ERR_COMMAND The card did not take the write command.
+ * \retval MMC_ERR_WRITE_READY Card not ready to write.
+ */
+errval_t mmchs_write_blocks(size_t block_nr, size_t count, const void *buffer)
+{
+    const uint8_t *buf = buffer;
+
+    while (count > 0) {
+        size_t n = count < MMCHS_MAX_BLOCKS ? count : MMCHS_MAX_BLOCKS;
+        errval_t err = transfer(false, block_nr, n, (void *)buf);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        block_nr += n;
+        count -= n;
+        buf += n * MMCHS_BLOCK_SIZE;
     }
+    return SYS_ERR_OK;
+}
 
-    return complete_card_transaction();
+/**
+ * \brief Reads a 512-byte block on the card.
+ *
+ * \param block_nr Index number of block to read.
+ * \param buffer Non-null buffer with a size of at least 512 bytes.
+ *
+ * \retval SYS_ERR_OK Block successfully written in buffer.
+ * \retval MMC_ERR_TRANSFER Error interrupt or no transfer complete interrupt.
+ * \retval MMC_ERR_READ_READY Card not ready to read.
+ */
+errval_t mmchs_read_block(size_t block_nr, void *buffer)
+{
+    return mmchs_read_blocks(block_nr, 1, buffer);
 }
 
 /**
@@ -393,25 +719,7 @@ errval_t mmchs_read_block(size_t block_nr, void *buffer)
  */
 errval_t mmchs_write_block(size_t block_nr, void *buffer)
 {
-    MMCHS_DEBUG("%s:%d: Wait for free data lines.\n", __FUNCTION__, __LINE__);
-    size_t timeout = 1000;
-    while (omap44xx_mmchs1_mmchs_pstate_dati_rdf(&mmchs) != 0x0 && timeout--) {
-        wait_msec(1);
-    }
-    if (timeout == 0) {
-        return MMC_ERR_WRITE_READY;
-    }
-
-    // Send data command
-    send_command(24, block_nr);
-    // TODO(gz): Check for errors
-
-    for (size_t i = 0; i < (omap44xx_mmchs1_mmchs_blk_blen_rdf(&mmchs) + 3) / 4; i++) {
-        while (omap44xx_mmchs1_mmchs_stat_bwr_rdf(&mmchs) == 0x0);
-        omap44xx_mmchs1_mmchs_data_wr(&mmchs, ((uint32_t *) buffer)[i]);
-    }
-
-    return complete_card_transaction();
+    return mmchs_write_blocks(block_nr, 1, buffer);
 }
 
 /**
@@ -433,4 +741,16 @@ void mmchs_init(void)
     mmc_host_and_bus_configuration();
 
     mmchs_identify_card();
+
+    err = dma_init();
+    use_dma = err_is_ok(err);
+    if (!use_dma) {
+        DEBUG_ERR(err, "ADMA not available, using PIO");
+    }
+
+    err = irq_init();
+    use_irq = err_is_ok(err);
+    if (!use_irq) {
+        DEBUG_ERR(err, "MMC interrupt not available, polling");
+    }
 }
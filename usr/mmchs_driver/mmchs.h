@@ -18,8 +18,13 @@
 #include "i2c.h"
 #include "twl6030.h"
 
+#define MMCHS_BLOCK_SIZE    512
+#define MMCHS_MAX_BLOCKS    128     ///< Blocks moved by one CMD18/CMD25
+
 void mmchs_init(void);
 errval_t mmchs_read_block(size_t block_nr, void *buffer);
 errval_t mmchs_write_block(size_t block_nr, void *buffer);
+errval_t mmchs_read_blocks(size_t block_nr, size_t count, void *buffer);
+errval_t mmchs_write_blocks(size_t block_nr, size_t count, const void *buffer);
 
 #endif // MMCHS2_H
\ No newline at end of file
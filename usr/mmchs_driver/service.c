@@ -1,6 +1,10 @@
 /**
  * \file
  * \brief Implementation of ata_rw28.if interface (to enable working vfs_fat)
+ *
+ * Clients are served concurrently, each in an AWE of its own. Their
+ * requests go through the block cache, and its misses and write-backs
+ * through the elevator, whose dispatcher runs in another AWE.
  */
 /*
  * Copyright (c) 2013, ETH Zurich.
@@ -27,47 +31,102 @@
 #include "mmchs.h"
 #include "mmchs_debug.h"
 
+#include "blockcache.h"
+#include "elevator.h"
+
 #define SECTION_SIZE 512
 #define SECTION_ROUND_UP(x) ( ((x) + (SECTION_SIZE-1))  & (~(SECTION_SIZE-1)) )
 
+/// All clients go through one cache and one request queue
+static struct elevator elevator;
+static struct bcache cache;
+
+/// Per client buffer, kept across requests
+struct client {
+    uint8_t *buf;
+    size_t size;
+};
+
+static void thc_suspend(void **waiter)
+{
+    THCSuspend((awe_t **)waiter);
+}
+
+static void thc_resume(void *waiter)
+{
+    THCSchedule(waiter);
+}
+
+static const struct blk_sched thc_sched = {
+    .suspend = thc_suspend,
+    .resume = thc_resume,
+    .yield = THCYield,
+};
+
+static errval_t card_transfer(void *st, bool write, uint32_t lba,
+                              uint32_t count, void *buf)
+{
+    if (write) {
+        return mmchs_write_blocks(lba, count, buf);
+    } else {
+        return mmchs_read_blocks(lba, count, buf);
+    }
+}
+
+static uint8_t *client_buffer(struct client *cl, size_t size)
+{
+    if (cl->size < size) {
+        free(cl->buf);
+        cl->buf = malloc(size);
+        cl->size = (cl->buf != NULL) ? size : 0;
+    }
+    assert(cl->buf != NULL);
+    return cl->buf;
+}
+
 static void read_dma(struct ata_rw28_thc_service_binding_t *sv,
-                     uint32_t read_size, uint32_t start_lba)
+                     struct client *cl, uint32_t read_size,
+                     uint32_t start_lba)
 {
     size_t buffer_size = SECTION_ROUND_UP(read_size);
     MMCHS_DEBUG("%s:%d read_size=%d buffer_size=%d\n", __FUNCTION__, __LINE__, read_size, buffer_size);
-    void *buffer = malloc(buffer_size);
-    assert(buffer != NULL);
-
-    uint8_t *bufptr = (uint8_t *)buffer;
-    for (size_t i = 0; i < (buffer_size / SECTION_SIZE); i++) {
-        MMCHS_DEBUG("%s:%d: i=%d start_lba=%d\n", __FUNCTION__, __LINE__, i, start_lba);
-        errval_t err = mmchs_read_block(start_lba+i, bufptr);
-        assert(err_is_ok(err));
-        bufptr += SECTION_SIZE;
-    }
+    uint8_t *buffer = client_buffer(cl, buffer_size);
+
+    errval_t err = bcache_read(&cache, start_lba, buffer_size / SECTION_SIZE,
+                               buffer);
+    assert(err_is_ok(err));
     sv->send.read_dma(sv, buffer, buffer_size);
-    free(buffer);
 }
 
-static void read_dma_block(struct ata_rw28_thc_service_binding_t *sv, uint32_t lba)
+static void read_dma_block(struct ata_rw28_thc_service_binding_t *sv,
+                           struct client *cl, uint32_t lba)
 {
     MMCHS_DEBUG("%s:%d lba=%d\n", __FUNCTION__, __LINE__, lba);
+    uint8_t *buffer = client_buffer(cl, SECTION_SIZE);
 
-    void *buffer = malloc(SECTION_SIZE);
-    assert(buffer != NULL);
-
-    errval_t err = mmchs_read_block(lba, buffer);
+    errval_t err = bcache_read(&cache, lba, 1, buffer);
     assert(err_is_ok(err));
-
     sv->send.read_dma_block(sv, buffer, SECTION_SIZE);
-    free(buffer);
 }
 
 static void write_dma(struct ata_rw28_thc_service_binding_t *sv,
-                      uint8_t *buffer, size_t buffer_len, uint32_t lba)
+                      struct client *cl, uint8_t *buffer, size_t buffer_len,
+                      uint32_t lba)
 {
-    MMCHS_DEBUG("%s:%d\n", __FUNCTION__, __LINE__);
-    sv->send.write_dma(sv, LIB_ERR_NOT_IMPLEMENTED);
+    MMCHS_DEBUG("%s:%d lba=%d buffer_len=%zu\n", __FUNCTION__, __LINE__, lba, buffer_len);
+    size_t blocks = SECTION_ROUND_UP(buffer_len) / SECTION_SIZE;
+    errval_t err;
+
+    if (buffer_len % SECTION_SIZE == 0) {
+        err = bcache_write(&cache, lba, blocks, buffer);
+    } else {
+        // Pad the last block with zeroes
+        uint8_t *padded = client_buffer(cl, blocks * SECTION_SIZE);
+        memcpy(padded, buffer, buffer_len);
+        memset(padded + buffer_len, 0, blocks * SECTION_SIZE - buffer_len);
+        err = bcache_write(&cache, lba, blocks, padded);
+    }
+    sv->send.write_dma(sv, err);
 }
 
 static void identify_device(struct ata_rw28_thc_service_binding_t *sv)
@@ -80,11 +139,17 @@ static void identify_device(struct ata_rw28_thc_service_binding_t *sv)
 static void flush_cache(struct ata_rw28_thc_service_binding_t *sv)
 {
     MMCHS_DEBUG("%s:%d\n", __FUNCTION__, __LINE__);
-    sv->send.flush_cache(sv, SYS_ERR_OK);
+    errval_t err = bcache_flush(&cache);
+#if defined(MMCHS_SERVICE_DEBUG)
+    bcache_print_stats(&cache);
+#endif
+    sv->send.flush_cache(sv, err);
 }
 
 static void service_client(struct ata_rw28_thc_service_binding_t *sv)
 {
+    struct client cl = { .buf = NULL, .size = 0 };
+
     DO_FINISH({
         bool stop = false;
         while (!stop) {
@@ -100,15 +165,15 @@ static void service_client(struct ata_rw28_thc_service_binding_t *sv)
             switch (m.msg) {
 
             case ata_rw28_read_dma:
-                read_dma(sv, m.args.read_dma.in.read_size, m.args.read_dma.in.start_lba);
+                read_dma(sv, &cl, m.args.read_dma.in.read_size, m.args.read_dma.in.start_lba);
                 break;
 
             case ata_rw28_read_dma_block:
-                read_dma_block(sv, m.args.read_dma_block.in.lba);
+                read_dma_block(sv, &cl, m.args.read_dma_block.in.lba);
                 break;
 
             case ata_rw28_write_dma:
-                write_dma(sv, m.args.write_dma.in.buffer, m.args.write_dma.in.buffer_size, m.args.write_dma.in.lba);
+                write_dma(sv, &cl, m.args.write_dma.in.buffer, m.args.write_dma.in.buffer_size, m.args.write_dma.in.lba);
                 break;
 
             case ata_rw28_identify_device:
@@ -136,6 +201,16 @@ void init_service(void)
     struct ata_rw28_thc_export_info info;
 
     MMCHS_DEBUG("%s:%d: Starting server\n", __FUNCTION__, __LINE__);
+    err = elevator_init(&elevator, card_transfer, NULL, MMCHS_MAX_BLOCKS,
+                        &thc_sched);
+    if (err_is_ok(err)) {
+        err = bcache_init(&cache, &elevator, BCACHE_DEFAULT_BLOCKS);
+    }
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "block cache init failed");
+        abort();
+    }
+
     err = ata_rw28_thc_export(&info,
                               "mmchs",
                               get_default_waitset(),
@@ -149,6 +224,9 @@ void init_service(void)
     }
 
     DO_FINISH({
+        // issues the transfers of all clients
+        ASYNC({elevator_run(&elevator);});
+
         while (1) {
             MMCHS_DEBUG("%s:%d: Server waiting for connection\n", __FUNCTION__, __LINE__);
             err = ata_rw28_thc_accept(&info, &b);
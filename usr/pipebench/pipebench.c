@@ -0,0 +1,105 @@
+/**
+ * \file
+ * \brief Pipe throughput test
+ *
+ * Usage: pipebench gen [bytes] | pipebench sink [bytes]
+ *
+ * gen writes a generated stream to stdout, sink reads it from stdin,
+ * checks every byte and reports the throughput. With bytes, sink also
+ * checks that the stream had that length.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <barrelfish/barrelfish.h>
+#include <bench/bench.h>
+
+#define DEFAULT_BYTES   (16 * 1024 * 1024)
+#define CHUNK           4096
+
+/// Byte \p i of the stream, 251 is prime so it does not line up with the ring
+static inline uint8_t pattern(size_t i)
+{
+    return i % 251;
+}
+
+static int gen(size_t bytes)
+{
+    static uint8_t buf[CHUNK];
+
+    for (size_t pos = 0; pos < bytes; ) {
+        size_t n = MIN(CHUNK, bytes - pos);
+        for (size_t i = 0; i < n; i++) {
+            buf[i] = pattern(pos + i);
+        }
+        if (fwrite(buf, 1, n, stdout) != n) {
+            // stdout is the pipe, complain on the console
+            debug_printf("pipebench: reader went away after %zu bytes\n",
+                         pos);
+            return EXIT_FAILURE;
+        }
+        pos += n;
+    }
+
+    fflush(stdout);
+    return EXIT_SUCCESS;
+}
+
+static int sink(size_t expect)
+{
+    static uint8_t buf[CHUNK];
+    size_t pos = 0, n;
+    cycles_t start = 0;
+
+    while ((n = fread(buf, 1, CHUNK, stdin)) > 0) {
+        if (pos == 0) {
+            start = bench_tsc();
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (buf[i] != pattern(pos + i)) {
+                printf("pipebench: corrupt byte at %zu\n", pos + i);
+                return EXIT_FAILURE;
+            }
+        }
+        pos += n;
+    }
+    cycles_t t = bench_tsc() - start;
+
+    if (expect != 0 && pos != expect) {
+        printf("pipebench: got %zu of %zu bytes\n", pos, expect);
+        return EXIT_FAILURE;
+    }
+
+    printf("pipebench: %zu bytes ok, %" PRIuCYCLES " ticks, %" PRIuCYCLES
+           " ticks/KiB\n", pos, t, pos >= 1024 ? t / (pos / 1024) : t);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t bytes = 0;
+    if (argc > 2) {
+        bytes = strtoul(argv[2], NULL, 0);
+    }
+
+    bench_init();
+
+    if (argc > 1 && strcmp(argv[1], "gen") == 0) {
+        return gen(bytes != 0 ? bytes : DEFAULT_BYTES);
+    } else if (argc > 1 && strcmp(argv[1], "sink") == 0) {
+        return sink(bytes);
+    }
+
+    printf("usage: pipebench gen [bytes] | pipebench sink [bytes]\n");
+    return EXIT_FAILURE;
+}
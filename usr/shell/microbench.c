@@ -0,0 +1,198 @@
+/**
+ * \file
+ * \brief Micro-benchmarks run by the shell's bench command
+ *
+ * Every benchmark is run a number of times, each run timed with
+ * bench_tsc(). The results are printed one line per benchmark, as
+ *
+ *   bench: <name> runs=<n> avg=<c> var=<c> min=<c> max=<c>
+ *
+ * in cycles, followed by "bench: done", for tools/harness to pick up.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/aos_rpc.h>
+#include <barrelfish/paging.h>
+#include <bench/bench.h>
+
+#include "microbench.h"
+
+/// Spawned by the spawn latency benchmarks
+#define SPAWN_TARGET    "hello"
+
+struct microbench {
+    const char *name;
+    const char *desc;
+    size_t default_runs;
+    /// Before the first run, may be NULL
+    errval_t (*setup)(size_t runs);
+    /// Run \p i, timing only what is measured
+    errval_t (*run)(size_t i, cycles_t *ret);
+};
+
+static errval_t rpc_run(size_t i, cycles_t *ret)
+{
+    size_t count;
+    cycles_t start = bench_tsc();
+    errval_t err = aos_rpc_process_get_no_of_pids(&local_rpc, &count);
+    *ret = bench_tsc() - start;
+    return err;
+}
+
+static errval_t ram_run(size_t i, cycles_t *ret)
+{
+    struct capref ram;
+    size_t bits;
+    cycles_t start = bench_tsc();
+    errval_t err = aos_rpc_get_ram_cap(&local_rpc, BASE_PAGE_BITS, &ram, &bits);
+    *ret = bench_tsc() - start;
+    if (err_is_fail(err)) {
+        return err;
+    }
+    // the memory stays with us, only the slot is given back
+    return cap_destroy(ram);
+}
+
+static errval_t spawn_on(coreid_t core, cycles_t *ret)
+{
+    char name[] = SPAWN_TARGET;
+    domainid_t pid;
+    cycles_t start = bench_tsc();
+    errval_t err = aos_rpc_process_spawn(&local_rpc, name, core, &pid);
+    *ret = bench_tsc() - start;
+    return err;
+}
+
+static errval_t spawn_run(size_t i, cycles_t *ret)
+{
+    return spawn_on(disp_get_core_id(), ret);
+}
+
+/// The shell has no URPC channel of its own, a spawn on the other core is
+/// forwarded over init's
+static errval_t urpc_run(size_t i, cycles_t *ret)
+{
+    return spawn_on(disp_get_core_id() == 0 ? 1 : 0, ret);
+}
+
+static uint8_t *fault_base;
+
+static errval_t fault_setup(size_t runs)
+{
+    void *buf;
+    errval_t err = paging_alloc(get_current_paging_state(), &buf,
+                                runs * PAGING_CHUNK_SIZE);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    fault_base = buf;
+    return SYS_ERR_OK;
+}
+
+/// Each run touches a chunk the fault handler has not mapped yet. The
+/// range is not given back, it would come back mapped.
+static errval_t fault_run(size_t i, cycles_t *ret)
+{
+    volatile uint8_t *p = fault_base + i * PAGING_CHUNK_SIZE;
+    cycles_t start = bench_tsc();
+    *p = 1;
+    *ret = bench_tsc() - start;
+    return SYS_ERR_OK;
+}
+
+static struct microbench benchmarks[] = {
+    { "rpc", "round trip to spawnd", 1000, NULL, rpc_run },
+    { "ram", "RAM cap from init", 100, NULL, ram_run },
+    { "spawn", "spawn " SPAWN_TARGET " on this core", 10, NULL, spawn_run },
+    { "pagefault", "page fault on fresh memory", 32, fault_setup, fault_run },
+    { "urpc", "spawn " SPAWN_TARGET " on the other core", 10, NULL, urpc_run },
+};
+
+#define NBENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+void microbench_list(void)
+{
+    for (size_t i = 0; i < NBENCHMARKS; i++) {
+        printf("%-10s %-40s %zu runs\n", benchmarks[i].name,
+               benchmarks[i].desc, benchmarks[i].default_runs);
+    }
+}
+
+static errval_t run_one(struct microbench *b, size_t runs)
+{
+    if (runs == 0) {
+        runs = b->default_runs;
+    }
+
+    cycles_t *samples = malloc(runs * sizeof(cycles_t));
+    if (samples == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    errval_t err = SYS_ERR_OK;
+    if (b->setup != NULL) {
+        err = b->setup(runs);
+    }
+    for (size_t i = 0; err_is_ok(err) && i < runs; i++) {
+        err = b->run(i, &samples[i]);
+    }
+
+    if (err_is_fail(err)) {
+        printf("bench: %s failed: %s\n", b->name, err_getstring(err));
+        free(samples);
+        return err;
+    }
+
+    cycles_t min = samples[0], max = samples[0];
+    for (size_t i = 1; i < runs; i++) {
+        min = MIN(min, samples[i]);
+        max = MAX(max, samples[i]);
+    }
+
+    printf("bench: %s runs=%zu avg=%" PRIuCYCLES " var=%" PRIuCYCLES
+           " min=%" PRIuCYCLES " max=%" PRIuCYCLES "\n", b->name, runs,
+           bench_avg(samples, runs), bench_variance(samples, runs), min, max);
+    free(samples);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Run the benchmark \p name, or all of them, \p runs times
+ *
+ * With \p runs 0, each one runs its default number of times.
+ */
+errval_t microbench_run(const char *name, size_t runs)
+{
+    bool all = (strcmp(name, "all") == 0);
+    bool found = false;
+    errval_t err = SYS_ERR_OK;
+
+    for (size_t i = 0; i < NBENCHMARKS; i++) {
+        if (all || strcmp(name, benchmarks[i].name) == 0) {
+            found = true;
+            errval_t e = run_one(&benchmarks[i], runs);
+            if (err_is_fail(e)) {
+                err = e;
+            }
+        }
+    }
+
+    if (!found) {
+        printf("bench: no benchmark %s\n", name);
+        return LIB_ERR_INVALID_ARGS;
+    }
+    printf("bench: done\n");
+    return err;
+}
@@ -0,0 +1,23 @@
+/**
+ * \file
+ * \brief Micro-benchmarks run by the shell's bench command
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef SHELL_MICROBENCH_H
+#define SHELL_MICROBENCH_H
+
+#include <barrelfish/barrelfish.h>
+
+void microbench_list(void);
+errval_t microbench_run(const char *name, size_t runs);
+
+#endif // SHELL_MICROBENCH_H
@@ -48,34 +48,32 @@ static const char *pikachu_img = " \
 
 static void shell_input(char *buf, size_t len) 
 {
-    int count = 0;
-    int c;
-
-    printf("$ ");
-    while (count < len) {
-        c = getchar();
-        if (count > 0) {
-            if (c == DELETE) {
-                c = BACKSPACE;
-            }
-
-            if (c == BACKSPACE) {
-                count--;
-                printf("%c %c", BACKSPACE, BACKSPACE);
-            }
-        }
+    size_t n = 0;
 
-        if (c == RETURN && count > 0) {
-            printf("\r\n");
-            break;
+    // init's serial server echoes and edits the line, we get it when done
+    while (n == 0) {
+        printf("$ ");
+        fflush(stdout);
+
+        errval_t err = aos_rpc_serial_read(&local_rpc, buf, len - 1, &n);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "failed to read shell input\n");
+            n = 0;
+            continue;
         }
 
-        if (c > 31 && c < 127) {
-            putchar(c);
-            memcpy(&buf[count++], &c, 1);
+        if (n > 0 && buf[n - 1] == '\n') {
+            n--;
+        } else {
+            // skip the rest of an overlong line
+            char rest[32];
+            size_t r = 0;
+            do {
+                err = aos_rpc_serial_read(&local_rpc, rest, sizeof(rest), &r);
+            } while (err_is_ok(err) && r > 0 && rest[r - 1] != '\n');
         }
-        //debug_printf("%d", c);
     }
+    buf[n] = '\0';
 }
 
 static void get_argv(char *str, char **argv, int *args)
@@ -115,30 +113,22 @@ static void run_memtest(char *input_argv)
 
 static void ps(char *input_argv)
 {
-    domainid_t *pids;
+    struct aos_ps_entry *ps;
     size_t pid_count;
-    errval_t err = aos_rpc_process_get_all_pids(&local_rpc, &pids, &pid_count);
+    errval_t err = aos_rpc_process_get_all(&local_rpc, &ps, &pid_count);
     if(err_is_fail(err)){
-        err_print_calltrace(err);
-        abort();
+        DEBUG_ERR(err, "failed to list processes\n");
+        return;
     }
 
     const char *divide = "+--------------------------+\n";
     printf("%s| Number of processes: %*d |\n%s", divide, 3,pid_count, divide);
 
     for(uint32_t j = 0; j < pid_count; j++){
-        char *name_buf = (char *)malloc(20);
-        err = aos_rpc_process_get_name(&local_rpc, pids[j], &name_buf);
-        if (err_is_fail(err)) {
-            DEBUG_ERR(err, "failed to get process name\n");
-            err_print_calltrace(err);
-            abort();
-        }
-        assert(name_buf != NULL);
-        printf("| %*d. %-15s %*d |\n", 3, j, name_buf, 3, pids[j]);
-        memset(name_buf, '\0', 20);
+        printf("| %*d. %-15s %*d |\n", 3, j, ps[j].name, 3, ps[j].pid);
     }
     printf(divide);
+    free(ps);
 }
 
 static void clear(void)
@@ -178,30 +168,6 @@ static errval_t oncore(char *input_argv, domainid_t *new_pid)
     return spawn(argv, coreid, new_pid);
 }
 
-static void ps(void)
-{
-    domainid_t *pids;
-    size_t pid_count;
-    errval_t err = aos_rpc_process_get_all_pids(&local_rpc, &pids, &pid_count);
-    if(err_is_fail(err)) {
-        err_print_calltrace(err);
-        abort();
-    }
-    
-    const char *divide = "+--------------------------+\n";
-    printf(divide);
-    printf("| Number of processes: %d |\n", pid_count);
-    printf(divide);
-    
-    for(uint32_t j = 0; j < pid_count; j++){
-        char *name_buf = (char *)malloc(20);
-        aos_rpc_process_get_name(&local_rpc, pids[j], &name_buf);
-        printf("| %d. %-15s %d |\n", j, name_buf, pids[j]);
-    }
-    printf(divide);
-}
-
-
 static void set_shell(char *argv_str) 
 {
     char cmd[64];
@@ -227,78 +193,167 @@ static void echo(char *rbuf)
     printf("%s\n", rbuf);
 }
 
-int main(int argc, char *argv[])
+static bool run_command(char *input_buf);
+
+/*
+ * \brief runs the command line after `time' and reports how long it took
+ *
+ * Applications are timed until spawned, not until they exit.
+ */
+static void time_command(char *input_argv)
+{
+    char line[256];
+    strncpy(line, input_argv, sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+
+    // system time is only as recent as our last dispatch, cycles are exact
+    systime_t start_us = get_system_time();
+    cycles_t start = bench_tsc();
+    run_command(line);
+    cycles_t cycles = bench_tsc() - start;
+    systime_t us = get_system_time() - start_us;
+
+    printf("time: cycles=%" PRIuCYCLES " us=%" PRIu64 " cmd=%s\n", cycles,
+           (uint64_t)us, input_argv);
+}
+
+/*
+ * \brief bench [list | all | NAME] [RUNS]
+ */
+static void bench(char *input_argv)
+{
+    char *argv[OUTPUT_LEN / 2];
+    int args = 0;
+
+    if (input_argv[0] != '\0') {
+        get_argv(input_argv, argv, &args);
+    }
+    if (args < 1 || args > 2 || strcmp(argv[0], "list") == 0) {
+        printf("usage: bench [list | all | NAME] [RUNS]\n");
+        microbench_list();
+        return;
+    }
+
+    size_t runs = (args == 2) ? strtoul(argv[1], NULL, 10) : 0;
+    microbench_run(argv[0], runs);
+}
+
+/*
+ * \brief runs one command line
+ *
+ * \return false if the shell should exit
+ */
+static bool run_command(char *input_buf)
 {
-    char input_buf[256];
     char *input_argv;
     char cmd[64];
 
-    errval_t err;
+    memset(cmd, 0, 64);
+    input_argv = headstr(input_buf, cmd, ' ');
+    //printf("DEBUG CMD: %s\n", cmd);
+
+    if (strchr(input_buf, '|') != NULL) {
+        // spawnd connects the stages with pipes
+        domainid_t pid;
+        if (!is_user_pipeline(input_buf)) {
+            printf("Oops! Not every command of the pipeline is an "
+                   "application\n");
+        } else if (err_is_fail(spawn(input_buf, shell_config.coreid,
+                                     &pid))) {
+            printf("Oops! Failed to spawn pipeline\n");
+        } else {
+            printf("Spawned pipeline - pid: %d\n", pid);
+        }
+        return true;
+    }
+
+    if (is_user_app(cmd)) {
+        // execute spawn user application and provide arguments.
+        domainid_t pid;
+        errval_t err = spawn(input_buf, shell_config.coreid, &pid);
+        if (err_is_fail(err)) {
+            printf("Oops! Failed to spawn `%s` process\n", cmd);
+        } else {
+            printf("Spawned process `%s` - pid: %d\n", cmd, pid);
+        }
+        //printf("executing %s...\n", cmd);
+        return true;
+    }
+
+    if (strcmp(cmd, "echo") == 0) {
+        echo (input_argv);
+    } else if (strcmp(cmd, "exit") == 0) {
+        printf("exiting shell... goodbye\n");
+        return false;
+    } else if (strcmp(cmd, "run_memtest") == 0) {
+        // forks a thread and runs a memory test.
+        run_memtest(input_argv);
+    } else if (strcmp(cmd, "oncore") == 0) {
+        // eg. oncore 1 [USR_APP]
+        // eg. oncore 2 [USR_APP]
+        domainid_t pid;
+        oncore(input_argv, &pid);
+        //printf("execution on process: %d");
+    } else if (strcmp(cmd, "ps") == 0) {
+        ps(input_argv);
+    } else if (strncmp(cmd, "pstree", 6) == 0) {
+        aos_chan_send_string(&local_rpc.spawnd_lc, "pstree");
+    } else if (strncmp(cmd, "psstack", 7) == 0) {
+        aos_chan_send_string(&local_rpc.spawnd_lc, "psstack");
+    } else if (strcmp(cmd, "kill") == 0) {
+        printf("NYI!\n");
+    } else if (strcmp(cmd, "fg") == 0) {
+        printf("NYI!\n");
+    } else if (strcmp(cmd, "jobs") == 0) {
+        printf("NYI!\n");
+    } else if (strcmp(cmd, "list") == 0) {
+        list_app();
+    } else if (strcmp(cmd, "clear") == 0) {
+        clear();
+    } else if (strcmp(cmd, "set") == 0 ) {
+        set_shell(input_argv);
+    } else if (strcmp(cmd, "time") == 0) {
+        time_command(input_argv);
+    } else if (strcmp(cmd, "bench") == 0) {
+        bench(input_argv);
+    } else if (strcmp(cmd, "pikachu") == 0) {
+        printf(pikachu_img); // not sure why the full pikachu does not print?
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    char input_buf[256];
 
     memset(input_buf, 0, 256);
-    memset(cmd, 0, 64);
 
     shell_config.coreid = disp_get_core_id();
+    bench_init();
+
+    // with arguments, run them as one command and exit, as in
+    // "shell bench all" for the test harness
+    if (argc > 1) {
+        size_t pos = 0;
+        for (int i = 1; i < argc && pos < sizeof(input_buf) - 1; i++) {
+            pos += snprintf(&input_buf[pos], sizeof(input_buf) - pos, "%s%s",
+                            (i > 1) ? " " : "", argv[i]);
+        }
+        run_command(input_buf);
+        return 0;
+    }
 
     printf("%s\n", pikachu_img);
 
     while (true) {
         shell_input(input_buf, 256);
         //printf("DEBUG: %s\n", input_buf);
-        input_argv = headstr(input_buf, cmd, ' ');
-        //printf("DEBUG CMD: %s\n", cmd);
-
-        if (is_user_app(cmd)) {
-            // execute spawn user application and provide arguments.
-            domainid_t pid;
-            errval_t err = spawn(input_buf, shell_config.coreid, &pid);
-            if (err_is_fail(err)) {
-                printf("Oops! Failed to spawn `%s` process\n", cmd);
-            } else {
-                printf("Spawned process `%s` - pid: %d\n", cmd, pid);
-            }
-            //printf("executing %s...\n", cmd);
-            memset(input_buf, 0, 256);
-            memset(cmd, 0, 64);
-            continue;
-        } 
-
-        if (strcmp(cmd, "echo") == 0) {
-            echo (input_argv);
-        } else if (strcmp(cmd, "exit") == 0) {
-            printf("exiting shell... goodbye\n");
-            break;
-        } else if (strcmp(cmd, "run_memtest") == 0) {
-            // forks a thread and runs a memory test.
-            run_memtest(input_argv);
-        } else if (strcmp(cmd, "oncore") == 0) {
-            // eg. oncore 1 [USR_APP]
-            // eg. oncore 2 [USR_APP]
-            domainid_t pid;
-            oncore(input_argv, &pid);
-            //printf("execution on process: %d");
-        } else if (strcmp(cmd, "ps") == 0) {
-            ps();
-        } else if (strncmp(cmd, "pstree", 6) == 0) {
-            aos_chan_send_string(&local_rpc.spawnd_lc, "pstree");
-        } else if (strncmp(cmd, "psstack", 7) == 0) {
-            aos_chan_send_string(&local_rpc.spawnd_lc, "psstack");
-        } else if (strcmp(cmd, "kill") == 0) {
-            printf("NYI!\n");
-        } else if (strcmp(cmd, "fg") == 0) {
-            printf("NYI!\n");
-        } else if (strcmp(cmd, "jobs") == 0) {
-            printf("NYI!\n");
-        } else if (strcmp(cmd, "list") == 0) {
-            list_app();
-        } else if (strcmp(cmd, "clear") == 0) {
-            clear();
-        } else if (strcmp(cmd, "set") == 0 ) {
-            set_shell(input_argv);
-        } else if (strcmp(cmd, "pikachu") == 0) {
-            printf(pikachu_img); // not sure why the full pikachu does not print?
-        memset(cmd, 0, 64);
+        bool go_on = run_command(input_buf);
         memset(input_buf, 0, 256);
+        if (!go_on) {
+            break;
+        }
     }
 
     return 0;
@@ -9,6 +9,9 @@
 #include <barrelfish/aos_rpc.h>
 #include <barrelfish/paging.h>
 #include <omap44xx_map.h>
+#include <bench/bench.h>
+
+#include "microbench.h"
 
 #define SMALL_CHUMP_ARRAY_SIZE (1UL << 10)
 #define SMALL_CHUMP_SIZE (1UL << 2)
@@ -20,10 +23,10 @@
 #define BIG_CHUMP_SIZE (1UL << 25)
 
 // List of User Programs
-#define N_APP 			4
+#define N_APP 			5
 #define OUTPUT_LEN 		256
 
-const char *usr_app[] = { "shell", "memeater", "hello", "blink" };
+const char *usr_app[] = { "shell", "memeater", "hello", "blink", "pipebench" };
 
 static inline void list_app(void)
 {	
@@ -44,6 +47,27 @@ static inline bool is_user_app(const char *name)
 	return false;
 }
 
+/*
+ * \brief whether every command of the pipeline "a | b | ..." is a user app
+ */
+static inline bool is_user_pipeline(const char *line)
+{
+	char buf[OUTPUT_LEN];
+	char *save, *stage;
+
+	strncpy(buf, line, OUTPUT_LEN - 1);
+	buf[OUTPUT_LEN - 1] = '\0';
+
+	for (stage = strtok_r(buf, "|", &save); stage != NULL;
+	     stage = strtok_r(NULL, "|", &save)) {
+		char *cmd = strtok(stage, " ");
+		if (cmd == NULL || !is_user_app(cmd)) {
+			return false;
+		}
+	}
+	return true;
+}
+
 static inline void *my_malloc(size_t size)
 {
     void *buf;
@@ -0,0 +1,142 @@
+/**
+ * \file
+ * \brief Spawning from the file system, with a cache of recent images
+ *
+ * Binaries that are not boot modules are read from the file server. The
+ * headers of the last SPAWND_IMAGE_CACHE images are kept with the frames
+ * of their read-only segments, so spawning one of them again only reads
+ * its headers and writable segments. An entry is only used while the file
+ * server reports the version of the file it was read from.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <string.h>
+#include <barrelfish/aos_rpc.h>
+
+#include "image.h"
+
+struct image_entry {
+    char *path;
+    uint32_t version;       ///< of the file, from aos_rpc_open_version()
+    struct spawn_image image;
+    struct image_entry *next;
+};
+
+/// Most recently spawned first
+static struct image_entry *images;
+static size_t nimages;
+
+static errval_t file_read(void *state, size_t pos, size_t size, void *buf,
+                          size_t *ret)
+{
+    int *fd = state;
+    return aos_rpc_read_into(&local_rpc, *fd, pos, size, buf, ret);
+}
+
+/**
+ * \brief Entry for \p path at \p version, at the front of the cache
+ *
+ * An entry kept from another version of the file loses its frames, even if
+ * \p fresh has the same layout: the segments may have changed in place.
+ * Returns NULL if there is no memory for a new entry.
+ */
+static struct image_entry *image_get(const char *path, uint32_t version,
+                                     struct spawn_image *fresh)
+{
+    struct image_entry **prev = &images, *e;
+
+    for (e = images; e != NULL; prev = &e->next, e = e->next) {
+        if (strcmp(e->path, path) == 0) {
+            *prev = e->next;
+            break;
+        }
+    }
+
+    if (e == NULL) {
+        e = malloc(sizeof(*e));
+        if (e == NULL) {
+            return NULL;
+        }
+        e->path = strdup(path);
+        if (e->path == NULL) {
+            free(e);
+            return NULL;
+        }
+        e->version = version;
+        e->image = *fresh;
+        nimages++;
+    } else if (e->version != version
+               || !spawn_image_same(&e->image, fresh)) {
+        spawn_image_free(&e->image);
+        e->version = version;
+        e->image = *fresh;
+    }
+
+    e->next = images;
+    images = e;
+
+    // evict the least recently spawned
+    if (nimages > SPAWND_IMAGE_CACHE) {
+        struct image_entry **last = &images;
+        while ((*last)->next != NULL) {
+            last = &(*last)->next;
+        }
+        spawn_image_free(&(*last)->image);
+        free((*last)->path);
+        free(*last);
+        *last = NULL;
+        nimages--;
+    }
+
+    return e;
+}
+
+/**
+ * \brief Where \p name is looked up in the file system
+ */
+void image_path(const char *name, char *path, size_t len)
+{
+    if (name[0] == '/') {
+        snprintf(path, len, "%s", name);
+    } else {
+        snprintf(path, len, "%s%s", SPAWND_BIN_DIR, name);
+    }
+}
+
+/**
+ * \brief Spawn the binary open as \p fd, at \p version
+ *
+ * Only the headers are read if \p path was spawned recently and was not
+ * written since, read-only segments come from the cache.
+ */
+errval_t image_load(struct spawninfo *si, int fd, uint32_t version,
+                    const char *path, coreid_t coreid, char *const argv[],
+                    char *const envp[])
+{
+    struct spawn_image fresh;
+
+    errval_t err = spawn_read_image(file_read, &fd, &fresh);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    struct image_entry *e = image_get(path, version, &fresh);
+    if (e == NULL) {
+        // still spawn it, without keeping anything
+        err = spawn_load_with_file(si, file_read, &fd, &fresh, path, coreid,
+                                   argv, envp);
+        spawn_image_free(&fresh);
+        return err;
+    }
+
+    return spawn_load_with_file(si, file_read, &fd, &e->image, path, coreid,
+                                argv, envp);
+}
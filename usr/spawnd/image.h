@@ -0,0 +1,25 @@
+/**
+ * \file
+ * \brief Spawning from the file system, with a cache of recent images
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef SPAWND_IMAGE_H
+#define SPAWND_IMAGE_H
+
+#include "spawnd.h"
+
+void image_path(const char *name, char *path, size_t len);
+errval_t image_load(struct spawninfo *si, int fd, uint32_t version,
+                    const char *path, coreid_t coreid, char *const argv[],
+                    char *const envp[]);
+
+#endif // SPAWND_IMAGE_H
@@ -1,16 +1,23 @@
 #include "spawnd.h"
+#include "image.h"
+#include <barrelfish/pipe.h>
+#include <collections/hash_table.h>
 
 #define ARGV_MAX_LEN 20
 
 
+/// Next pid handed out, on this core or for a spawn on another one
 static domainid_t pid_counter;
-static errval_t spawn(char *name, domainid_t parent_pid,
-                      domainid_t *return_pid);
+static errval_t spawn_pipeline(char *line, domainid_t parent_pid,
+                               domainid_t *return_pid);
 struct bootinfo *bi;
 
 struct ps_stack_elm *ps_stack_top;
 struct ps_state *ps_root;
 
+/// All processes of the tree by pid
+static collections_hash_table *ps_table;
+
 struct ps_stack_elm {
     struct ps_state *state;
     struct ps_stack_elm *next;
@@ -23,6 +30,14 @@ struct ps_state {
     struct lmp_chan lc;
     char name[30];
     domainid_t pid;
+
+    // process list being sent in reply to PROCESS_GET_ALL
+    struct aos_ps_entry *list;
+    size_t list_len;
+    size_t list_pos;
+    uint16_t list_seq;      // of the request it answers
+    uint16_t list_queued;   // a later request answered once it is sent, 0 if
+                            // none; those before it were given up on
 };
 
 static void debug_print_ps_stack(char *buf)
@@ -74,91 +89,124 @@ static int debug_print_ps_tree(struct ps_state *subtree, char *buf)
 }
 
 /**
- * Count nodes in process tree depth first
- **/
-static size_t get_no_of_processes(struct ps_state *sub_root)
+ * Count processes in the tree
+ */
+static size_t get_no_of_processes(void)
 {
-    if (sub_root == NULL){
-        return 0;
-    }
-    
-    struct ps_state *child = sub_root->fst_child;
-    size_t sub_count = 1;
-    while (child != NULL) {
-        sub_count += get_no_of_processes(child);
-        child = child->next_sibling;
-    }
-    
-    return sub_count;
+    return collections_hash_size(ps_table);
 }
 
 /**
- * Search process tree for pid name depth first
+ * Look up a process of the tree by pid
  */
-static const char *get_name_by_pid(struct ps_state *subroot, domainid_t pid) 
+static struct ps_state *get_state_by_pid(domainid_t pid)
 {
-    if (subroot == NULL){
-        return NULL;
-    }
-    
-    if (pid == subroot->pid){
-        return subroot->name;
-    }
-    
-    const char *name = NULL;
-    
-    struct ps_state *child = subroot->fst_child;
-    while (child != NULL && name == NULL) {
-        name = get_name_by_pid(child, pid);
-        child = child->next_sibling;
-    }
-    
-    return name;
+    return collections_hash_find(ps_table, pid);
 }
 
+static const char *get_name_by_pid(domainid_t pid)
+{
+    struct ps_state *state = get_state_by_pid(pid);
+    return (state == NULL) ? NULL : state->name;
+}
+
+static void get_all_processes(struct ps_state *ps_state, uint16_t seq);
+
 /**
- * Search process tree for pointer by pid
+ * \brief Send the rest of the process list, resumed when the channel has room
+ *
+ * Then answers the queued PROCESS_GET_ALL, if any.
  */
-static struct ps_state *get_state_by_pid(struct ps_state *subroot,
-                                        domainid_t pid) 
+static void send_ps_list(void *ps_state_in)
 {
-    if (subroot == NULL){
-        return NULL;
+    struct ps_state *ps_state = (struct ps_state *)ps_state_in;
+    errval_t err = SYS_ERR_OK;
+
+    while (ps_state->list_pos < ps_state->list_len) {
+        struct aos_ps_entry *e = &ps_state->list[ps_state->list_pos];
+        uintptr_t name[AOS_RPC_PS_NAME_WORDS];
+        memcpy(name, e->name, sizeof(name));
+
+        err = lmp_chan_send9(&ps_state->lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+                             AOS_RPC_TAG(PROCESS_GET_ALL, ps_state->list_seq),
+                             ps_state->list_len - ps_state->list_pos - 1,
+                             e->pid, name[0], name[1], name[2], name[3],
+                             name[4], name[5]);
+        if (lmp_err_is_transient(err)) {
+            err = lmp_chan_register_send(&ps_state->lc, get_default_waitset(),
+                                         MKCLOSURE(send_ps_list, ps_state));
+            if (err_is_ok(err)) {
+                return;
+            }
+        }
+        if (err_is_fail(err)) {
+            break;
+        }
+        ps_state->list_pos++;
     }
-    if (pid == subroot->pid){
-        return subroot;
+
+    if (err_is_fail(err)) {
+        debug_printf("Could not send process list to %s: %s\n",
+            ps_state->name, err_getstring(err));
     }
-    
-    struct ps_state *ps_state = NULL;
-    struct ps_state *child = subroot->fst_child;
-    while (child != NULL && ps_state == NULL) {
-        ps_state = get_state_by_pid(child, pid);
-        child = child->next_sibling;
+    free(ps_state->list);
+    ps_state->list = NULL;
+
+    if (ps_state->list_queued != 0) {
+        uint16_t seq = ps_state->list_queued;
+        ps_state->list_queued = 0;
+        get_all_processes(ps_state, seq);
     }
-    
-    return ps_state;
 }
 
-static uint32_t get_pid_by_idx(struct ps_state *subroot, uint32_t no, 
-                              domainid_t *pid)
+/**
+ * \brief Reply to the PROCESS_GET_ALL tagged \p seq with one message per
+ *        process
+ *
+ * A request arriving while the previous list is still being sent is
+ * answered after it, with a list of its own. A failure is answered with a
+ * single message, see AOS_RPC_PS_FAILED.
+ */
+static void get_all_processes(struct ps_state *ps_state, uint16_t seq)
 {
-    if (subroot == NULL){
-        return 0;
+    // send_ps_list() may still be waiting to send the previous list
+    if (ps_state->list != NULL) {
+        ps_state->list_queued = seq;
+        return;
     }
 
-    if (no == 0) {
-        *pid = subroot->pid;
-        return 1;
+    size_t count = get_no_of_processes();
+    assert(count > 0); // init and spawnd
+    ps_state->list = malloc(count * sizeof(struct aos_ps_entry));
+    if (ps_state->list == NULL) {
+        errval_t err = lmp_chan_send3(&ps_state->lc, LMP_SEND_FLAGS_DEFAULT,
+                                      NULL_CAP,
+                                      AOS_RPC_TAG(PROCESS_GET_ALL, seq),
+                                      AOS_RPC_PS_FAILED, LIB_ERR_MALLOC_FAIL);
+        if (err_is_fail(err)) {
+            debug_printf("Could not list processes for %s: %s\n",
+                ps_state->name, err_getstring(err));
+        }
+        return;
     }
-    
-    uint32_t count = 1;
-    struct ps_state *child = subroot->fst_child;
-    while (child != NULL && (no-count) >= 0) {
-        count += get_pid_by_idx(child, no-count, pid);
-        child = child->next_sibling;
+
+    size_t i = 0;
+    uint64_t pid;
+    struct ps_state *cur;
+    collections_hash_traverse_start(ps_table);
+    while (i < count &&
+           (cur = collections_hash_traverse_next(ps_table, &pid)) != NULL) {
+        ps_state->list[i].pid = cur->pid;
+        strncpy(ps_state->list[i].name, cur->name, AOS_RPC_PS_NAME_LEN - 1);
+        ps_state->list[i].name[AOS_RPC_PS_NAME_LEN - 1] = '\0';
+        i++;
     }
-    
-    return count;
+    collections_hash_traverse_end(ps_table);
+
+    ps_state->list_len = i;
+    ps_state->list_pos = 0;
+    ps_state->list_seq = seq;
+    send_ps_list(ps_state);
 }
 
 static struct ps_state *create_new_ps_state(struct ps_state *parent,
@@ -166,11 +214,16 @@ static struct ps_state *create_new_ps_state(struct ps_state *parent,
     struct ps_state *new_state =
         (struct ps_state *)malloc(sizeof(struct ps_state));
     
-    sprintf(&new_state->name[0], name);
-    new_state->pid = get_no_of_processes(ps_root);
+    strncpy(new_state->name, name, sizeof(new_state->name) - 1);
+    new_state->name[sizeof(new_state->name) - 1] = '\0';
+    new_state->pid = pid_counter++;
     
     new_state->fst_child = NULL;
     new_state->next_sibling = NULL;
+    new_state->list = NULL;
+    new_state->list_seq = 0;
+    new_state->list_queued = 0;
+    collections_hash_insert(ps_table, new_state->pid, new_state);
 
     if (parent == NULL){
         assert(ps_root == NULL);
@@ -193,14 +246,14 @@ static void default_recv_handler(void *ps_state_in)
     struct capref remote_cap;
     struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
     uint32_t rpc_code;
-    errval_t err = aos_retrieve_msg(&ps_state->lc, &remote_cap,
-                                    &rpc_code, &msg);
+    uint16_t seq;
+    errval_t err = aos_retrieve_tagged_msg(&ps_state->lc, &remote_cap,
+                                           &rpc_code, &seq, &msg);
 
     if (err_is_fail(err)) {
         debug_printf("Could not retrieve msg from %s: %s\n",
             ps_state->name, err_getstring(err));
         err_print_calltrace(err);
-        local_rpc.return_cap = NULL_CAP;
         return;
     }
     
@@ -216,29 +269,43 @@ static void default_recv_handler(void *ps_state_in)
         
         case PROCESS_SPAWN:
         {
-            char name[30];
-            memcpy(name, &local_rpc.msg_buf[0], strlen(&local_rpc.msg_buf[0])+1);
-            domainid_t return_pid;
-            err = spawn(name, ps_state->pid, &return_pid);
-            if (err_is_fail(err)){
-                // TODO handle
-                break;
+            char name[AOS_RPC_MSGBUF_LEN];
+            strncpy(name, local_rpc.msg_buf, sizeof(name) - 1);
+            name[sizeof(name) - 1] = '\0';
+            domainid_t return_pid = 0;
+            errval_t spawn_err = spawn_pipeline(name, ps_state->pid,
+                                                &return_pid);
+
+            // the client waits for the error as much as for the pid
+            err = lmp_chan_send3(&ps_state->lc, LMP_SEND_FLAGS_DEFAULT,
+                                 NULL_CAP, AOS_RPC_TAG(PROCESS_SPAWN, seq),
+                                 spawn_err, return_pid);
+            if (err_is_fail(err)) {
+                debug_printf("Could not answer spawn of '%s' to %s: %s\n",
+                    name, ps_state->name, err_getstring(err));
             }
-            
-            lmp_chan_send2(&ps_state->lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
-                           PROCESS_SPAWN, return_pid);
             break;
         }        
         
         case PROCESS_GET_NAME:
         {
-            const char *name = get_name_by_pid(ps_root, msg.words[0]);
-            err = aos_chan_send_string(&ps_state->lc, name);
-            lmp_chan_send1(&ps_state->lc, LMP_SEND_FLAGS_DEFAULT,
-                           NULL_CAP, PROCESS_GET_NAME);
+            const char *name = get_name_by_pid(msg.words[0]);
+            errval_t name_err = SYS_ERR_OK;
+            err = SYS_ERR_OK;
+            if (name == NULL) {
+                name_err = SPAWN_ERR_DOMAIN_NOTFOUND;
+            } else {
+                err = aos_chan_send_tagged_string(&ps_state->lc, name, seq);
+            }
+            if (err_is_ok(err)) {
+                err = lmp_chan_send2(&ps_state->lc, LMP_SEND_FLAGS_DEFAULT,
+                                     NULL_CAP,
+                                     AOS_RPC_TAG(PROCESS_GET_NAME, seq),
+                                     name_err);
+            }
             if (err_is_fail(err)) {
-                debug_printf("Could not send process name '%s' to %s: %s\n",
-                    name, ps_state->name, err_getstring(err));
+                debug_printf("Could not send process name to %s: %s\n",
+                    ps_state->name, err_getstring(err));
             }
             
             break;            
@@ -246,9 +313,10 @@ static void default_recv_handler(void *ps_state_in)
         
         case PROCESS_GET_NO_OF_PIDS:
         {
-            size_t pids = get_no_of_processes(ps_root);
-            err = lmp_chan_send2(&ps_state->lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
-                                 PROCESS_GET_NO_OF_PIDS, pids);
+            size_t pids = get_no_of_processes();
+            err = lmp_chan_send3(&ps_state->lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+                                 AOS_RPC_TAG(PROCESS_GET_NO_OF_PIDS, seq),
+                                 SYS_ERR_OK, pids);
             if (err_is_fail(err)){
                 debug_printf("Could not send number of pids to %s: %s\n",
                     ps_state->name, err_getstring(err));
@@ -257,18 +325,9 @@ static void default_recv_handler(void *ps_state_in)
             break;            
         }
         
-        case PROCESS_GET_PID:
+        case PROCESS_GET_ALL:
         {
-            domainid_t pid = -1;
-            get_pid_by_idx(ps_root, msg.words[0], &pid);
-            assert(pid != -1); // idx too large
-            err = lmp_chan_send2(&ps_state->lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
-                                 PROCESS_GET_PID, pid);
-            if (err_is_fail(err)){
-                debug_printf("Could not send pid to %s: %s\n",
-                    ps_state->name, err_getstring(err));
-            }
-            
+            get_all_processes(ps_state, seq);
             break;            
         }
         
@@ -314,13 +373,13 @@ static void init_recv_handler(void *rpc_in){
     struct capref remote_cap;
     struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
     uint32_t code;
-    errval_t err = aos_retrieve_msg(&local_rpc.init_lc, &remote_cap,
-                                    &code, &msg);
+    uint16_t seq;
+    errval_t err = aos_retrieve_tagged_msg(&local_rpc.init_lc, &remote_cap,
+                                           &code, &seq, &msg);
     if (err_is_fail(err)) {
         debug_printf("Could not receive msg from init: %s\n",
             err_getstring(err));
         err_print_calltrace(err);
-        local_rpc.return_cap = NULL_CAP;
         return;
     }
     
@@ -348,29 +407,31 @@ static void init_recv_handler(void *rpc_in){
             
             break;
         }
-        case REQUEST_RAM_CAP:
-        {
-            local_rpc.return_cap = remote_cap;
-            local_rpc.ret_bits = msg.words[0];
-            break;
-        }
         case PROCESS_SPAWN:
         {
-            char name[30];
-            memcpy(name, &local_rpc.msg_buf[0], strlen(&local_rpc.msg_buf[0])+1);
-            domainid_t pid;
-            err = spawn(name, 0, &pid);
-            if (err_is_fail(err)){
-                // TODO handle
-                break;
+            char name[AOS_RPC_MSGBUF_LEN];
+            strncpy(name, local_rpc.msg_buf, sizeof(name) - 1);
+            name[sizeof(name) - 1] = '\0';
+            domainid_t pid = 0;
+            errval_t spawn_err = spawn_pipeline(name, 0, &pid);
+
+            err = lmp_chan_send3(&local_rpc.init_lc, LMP_SEND_FLAGS_DEFAULT,
+                                 NULL_CAP, PROCESS_SPAWN, spawn_err, pid);
+            if (err_is_fail(err)) {
+                debug_printf("Could not answer spawn of '%s' to init: %s\n",
+                    name, err_getstring(err));
             }
-            
             break;
         }        
 
         default:
         {
-            debug_printf("Cannot handle msg code: %d\n", code);
+            // replies to the calls we make ourselves, for memory and to
+            // spawn binaries from the file system
+            if (!aos_rpc_init_reply(&local_rpc, code, seq, &msg,
+                                    remote_cap)) {
+                debug_printf("Cannot handle msg code: %d\n", code);
+            }
         }
     }
         
@@ -378,7 +439,12 @@ static void init_recv_handler(void *rpc_in){
 }
 
 
+/**
+ * \brief Spawn \p name, reading from \p stdin_frame and writing to
+ *        \p stdout_frame if they are pipes
+ */
 static errval_t spawn(char *name, domainid_t parent_pid,
+                      struct capref stdin_frame, struct capref stdout_frame,
                       domainid_t *return_pid)
 {
     errval_t err;
@@ -394,22 +460,37 @@ static errval_t spawn(char *name, domainid_t parent_pid,
     memcpy(concat_name, path, strlen(path));
     memcpy(&concat_name[strlen(path)], name, strlen(name)+1);
     
-    struct mem_region *mr = multiboot_find_module(bi, concat_name);
-    
-    if (mr == NULL){
-        // FIXME convert this to user space printing
-        debug_printf("Could not spawn '%s': Program does not exist.\n",
-            concat_name);
-        return SPAWN_ERR_LOAD;
+    struct mem_region *mr = NULL;
+    if (name[0] != '/') {
+        mr = multiboot_find_module(bi, concat_name);
+    }
+
+    // not a boot module, try the file system
+    char fs_path[AOS_RPC_FS_PATH_MAX];
+    int fd = -1;
+    uint32_t version = 0;
+    if (mr == NULL) {
+        image_path(name, fs_path, sizeof(fs_path));
+        err = aos_rpc_open_version(&local_rpc, fs_path, &fd, &version);
+        if (err_is_fail(err)) {
+            // FIXME convert this to user space printing
+            debug_printf("Could not spawn '%s': Program does not exist.\n",
+                name);
+            return err_push(err, SPAWN_ERR_FIND_MODULE);
+        }
     }
     
-    struct ps_state *parent = get_state_by_pid(ps_root, parent_pid);
+    struct ps_state *parent = get_state_by_pid(parent_pid);
     struct ps_state *new_state = create_new_ps_state(parent, name);
     
     /* URPC REMOTE SPAWN */
     debug_printf("PROCESS SPAWN CORE ID: %d\n", coreid);
     if (coreid != my_core_id) {
-        err = urpc_remote_spawn(coreid, name, pid_counter + 1, 
+        if (fd >= 0) {
+            aos_rpc_close(&local_rpc, fd);
+        }
+        *return_pid = new_state->pid;
+        err = urpc_remote_spawn(coreid, name, new_state->pid,
                                 new_elm->background, SPAWN);
         if (err_is_fail(err)) {
             err_print_calltrace(err);
@@ -436,8 +517,14 @@ static errval_t spawn(char *name, domainid_t parent_pid,
     char *envp[1];
     envp[0] = NULL; // FIXME pass parent environment
     
-    err = spawn_load_with_args(&si, mr, concat_name, disp_get_core_id(),
-            argv, envp);
+    if (mr != NULL) {
+        err = spawn_load_with_args(&si, mr, concat_name, disp_get_core_id(),
+                argv, envp);
+    } else {
+        err = image_load(&si, fd, version, fs_path, disp_get_core_id(), argv,
+                         envp);
+        aos_rpc_close(&local_rpc, fd);
+    }
 
     if (err_is_fail(err)) {
         debug_printf("Failed spawn image: %s\n", err_getstring(err));
@@ -462,6 +549,47 @@ static errval_t spawn(char *name, domainid_t parent_pid,
         return err;
     }
 
+    // The SD card driver takes its interrupt itself. Anything else, and
+    // binaries from the card in particular, could route any interrupt to
+    // itself with the cap, so their slot stays empty.
+    if (mr != NULL && strcmp(argv[0], SPAWND_IRQ_DRIVER) == 0) {
+        struct capref dest_irq = {
+            .cnode = si.taskcn,
+            .slot = TASKCN_SLOT_IRQ,
+        };
+
+        err = cap_copy(dest_irq, cap_irq);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "failed to copy IRQ cap to new process' cspace\n");
+            return err;
+        }
+    }
+
+    // Pipes to the neighbours in a pipeline
+    if (!capref_is_null(stdin_frame)) {
+        struct capref dest_stdin = {
+            .cnode = si.taskcn,
+            .slot = TASKCN_SLOT_STDIN,
+        };
+        err = cap_copy(dest_stdin, stdin_frame);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "failed to copy stdin pipe to new process' cspace\n");
+            return err;
+        }
+    }
+
+    if (!capref_is_null(stdout_frame)) {
+        struct capref dest_stdout = {
+            .cnode = si.taskcn,
+            .slot = TASKCN_SLOT_STDOUT,
+        };
+        err = cap_copy(dest_stdout, stdout_frame);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "failed to copy stdout pipe to new process' cspace\n");
+            return err;
+        }
+    }
+
     struct capref dest_selfep = {
         .cnode = si.taskcn,
         .slot = TASKCN_SLOT_SELFEP,
@@ -509,6 +637,94 @@ static errval_t spawn(char *name, domainid_t parent_pid,
     return SYS_ERR_OK;
 }
 
+/// Cut the blanks around \p s
+static char *trim(char *s)
+{
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t')) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+/**
+ * \brief Spawn the stages of "a | b | ..." with pipes between them
+ *
+ * Each stage writes into a frame the next one reads from. The stages are
+ * spawned from the last one on, so that a stage that fails to spawn only
+ * leaves readers behind, which see the end of their input. The pid of the
+ * last stage is returned.
+ */
+static errval_t spawn_pipeline(char *line, domainid_t parent_pid,
+                               domainid_t *return_pid)
+{
+    char *stages[SPAWND_PIPELINE_MAX];
+    size_t nstages = 0;
+    char *save;
+    errval_t err = SYS_ERR_OK;
+
+    for (char *tok = strtok_r(line, "|", &save); tok != NULL;
+         tok = strtok_r(NULL, "|", &save)) {
+        if (nstages == SPAWND_PIPELINE_MAX) {
+            debug_printf("Could not spawn pipeline: more than %d stages\n",
+                SPAWND_PIPELINE_MAX);
+            return SPAWN_ERR_LOAD;
+        }
+        stages[nstages] = trim(tok);
+        if (stages[nstages][0] == '\0') {
+            debug_printf("Could not spawn pipeline: empty stage\n");
+            return SPAWN_ERR_LOAD;
+        }
+        nstages++;
+    }
+    if (nstages == 0) {
+        return SPAWN_ERR_LOAD;
+    }
+
+    struct capref out = NULL_CAP;
+    for (size_t i = nstages; i-- > 0; ) {
+        struct capref in = NULL_CAP;
+        if (i > 0) {
+            err = frame_alloc(&in, PIPE_FRAME_SIZE, NULL);
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "failed to allocate pipe\n");
+                break;
+            }
+        }
+
+        domainid_t pid;
+        err = spawn(stages[i], parent_pid, in, out, &pid);
+        if (err_is_fail(err)) {
+            if (!capref_is_null(in)) {
+                cap_destroy(in);
+            }
+            break;
+        }
+        if (i == nstages - 1) {
+            *return_pid = pid;
+        }
+
+        // the stages have their own copies
+        if (!capref_is_null(out)) {
+            cap_destroy(out);
+        }
+        out = in;
+    }
+
+    if (err_is_fail(err) && !capref_is_null(out)) {
+        // nobody is going to write into the pipe of the stage after
+        struct pipe p;
+        if (err_is_ok(pipe_init(&p, out, true))) {
+            pipe_close(&p);
+        }
+        cap_destroy(out);
+    }
+    return err;
+}
+
 // static errval_t cleanup_cap(struct capref cap)
 // {
 //     errval_t err;
@@ -584,6 +800,9 @@ static errval_t frame_alloc_wrapper(struct capref *ret, uint8_t bits,
 {
     size_t ret_bits;
     errval_t err = aos_rpc_get_ram_cap(&local_rpc, bits, ret, &ret_bits);
+    if (err_is_fail(err)) {
+        return err;
+    }
     if (ret_bits != bits){
         debug_printf("ret_bits != bits\n");
         err_print_calltrace(err);
@@ -600,6 +819,7 @@ int main(int args, char **argv)
  
     ps_root = NULL;
     ps_stack_top = NULL;
+    collections_hash_create_with_buckets(&ps_table, AOS_RPC_MAX_DOMAINS, NULL);
     
     struct ps_state *init_state = create_new_ps_state(NULL, "init");
      
@@ -620,8 +840,6 @@ int main(int args, char **argv)
         abort();
     }
     
-    pid_counter = 2;
-    
     err = lmp_chan_send1(&local_rpc.init_lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
                          SPAWND_READY);
     if (err_is_fail(err)){
@@ -637,7 +855,7 @@ int main(int args, char **argv)
     
     while(true) {
         // garbage_collect();
-        event_dispatch(get_default_waitset());
+        event_dispatch_many(get_default_waitset(), SPAWND_EVENT_BATCH);
 	}
 
 	return 0;
@@ -9,6 +9,21 @@
 #include <barrelfish/capabilities.h>
 #include <mm/mm.h>
 
+/// Maximum number of events handled per pass of the dispatch loop
+#define SPAWND_EVENT_BATCH 16
+
+/// Where binaries that are not boot modules are looked up
+#define SPAWND_BIN_DIR "/sbin/"
+
+/// Images whose read-only segments are kept for the next spawn
+#define SPAWND_IMAGE_CACHE 8
+
+/// Commands in one pipeline
+#define SPAWND_PIPELINE_MAX 8
+
+/// The only boot module that gets the IRQ cap, the others go without
+#define SPAWND_IRQ_DRIVER "mmchs"
+
 // extern struct bootinfo *bi;
 
 // #include "ps.h"
@@ -0,0 +1,108 @@
+/**
+ * \file
+ * \brief User-level thread scheduler benchmark
+ *
+ * Measures thread create/join and yield ping-pong cost for increasing
+ * numbers of threads.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/threads.h>
+#include <bench/bench.h>
+
+/// Stack size for benchmark threads; small so 10000 of them fit in the heap
+#define BENCH_STACK_BYTES   (4 * 1024)
+
+/// Number of yields done by each thread in the ping-pong benchmark
+#define YIELD_ROUNDS        100
+
+/// Number of create/join rounds used to measure the recycled-thread path
+#define RECYCLE_ROUNDS      1000
+
+static const size_t thread_counts[] = { 10, 100, 1000, 10000 };
+
+static struct thread **threads;
+
+static int empty_thread(void *arg)
+{
+    return 0;
+}
+
+static int yield_thread(void *arg)
+{
+    for (int i = 0; i < YIELD_ROUNDS; i++) {
+        thread_yield();
+    }
+    return 0;
+}
+
+/// Create \p n threads running \p func, then join them all
+static cycles_t create_join(size_t n, thread_func_t func, size_t stacksize)
+{
+    cycles_t start = bench_tsc();
+
+    for (size_t i = 0; i < n; i++) {
+        threads[i] = thread_create_varstack(func, NULL, stacksize);
+        if (threads[i] == NULL) {
+            USER_PANIC("thread_create failed at thread %zu\n", i);
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        errval_t err = thread_join(threads[i], NULL);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "thread_join");
+        }
+    }
+
+    return bench_tsc() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init();
+
+    size_t max = thread_counts[sizeof(thread_counts) / sizeof(thread_counts[0]) - 1];
+    threads = malloc(max * sizeof(struct thread *));
+    assert(threads != NULL);
+
+    printf("threadbench: tsc overhead %" PRIuCYCLES " ticks\n",
+           bench_tscoverhead());
+
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        size_t n = thread_counts[i];
+
+        cycles_t create = create_join(n, empty_thread, BENCH_STACK_BYTES);
+        cycles_t yield = create_join(n, yield_thread, BENCH_STACK_BYTES);
+
+        printf("threadbench: threads %zu create+join %" PRIuCYCLES
+               " ticks/thread yield %" PRIuCYCLES " ticks/switch\n", n,
+               create / n, yield / (n * YIELD_ROUNDS));
+    }
+
+    // default-sized threads come from the per-dispatcher free list
+    cycles_t *samples = malloc(RECYCLE_ROUNDS * sizeof(cycles_t));
+    assert(samples != NULL);
+    for (int i = 0; i < RECYCLE_ROUNDS; i++) {
+        samples[i] = create_join(1, empty_thread, THREADS_DEFAULT_STACK_BYTES);
+    }
+    printf("threadbench: recycled create+join avg %" PRIuCYCLES
+           " var %" PRIuCYCLES " ticks\n",
+           bench_avg(samples, RECYCLE_ROUNDS),
+           bench_variance(samples, RECYCLE_ROUNDS));
+
+    free(samples);
+    free(threads);
+    return EXIT_SUCCESS;
+}